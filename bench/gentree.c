@@ -0,0 +1,377 @@
+//
+// gentree.c
+// snapper
+//
+// Makes a synthetic tree to benchmark snapper on.  The same options (and
+// seed) always make the same tree, so numbers from different commits can be
+// compared.
+//
+// Directories are made first, fanout to a directory, depth levels deep.
+// Files are then dealt out among them at random.  A file is a symlink or a
+// hardlink to an earlier file some percentage of the time, and otherwise
+// a regular file with a random size.  Files are sparse (truncated out to
+// their size), so a big tree doesn't take up the disk it says it does.
+//
+// Usage:
+//		gentree [options] <directory>
+//		--seed			Seed for the generator (1)
+//		--fanout		Subdirectories per directory (10)
+//		--depth			Levels of subdirectories (3)
+//		--files			Files in all (10000)
+//		--name-min		Shortest name (4)
+//		--name-max		Longest name (16)
+//		--max-size		Largest file, with a K, M or G suffix (1M)
+//		--sizes			How sizes are spread up to it: log (the default;
+//						mostly small files, as real trees have), uniform, or
+//						zero
+//		--hardlinks		Percentage of files that are hardlinks (0)
+//		--symlinks		Percentage that are symlinks (0)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#pragma mark Defines
+// Most directories a tree can have.
+#define MAX_DIRS			(1 << 20)
+
+#define SIZES_LOG			0
+#define SIZES_UNIFORM		1
+#define SIZES_ZERO			2
+
+#pragma mark Globals
+static struct {
+	uint64_t	seed;
+	int			fanout;
+	int			depth;
+	long		files;
+	int			name_min;
+	int			name_max;
+	long long	max_size;
+	int			sizes;
+	int			hardlinks;
+	int			symlinks;
+} options = {1, 10, 3, 10000, 4, 16, 1024 * 1024, SIZES_LOG, 0, 0};
+
+static uint64_t rng_state;
+
+#pragma mark Local Prototypes
+static void seed_random(uint64_t seed);
+static uint64_t next_random(void);
+static long random_below(long n);
+static char *make_name(char *buffer, long index);
+static long long random_size(void);
+static long long parse_size(const char *str);
+static void usage(void);
+
+#pragma mark Function Implementations
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"seed",		required_argument,	NULL,	's'},
+		{"fanout",		required_argument,	NULL,	'f'},
+		{"depth",		required_argument,	NULL,	'd'},
+		{"files",		required_argument,	NULL,	'n'},
+		{"name-min",	required_argument,	NULL,	'm'},
+		{"name-max",	required_argument,	NULL,	'M'},
+		{"max-size",	required_argument,	NULL,	'z'},
+		{"sizes",		required_argument,	NULL,	'S'},
+		{"hardlinks",	required_argument,	NULL,	'H'},
+		{"symlinks",	required_argument,	NULL,	'L'},
+		{NULL,			0,					NULL,	0}
+	};
+	char **dirs, **regular, name[NAME_MAX + 1], path[PATH_MAX];
+	long dir_count, level_start, level_end, regular_count = 0, i, d;
+	long hardlinks = 0, symlinks = 0;
+	long long bytes = 0, size;
+	int c, f, kind, fd;
+
+	while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+	{
+		switch (c) {
+			case 's':
+				options.seed = strtoull(optarg, NULL, 10);
+				break;
+			case 'f':
+				options.fanout = atoi(optarg);
+				break;
+			case 'd':
+				options.depth = atoi(optarg);
+				break;
+			case 'n':
+				options.files = atol(optarg);
+				break;
+			case 'm':
+				options.name_min = atoi(optarg);
+				break;
+			case 'M':
+				options.name_max = atoi(optarg);
+				break;
+			case 'z':
+				if ((options.max_size = parse_size(optarg)) == -1)
+				{
+					fprintf(stderr, "Bad size: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'S':
+				if (strcmp(optarg, "log") == 0)
+					options.sizes = SIZES_LOG;
+				else if (strcmp(optarg, "uniform") == 0)
+					options.sizes = SIZES_UNIFORM;
+				else if (strcmp(optarg, "zero") == 0)
+					options.sizes = SIZES_ZERO;
+				else
+				{
+					fprintf(stderr, "Unknown size spread: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'H':
+				options.hardlinks = atoi(optarg);
+				break;
+			case 'L':
+				options.symlinks = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+
+	if (optind != argc - 1 || options.fanout < 1 || options.depth < 0 ||
+		options.files < 0 || options.name_min < 1 ||
+		options.name_max < options.name_min || options.name_max > 200 ||
+		options.hardlinks < 0 || options.symlinks < 0 ||
+		options.hardlinks + options.symlinks > 100)
+	{
+		usage();
+		exit(1);
+	}
+
+	seed_random(options.seed);
+
+	// The directories, a level at a time.
+	dirs = malloc(MAX_DIRS * sizeof(char *));
+	regular = malloc((options.files + 1) * sizeof(char *));
+	if (dirs == NULL || regular == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	if (mkdir(argv[optind], 0755) == -1 && errno != EEXIST)
+	{
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		exit(1);
+	}
+	// Absolute, so the symlinks point at their files from anywhere.
+	if ((dirs[0] = realpath(argv[optind], NULL)) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		exit(1);
+	}
+	dir_count = 1;
+	level_start = 0;
+
+	for (i = 0; i < options.depth; i++)
+	{
+		level_end = dir_count;
+		for (d = level_start; d < level_end; d++)
+		{
+			for (f = 0; f < options.fanout; f++)
+			{
+				if (dir_count == MAX_DIRS)
+				{
+					fprintf(stderr, "More than %d directories\n", MAX_DIRS);
+					exit(1);
+				}
+				snprintf(path, sizeof(path), "%s/%s", dirs[d],
+						 make_name(name, f));
+				if (mkdir(path, 0755) == -1)
+				{
+					fprintf(stderr, "%s: %s\n", path, strerror(errno));
+					exit(1);
+				}
+				dirs[dir_count++] = strdup(path);
+			}
+		}
+		level_start = level_end;
+	}
+
+	// Then the files, anywhere.
+	for (i = 0; i < options.files; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", dirs[random_below(dir_count)],
+				 make_name(name, options.fanout + i));
+
+		kind = (int) random_below(100);
+		if (regular_count && kind < options.symlinks)
+		{
+			if (symlink(regular[random_below(regular_count)], path) == -1)
+			{
+				fprintf(stderr, "%s: %s\n", path, strerror(errno));
+				exit(1);
+			}
+			symlinks++;
+		}
+		else if (regular_count &&
+				 kind < options.symlinks + options.hardlinks)
+		{
+			if (link(regular[random_below(regular_count)], path) == -1)
+			{
+				fprintf(stderr, "%s: %s\n", path, strerror(errno));
+				exit(1);
+			}
+			hardlinks++;
+		}
+		else
+		{
+			size = random_size();
+			if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 ||
+				ftruncate(fd, size) == -1)
+			{
+				fprintf(stderr, "%s: %s\n", path, strerror(errno));
+				exit(1);
+			}
+			close(fd);
+			regular[regular_count++] = strdup(path);
+			bytes += size;
+		}
+	}
+
+	printf("%ld directories, %ld files (%ld regular, %ld hardlinks, "
+		   "%ld symlinks), %lld bytes\n", dir_count, options.files,
+		   regular_count, hardlinks, symlinks, bytes);
+
+	for (i = 0; i < dir_count; i++)
+	{
+		free(dirs[i]);
+	}
+	for (i = 0; i < regular_count; i++)
+	{
+		free(regular[i]);
+	}
+	free(dirs);
+	free(regular);
+
+	return 0;
+}
+
+#pragma mark Local Functions
+// Seeds through splitmix64, so that small seeds are fine (and none is 0).
+static void seed_random(uint64_t seed)
+{
+	uint64_t x = seed + 0x9e3779b97f4a7c15ULL;
+
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	rng_state = (x ^ (x >> 31)) | 1;
+}
+
+// xorshift64*.
+static uint64_t next_random(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+// In [0, n).
+static long random_below(long n)
+{
+	return (long) (next_random() % (uint64_t) n);
+}
+
+// A random name of a random length, made unique by ending in index.
+static char *make_name(char *buffer, long index)
+{
+	static const char chars[] =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.";
+	char suffix[24];
+	int len, suffix_len, i;
+
+	suffix_len = snprintf(suffix, sizeof(suffix), "-%lx", index);
+	len = options.name_min +
+		(int) random_below(options.name_max - options.name_min + 1);
+	len = (len > suffix_len) ? len - suffix_len : 1;
+
+	for (i = 0; i < len; i++)
+	{
+		// Not starting with a '.', so nothing's hidden.
+		buffer[i] = chars[random_below(sizeof(chars) - (i == 0 ? 2 : 1))];
+	}
+	memcpy(buffer + len, suffix, suffix_len + 1);
+
+	return buffer;
+}
+
+static long long random_size(void)
+{
+	double fraction = (next_random() >> 11) * (1.0 / 9007199254740992.0);
+
+	switch (options.sizes) {
+		case SIZES_UNIFORM:
+			return (long long) (fraction * options.max_size);
+		case SIZES_ZERO:
+			return 0;
+		default:
+			// Spread evenly over the orders of magnitude.
+			return (long long) pow((double) options.max_size + 1, fraction) -
+				1;
+	}
+}
+
+static long long parse_size(const char *str)
+{
+	char *end;
+	long long size = strtoll(str, &end, 10);
+
+	if (end == str || size < 0)
+	{
+		return -1;
+	}
+
+	switch (*end) {
+		case 'G': case 'g':
+			size *= 1024;
+			/* FALLTHROUGH */
+		case 'M': case 'm':
+			size *= 1024;
+			/* FALLTHROUGH */
+		case 'K': case 'k':
+			size *= 1024;
+			end++;
+			break;
+	}
+
+	return (*end == '\0') ? size : -1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: gentree [options] <directory>\n"
+"	--seed		Seed for the generator (1)\n"
+"	--fanout	Subdirectories per directory (10)\n"
+"	--depth		Levels of subdirectories (3)\n"
+"	--files		Files in all (10000)\n"
+"	--name-min	Shortest name (4)\n"
+"	--name-max	Longest name (16)\n"
+"	--max-size	Largest file, with a K, M or G suffix (1M)\n"
+"	--sizes		log (the default), uniform or zero\n"
+"	--hardlinks	Percentage of files that are hardlinks (0)\n"
+"	--symlinks	Percentage that are symlinks (0)\n");
+}
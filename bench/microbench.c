@@ -0,0 +1,409 @@
+//
+// microbench.c
+// snapper
+//
+// Times the per-record routines of the write and read paths on their own,
+// in memory, so it's their CPU cost alone:
+//
+//		o rprintbuf(), formatting records into a chunk the way
+//		  write_snap_record_to_file() does, for a few column strings;
+//		o hprintbuf(), the header line for each;
+//		o _getline() and parse_snapper_file_line(), over snapshot text
+//		  made from the same records with each column string.
+//
+// The records are made up, with paths shaped like real ones (a few common
+// top directories, then random components, each a few to a dozen or so
+// characters, a handful of levels deep).  Each case is run a few times, and
+// the fastest run counts.
+//
+// Usage:
+//		microbench [-n records] [-r repeats] [-s seed]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../snap_record.h"
+#include "../stats.h"
+#include "../util_macros.h"
+
+#pragma mark Defines
+// Calls of hprintbuf() per run.
+#define HEADER_CALLS		100000
+
+#pragma mark Globals
+// What's timed: paths alone, the default columns, raw and human readable
+// stat columns, and every column but the hashes.
+static const char *column_strings[] = {
+	"%p",
+	"%p %m %c",
+	"%p %S %M %C %o %g %P %T",
+	"%p %s %a %m %c %o %g %P %t",
+	"%p %S %s %A %a %M %m %C %c %i %d %o %g %P %T",
+	NULL
+};
+
+static uint64_t rng_state;
+
+#pragma mark Local Prototypes
+static file_record **make_records(int count, double *path_len);
+static char *make_path(char *buffer);
+static void time_format(file_record **records, int count, int repeats,
+						const char *columns);
+static void time_header(int repeats, const char *columns);
+static void time_parse(file_record **records, int count, int repeats,
+					   const char *columns);
+static uint64_t next_random(void);
+static long random_below(long n);
+static void usage(void);
+
+#pragma mark Function Implementations
+int main(int argc, char *argv[])
+{
+	file_record **records;
+	int count = 100000, repeats = 5, c, i;
+	uint64_t seed = 1;
+	double path_len;
+
+	while ((c = getopt(argc, argv, "n:r:s:h")) != -1)
+	{
+		switch (c) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 'r':
+				repeats = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 10);
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+	if (count < 1 || repeats < 1)
+	{
+		usage();
+		exit(1);
+	}
+
+	// xorshift64* can't start at 0.
+	rng_state = seed * 0x9e3779b97f4a7c15ULL | 1;
+
+	records = make_records(count, &path_len);
+	printf("%d records, paths %.1f bytes on average, best of %d runs\n\n",
+		   count, path_len, repeats);
+
+	printf("%-48s %10s %10s\n", "rprintbuf", "ns/record", "MB/s");
+	for (i = 0; column_strings[i]; i++)
+	{
+		time_format(records, count, repeats, column_strings[i]);
+	}
+
+	printf("\n%-48s %10s\n", "hprintbuf", "ns/call");
+	for (i = 0; column_strings[i]; i++)
+	{
+		time_header(repeats, column_strings[i]);
+	}
+
+	printf("\n%-48s %10s %10s\n", "_getline + parse_snapper_file_line",
+		   "ns/record", "MB/s");
+	for (i = 0; column_strings[i]; i++)
+	{
+		time_parse(records, count, repeats, column_strings[i]);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		free_file_record(records[i]);
+	}
+	free(records);
+
+	return 0;
+}
+
+#pragma mark Local Functions
+static file_record **make_records(int count, double *path_len)
+{
+	char path[PATH_MAX];
+	file_record **records, *record;
+	long long total_len = 0;
+	time_t now = time(NULL);
+	int i, kind;
+
+	records = calloc(count, sizeof(file_record *));
+	for (i = 0; i < count; i++)
+	{
+		record = calloc(1, sizeof(file_record));
+		record->re_path = strdup(make_path(path));
+		total_len += strlen(record->re_path);
+
+		// Mostly files, some directories, a few links.
+		kind = (int) random_below(100);
+		if (kind < 80)
+		{
+			record->re_type = 'F';
+			record->re_mode = S_IFREG | 0644;
+			// Spread over the orders of magnitude, up to a gigabyte.
+			record->re_size = (off_t) pow(1e9, random_below(1000) / 1000.0);
+		}
+		else if (kind < 95)
+		{
+			record->re_type = 'D';
+			record->re_mode = S_IFDIR | 0755;
+			record->re_size = 64 * (1 + random_below(64));
+		}
+		else
+		{
+			record->re_type = 'L';
+			record->re_mode = S_IFLNK | 0777;
+			record->re_size = 10 + random_below(60);
+		}
+
+		// Anywhere in the last five years.
+		record->re_mtime = now - random_below(5 * 365 * 86400);
+		record->re_ctime = record->re_mtime + random_below(86400);
+		record->re_atime = record->re_ctime + random_below(86400);
+		record->re_ino = 1000 + random_below(100000000);
+		record->re_dev = 16777220;
+		record->re_uid = 500 + random_below(4);
+		record->re_gid = 20;
+		record->re_selected = 'u';
+
+		records[i] = record;
+	}
+
+	*path_len = (double) total_len / count;
+
+	return records;
+}
+
+static char *make_path(char *buffer)
+{
+	static const char *tops[] = {"/Users", "/usr", "/var", "/Library",
+		"/Applications", "/opt", "/home", "/System/Library"};
+	static const char chars[] =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-. ";
+	int depth, len, i, j;
+	char *end;
+
+	end = buffer + sprintf(buffer, "%s", tops[random_below(8)]);
+	depth = 2 + (int) random_below(8);
+
+	for (i = 0; i < depth; i++)
+	{
+		*end++ = '/';
+		len = 3 + (int) random_below(14);
+		for (j = 0; j < len; j++)
+		{
+			*end++ = chars[random_below(sizeof(chars) - 1)];
+		}
+	}
+	*end = '\0';
+
+	return buffer;
+}
+
+static void time_format(file_record **records, int count, int repeats,
+						const char *columns)
+{
+	char *chunk, *insert;
+	uint64_t start, elapsed, best = UINT64_MAX;
+	long long bytes = 0;
+	size_t used;
+	snap_t snap;
+	int r, i;
+
+	init_snap_record(&snap);
+	free(snap.column_string);
+	set_snap_column_string(&snap, (char *) columns);
+	chunk = malloc(WRITE_CHUNK_SIZE + MAX_RECORD_LENGTH + 1);
+
+	for (r = 0; r < repeats; r++)
+	{
+		bytes = 0;
+		used = 0;
+		start = monotonic_ns();
+		for (i = 0; i < count; i++)
+		{
+			// As the writer does: a record at the end of the chunk, and a
+			// fresh chunk once it's full.
+			if (used >= WRITE_CHUNK_SIZE)
+			{
+				bytes += used;
+				used = 0;
+			}
+			insert = chunk + used;
+			used += rprintbuf(&snap, records[i], &insert, MAX_RECORD_LENGTH);
+		}
+		bytes += used;
+		elapsed = monotonic_ns() - start;
+		best = MIN(best, elapsed);
+	}
+
+	printf("  %-46s %10.1f %10.1f\n", columns, (double) best / count,
+		   bytes / (best / 1e9) / 1e6);
+
+	free(chunk);
+	free_snap(&snap);
+}
+
+static void time_header(int repeats, const char *columns)
+{
+	char *buffer, *insert;
+	uint64_t start, elapsed, best = UINT64_MAX;
+	snap_t snap;
+	int r, i;
+
+	init_snap_record(&snap);
+	free(snap.column_string);
+	set_snap_column_string(&snap, (char *) columns);
+	buffer = malloc(MAX_RECORD_LENGTH + 1);
+
+	for (r = 0; r < repeats; r++)
+	{
+		start = monotonic_ns();
+		for (i = 0; i < HEADER_CALLS; i++)
+		{
+			insert = buffer;
+			hprintbuf(&snap, &insert, MAX_RECORD_LENGTH);
+		}
+		elapsed = monotonic_ns() - start;
+		best = MIN(best, elapsed);
+	}
+
+	printf("  %-46s %10.1f\n", columns, (double) best / HEADER_CALLS);
+
+	free(buffer);
+	free_snap(&snap);
+}
+
+static void time_parse(file_record **records, int count, int repeats,
+					   const char *columns)
+{
+	char *text, *insert, path[PATH_MAX], *line;
+	size_t size, used, header_len;
+	uint64_t start, elapsed, best = UINT64_MAX;
+	file_record *parsed;
+	snap_reader_t reader;
+	snap_t snap, read_snap;
+	FILE *file;
+	int r, i, n, fd;
+
+	init_snap_record(&snap);
+	free(snap.column_string);
+	set_snap_column_string(&snap, (char *) columns);
+
+	// The snapshot, header and all.
+	size = (size_t) count * 128 + MAX_RECORD_LENGTH + 1;
+	text = malloc(size);
+	insert = text;
+	hprintbuf(&snap, &insert, MAX_RECORD_LENGTH);
+	used = header_len = strlen(text);
+	for (i = 0; i < count; i++)
+	{
+		if (used + MAX_RECORD_LENGTH + 1 > size)
+		{
+			size *= 2;
+			text = realloc(text, size);
+		}
+		insert = text + used;
+		used += rprintbuf(&snap, records[i], &insert, MAX_RECORD_LENGTH);
+	}
+	text[used] = '\0';
+
+	// The reader works out the columns from the header, which it reads
+	// from a file.
+	snprintf(path, sizeof(path), "%s/microbench.XXXXXX",
+			 getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if ((fd = mkstemp(path)) == -1 ||
+		write(fd, text, header_len) != (ssize_t) header_len)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	close(fd);
+	init_snap_record(&read_snap);
+	if (open_snap_reader(&reader, &read_snap, path) != 0)
+	{
+		exit(1);
+	}
+	unlink(path);
+
+	parsed = calloc(count, sizeof(file_record));
+	line = malloc(PATH_MAX + 128);
+
+	for (r = 0; r < repeats; r++)
+	{
+		if ((file = fmemopen(text + header_len, used - header_len,
+							 "r")) == NULL)
+		{
+			fprintf(stderr, "fmemopen: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		start = monotonic_ns();
+		for (n = 0; n < count &&
+			 _getline(file, line, PATH_MAX + 64) >= 0; n++)
+		{
+			parse_snapper_file_line(reader.column_tracker, line,
+									&(parsed[n]));
+		}
+		elapsed = monotonic_ns() - start;
+		best = MIN(best, elapsed);
+
+		fclose(file);
+		for (i = 0; i < n; i++)
+		{
+			free(parsed[i].re_path);
+			free(parsed[i].re_atime_str);
+			free(parsed[i].re_mtime_str);
+			free(parsed[i].re_ctime_str);
+		}
+	}
+
+	printf("  %-46s %10.1f %10.1f\n", columns, (double) best / count,
+		   (used - header_len) / (best / 1e9) / 1e6);
+
+	free(parsed);
+	free(line);
+	free(text);
+	close_snap_reader(&reader);
+	free_snap(&read_snap);
+	free_snap(&snap);
+}
+
+// xorshift64*.
+static uint64_t next_random(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+// In [0, n).
+static long random_below(long n)
+{
+	return (long) (next_random() % (uint64_t) n);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: microbench [-n records] [-r repeats] [-s seed]\n"
+"	-n	Records to make up (100000)\n"
+"	-r	Runs of each case; the fastest counts (5)\n"
+"	-s	Seed for making them up (1)\n");
+}
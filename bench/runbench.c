@@ -0,0 +1,285 @@
+//
+// runbench.c
+// snapper
+//
+// Runs snapper (and snapdiff) over benchmark trees, and reports how each
+// run went as CSV, one line per run:
+//
+//		label,case,tree,entries,run,wall_s,entries_per_s,user_s,sys_s,max_rss_kb
+//
+// The label is whatever names the build (make bench uses the commit), so
+// results from different commits can be kept in one file and compared.
+// The cases, in order:
+//
+//		scan	Walk the tree, recording paths only.
+//		sort	The same, sorted by path.
+//		write	All the stat columns, sorted, with headers, to a file.
+//		read	snapdiff that file against itself: two reads and a compare.
+//
+// Usage:
+//		runbench [-n runs] [-l label] [-o csv file] [-t temp dir]
+//				 <directory with the programs> <tree> ...
+//
+// The CSV goes to stdout, and is added to the csv file too, if given (with
+// the header line, if the file's new).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../stats.h"
+
+#pragma mark Defines
+#define CSV_HEADER	"label,case,tree,entries,run,wall_s,entries_per_s,user_s," \
+					"sys_s,max_rss_kb\n"
+#define MAX_ARGS	16
+
+#pragma mark Data Types
+struct result_t {
+	double		wall;				// Seconds
+	double		user;
+	double		sys;
+	long		max_rss_kb;
+};
+
+#pragma mark Local Prototypes
+static long long count_entries(char *tree);
+static int run(char *argv[], struct result_t *result);
+static void usage(void);
+
+#pragma mark Function Implementations
+int main(int argc, char *argv[])
+{
+	char *label = "dev", *csv_path = NULL, *temp_dir = "/tmp";
+	char snapper[PATH_MAX], snapdiff[PATH_MAX], snap[PATH_MAX];
+	char *args[MAX_ARGS], line[PATH_MAX + 256];
+	struct result_t result;
+	long long entries;
+	FILE *csv = NULL;
+	struct stat st;
+	int runs = 3, c, t, i, cs;
+	const char *cases[] = {"scan", "sort", "write", "read", NULL};
+
+	while ((c = getopt(argc, argv, "n:l:o:t:h")) != -1)
+	{
+		switch (c) {
+			case 'n':
+				runs = atoi(optarg);
+				break;
+			case 'l':
+				label = optarg;
+				break;
+			case 'o':
+				csv_path = optarg;
+				break;
+			case 't':
+				temp_dir = optarg;
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+
+	if (argc - optind < 2 || runs < 1)
+	{
+		usage();
+		exit(1);
+	}
+
+	snprintf(snapper, sizeof(snapper), "%s/snapper", argv[optind]);
+	snprintf(snapdiff, sizeof(snapdiff), "%s/snapdiff", argv[optind]);
+	snprintf(snap, sizeof(snap), "%s/runbench.%ld.snap", temp_dir,
+			 (long) getpid());
+
+	if (csv_path)
+	{
+		if ((csv = fopen(csv_path, "a")) == NULL)
+		{
+			fprintf(stderr, "%s: %s\n", csv_path, strerror(errno));
+			exit(1);
+		}
+		if (fstat(fileno(csv), &st) == 0 && st.st_size == 0)
+		{
+			fputs(CSV_HEADER, csv);
+		}
+	}
+	fputs(CSV_HEADER, stdout);
+
+	for (t = optind + 1; t < argc; t++)
+	{
+		if ((entries = count_entries(argv[t])) == -1)
+		{
+			exit(1);
+		}
+
+		for (cs = 0; cases[cs]; cs++)
+		{
+			i = 0;
+			if (strcmp(cases[cs], "read") == 0)
+			{
+				args[i++] = snapdiff;
+				args[i++] = snap;
+				args[i++] = snap;
+			}
+			else
+			{
+				args[i++] = snapper;
+				args[i++] = "-q";
+				args[i++] = "-p";
+				args[i++] = argv[t];
+				args[i++] = "-c";
+				if (strcmp(cases[cs], "write") == 0)
+				{
+					args[i++] = "%p %S %M %C %A %o %g %P %T %i %d";
+					args[i++] = "-H";
+					args[i++] = "-o";
+					args[i++] = snap;
+				}
+				else
+				{
+					args[i++] = "%p";
+					args[i++] = "-o";
+					args[i++] = "/dev/null";
+				}
+				if (strcmp(cases[cs], "scan") != 0)
+				{
+					args[i++] = "-s";
+					args[i++] = "p";
+				}
+			}
+			args[i] = NULL;
+
+			for (i = 1; i <= runs; i++)
+			{
+				if (run(args, &result) == -1)
+				{
+					unlink(snap);
+					exit(1);
+				}
+
+				snprintf(line, sizeof(line), "%s,%s,%s,%lld,%d,%.3f,%.0f,"
+						 "%.3f,%.3f,%ld\n", label, cases[cs], argv[t],
+						 entries, i, result.wall,
+						 (result.wall > 0) ? entries / result.wall : 0.0,
+						 result.user, result.sys, result.max_rss_kb);
+				fputs(line, stdout);
+				fflush(stdout);
+				if (csv)
+				{
+					fputs(line, csv);
+				}
+			}
+		}
+	}
+
+	unlink(snap);
+	if (csv && fclose(csv) == EOF)
+	{
+		fprintf(stderr, "%s: %s\n", csv_path, strerror(errno));
+		exit(1);
+	}
+
+	return 0;
+}
+
+#pragma mark Local Functions
+// Entries in the tree, as snapper counts them: the top, and everything in
+// it.
+static long long count_entries(char *tree)
+{
+	char *paths[] = {tree, NULL};
+	long long entries = 0;
+	FTSENT *p;
+	FTS *fts;
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_XDEV | FTS_NOSTAT,
+						NULL)) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", tree, strerror(errno));
+		return -1;
+	}
+	while ((p = fts_read(fts)) != NULL)
+	{
+		if (p->fts_info != FTS_DP)
+		{
+			entries++;
+		}
+	}
+	fts_close(fts);
+
+	return entries;
+}
+
+// Runs a program (its output thrown away), and says what it took.
+static int run(char *argv[], struct result_t *result)
+{
+	struct rusage usage;
+	uint64_t start;
+	pid_t pid;
+	int status, fd;
+
+	start = monotonic_ns();
+
+	if ((pid = fork()) == -1)
+	{
+		fprintf(stderr, "fork: %s\n", strerror(errno));
+		return -1;
+	}
+	if (pid == 0)
+	{
+		if ((fd = open("/dev/null", O_WRONLY)) != -1)
+		{
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	if (wait4(pid, &status, 0, &usage) == -1)
+	{
+		fprintf(stderr, "wait4: %s\n", strerror(errno));
+		return -1;
+	}
+	result->wall = (monotonic_ns() - start) / 1e9;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "%s failed (status %d)\n", argv[0], status);
+		return -1;
+	}
+
+	result->user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+	result->sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+	result->max_rss_kb = usage.ru_maxrss / 1024;	// Bytes, there
+#else
+	result->max_rss_kb = usage.ru_maxrss;
+#endif
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: runbench [-n runs] [-l label] [-o csv file] [-t temp dir]\n"
+"		<directory with the programs> <tree> ...\n"
+"	-n	Runs of each case (3)\n"
+"	-l	Label for the results, e.g. the commit (dev)\n"
+"	-o	File to add the results to, as well as printing them\n"
+"	-t	Where the snapshot for the write and read cases goes (/tmp)\n");
+}
@@ -5,19 +5,61 @@
  *  Created by Frank Fleschner on 5/22/09.
  *  Copyright 2009 ACS. All rights reserved.
  *
+ *  The asynchronous log is a bounded queue of fixed-size slots that any
+ *  thread can add to without a lock: a thread claims the next slot by
+ *  moving the tail past it (with a compare-and-swap), fills it in, and
+ *  bumps the slot's sequence number to say it's ready.  The writer thread
+ *  takes ready slots in order, a batch at a time, and hands each slot back
+ *  by bumping its sequence number a lap ahead.
+ *
  */
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "comm.h"
 
+#pragma mark Asynchronous log
+// Bytes the writer thread gathers up before writing them.
+#define LOG_BATCH_SIZE		(64 * 1024)
+// How long it sleeps when there's nothing to write.
+#define LOG_IDLE_USEC		1000
+
+struct log_slot_t {
+	uint64_t	sequence;			// Its position when free to fill, that
+									// plus one when ready to write
+	size_t		len;
+	char		text[LOG_SLOT_SIZE];
+};
+
+static struct {
+	int			running;
+	int			stopping;
+	pthread_t	thread;
+	struct log_slot_t *slots;
+	uint64_t	tail;				// Next position to claim
+	uint64_t	head;				// Next to write (the writer's alone)
+	uint64_t	written;			// Positions written out so far
+	uint64_t	dropped;			// Messages dropped for want of room
+} async_log;
+
+static void vlog(char droppable, const char *format, va_list ap);
+static int enqueue(const char *text, size_t len, char droppable);
+static void flush_queue(void);
+static void *log_thread(void *arg);
+
 // Logs errors to stderr.
 void LogError(const char *format, ...)
 {
 	va_list ap;
     va_start(ap, format);
-    vfprintf(stderr, format, ap);
+    vlog(0, format, ap);
     va_end(ap);
 }
 
@@ -30,7 +72,7 @@ void _LogV(char enable, const char *format, ...)
     
     va_list ap;
     va_start(ap, format);
-    vfprintf(stderr, format, ap);
+    vlog(1, format, ap);
     va_end(ap);
 }
 
@@ -43,6 +85,243 @@ void _LogMV(char enable, const char *format, ...)
     
     va_list ap;
     va_start(ap, format);
-    vfprintf(stderr, format, ap);
+    vlog(1, format, ap);
     va_end(ap);
 }
+
+int LogText(const char *text, size_t len, char droppable)
+{
+	if (!async_log.running || len >= LOG_SLOT_SIZE)
+	{
+		// Too big to queue, so it goes straight out, but not before
+		// anything that was queued ahead of it.
+		if (async_log.running)
+		{
+			flush_queue();
+		}
+		fwrite(text, 1, len, stderr);
+		return 0;
+	}
+
+	return enqueue(text, len, droppable);
+}
+
+void start_async_log(void)
+{
+	uint64_t i;
+
+	if (async_log.running)
+	{
+		return;
+	}
+
+	async_log.slots = calloc(LOG_QUEUE_SLOTS, sizeof(struct log_slot_t));
+	if (async_log.slots == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < LOG_QUEUE_SLOTS; i++)
+	{
+		async_log.slots[i].sequence = i;
+	}
+	async_log.tail = async_log.head = async_log.written = 0;
+	async_log.dropped = 0;
+	async_log.stopping = 0;
+
+	if (pthread_create(&(async_log.thread), NULL, log_thread, NULL) != 0)
+	{
+		free(async_log.slots);
+		async_log.slots = NULL;
+		return;
+	}
+
+	async_log.running = 1;
+	atexit(stop_async_log);
+}
+
+void stop_async_log(void)
+{
+	uint64_t dropped;
+
+	if (!async_log.running)
+	{
+		return;
+	}
+
+	__atomic_store_n(&(async_log.stopping), 1, __ATOMIC_RELEASE);
+	pthread_join(async_log.thread, NULL);
+	async_log.running = 0;
+
+	free(async_log.slots);
+	async_log.slots = NULL;
+
+	dropped = __atomic_load_n(&(async_log.dropped), __ATOMIC_RELAXED);
+	if (dropped)
+	{
+		fprintf(stderr, "\n%llu log message%s dropped (logging couldn't keep "
+				"up)\n", (unsigned long long) dropped,
+				(dropped != 1) ? "s were" : " was");
+	}
+}
+
+// Formats a message, and writes (or queues) it.
+static void vlog(char droppable, const char *format, va_list ap)
+{
+	char buffer[LOG_SLOT_SIZE], *text = buffer;
+	va_list again;
+	int len;
+
+	if (!async_log.running)
+	{
+		vfprintf(stderr, format, ap);
+		return;
+	}
+
+	va_copy(again, ap);
+	len = vsnprintf(buffer, sizeof(buffer), format, ap);
+	if (len >= (int) sizeof(buffer) && (text = malloc(len + 1)) != NULL)
+	{
+		vsnprintf(text, len + 1, format, again);
+	}
+	va_end(again);
+
+	if (len > 0 && text)
+	{
+		LogText(text, len, droppable);
+	}
+	if (text != buffer && text)
+	{
+		free(text);
+	}
+}
+
+// Claims a slot and fills it in.  When the queue's full, a droppable
+// message is dropped (returning -1); anything else waits for the writer.
+static int enqueue(const char *text, size_t len, char droppable)
+{
+	struct log_slot_t *slot;
+	uint64_t position, sequence;
+	int yielded = 0;
+
+	position = __atomic_load_n(&(async_log.tail), __ATOMIC_RELAXED);
+	for (;;)
+	{
+		slot = &(async_log.slots[position & (LOG_QUEUE_SLOTS - 1)]);
+		sequence = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE);
+
+		if (sequence == position)
+		{
+			// Free: try to claim it.  If another thread got there first,
+			// position is updated to the new tail.
+			if (__atomic_compare_exchange_n(&(async_log.tail), &position,
+											position + 1, 1, __ATOMIC_RELAXED,
+											__ATOMIC_RELAXED))
+			{
+				break;
+			}
+		}
+		else if (sequence < position)
+		{
+			// Full: the writer hasn't handed this slot back yet.  It gets
+			// one chance to (it may not have had a CPU); after that a
+			// droppable message is dropped.
+			if (droppable && yielded)
+			{
+				__atomic_add_fetch(&(async_log.dropped), 1, __ATOMIC_RELAXED);
+				return -1;
+			}
+			yielded = 1;
+			sched_yield();
+			position = __atomic_load_n(&(async_log.tail), __ATOMIC_RELAXED);
+		}
+		else
+		{
+			// Someone else claimed it; try the new tail.
+			position = __atomic_load_n(&(async_log.tail), __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(slot->text, text, len);
+	slot->len = len;
+	__atomic_store_n(&(slot->sequence), position + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+// Waits until everything queued so far has been written.
+static void flush_queue(void)
+{
+	uint64_t target = __atomic_load_n(&(async_log.tail), __ATOMIC_ACQUIRE);
+
+	while (__atomic_load_n(&(async_log.written), __ATOMIC_ACQUIRE) < target)
+	{
+		sched_yield();
+	}
+}
+
+static void *log_thread(void *arg)
+{
+	char *batch = malloc(LOG_BATCH_SIZE);
+	struct log_slot_t *slot;
+	size_t used;
+	int stopping;
+
+	for (;;)
+	{
+		// Read this first: anything queued before it was set is seen below.
+		stopping = __atomic_load_n(&(async_log.stopping), __ATOMIC_ACQUIRE);
+		used = 0;
+
+		for (;;)
+		{
+			slot = &(async_log.slots[async_log.head & (LOG_QUEUE_SLOTS - 1)]);
+			if (__atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE) !=
+				async_log.head + 1)
+			{
+				break;
+			}
+			if (batch && used + slot->len > LOG_BATCH_SIZE)
+			{
+				break;
+			}
+
+			if (batch)
+			{
+				memcpy(batch + used, slot->text, slot->len);
+				used += slot->len;
+			}
+			else
+			{
+				fwrite(slot->text, 1, slot->len, stderr);
+			}
+
+			// Hand it back, a lap ahead.
+			__atomic_store_n(&(slot->sequence),
+							 async_log.head + LOG_QUEUE_SLOTS,
+							 __ATOMIC_RELEASE);
+			async_log.head++;
+		}
+
+		if (used)
+		{
+			fwrite(batch, 1, used, stderr);
+		}
+		__atomic_store_n(&(async_log.written), async_log.head,
+						 __ATOMIC_RELEASE);
+
+		if (async_log.head ==
+			__atomic_load_n(&(async_log.tail), __ATOMIC_ACQUIRE))
+		{
+			if (stopping)
+			{
+				break;
+			}
+			usleep(LOG_IDLE_USEC);
+		}
+	}
+
+	fflush(stderr);
+	free(batch);
+
+	return arg;
+}
@@ -7,9 +7,17 @@
  *
  */
 
+#include <stddef.h>
+
 #define LogV(...)	_LogV(globals->verbose, __VA_ARGS__)
 #define LogMV(...)	_LogMV(globals->megaVerbose, __VA_ARGS__)
 
+// Messages (formatted) that fit in a slot of the asynchronous log's queue.
+// Longer ones are written straight out, after what's queued.
+#define LOG_SLOT_SIZE		512
+// Slots in the queue.  A power of two.
+#define LOG_QUEUE_SLOTS		4096
+
 // Logs errors to stderr.
 void LogError(const char *format, ...) 
 __attribute__((format(printf, 1, 2)));
@@ -21,3 +29,18 @@ __attribute__((format(printf, 2, 3)));
 // For mega-verbose (-V) output, goes to stderr.
 void _LogMV(char enable, const char *format, ...) 
 __attribute__((format(printf, 2, 3)));
+
+// Writes an already formatted message to stderr.  If droppable, it may be
+// dropped (and counted) instead of waiting for room in the asynchronous
+// log's queue, and then -1 is returned.
+int LogText(const char *text, size_t len, char droppable);
+
+// From here on, messages are queued and written to stderr by a thread of
+// their own, so logging doesn't wait on stderr.  Verbose messages (and
+// status updates) that would have to wait for room in the queue are dropped
+// instead; errors never are.
+void start_async_log(void);
+
+// Writes out what's queued and stops the thread.  Says how many messages
+// were dropped, if any were.  (Also run at exit.)
+void stop_async_log(void);
@@ -0,0 +1,184 @@
+/*
+ *  dirprofile.c
+ *  snapper
+ *
+ *  The slowest directories.  See dirprofile.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "comm.h"
+#include "dirprofile.h"
+#include "util_macros.h"
+
+#pragma mark Local Prototypes
+static struct dirprofile_open_t *open_dir(dirprofile_t *profile, int level);
+static void sift_down(dirprofile_t *profile, int i);
+static int slowest_first(const void *left, const void *right);
+
+#pragma mark Function Implementations
+void init_dirprofile(dirprofile_t *profile, int size)
+{
+	memset(profile, 0, sizeof(dirprofile_t));
+
+	profile->size = MAX(size, 1);
+	CREATE(profile->heap, profile->size * sizeof(struct dirprofile_dir_t));
+}
+
+void dirprofile_enter(dirprofile_t *profile, int level, uint64_t ns)
+{
+	struct dirprofile_open_t *dir;
+
+	if (level > 0)
+	{
+		open_dir(profile, level - 1)->entries++;
+	}
+
+	// Whatever was last at this level was skipped, or is done.
+	dir = open_dir(profile, level);
+	dir->ns = ns;
+	dir->entries = 0;
+}
+
+void dirprofile_charge(dirprofile_t *profile, int level, uint64_t ns)
+{
+	struct dirprofile_open_t *dir;
+
+	if (level > 0)
+	{
+		dir = open_dir(profile, level - 1);
+		dir->ns += ns;
+		dir->entries++;
+	}
+}
+
+void dirprofile_charge_dir(dirprofile_t *profile, int level, uint64_t ns)
+{
+	open_dir(profile, level)->ns += ns;
+}
+
+void dirprofile_leave(dirprofile_t *profile, int level, const char *path,
+					  uint64_t ns)
+{
+	struct dirprofile_open_t *dir = open_dir(profile, level);
+	struct dirprofile_dir_t kept;
+	int i, parent;
+
+	dir->ns += ns;
+
+	if (profile->count == profile->size && dir->ns <= profile->heap[0].ns)
+	{
+		return;
+	}
+
+	kept.path = strdup(path);
+	kept.ns = dir->ns;
+	kept.entries = dir->entries;
+
+	if (profile->count < profile->size)
+	{
+		// Room for it: add it at the bottom, and bubble it up.
+		for (i = profile->count++; i > 0; i = parent)
+		{
+			parent = (i - 1) / 2;
+			if (profile->heap[parent].ns <= kept.ns)
+			{
+				break;
+			}
+			profile->heap[i] = profile->heap[parent];
+		}
+		profile->heap[i] = kept;
+	}
+	else
+	{
+		// Slower than the fastest kept, which goes.
+		free(profile->heap[0].path);
+		profile->heap[0] = kept;
+		sift_down(profile, 0);
+	}
+}
+
+int dirprofile_sort(dirprofile_t *profile)
+{
+	qsort(profile->heap, profile->count, sizeof(struct dirprofile_dir_t),
+		  slowest_first);
+
+	return profile->count;
+}
+
+void free_dirprofile(dirprofile_t *profile)
+{
+	int i;
+
+	for (i = 0; i < profile->count; i++)
+	{
+		free(profile->heap[i].path);
+	}
+	free(profile->heap);
+	if (profile->open)
+	{
+		free(profile->open);
+	}
+
+	memset(profile, 0, sizeof(dirprofile_t));
+}
+
+#pragma mark Local Functions
+// The directory being walked at level, growing the stack to reach it.
+static struct dirprofile_open_t *open_dir(dirprofile_t *profile, int level)
+{
+	int old = profile->open_capacity;
+
+	if (level >= old)
+	{
+		profile->open_capacity = MAX(level + 1, old * 2);
+		if (profile->open)
+		{
+			RECREATE(profile->open, profile->open_capacity *
+					 sizeof(struct dirprofile_open_t));
+		}
+		else
+		{
+			CREATE(profile->open, profile->open_capacity *
+				   sizeof(struct dirprofile_open_t));
+		}
+		memset(profile->open + old, 0, (profile->open_capacity - old) *
+			   sizeof(struct dirprofile_open_t));
+	}
+
+	return &(profile->open[level]);
+}
+
+static void sift_down(dirprofile_t *profile, int i)
+{
+	struct dirprofile_dir_t moving = profile->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < profile->count)
+	{
+		if (child + 1 < profile->count &&
+			profile->heap[child + 1].ns < profile->heap[child].ns)
+		{
+			child++;
+		}
+		if (profile->heap[child].ns >= moving.ns)
+		{
+			break;
+		}
+		profile->heap[i] = profile->heap[child];
+		i = child;
+	}
+	profile->heap[i] = moving;
+}
+
+static int slowest_first(const void *left, const void *right)
+{
+	const struct dirprofile_dir_t *l = left, *r = right;
+
+	return (l->ns < r->ns) ? 1 : (l->ns > r->ns) ? -1 : 0;
+}
@@ -0,0 +1,74 @@
+/*
+ *  dirprofile.h
+ *  snapper
+ *
+ *  Which directories the walk spent the most time in.  Each directory is
+ *  charged for its own visits and for visiting its entries (reading them,
+ *  checking the ignore rules, recording them), but not for what's under its
+ *  subdirectories.  As each directory is finished it's offered to a bounded
+ *  heap of the slowest, so only those are kept, however big the tree.
+ *
+ *  The walk is depth first, so the directories being walked are a stack,
+ *  one per level.
+ *
+ */
+
+#include <stdint.h>
+
+#pragma mark Defines
+// How many directories are kept, unless told otherwise.
+#define DIRPROFILE_SIZE		10
+
+#pragma mark Data Types
+// A directory being walked.
+struct dirprofile_open_t {
+	uint64_t	ns;
+	long long	entries;
+};
+
+// A finished one, in the heap.
+struct dirprofile_dir_t {
+	char		*path;
+	uint64_t	ns;
+	long long	entries;
+};
+
+struct dirprofile_t {
+	int			size;				// Most directories kept
+	int			count;				// Directories kept
+	struct dirprofile_dir_t *heap;	// Min-heap on ns: the fastest kept is
+									// the first to go
+
+	struct dirprofile_open_t *open;	// By level
+	int			open_capacity;
+};
+
+typedef struct dirprofile_t dirprofile_t;
+
+#pragma mark Functions
+
+// Keeps the size slowest directories.
+void init_dirprofile(dirprofile_t *profile, int size);
+
+// A directory at level was visited (taking ns), and its walk begins.  It's
+// an entry of the directory above it.
+void dirprofile_enter(dirprofile_t *profile, int level, uint64_t ns);
+
+// An entry (not a directory being walked) at level took ns.  It's charged
+// to the directory above it.
+void dirprofile_charge(dirprofile_t *profile, int level, uint64_t ns);
+
+// The directory at level (being walked) took ns more, as a whole.
+void dirprofile_charge_dir(dirprofile_t *profile, int level, uint64_t ns);
+
+// The directory at level, path, is done, after ns more.  It's kept if it's
+// one of the slowest so far.
+void dirprofile_leave(dirprofile_t *profile, int level, const char *path,
+					  uint64_t ns);
+
+// Sorts the kept directories, slowest first, and returns how many there
+// are.  Nothing more can be offered after this.
+int dirprofile_sort(dirprofile_t *profile);
+
+// Frees the directories.
+void free_dirprofile(dirprofile_t *profile);
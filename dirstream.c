@@ -0,0 +1,155 @@
+/*
+ *  dirstream.c
+ *  snapper
+ *
+ *  Streaming big directories.  See dirstream.h.
+ *
+ *  readdir() already reads the directory in fixed-size batches (getdents()
+ *  on Linux, getdirentries() on the BSDs), so all that's held here is its
+ *  buffer and one entry.  The stat is relative to the open directory, so the
+ *  path isn't looked up again for every entry.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "stats.h"
+#include "latency.h"
+#include "dirstream.h"
+#include "util_macros.h"
+
+#pragma mark Function Implementations
+int open_dirstream(dirstream_t *stream, FTSENT *dir, latency_set_t *latency)
+{
+	uint64_t start = LATENCY_START(latency);
+
+	memset(stream, 0, sizeof(dirstream_t));
+	stream->latency = latency;
+
+	stream->dir = opendir(dir->fts_accpath);
+	LATENCY_END(latency, LATENCY_OPENDIR, start);
+	if (stream->dir == NULL)
+	{
+		LogError("%s: %s\n", dir->fts_path, strerror(errno));
+		return -1;
+	}
+
+	stream->parent = dir;
+
+	// fts_name is the last member, sized to fit; leave room for any name.
+	CREATE(stream->entry, sizeof(FTSENT) + NAME_MAX + 1);
+	CREATE(stream->path, PATH_MAX);
+
+	stream->dir_len = snprintf(stream->path, PATH_MAX, "%s%s", dir->fts_path,
+							   (dir->fts_pathlen > 0 &&
+								dir->fts_path[dir->fts_pathlen - 1] == '/') ?
+							   "" : "/");
+
+	return 0;
+}
+
+FTSENT *dirstream_next(dirstream_t *stream)
+{
+	struct dirent *dirent;
+	FTSENT *entry = stream->entry;
+	size_t name_len;
+	uint64_t start;
+	int failed;
+
+	for (;;)
+	{
+		errno = 0;
+		start = LATENCY_START(stream->latency);
+		dirent = readdir(stream->dir);
+		LATENCY_END(stream->latency, LATENCY_READDIR, start);
+		if (dirent == NULL)
+		{
+			if (errno)
+			{
+				LogError("%s: %s\n", stream->parent->fts_path,
+						 strerror(errno));
+			}
+			return NULL;
+		}
+
+		if (strcmp(dirent->d_name, ".") == 0 ||
+			strcmp(dirent->d_name, "..") == 0)
+		{
+			continue;
+		}
+
+		name_len = strlen(dirent->d_name);
+		if (stream->dir_len + name_len < PATH_MAX)
+		{
+			break;
+		}
+		LogError("%.*s%s: %s\n", (int) stream->dir_len, stream->path,
+				 dirent->d_name, strerror(ENAMETOOLONG));
+	}
+
+	memset(entry, 0, sizeof(FTSENT));
+	memcpy(entry->fts_name, dirent->d_name, name_len + 1);
+	entry->fts_namelen = name_len;
+	memcpy(stream->path + stream->dir_len, dirent->d_name, name_len + 1);
+	entry->fts_path = stream->path;
+	entry->fts_accpath = stream->path;
+	entry->fts_pathlen = stream->dir_len + name_len;
+	entry->fts_parent = stream->parent;
+	entry->fts_level = stream->parent->fts_level + 1;
+	entry->fts_statp = &(stream->st);
+
+	start = LATENCY_START(stream->latency);
+	failed = (fstatat(dirfd(stream->dir), dirent->d_name, &(stream->st),
+					  AT_SYMLINK_NOFOLLOW) == -1);
+	LATENCY_END(stream->latency, LATENCY_STAT, start);
+	if (failed)
+	{
+		entry->fts_errno = errno;
+		entry->fts_info = FTS_NS;
+	}
+	else if (S_ISDIR(stream->st.st_mode))
+	{
+		entry->fts_info = FTS_D;
+	}
+	else if (S_ISLNK(stream->st.st_mode))
+	{
+		entry->fts_info = FTS_SL;
+	}
+	else if (S_ISREG(stream->st.st_mode))
+	{
+		entry->fts_info = FTS_F;
+	}
+	else
+	{
+		entry->fts_info = FTS_DEFAULT;
+	}
+
+	entry->fts_dev = stream->st.st_dev;
+	entry->fts_ino = stream->st.st_ino;
+	entry->fts_nlink = stream->st.st_nlink;
+	stream->entries++;
+
+	return entry;
+}
+
+void close_dirstream(dirstream_t *stream)
+{
+	if (stream->dir)
+	{
+		closedir(stream->dir);
+	}
+	free(stream->entry);
+	free(stream->path);
+
+	memset(stream, 0, sizeof(dirstream_t));
+}
@@ -0,0 +1,47 @@
+/*
+ *  dirstream.h
+ *  snapper
+ *
+ *  Reads a directory a few entries at a time, for directories too big for
+ *  fts, which reads (and sorts) every entry of a directory before handing
+ *  out the first.  Entries come back in the order the filesystem keeps
+ *  them, each stat()ed (without following links) into an FTSENT that looks
+ *  enough like one from fts for the walk: the path, name, level, parent,
+ *  stat and fts_info are filled in.  The same FTSENT is reused for every
+ *  entry, so memory use doesn't depend on the directory's size.
+ *
+ *  Requires fts.h, dirent.h, stats.h and latency.h.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#pragma mark Data Types
+struct dirstream_t {
+	DIR			*dir;				// The directory being read
+	FTSENT		*parent;			// Its entry, from fts
+	FTSENT		*entry;				// The entry handed out last
+	struct stat	st;					// Its stat
+	char		*path;				// Its path (PATH_MAX)
+	size_t		dir_len;			// Length of the directory's part of it
+	long long	entries;			// Entries handed out so far
+	latency_set_t *latency;			// Where its calls are timed, or NULL
+};
+
+typedef struct dirstream_t dirstream_t;
+
+#pragma mark Functions
+
+// Opens the directory dir (an FTS_D entry) for streaming.  If latency isn't
+// NULL, the opendir(), readdir()s and stat()s are timed into it.  Returns 0,
+// or -1 (after logging why) if it can't be read.
+int open_dirstream(dirstream_t *stream, FTSENT *dir, latency_set_t *latency);
+
+// Reads the next entry, or returns NULL at the end.  Entries that can't be
+// stat()ed come back as FTS_NS, with fts_errno set.  The entry is only good
+// until the next call.
+FTSENT *dirstream_next(dirstream_t *stream);
+
+// Closes the directory, and frees the entry.
+void close_dirstream(dirstream_t *stream);
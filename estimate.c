@@ -0,0 +1,252 @@
+/*
+ *  estimate.c
+ *  snapper
+ *
+ *  Scan estimates from a sample of the tree.  See estimate.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "comm.h"
+#include "stats.h"
+#include "estimate.h"
+#include "util_macros.h"
+
+#pragma mark Local Prototypes
+static struct estimate_level_t *level_at(estimate_t *estimate, int level);
+static double parent_weight(estimate_t *estimate, int level);
+static double random_fraction(estimate_t *estimate);
+
+#pragma mark Function Implementations
+void init_estimate(estimate_t *estimate, int budget_ms, uint64_t seed)
+{
+	uint64_t x = seed + 0x9e3779b97f4a7c15ULL;
+
+	memset(estimate, 0, sizeof(estimate_t));
+
+	estimate->deadline = monotonic_ns() + (uint64_t) budget_ms * 1000000ULL;
+
+	// Through splitmix64, so any seed will do (and none ends up 0).
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	estimate->random = (x ^ (x >> 31)) | 1;
+}
+
+int estimate_next_pass(estimate_t *estimate)
+{
+	uint64_t now = monotonic_ns();
+	uint64_t left = (estimate->deadline > now) ? estimate->deadline - now : 0;
+
+	if (estimate->target == 0)
+	{
+		estimate->target = ESTIMATE_FIRST_TARGET;
+	}
+	else if (estimate->exact || estimate->expired ||
+			 left < estimate->last_ns + estimate->last_ns / 2)
+	{
+		return 0;
+	}
+	else if (left > 3 * estimate->last_ns && estimate->target < (1 << 24))
+	{
+		// Twice the directories takes about twice as long.
+		estimate->target *= 2;
+	}
+
+	estimate->pass_started = now;
+	estimate->skipped = 0;
+	estimate->visited = 0;
+	estimate->entries = estimate->records = 0;
+	estimate->bytes = estimate->dirs = 0;
+	if (estimate->levels)
+	{
+		memset(estimate->levels, 0, estimate->level_capacity *
+			   sizeof(struct estimate_level_t));
+	}
+
+	return 1;
+}
+
+int estimate_walk_into(estimate_t *estimate, int level)
+{
+	struct estimate_level_t *here = level_at(estimate, level);
+	double weight = parent_weight(estimate, level), chance;
+
+	here->found++;
+	estimate->dirs += weight;
+
+	if (estimate->expired || monotonic_ns() > estimate->deadline)
+	{
+		estimate->expired = 1;
+		return 0;
+	}
+
+	// Every one of the first target, and fewer and fewer after.
+	chance = MIN(1.0, (double) estimate->target / here->found);
+	if (chance < 1.0)
+	{
+		estimate->skipped = 1;
+		if (random_fraction(estimate) >= chance)
+		{
+			return 0;
+		}
+	}
+
+	here->walked++;
+	here->weight = weight / chance;
+
+	return 1;
+}
+
+void estimate_visit(estimate_t *estimate, int level)
+{
+	estimate->visited++;
+	estimate->entries += parent_weight(estimate, level);
+}
+
+void estimate_record(estimate_t *estimate, int level, off_t size)
+{
+	double weight = parent_weight(estimate, level);
+
+	estimate->records += weight;
+	estimate->bytes += weight * size;
+}
+
+void estimate_end_pass(estimate_t *estimate)
+{
+	uint64_t ns = monotonic_ns() - estimate->pass_started;
+
+	estimate->walk_ns += ns;
+	estimate->total_visited += estimate->visited;
+
+	// Cut short, it's missing some of the tree.  It's better than nothing,
+	// though, if it's all there is.
+	if (estimate->expired)
+	{
+		if (estimate->passes == 0)
+		{
+			estimate->rough = 1;
+			estimate->sample = 1;
+			estimate->entries_sum = estimate->entries;
+			estimate->records_sum = estimate->records;
+			estimate->bytes_sum = estimate->bytes;
+			estimate->dirs_sum = estimate->dirs;
+		}
+		return;
+	}
+
+	// Nothing was skipped, so that was all of it.
+	if (!estimate->skipped)
+	{
+		estimate->exact = 1;
+		estimate->sample = 0;
+		estimate->entries_sum = estimate->records_sum = 0;
+		estimate->bytes_sum = estimate->dirs_sum = 0;
+		estimate->entries_squares = estimate->sample_squares = 0;
+	}
+
+	estimate->passes++;
+	estimate->last_ns = ns;
+	estimate->sample += estimate->visited;
+	estimate->entries_sum += estimate->visited * estimate->entries;
+	estimate->records_sum += estimate->visited * estimate->records;
+	estimate->bytes_sum += estimate->visited * estimate->bytes;
+	estimate->dirs_sum += estimate->visited * estimate->dirs;
+	estimate->entries_squares += estimate->visited * estimate->entries *
+		estimate->entries;
+	estimate->sample_squares += (double) estimate->visited *
+		estimate->visited;
+}
+
+void finish_estimate(estimate_t *estimate)
+{
+	double variance, worth;
+
+	if (estimate->sample > 0)
+	{
+		estimate->est_entries = estimate->entries_sum / estimate->sample;
+		estimate->est_records = estimate->records_sum / estimate->sample;
+		estimate->est_bytes = estimate->bytes_sum / estimate->sample;
+		estimate->est_dirs = estimate->dirs_sum / estimate->sample;
+	}
+
+	// The passes' spread about it, over however many equal passes they're
+	// worth, by their weights.
+	if (estimate->passes > 1 && !estimate->exact && !estimate->rough &&
+		estimate->est_entries > 0)
+	{
+		variance = estimate->entries_squares / estimate->sample -
+			estimate->est_entries * estimate->est_entries;
+		worth = estimate->sample * estimate->sample /
+			estimate->sample_squares;
+		estimate->est_error = (worth > 1 && variance > 0) ?
+			sqrt(variance / (worth - 1)) / estimate->est_entries : 0;
+	}
+	if (estimate->total_visited > 0)
+	{
+		estimate->entry_us = estimate->walk_ns / 1e3 /
+			estimate->total_visited;
+	}
+	estimate->est_seconds = estimate->est_entries * estimate->entry_us / 1e6;
+}
+
+void free_estimate(estimate_t *estimate)
+{
+	if (estimate->levels)
+	{
+		free(estimate->levels);
+	}
+	estimate->levels = NULL;
+	estimate->level_capacity = 0;
+}
+
+#pragma mark Local Functions
+// The level's counts, growing the levels to reach it.
+static struct estimate_level_t *level_at(estimate_t *estimate, int level)
+{
+	int old = estimate->level_capacity;
+
+	if (level >= old)
+	{
+		estimate->level_capacity = MAX(level + 1, old * 2);
+		if (estimate->levels)
+		{
+			RECREATE(estimate->levels, estimate->level_capacity *
+					 sizeof(struct estimate_level_t));
+		}
+		else
+		{
+			CREATE(estimate->levels, estimate->level_capacity *
+				   sizeof(struct estimate_level_t));
+		}
+		memset(estimate->levels + old, 0, (estimate->level_capacity - old) *
+			   sizeof(struct estimate_level_t));
+	}
+
+	return &(estimate->levels[level]);
+}
+
+// What an entry at level stands for: what the directory it's in does.  The
+// walk is depth first, so that's the last one walked into a level up.
+static double parent_weight(estimate_t *estimate, int level)
+{
+	return (level > 0) ? level_at(estimate, level - 1)->weight : 1.0;
+}
+
+// In [0, 1), from xorshift64*.
+static double random_fraction(estimate_t *estimate)
+{
+	uint64_t x = estimate->random;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	estimate->random = x;
+
+	return ((x * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
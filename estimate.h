@@ -0,0 +1,117 @@
+/*
+ *  estimate.h
+ *  snapper
+ *
+ *  Estimates what a scan will come to (entries, records, bytes, and how long
+ *  it'll take) from a sample of the tree, in a few seconds.
+ *
+ *  The tree is walked as usual, ignore rules and all, but only some of the
+ *  directories at each level are walked into.  Each level's first target
+ *  directories are, and after that each one is with a chance of target over
+ *  how many have been found at that level so far, so a pass walks into a
+ *  few times target directories a level, however big the tree.  Whatever's
+ *  found under a directory walked into with a chance of p stands for 1/p as
+ *  much (times what its parent stands for), which keeps the estimate
+ *  unbiased.
+ *
+ *  Passes are repeated, doubling target while there's time for it, and the
+ *  estimate is theirs, each counted by how many entries it visited.  A pass
+ *  that didn't have to skip anything saw the whole tree, so its numbers are
+ *  exact.  The time is the cost of an entry, as the passes found it, times
+ *  the entries.
+ *
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#pragma mark Tunables
+// How long the passes can take, all told.
+#define ESTIMATE_BUDGET_MS		5000
+// Directories a level the first pass aims to walk into.
+#define ESTIMATE_FIRST_TARGET	8
+
+#pragma mark Data Types
+// A level of the tree, this pass.
+struct estimate_level_t {
+	long long	found;				// Directories found here
+	long long	walked;				// Of them, walked into
+	double		weight;				// What the last one walked into
+									// stands for
+};
+
+struct estimate_t {
+	uint64_t	deadline;			// When the passes have to be done by
+	uint64_t	random;				// The generator's state
+
+	// The pass being walked:
+	int			target;
+	uint64_t	pass_started;
+	int			skipped;			// Did it skip any directories?
+	int			expired;			// Did it run out of time?
+	long long	visited;			// Entries it visited
+	double		entries;			// What they stand for, weighted
+	double		records;
+	double		bytes;
+	double		dirs;
+	struct estimate_level_t *levels;
+	int			level_capacity;
+
+	// The passes so far:
+	int			passes;				// Done (not cut short)
+	uint64_t	last_ns;			// How long the last one took
+	double		sample;				// The entries they visited, by which
+									// each is counted
+	double		entries_sum;		// Their estimates, times that
+	double		records_sum;
+	double		bytes_sum;
+	double		dirs_sum;
+	double		entries_squares;	// Their entries squared, times that
+	double		sample_squares;		// The entries visited, squared
+	long long	total_visited;		// Entries visited by every pass
+	uint64_t	walk_ns;			// and the time it took
+
+	// What they come to, from finish_estimate():
+	double		est_entries;
+	double		est_records;
+	double		est_bytes;
+	double		est_dirs;
+	double		est_seconds;		// To walk it all
+	double		entry_us;			// Time an entry
+	double		est_error;			// Standard error of the entries, as
+									// a fraction of them (0 if unknown)
+	int			exact;				// A pass saw the whole tree
+	int			rough;				// Only from a pass cut short
+};
+
+typedef struct estimate_t estimate_t;
+
+#pragma mark Functions
+
+// Gives the passes budget_ms, sampling with the given seed.
+void init_estimate(estimate_t *estimate, int budget_ms, uint64_t seed);
+
+// Starts the next pass.  Returns 1 if there's to be one, or 0 if the
+// estimate's done: a pass was exact, or there isn't time for another.
+int estimate_next_pass(estimate_t *estimate);
+
+// A directory at level (the scan path's 0) was found, and isn't ignored.
+// Returns 1 if the pass walks into it, or 0 to skip what's in it.  After
+// the budget is up, nothing more is.
+int estimate_walk_into(estimate_t *estimate, int level);
+
+// An entry at level was visited.
+void estimate_visit(estimate_t *estimate, int level);
+
+// An entry at level, of size bytes, was recorded.
+void estimate_record(estimate_t *estimate, int level, off_t size);
+
+// The pass's walk is done.  Its numbers count unless it ran out of time.
+void estimate_end_pass(estimate_t *estimate);
+
+// Works out the estimate from the passes.  The error comes from how much
+// they differ, so there's none with only one.
+void finish_estimate(estimate_t *estimate);
+
+// Frees the levels.
+void free_estimate(estimate_t *estimate);
@@ -0,0 +1,573 @@
+/*
+ *  extsort.c
+ *  snapper
+ *
+ *  External sorting.  See extsort.h.
+ *
+ *  A run is a sequence of entries, each a key (the record fields a sort
+ *  token can look at) followed by the record's path and its formatted
+ *  output line.  The merge rebuilds just enough of a file_record from them
+ *  to call the same compare function the in-memory sort uses.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "comm.h"
+#include "snap_record.h"
+#include "extsort.h"
+#include "stats.h"
+#include "trace.h"
+#include "util_macros.h"
+
+#pragma mark Data Types
+// What a run stores ahead of each line.
+struct extsort_key_t {
+	off_t		size;
+	time_t		atime;
+	time_t		mtime;
+	time_t		ctime;
+	ino_t		ino;
+	dev_t		dev;
+	uid_t		uid;
+	gid_t		gid;
+	uint32_t	path_len;			// Bytes in the path that follows
+	uint32_t	len;				// Bytes in the line after that
+};
+
+// Where the merge is in one of its inputs.
+struct extsort_cursor_t {
+	FILE		*file;				// A run, or NULL for the snap itself
+	snap_t		*snap;				// The snap, if file is NULL
+	int			next;				// Next record of the snap
+	file_record	record;				// The current entry's key, from a run
+	file_record	*current;			// The current record
+	char		*path;				// The current entry's path, from a run
+	char		*line;				// The current entry's line, from a run
+	uint32_t	len;
+	int			order;				// Breaks ties: older inputs first
+};
+
+#pragma mark Local Prototypes
+static FILE *new_run_file(extsort_t *sort, char **buffer);
+static FILE *open_run_file(const char *path, const char *mode, char **buffer);
+static int spill(extsort_t *sort, snap_t *snap, const char *path);
+static void add_run(extsort_t *sort, int at, FILE *file, char *buffer,
+					long long records);
+static int write_entry(FILE *file, file_record *record, const char *line,
+					   uint32_t len);
+static int advance(struct extsort_cursor_t *cursor);
+static int cursor_less(extsort_t *sort, struct extsort_cursor_t *left,
+					   struct extsort_cursor_t *right);
+static void sift_down(extsort_t *sort, struct extsort_cursor_t **heap,
+					  int count, int i);
+static long long merge(extsort_t *sort, int first, int count, snap_t *snap,
+					   FILE *out, int raw);
+static int reduce_runs(extsort_t *sort, int most);
+static void sort_snap(extsort_t *sort, snap_t *snap);
+
+#pragma mark Function Implementations
+void init_extsort(extsort_t *sort, const char *temp_dir, size_t mem_limit,
+				  int (*compare)(const void *, const void *))
+{
+	memset(sort, 0, sizeof(extsort_t));
+
+	if (temp_dir == NULL || *temp_dir == '\0')
+	{
+		temp_dir = getenv("TMPDIR");
+	}
+	if (temp_dir == NULL || *temp_dir == '\0')
+	{
+		temp_dir = "/tmp";
+	}
+
+	sort->temp_dir = strdup(temp_dir);
+	sort->mem_limit = mem_limit;
+	sort->compare = compare;
+}
+
+int extsort_account(extsort_t *sort, file_record *record)
+{
+	// The record, its slot in the master array, its path, and a little for
+	// malloc's bookkeeping.  The hash strings come later, so guess at them.
+	sort->mem_used += sizeof(file_record) + sizeof(file_record *) +
+		strlen(record->re_path) + 1 + 64;
+
+	return (sort->mem_used >= sort->mem_limit);
+}
+
+int extsort_spill(extsort_t *sort, snap_t *snap)
+{
+	uint64_t start = TRACE_START();
+	int result = spill(sort, snap, NULL);
+
+	TRACE_END("spill", NULL, start);
+
+	return result;
+}
+
+int extsort_spill_to(extsort_t *sort, snap_t *snap, const char *path)
+{
+	uint64_t start = TRACE_START();
+	int result = spill(sort, snap, path);
+
+	TRACE_END("spill", path, start);
+
+	return result;
+}
+
+int extsort_add_run(extsort_t *sort, const char *path, long long records)
+{
+	FILE *file;
+	char *buffer;
+
+	if ((file = open_run_file(path, "r", &buffer)) == NULL)
+	{
+		return -1;
+	}
+
+	add_run(sort, sort->run_count, file, buffer, records);
+	sort->records_spilled += records;
+
+	return reduce_runs(sort, EXTSORT_MAX_FANIN);
+}
+
+int extsort_write(extsort_t *sort, snap_t *snap, char *path)
+{
+	FILE *out;
+	long long records;
+
+	// Leave one input for what's still in the snap.
+	if (reduce_runs(sort, EXTSORT_MAX_FANIN - 1) == -1)
+	{
+		return -1;
+	}
+
+	sort_snap(sort, snap);
+
+	out = open_snap_output(snap, path);
+	records = merge(sort, 0, sort->run_count, snap, out, 0);
+	close_snap_output(out, path);
+
+	return (records < 0) ? -1 : 0;
+}
+
+void free_extsort(extsort_t *sort)
+{
+	int i;
+
+	for (i = 0; i < sort->run_count; i++)
+	{
+		fclose(sort->runs[i].file);
+		free(sort->runs[i].buffer);
+	}
+	free(sort->runs);
+	free(sort->temp_dir);
+
+	memset(sort, 0, sizeof(extsort_t));
+}
+
+#pragma mark Runs
+// Sorts the snap's records into a new run (a temporary one, or a kept one
+// at path), and frees them.
+static int spill(extsort_t *sort, snap_t *snap, const char *path)
+{
+	FILE *file;
+	char *line, *buffer;
+	int i, len;
+
+	if (snap->currentArraySize == 0)
+	{
+		return 0;
+	}
+
+	file = path ? open_run_file(path, "w+", &buffer) :
+		new_run_file(sort, &buffer);
+	if (file == NULL)
+	{
+		return -1;
+	}
+
+	sort_snap(sort, snap);
+
+	CREATE(line, MAX_RECORD_LENGTH+1);
+	for (i = 0; i < snap->currentArraySize; i++)
+	{
+		len = rprintbuf(snap, snap->master_array[i], &line, MAX_RECORD_LENGTH);
+		if (write_entry(file, snap->master_array[i], line, len) == -1)
+		{
+			break;
+		}
+	}
+	free(line);
+
+	// A kept run has to be on disk before anything says it's there.
+	if (i < snap->currentArraySize ||
+		(path && (fflush(file) == EOF || fsync(fileno(file)) == -1)))
+	{
+		LogError("Couldn't write a sort run to %s: %s\n",
+				 path ? path : sort->temp_dir, strerror(errno));
+		fclose(file);
+		free(buffer);
+		return -1;
+	}
+
+	add_run(sort, sort->run_count, file, buffer, snap->currentArraySize);
+	sort->records_spilled += snap->currentArraySize;
+
+	empty_snap(snap);
+	sort->mem_used = 0;
+
+	// Don't let open runs pile up past what one merge can take.
+	return reduce_runs(sort, EXTSORT_MAX_FANIN);
+}
+
+// Makes a temporary file, and unlinks it right away, so that it's gone as
+// soon as it's closed.
+static FILE *new_run_file(extsort_t *sort, char **buffer)
+{
+	char path[PATH_MAX];
+	FILE *file;
+	int fd;
+
+	snprintf(path, PATH_MAX, "%s/snapper.run.XXXXXX", sort->temp_dir);
+
+	if ((fd = mkstemp(path)) == -1)
+	{
+		LogError("Couldn't create a sort run in %s: %s\n", sort->temp_dir,
+				 strerror(errno));
+		return NULL;
+	}
+	unlink(path);
+
+	if ((file = fdopen(fd, "w+")) == NULL)
+	{
+		LogError("Couldn't open a sort run in %s: %s\n", sort->temp_dir,
+				 strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	CREATE(*buffer, EXTSORT_BUFFER_SIZE);
+	setvbuf(file, *buffer, _IOFBF, EXTSORT_BUFFER_SIZE);
+
+	return file;
+}
+
+// Opens a kept run file.
+static FILE *open_run_file(const char *path, const char *mode, char **buffer)
+{
+	FILE *file;
+
+	if ((file = fopen(path, mode)) == NULL)
+	{
+		LogError("Couldn't open sort run %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	CREATE(*buffer, EXTSORT_BUFFER_SIZE);
+	setvbuf(file, *buffer, _IOFBF, EXTSORT_BUFFER_SIZE);
+
+	return file;
+}
+
+static void add_run(extsort_t *sort, int at, FILE *file, char *buffer,
+					long long records)
+{
+	if (sort->run_count >= sort->run_capacity)
+	{
+		sort->run_capacity = MAX(sort->run_capacity * 2, 16);
+		if (sort->runs)
+		{
+			RECREATE(sort->runs,
+					 sort->run_capacity * sizeof(struct extsort_run_t));
+		}
+		else
+		{
+			CREATE(sort->runs,
+				   sort->run_capacity * sizeof(struct extsort_run_t));
+		}
+	}
+
+	memmove(sort->runs + at + 1, sort->runs + at,
+			(sort->run_count - at) * sizeof(struct extsort_run_t));
+	sort->runs[at].file = file;
+	sort->runs[at].buffer = buffer;
+	sort->runs[at].records = records;
+	sort->run_count++;
+}
+
+static int write_entry(FILE *file, file_record *record, const char *line,
+					   uint32_t len)
+{
+	struct extsort_key_t key;
+
+	memset(&key, 0, sizeof(key));
+	key.size = record->re_size;
+	key.atime = record->re_atime;
+	key.mtime = record->re_mtime;
+	key.ctime = record->re_ctime;
+	key.ino = record->re_ino;
+	key.dev = record->re_dev;
+	key.uid = record->re_uid;
+	key.gid = record->re_gid;
+	key.path_len = strlen(record->re_path);
+	key.len = len;
+
+	if (fwrite(&key, sizeof(key), 1, file) != 1 ||
+		fwrite(record->re_path, key.path_len, 1, file) != 1 ||
+		(len > 0 && fwrite(line, len, 1, file) != 1))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+#pragma mark Merging
+// Moves a cursor to its next entry.  Returns 0, or -1 at the end (or on a
+// read error, which is logged).
+static int advance(struct extsort_cursor_t *cursor)
+{
+	struct extsort_key_t key;
+
+	if (cursor->file == NULL)
+	{
+		if (cursor->next >= cursor->snap->currentArraySize)
+		{
+			return -1;
+		}
+		cursor->current = cursor->snap->master_array[cursor->next++];
+		return 0;
+	}
+
+	if (fread(&key, sizeof(key), 1, cursor->file) != 1)
+	{
+		if (ferror(cursor->file))
+		{
+			LogError("Couldn't read a sort run: %s\n", strerror(errno));
+		}
+		return -1;
+	}
+
+	if (key.len > MAX_RECORD_LENGTH || key.path_len == 0 ||
+		key.path_len > PATH_MAX ||
+		fread(cursor->path, key.path_len, 1, cursor->file) != 1 ||
+		(key.len > 0 && fread(cursor->line, key.len, 1, cursor->file) != 1))
+	{
+		LogError("Sort run is truncated or corrupt\n");
+		return -1;
+	}
+
+	cursor->path[key.path_len] = '\0';
+	cursor->len = key.len;
+	cursor->record.re_path = cursor->path;
+	cursor->record.re_size = key.size;
+	cursor->record.re_atime = key.atime;
+	cursor->record.re_mtime = key.mtime;
+	cursor->record.re_ctime = key.ctime;
+	cursor->record.re_ino = key.ino;
+	cursor->record.re_dev = key.dev;
+	cursor->record.re_uid = key.uid;
+	cursor->record.re_gid = key.gid;
+	cursor->current = &(cursor->record);
+
+	return 0;
+}
+
+static int cursor_less(extsort_t *sort, struct extsort_cursor_t *left,
+					   struct extsort_cursor_t *right)
+{
+	int result = 0;
+
+	if (sort->compare)
+	{
+		result = sort->compare(&(left->current), &(right->current));
+	}
+
+	return (result != 0) ? (result < 0) : (left->order < right->order);
+}
+
+static void sift_down(extsort_t *sort, struct extsort_cursor_t **heap,
+					  int count, int i)
+{
+	struct extsort_cursor_t *swap;
+	int smallest, child;
+
+	for (;;)
+	{
+		smallest = i;
+		child = 2 * i + 1;
+
+		if (child < count && cursor_less(sort, heap[child], heap[smallest]))
+			smallest = child;
+		if (child + 1 < count &&
+			cursor_less(sort, heap[child + 1], heap[smallest]))
+			smallest = child + 1;
+
+		if (smallest == i)
+			return;
+
+		swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+// Merges count runs starting at first (and the snap's records, if snap
+// isn't NULL) into out: as run entries if raw, otherwise as output lines.
+// Returns the number of records written, or -1 on error.
+static long long merge(extsort_t *sort, int first, int count, snap_t *snap,
+					   FILE *out, int raw)
+{
+	struct extsort_cursor_t *cursors, **heap, *top;
+	long long written = 0;
+	int inputs = count + (snap ? 1 : 0), heap_count = 0, i, failed = false;
+	uint64_t start = TRACE_START();
+	char *line;
+
+	CREATE(cursors, MAX(inputs, 1) * sizeof(struct extsort_cursor_t));
+	CREATE(heap, MAX(inputs, 1) * sizeof(struct extsort_cursor_t *));
+	CREATE(line, MAX_RECORD_LENGTH+1);
+
+	for (i = 0; i < inputs; i++)
+	{
+		cursors[i].order = i;
+		if (i < count)
+		{
+			cursors[i].file = sort->runs[first + i].file;
+			CREATE(cursors[i].path, PATH_MAX+1);
+			CREATE(cursors[i].line, MAX_RECORD_LENGTH+1);
+			rewind(cursors[i].file);
+		}
+		else
+		{
+			// The snap's records are newer than any run's.
+			cursors[i].snap = snap;
+		}
+
+		if (advance(&(cursors[i])) == 0)
+		{
+			heap[heap_count++] = &(cursors[i]);
+		}
+	}
+
+	for (i = heap_count / 2 - 1; i >= 0; i--)
+	{
+		sift_down(sort, heap, heap_count, i);
+	}
+
+	while (heap_count > 0 && !failed)
+	{
+		top = heap[0];
+
+		if (top->file == NULL)
+		{
+			// Straight from memory, so format it now.
+			top->len = rprintbuf(snap, top->current, &line, MAX_RECORD_LENGTH);
+			top->line = line;
+		}
+
+		if (raw)
+		{
+			failed = (write_entry(out, top->current, top->line,
+								  top->len) == -1);
+		}
+		else
+		{
+			failed = (fwrite(top->line, 1, top->len, out) != top->len);
+			snap->bytes_written += top->len;
+		}
+		written++;
+
+		if (top->file == NULL)
+		{
+			top->line = NULL;
+		}
+
+		if (advance(top) == -1)
+		{
+			heap[0] = heap[--heap_count];
+		}
+		sift_down(sort, heap, heap_count, 0);
+	}
+
+	if (failed)
+	{
+		LogError("Couldn't write merged records: %s\n", strerror(errno));
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		free(cursors[i].path);
+		free(cursors[i].line);
+	}
+	free(cursors);
+	free(heap);
+	free(line);
+
+	TRACE_END(raw ? "merge runs" : "merge", NULL, start);
+
+	return failed ? -1 : written;
+}
+
+// Merges the oldest runs together until there are at most most of them.
+// The merged run goes first, so ties still break in order.
+static int reduce_runs(extsort_t *sort, int most)
+{
+	FILE *file;
+	char *buffer;
+	long long records;
+	int i;
+
+	while (sort->run_count > most)
+	{
+		if ((file = new_run_file(sort, &buffer)) == NULL)
+		{
+			return -1;
+		}
+
+		if ((records = merge(sort, 0, EXTSORT_MAX_FANIN, NULL, file, 1)) < 0)
+		{
+			fclose(file);
+			free(buffer);
+			return -1;
+		}
+
+		for (i = 0; i < EXTSORT_MAX_FANIN; i++)
+		{
+			fclose(sort->runs[i].file);
+			free(sort->runs[i].buffer);
+		}
+		memmove(sort->runs, sort->runs + EXTSORT_MAX_FANIN,
+				(sort->run_count - EXTSORT_MAX_FANIN) *
+				sizeof(struct extsort_run_t));
+		sort->run_count -= EXTSORT_MAX_FANIN;
+
+		add_run(sort, 0, file, buffer, records);
+		sort->merge_passes++;
+	}
+
+	return 0;
+}
+
+static void sort_snap(extsort_t *sort, snap_t *snap)
+{
+	uint64_t start = TRACE_START();
+
+	if (sort->compare && snap->currentArraySize > 1)
+	{
+		qsort(snap->master_array, snap->currentArraySize,
+			  sizeof(file_record *), sort->compare);
+	}
+
+	TRACE_END("sort", NULL, start);
+}
@@ -0,0 +1,91 @@
+/*
+ *  extsort.h
+ *  snapper
+ *
+ *  External sorting, for snapshots too big to hold in memory.  Records are
+ *  counted against a memory limit as the walk adds them; when the limit is
+ *  reached, what's in the snap is sorted, written to a temporary run file
+ *  (already formatted, along with the fields the sort tokens look at) and
+ *  freed.  At the end, the runs and whatever is still in memory are merged
+ *  into the output, a record at a time, with a heap.
+ *
+ *  Run files are unlinked as soon as they're created, so they go away on
+ *  their own, however snapper exits.  If there are more than
+ *  EXTSORT_MAX_FANIN of them, the oldest are merged into one first, so the
+ *  number of open files stays bounded.
+ *
+ *  Where records compare equal, those from older runs come out first, so
+ *  with no compare function at all, the output is in walk order.
+ *
+ *  Runs can also be kept, in files of their own (see journal.h): those are
+ *  synced to disk when they're written, and can be added back to a later
+ *  sort.
+ *
+ *  Requires snap_record.h.
+ *
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#pragma mark Tunables
+// Most runs merged at once.
+#define EXTSORT_MAX_FANIN		128
+// stdio buffer for each run file.
+#define EXTSORT_BUFFER_SIZE		(256 * 1024)
+
+#pragma mark Data Types
+struct extsort_run_t {
+	FILE		*file;				// The run, unlinked, open for reading
+	char		*buffer;			// Its stdio buffer
+	long long	records;			// Records in it
+};
+
+struct extsort_t {
+	char		*temp_dir;			// Where run files go
+	size_t		mem_limit;			// Bytes of records to hold at most
+	size_t		mem_used;			// Bytes of records held now (roughly)
+	int			(*compare)(const void *, const void *);
+									// qsort() compare on file_record **'s,
+									// or NULL to keep walk order.
+
+	struct extsort_run_t *runs;		// The runs, oldest first
+	int			run_count;
+	int			run_capacity;
+
+	long long	records_spilled;	// Records written to runs, ever
+	int			merge_passes;		// Extra passes to cut down the fan-in
+};
+
+typedef struct extsort_t extsort_t;
+
+#pragma mark Functions
+
+// Sets up the sort.  temp_dir of NULL means $TMPDIR, or /tmp.
+void init_extsort(extsort_t *sort, const char *temp_dir, size_t mem_limit,
+				  int (*compare)(const void *, const void *));
+
+// Counts a record just added to the snap against the limit.  Returns true
+// if the limit has been reached, and the snap should be spilled.
+int extsort_account(extsort_t *sort, file_record *record);
+
+// Sorts the snap's records into a new run, and frees them.  Every field of
+// them (hashes included) has to be filled in already.  Returns 0, or -1 if
+// the run couldn't be written.
+int extsort_spill(extsort_t *sort, snap_t *snap);
+
+// Like extsort_spill(), but the run goes to a new file at path, which is
+// kept (and synced) rather than deleted.
+int extsort_spill_to(extsort_t *sort, snap_t *snap, const char *path);
+
+// Adds a run kept by extsort_spill_to() on an earlier run of the program.
+// It goes after the runs already there.  Returns 0, or -1 if it can't be
+// opened.
+int extsort_add_run(extsort_t *sort, const char *path, long long records);
+
+// Sorts what's left in the snap, and writes it merged with the runs to path
+// (as write_snap_record_to_file() would).  Returns 0, or -1 on error.
+int extsort_write(extsort_t *sort, snap_t *snap, char *path);
+
+// Closes (and so deletes) the runs, and frees the rest.
+void free_extsort(extsort_t *sort);
@@ -0,0 +1,584 @@
+/*
+ *  filter.c
+ *  snapper
+ *
+ *  Filter expressions.  See filter.h.
+ *
+ *  The expression is parsed by recursive descent:
+ *
+ *		or			:= and ( "||" and )*
+ *		and			:= unary ( "&&" unary )*
+ *		unary		:= "!" unary | "(" or ")" | field op value
+ *
+ *  into a tree of nodes, which filter_matches() walks for each file.  All the
+ *  work of turning values into numbers (sizes, dates, user names) happens
+ *  here, once, so matching is just integer comparisons.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "globset.h"
+#include "filter.h"
+#include "util_macros.h"
+
+#pragma mark Fields
+#define FIELD_SIZE		0
+#define FIELD_MTIME		1
+#define FIELD_ATIME		2
+#define FIELD_CTIME		3
+#define FIELD_TYPE		4
+#define FIELD_OWNER		5
+#define FIELD_GROUP		6
+#define FIELD_PERM		7
+#define FIELD_INODE		8
+#define FIELD_DEV		9
+#define FIELD_NAME		10
+
+#pragma mark Comparisons
+#define OP_EQ			0
+#define OP_NE			1
+#define OP_LT			2
+#define OP_LE			3
+#define OP_GT			4
+#define OP_GE			5
+
+static struct {
+	const char	*name;
+	char		field;
+} field_names[] = {
+	{"size",	FIELD_SIZE},
+	{"mtime",	FIELD_MTIME},
+	{"atime",	FIELD_ATIME},
+	{"ctime",	FIELD_CTIME},
+	{"type",	FIELD_TYPE},
+	{"owner",	FIELD_OWNER},
+	{"uid",		FIELD_OWNER},
+	{"group",	FIELD_GROUP},
+	{"gid",		FIELD_GROUP},
+	{"perm",	FIELD_PERM},
+	{"mode",	FIELD_PERM},
+	{"inode",	FIELD_INODE},
+	{"dev",		FIELD_DEV},
+	{"name",	FIELD_NAME},
+	{NULL,		0}
+};
+
+// Where the parser is.
+struct filter_parser_t {
+	filter_t	*filter;
+	const char	*expression;		// The whole thing, for error messages
+	const char	*p;					// The next unread character
+	char		value[1024];		// The last value read
+};
+
+#pragma mark Local Prototypes
+static int parse_or(struct filter_parser_t *parser);
+static int parse_and(struct filter_parser_t *parser);
+static int parse_unary(struct filter_parser_t *parser);
+static int parse_comparison(struct filter_parser_t *parser);
+static int parse_value(struct filter_parser_t *parser, int field,
+					   long long *value);
+static int parse_time(struct filter_parser_t *parser, long long *value);
+static int read_value(struct filter_parser_t *parser);
+static int new_node(filter_t *filter, int type);
+static int parse_error(struct filter_parser_t *parser, const char *message);
+static void skip_space(struct filter_parser_t *parser);
+static int match_node(filter_t *filter, int index, const char *name,
+					  size_t namelen, const struct stat *st);
+static char type_letter(mode_t mode);
+
+#pragma mark Function Implementations
+void init_filter(filter_t *filter)
+{
+	memset(filter, 0, sizeof(filter_t));
+	filter->root = -1;
+}
+
+int filter_compile(filter_t *filter, const char *expression)
+{
+	struct filter_parser_t parser;
+
+	free_filter(filter);
+
+	filter->now = time(NULL);
+
+	parser.filter = filter;
+	parser.expression = expression;
+	parser.p = expression;
+
+	skip_space(&parser);
+	if (*parser.p == '\0')
+	{
+		return 0;
+	}
+
+	if ((filter->root = parse_or(&parser)) == -1)
+	{
+		free_filter(filter);
+		return -1;
+	}
+
+	skip_space(&parser);
+	if (*parser.p != '\0')
+	{
+		parse_error(&parser, "expected && or || ");
+		free_filter(filter);
+		return -1;
+	}
+
+	return 0;
+}
+
+int filter_matches(filter_t *filter, const char *name, size_t namelen,
+				   const struct stat *st)
+{
+	if (filter->root == -1)
+		return true;
+
+	return match_node(filter, filter->root, name, namelen, st);
+}
+
+void free_filter(filter_t *filter)
+{
+	int i;
+
+	for (i = 0; i < filter->count; i++)
+	{
+		if (filter->nodes[i].glob)
+		{
+			free_globset(filter->nodes[i].glob);
+			free(filter->nodes[i].glob);
+		}
+	}
+	free(filter->nodes);
+
+	init_filter(filter);
+}
+
+#pragma mark Parsing
+static int parse_or(struct filter_parser_t *parser)
+{
+	int left, right, node;
+
+	if ((left = parse_and(parser)) == -1)
+		return -1;
+
+	for (;;)
+	{
+		skip_space(parser);
+		if (strncmp(parser->p, "||", 2))
+			return left;
+		parser->p += 2;
+
+		if ((right = parse_and(parser)) == -1)
+			return -1;
+
+		node = new_node(parser->filter, FILTER_OR);
+		parser->filter->nodes[node].left = left;
+		parser->filter->nodes[node].right = right;
+		left = node;
+	}
+}
+
+static int parse_and(struct filter_parser_t *parser)
+{
+	int left, right, node;
+
+	if ((left = parse_unary(parser)) == -1)
+		return -1;
+
+	for (;;)
+	{
+		skip_space(parser);
+		if (strncmp(parser->p, "&&", 2))
+			return left;
+		parser->p += 2;
+
+		if ((right = parse_unary(parser)) == -1)
+			return -1;
+
+		node = new_node(parser->filter, FILTER_AND);
+		parser->filter->nodes[node].left = left;
+		parser->filter->nodes[node].right = right;
+		left = node;
+	}
+}
+
+static int parse_unary(struct filter_parser_t *parser)
+{
+	int operand, node;
+
+	skip_space(parser);
+
+	if (*parser->p == '!' && parser->p[1] != '=')
+	{
+		parser->p++;
+		if ((operand = parse_unary(parser)) == -1)
+			return -1;
+
+		node = new_node(parser->filter, FILTER_NOT);
+		parser->filter->nodes[node].left = operand;
+		return node;
+	}
+
+	if (*parser->p == '(')
+	{
+		parser->p++;
+		if ((operand = parse_or(parser)) == -1)
+			return -1;
+
+		skip_space(parser);
+		if (*parser->p != ')')
+			return parse_error(parser, "expected ) ");
+		parser->p++;
+
+		return operand;
+	}
+
+	return parse_comparison(parser);
+}
+
+static int parse_comparison(struct filter_parser_t *parser)
+{
+	const char *start = parser->p;
+	int field = -1, op, node, i;
+	long long value = 0;
+	size_t len;
+
+	while (isalpha((unsigned char) *parser->p))
+		parser->p++;
+	len = parser->p - start;
+
+	for (i = 0; field_names[i].name; i++)
+	{
+		if (strlen(field_names[i].name) == len &&
+			!strncmp(field_names[i].name, start, len))
+		{
+			field = field_names[i].field;
+			break;
+		}
+	}
+	if (field == -1)
+	{
+		parser->p = start;
+		return parse_error(parser, "unknown field ");
+	}
+
+	skip_space(parser);
+	if (!strncmp(parser->p, "==", 2))		{ op = OP_EQ; parser->p += 2; }
+	else if (!strncmp(parser->p, "!=", 2))	{ op = OP_NE; parser->p += 2; }
+	else if (!strncmp(parser->p, "<=", 2))	{ op = OP_LE; parser->p += 2; }
+	else if (!strncmp(parser->p, ">=", 2))	{ op = OP_GE; parser->p += 2; }
+	else if (*parser->p == '=')				{ op = OP_EQ; parser->p++; }
+	else if (*parser->p == '<')				{ op = OP_LT; parser->p++; }
+	else if (*parser->p == '>')				{ op = OP_GT; parser->p++; }
+	else
+		return parse_error(parser, "expected a comparison ");
+
+	if ((field == FIELD_NAME || field == FIELD_TYPE) &&
+		op != OP_EQ && op != OP_NE)
+	{
+		return parse_error(parser, "only == and != work for this field ");
+	}
+
+	start = parser->p;
+	if (read_value(parser) == -1)
+		return -1;
+
+	node = new_node(parser->filter, FILTER_CMP);
+	parser->filter->nodes[node].field = field;
+	parser->filter->nodes[node].op = op;
+
+	if (field == FIELD_NAME)
+	{
+		CREATE(parser->filter->nodes[node].glob, sizeof(globset_t));
+		init_globset(parser->filter->nodes[node].glob);
+		globset_add(parser->filter->nodes[node].glob, parser->value);
+		return node;
+	}
+
+	if (parse_value(parser, field, &value) == -1)
+	{
+		parser->p = start;
+		return parse_error(parser, "bad value ");
+	}
+	parser->filter->nodes[node].value = value;
+
+	return node;
+}
+
+// Turns parser->value into a number, as the field wants it.
+static int parse_value(struct filter_parser_t *parser, int field,
+					   long long *value)
+{
+	const char *str = parser->value;
+	char *end;
+	struct passwd *pw;
+	struct group *gr;
+
+	switch (field)
+	{
+		case FIELD_SIZE:
+			*value = strtoll(str, &end, 10);
+			if (end == str)
+				return -1;
+			switch (toupper((unsigned char) *end))
+			{
+				case 'P': *value *= 1024ll;	/* FALLTHROUGH */
+				case 'T': *value *= 1024ll;	/* FALLTHROUGH */
+				case 'G': *value *= 1024ll;	/* FALLTHROUGH */
+				case 'M': *value *= 1024ll;	/* FALLTHROUGH */
+				case 'K': *value *= 1024ll; end++; break;
+				default: break;
+			}
+			if (toupper((unsigned char) *end) == 'B')
+				end++;
+			return (*end == '\0') ? 0 : -1;
+		case FIELD_MTIME:
+		case FIELD_ATIME:
+		case FIELD_CTIME:
+			return parse_time(parser, value);
+		case FIELD_TYPE:
+			if (strlen(str) != 1 || !strchr("FDLSUBCX",
+											toupper((unsigned char) *str)))
+				return -1;
+			*value = toupper((unsigned char) *str);
+			return 0;
+		case FIELD_OWNER:
+			*value = strtoll(str, &end, 10);
+			if (end != str && *end == '\0')
+				return 0;
+			if ((pw = getpwnam(str)) == NULL)
+				return -1;
+			*value = pw->pw_uid;
+			return 0;
+		case FIELD_GROUP:
+			*value = strtoll(str, &end, 10);
+			if (end != str && *end == '\0')
+				return 0;
+			if ((gr = getgrnam(str)) == NULL)
+				return -1;
+			*value = gr->gr_gid;
+			return 0;
+		case FIELD_PERM:
+			*value = strtoll(str, &end, 8);
+			return (end != str && *end == '\0') ? 0 : -1;
+		case FIELD_INODE:
+		case FIELD_DEV:
+			*value = (long long) strtoull(str, &end, 10);
+			return (end != str && *end == '\0') ? 0 : -1;
+		default:
+			return -1;
+	}
+}
+
+// A time is an offset from now ("-1d", "+2h"), a date ("2008-12-02",
+// "2008-12-02T13:30"), or seconds since the epoch.
+static int parse_time(struct filter_parser_t *parser, long long *value)
+{
+	const char *str = parser->value;
+	struct tm tm;
+	char *end;
+	int consumed = 0;
+
+	if (*str == '-' || *str == '+')
+	{
+		*value = strtoll(str, &end, 10);
+		if (end == str + 1)
+			return -1;
+		switch (*end)
+		{
+			case 'w': *value *= 7;	/* FALLTHROUGH */
+			case 'd': *value *= 24;	/* FALLTHROUGH */
+			case 'h': *value *= 60;	/* FALLTHROUGH */
+			case 'm': *value *= 60; end++; break;
+			case 's': end++; break;
+			default: break;
+		}
+		*value += parser->filter->now;
+		return (*end == '\0') ? 0 : -1;
+	}
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(str, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			   &consumed) == 3)
+	{
+		str += consumed;
+		if ((*str == 'T' || *str == ' ') &&
+			sscanf(str + 1, "%2d:%2d%n", &tm.tm_hour, &tm.tm_min,
+				   &consumed) == 2)
+		{
+			str += consumed + 1;
+			if (*str == ':' && sscanf(str + 1, "%2d%n", &tm.tm_sec,
+									  &consumed) == 1)
+				str += consumed + 1;
+		}
+		if (*str != '\0')
+			return -1;
+
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		tm.tm_isdst = -1;
+		*value = mktime(&tm);
+		return 0;
+	}
+
+	*value = strtoll(str, &end, 10);
+	return (end != str && *end == '\0') ? 0 : -1;
+}
+
+// Reads a value into parser->value: quoted, or up to the next space or
+// operator character.
+static int read_value(struct filter_parser_t *parser)
+{
+	size_t len = 0;
+	char quote;
+
+	skip_space(parser);
+
+	if (*parser->p == '\'' || *parser->p == '"')
+	{
+		quote = *parser->p++;
+		while (*parser->p && *parser->p != quote)
+		{
+			if (len < sizeof(parser->value) - 1)
+				parser->value[len++] = *parser->p;
+			parser->p++;
+		}
+		if (*parser->p != quote)
+			return parse_error(parser, "unterminated quote ");
+		parser->p++;
+	}
+	else
+	{
+		while (*parser->p && !isspace((unsigned char) *parser->p) &&
+			   !strchr("()&|!<>=", *parser->p))
+		{
+			if (len < sizeof(parser->value) - 1)
+				parser->value[len++] = *parser->p;
+			parser->p++;
+		}
+	}
+
+	parser->value[len] = '\0';
+
+	if (len == 0)
+		return parse_error(parser, "expected a value ");
+
+	return 0;
+}
+
+static int new_node(filter_t *filter, int type)
+{
+	if (filter->count >= filter->capacity)
+	{
+		filter->capacity = MAX(filter->capacity * 2, 8);
+		if (filter->nodes)
+		{
+			RECREATE(filter->nodes,
+					 filter->capacity * sizeof(struct filter_node_t));
+		}
+		else
+		{
+			CREATE(filter->nodes,
+				   filter->capacity * sizeof(struct filter_node_t));
+		}
+	}
+
+	memset(&(filter->nodes[filter->count]), 0, sizeof(struct filter_node_t));
+	filter->nodes[filter->count].type = type;
+	filter->nodes[filter->count].left = -1;
+	filter->nodes[filter->count].right = -1;
+
+	return filter->count++;
+}
+
+static int parse_error(struct filter_parser_t *parser, const char *message)
+{
+	LogError("Bad filter expression: %sat character %d of \"%s\"\n",
+			 message, (int)(parser->p - parser->expression) + 1,
+			 parser->expression);
+	return -1;
+}
+
+static void skip_space(struct filter_parser_t *parser)
+{
+	while (isspace((unsigned char) *parser->p))
+		parser->p++;
+}
+
+#pragma mark Matching
+static int match_node(filter_t *filter, int index, const char *name,
+					  size_t namelen, const struct stat *st)
+{
+	struct filter_node_t *node = &(filter->nodes[index]);
+	long long actual;
+
+	switch (node->type)
+	{
+		case FILTER_AND:
+			return (match_node(filter, node->left, name, namelen, st) &&
+					match_node(filter, node->right, name, namelen, st));
+		case FILTER_OR:
+			return (match_node(filter, node->left, name, namelen, st) ||
+					match_node(filter, node->right, name, namelen, st));
+		case FILTER_NOT:
+			return !match_node(filter, node->left, name, namelen, st);
+		default:
+			break;
+	}
+
+	switch (node->field)
+	{
+		case FIELD_SIZE:	actual = st->st_size;				break;
+		case FIELD_MTIME:	actual = st->st_mtime;				break;
+		case FIELD_ATIME:	actual = st->st_atime;				break;
+		case FIELD_CTIME:	actual = st->st_ctime;				break;
+		case FIELD_TYPE:	actual = type_letter(st->st_mode);	break;
+		case FIELD_OWNER:	actual = st->st_uid;				break;
+		case FIELD_GROUP:	actual = st->st_gid;				break;
+		case FIELD_PERM:	actual = st->st_mode & 07777;		break;
+		case FIELD_INODE:	actual = (long long) st->st_ino;	break;
+		case FIELD_DEV:		actual = (long long) st->st_dev;	break;
+		case FIELD_NAME:
+			actual = globset_matches(node->glob, name, namelen);
+			return (node->op == OP_EQ) ? actual : !actual;
+		default:
+			return false;
+	}
+
+	switch (node->op)
+	{
+		case OP_EQ:	return actual == node->value;
+		case OP_NE:	return actual != node->value;
+		case OP_LT:	return actual < node->value;
+		case OP_LE:	return actual <= node->value;
+		case OP_GT:	return actual > node->value;
+		case OP_GE:	return actual >= node->value;
+		default:	return false;
+	}
+}
+
+// The same letters as the %T column.
+static char type_letter(mode_t mode)
+{
+	if (S_ISDIR(mode))	return 'D';
+	if (S_ISLNK(mode))	return 'L';
+	if (S_ISSOCK(mode))	return 'S';
+	if (S_ISFIFO(mode))	return 'U';
+	if (S_ISBLK(mode))	return 'B';
+	if (S_ISCHR(mode))	return 'C';
+	if (S_ISREG(mode))	return 'F';
+	return 'X';
+}
@@ -0,0 +1,79 @@
+/*
+ *  filter.h
+ *  snapper
+ *
+ *  Filter expressions (--where), compiled once and checked against each
+ *  file's stat() as the walk finds it, so files that don't match never
+ *  become records.  An expression is comparisons joined with && and ||,
+ *  negated with !, and grouped with parentheses:
+ *
+ *		size>100M && mtime>-1d && type==F
+ *		(owner==root || group==wheel) && !name==*.o
+ *
+ *  Comparisons are a field, one of == (or =), !=, <, <=, > or >=, and a
+ *  value.  Fields and their values:
+ *		size			Bytes, with an optional K, M, G, T or P (powers of 1024)
+ *		mtime, atime,	Seconds since the epoch, a local YYYY-MM-DD[THH:MM[:SS]]
+ *		ctime			date, or a signed offset from now with a unit of s, m,
+ *						h, d or w, so mtime>-1d is "modified in the last day"
+ *		type			One of the %T letters (F, D, L, S, U, B, C)
+ *		owner, group	A user or group name, or a numeric ID
+ *		perm			Permission bits, in octal
+ *		inode, dev		Numbers
+ *		name			A wildcard pattern (as in ignore strings), == or != only
+ *
+ *  Values can be quoted with ' or " if they hold spaces or operators.
+ *
+ *  Requires globset.h.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#pragma mark Node types
+#define FILTER_AND		0
+#define FILTER_OR		1
+#define FILTER_NOT		2
+#define FILTER_CMP		3
+
+#pragma mark Data Types
+// One node of the expression tree.  Children are indexes into the filter's
+// node array.
+struct filter_node_t {
+	char		type;				// FILTER_* kind of node
+	char		field;				// What a FILTER_CMP looks at
+	char		op;					// How a FILTER_CMP compares
+	int			left;				// First operand (AND, OR, NOT)
+	int			right;				// Second operand (AND, OR)
+	long long	value;				// What a FILTER_CMP compares to
+	globset_t	*glob;				// Or, for names, the pattern
+};
+
+struct filter_t {
+	struct filter_node_t *nodes;	// The expression tree
+	int			count;
+	int			capacity;
+	int			root;				// Index of the top node, -1 if empty
+	time_t		now;				// When it was compiled, for relative times
+};
+
+typedef struct filter_t filter_t;
+
+#pragma mark Functions
+
+// Sets up an empty filter, which matches everything.
+void init_filter(filter_t *filter);
+
+// Compiles an expression into the filter.  Returns 0, or -1 (after logging
+// what was wrong and where) if the expression doesn't parse.
+int filter_compile(filter_t *filter, const char *expression);
+
+// Whether a file with this name (its last path component) and stat()
+// matches the filter.
+int filter_matches(filter_t *filter, const char *name, size_t namelen,
+				   const struct stat *st);
+
+// Frees everything the filter holds.
+void free_filter(filter_t *filter);
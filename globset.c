@@ -0,0 +1,492 @@
+/*
+ *  globset.c
+ *  snapper
+ *
+ *  Glob patterns, compiled into one lazily built DFA.  See globset.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "comm.h"
+#include "hash.h"
+#include "globset.h"
+#include "util_macros.h"
+
+#pragma mark NFA position types
+#define GLOBSET_CHAR		0	// c, then on to the next position
+#define GLOBSET_ANY			1	// Any byte but '/'
+#define GLOBSET_CLASS		2	// A byte in class_bits (never '/')
+#define GLOBSET_STAR		3	// Any bytes but '/', staying put; or skip
+#define GLOBSET_DIRS		4	// "**/": enters the loop, or skips it
+#define GLOBSET_DIRS_LOOP	5	// Bytes up to and including a '/'
+#define GLOBSET_REST		6	// A trailing "**": any bytes at all
+#define GLOBSET_ACCEPT		7	// The end of a pattern
+
+#pragma mark Local Prototypes
+static void add_node(globset_t *set, char type, unsigned char c,
+					 const unsigned char *class_bits);
+static const char *parse_class(const char *pattern, unsigned char *bits);
+static void begin_set(globset_t *set);
+static void add_closure(globset_t *set, int position);
+static int state_for_scratch(globset_t *set);
+static int next_state(globset_t *set, int state, unsigned char c);
+static void reset_dfa(globset_t *set);
+
+#pragma mark Function Implementations
+void init_globset(globset_t *set)
+{
+	memset(set, 0, sizeof(globset_t));
+	set->start_state = -1;
+}
+
+int globset_add(globset_t *set, const char *pattern)
+{
+	unsigned char bits[32];
+	const char *p, *end;
+
+	if (pattern == NULL || *pattern == '\0')
+	{
+		return -1;
+	}
+
+	if (set->pattern_count >= set->start_capacity)
+	{
+		set->start_capacity = MAX(set->start_capacity * 2, 16);
+		if (set->starts)
+		{
+			RECREATE(set->starts, set->start_capacity * sizeof(int));
+		}
+		else
+		{
+			CREATE(set->starts, set->start_capacity * sizeof(int));
+		}
+	}
+	set->starts[set->pattern_count++] = set->node_count;
+
+	for (p = pattern; *p; p++)
+	{
+		switch (*p) {
+			case '*':
+				if (p[1] == '*' && (p == pattern || p[-1] == '/') &&
+					(p[2] == '/' || p[2] == '\0'))
+				{
+					// A "**" component.
+					if (p[2] == '\0')
+					{
+						add_node(set, GLOBSET_REST, 0, NULL);
+						p++;
+					}
+					else
+					{
+						add_node(set, GLOBSET_DIRS, 0, NULL);
+						add_node(set, GLOBSET_DIRS_LOOP, 0, NULL);
+						p += 2;
+					}
+				}
+				else
+				{
+					// Runs of stars are the same as one.
+					while (p[1] == '*')
+						p++;
+					add_node(set, GLOBSET_STAR, 0, NULL);
+				}
+				break;
+			case '?':
+				add_node(set, GLOBSET_ANY, 0, NULL);
+				break;
+			case '[':
+				if ((end = parse_class(p + 1, bits)) != NULL)
+				{
+					add_node(set, GLOBSET_CLASS, 0, bits);
+					p = end;
+				}
+				else
+				{
+					// No closing bracket; it's just a '['.
+					add_node(set, GLOBSET_CHAR, '[', NULL);
+				}
+				break;
+			case '\\':
+				if (p[1] != '\0')
+					p++;
+				add_node(set, GLOBSET_CHAR, *p, NULL);
+				break;
+			default:
+				add_node(set, GLOBSET_CHAR, *p, NULL);
+				break;
+		}
+	}
+
+	add_node(set, GLOBSET_ACCEPT, 0, NULL);
+
+	// The DFA was built for the old patterns.
+	reset_dfa(set);
+
+	return 0;
+}
+
+int globset_matches(globset_t *set, const char *str, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) str;
+	struct globset_state_t *state;
+	int current, next, j;
+	size_t i;
+
+	if (set->pattern_count == 0)
+	{
+		return 0;
+	}
+
+	if (set->start_state == -1)
+	{
+		begin_set(set);
+		for (j = 0; j < set->pattern_count; j++)
+		{
+			add_closure(set, set->starts[j]);
+		}
+		set->start_state = state_for_scratch(set);
+	}
+
+	current = set->start_state;
+	for (i = 0; i < len; i++)
+	{
+		state = set->states[current];
+		if (state->count == 0)
+		{
+			// Dead: no pattern can match from here.
+			return 0;
+		}
+
+		next = state->next[s[i]];
+		if (next == -1)
+		{
+			next = next_state(set, current, s[i]);
+		}
+		current = next;
+	}
+
+	return set->states[current]->accepting;
+}
+
+int is_glob_pattern(const char *str)
+{
+	return strpbrk(str, "*?[\\") != NULL;
+}
+
+size_t globset_memory(globset_t *set)
+{
+	size_t bytes;
+	int i;
+
+	bytes = set->node_capacity * (sizeof(struct globset_node_t) +
+								  sizeof(unsigned) + sizeof(int)) +
+		set->start_capacity * sizeof(int);
+
+	if (set->table)
+	{
+		bytes += set->table_capacity * sizeof(int) +
+			GLOBSET_MAX_STATES * sizeof(struct globset_state_t *);
+	}
+	for (i = 0; i < set->state_count; i++)
+	{
+		bytes += sizeof(struct globset_state_t) +
+			set->states[i]->count * sizeof(int);
+	}
+
+	return bytes;
+}
+
+void free_globset(globset_t *set)
+{
+	reset_dfa(set);
+
+	free(set->nodes);
+	free(set->starts);
+	free(set->states);
+	free(set->table);
+	free(set->marks);
+	free(set->scratch);
+
+	init_globset(set);
+}
+
+#pragma mark NFA construction
+static void add_node(globset_t *set, char type, unsigned char c,
+					 const unsigned char *class_bits)
+{
+	struct globset_node_t *node;
+
+	if (set->node_count >= set->node_capacity)
+	{
+		set->node_capacity = MAX(set->node_capacity * 2, 64);
+		if (set->nodes)
+		{
+			RECREATE(set->nodes,
+					 set->node_capacity * sizeof(struct globset_node_t));
+			RECREATE(set->marks, set->node_capacity * sizeof(unsigned));
+			RECREATE(set->scratch, set->node_capacity * sizeof(int));
+		}
+		else
+		{
+			CREATE(set->nodes,
+				   set->node_capacity * sizeof(struct globset_node_t));
+			CREATE(set->marks, set->node_capacity * sizeof(unsigned));
+			CREATE(set->scratch, set->node_capacity * sizeof(int));
+		}
+	}
+
+	node = &(set->nodes[set->node_count]);
+	memset(node, 0, sizeof(struct globset_node_t));
+	node->type = type;
+	node->c = c;
+	if (class_bits)
+	{
+		memcpy(node->class_bits, class_bits, sizeof(node->class_bits));
+	}
+
+	set->marks[set->node_count] = 0;
+	set->node_count++;
+}
+
+// Parses a class, starting just after the '['.  Returns the closing ']', or
+// NULL if there isn't one.
+static const char *parse_class(const char *pattern, unsigned char *bits)
+{
+	const unsigned char *p = (const unsigned char *) pattern;
+	int negate = 0, first = 1, c, last, i;
+
+	memset(bits, 0, 32);
+
+	if (*p == '!' || *p == '^')
+	{
+		negate = 1;
+		p++;
+	}
+
+	for (; *p && (*p != ']' || first); p++, first = 0)
+	{
+		c = *p;
+		if (c == '\\' && p[1])
+			c = *++p;
+
+		last = c;
+		if (p[1] == '-' && p[2] && p[2] != ']')
+		{
+			p += 2;
+			last = *p;
+			if (last == '\\' && p[1])
+				last = *++p;
+		}
+
+		for (i = c; i <= last; i++)
+		{
+			bits[i >> 3] |= 1 << (i & 7);
+		}
+	}
+
+	if (*p != ']')
+	{
+		return NULL;
+	}
+
+	if (negate)
+	{
+		for (i = 0; i < 32; i++)
+			bits[i] = ~bits[i];
+	}
+
+	// Like '*' and '?', classes stay inside a path component.
+	bits['/' >> 3] &= ~(1 << ('/' & 7));
+
+	return (const char *) p;
+}
+
+#pragma mark DFA construction
+// Starts building a new position set in scratch.
+static void begin_set(globset_t *set)
+{
+	set->scratch_count = 0;
+	if (++set->mark == 0)
+	{
+		// Wrapped; clear the old marks so none look current.
+		memset(set->marks, 0, set->node_count * sizeof(unsigned));
+		set->mark = 1;
+	}
+}
+
+// Adds a position to scratch, along with everything reachable from it
+// without reading a byte.
+static void add_closure(globset_t *set, int position)
+{
+	if (set->marks[position] == set->mark)
+	{
+		return;
+	}
+
+	set->marks[position] = set->mark;
+	set->scratch[set->scratch_count++] = position;
+
+	switch (set->nodes[position].type) {
+		case GLOBSET_STAR:
+		case GLOBSET_REST:
+			add_closure(set, position + 1);
+			break;
+		case GLOBSET_DIRS:
+			// Into the loop, or no directories at all.
+			add_closure(set, position + 1);
+			add_closure(set, position + 2);
+			break;
+		default:
+			break;
+	}
+}
+
+static int compare_ints(const void *left, const void *right)
+{
+	return *(const int *) left - *(const int *) right;
+}
+
+// Returns the state for the set in scratch, making it if it's new.  If the
+// DFA is full, it's thrown away first, so any other state numbers the
+// caller holds are no good afterwards.
+static int state_for_scratch(globset_t *set)
+{
+	struct globset_state_t *state;
+	uint64_t slot;
+	int i, id;
+
+	qsort(set->scratch, set->scratch_count, sizeof(int), compare_ints);
+
+	if (set->table == NULL)
+	{
+		set->table_capacity = GLOBSET_MAX_STATES * 2;
+		CREATE(set->table, set->table_capacity * sizeof(int));
+		CREATE(set->states,
+			   GLOBSET_MAX_STATES * sizeof(struct globset_state_t *));
+	}
+
+	slot = xxh64(set->scratch, set->scratch_count * sizeof(int), 0) &
+		(set->table_capacity - 1);
+	while ((id = set->table[slot]) != 0)
+	{
+		state = set->states[id - 1];
+		if (state->count == set->scratch_count &&
+			!memcmp(state->positions, set->scratch,
+					set->scratch_count * sizeof(int)))
+		{
+			return id - 1;
+		}
+		slot = (slot + 1) & (set->table_capacity - 1);
+	}
+
+	if (set->state_count >= GLOBSET_MAX_STATES)
+	{
+		reset_dfa(set);
+		return state_for_scratch(set);
+	}
+
+	CREATE(state, sizeof(struct globset_state_t));
+	state->count = set->scratch_count;
+	if (state->count > 0)
+	{
+		CREATE(state->positions, state->count * sizeof(int));
+		memcpy(state->positions, set->scratch, state->count * sizeof(int));
+	}
+	memset(state->next, 0xff, sizeof(state->next));
+
+	for (i = 0; i < state->count; i++)
+	{
+		if (set->nodes[state->positions[i]].type == GLOBSET_ACCEPT)
+		{
+			state->accepting = 1;
+		}
+	}
+
+	id = set->state_count++;
+	set->states[id] = state;
+	set->table[slot] = id + 1;
+
+	return id;
+}
+
+// Works out (and remembers) where a byte leads from a state.
+static int next_state(globset_t *set, int state, unsigned char c)
+{
+	struct globset_state_t *from = set->states[state];
+	struct globset_node_t *node;
+	unsigned resets = set->resets;
+	int i, position, next;
+
+	begin_set(set);
+
+	for (i = 0; i < from->count; i++)
+	{
+		position = from->positions[i];
+		node = &(set->nodes[position]);
+
+		switch (node->type) {
+			case GLOBSET_CHAR:
+				if (c == node->c)
+					add_closure(set, position + 1);
+				break;
+			case GLOBSET_ANY:
+				if (c != '/')
+					add_closure(set, position + 1);
+				break;
+			case GLOBSET_CLASS:
+				if (node->class_bits[c >> 3] & (1 << (c & 7)))
+					add_closure(set, position + 1);
+				break;
+			case GLOBSET_STAR:
+				if (c != '/')
+					add_closure(set, position);
+				break;
+			case GLOBSET_DIRS_LOOP:
+				// Stay in the loop, and after a '/' also try what follows.
+				add_closure(set, position);
+				if (c == '/')
+					add_closure(set, position + 1);
+				break;
+			case GLOBSET_REST:
+				add_closure(set, position);
+				break;
+			default:
+				break;
+		}
+	}
+
+	next = state_for_scratch(set);
+
+	// If the DFA was reset, from is gone; just don't remember this one.
+	if (set->resets == resets)
+	{
+		from->next[c] = next;
+	}
+
+	return next;
+}
+
+// Throws away every DFA state.  The NFA is kept.
+static void reset_dfa(globset_t *set)
+{
+	int i;
+
+	for (i = 0; i < set->state_count; i++)
+	{
+		free(set->states[i]->positions);
+		free(set->states[i]);
+		set->states[i] = NULL;
+	}
+
+	set->state_count = 0;
+	set->start_state = -1;
+	set->resets++;
+	if (set->table)
+	{
+		memset(set->table, 0, set->table_capacity * sizeof(int));
+	}
+}
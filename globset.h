@@ -0,0 +1,93 @@
+/*
+ *  globset.h
+ *  snapper
+ *
+ *  A set of glob patterns, all matched at once.  The patterns are compiled
+ *  into one NFA, and strings are run through a DFA built from it lazily:
+ *  each DFA state is a set of NFA positions, created the first time some
+ *  string reaches it, and its transitions are filled in as they're used.
+ *  So matching a string costs one table lookup per character, no matter how
+ *  many patterns there are.
+ *
+ *  Pattern syntax:
+ *		*		Any run of characters, except '/'
+ *		?		Any one character, except '/'
+ *		[...]	One character from the class ("[a-z_]"), or not in it if the
+ *				class starts with '!' or '^'.  Never matches '/'.
+ *		**		As a whole path component: any number of components,
+ *				including none, so /var, **, tmp joined with slashes
+ *				matches /var/tmp and /var/a/b/tmp.  At the end, anything
+ *				at all.  Elsewhere, the same as '*'.
+ *		\c		The character c, literally.
+ *
+ *  A pattern has to match the whole string.
+ *
+ */
+
+#include <stddef.h>
+
+#pragma mark Tunables
+// Most DFA states kept at once.  If matching needs more, the DFA is thrown
+// away and rebuilt, so this bounds memory (each state is a little over 1K).
+// Keep it a power of two.
+#define GLOBSET_MAX_STATES	4096
+
+#pragma mark Data Types
+// One NFA position.  Positions of a pattern are consecutive, and matching a
+// position's character moves to the next one.
+struct globset_node_t {
+	char			type;			// GLOBSET_* kind of position
+	unsigned char	c;				// The character, for GLOBSET_CHAR
+	unsigned char	class_bits[32];	// The characters, for GLOBSET_CLASS
+};
+
+// One DFA state: a set of NFA positions, and where each byte leads.
+struct globset_state_t {
+	int				*positions;		// Sorted NFA positions
+	int				count;			// How many (none is the dead state)
+	char			accepting;		// Some pattern matched
+	int				next[256];		// State for each byte, -1 if unknown
+};
+
+struct globset_t {
+	struct globset_node_t *nodes;	// The NFA, pattern after pattern
+	int				node_count;
+	int				node_capacity;
+	int				*starts;		// First position of each pattern
+	int				pattern_count;
+	int				start_capacity;
+
+	struct globset_state_t **states;	// The DFA built so far
+	int				state_count;
+	int				start_state;	// -1 until (re)built
+	int				*table;			// Position set -> state + 1, or 0
+	int				table_capacity;	// Slots in table, a power of two
+	unsigned		resets;			// Times the DFA has been thrown away
+
+	unsigned		*marks;			// Per position: added to scratch yet?
+	unsigned		mark;			// Current mark value
+	int				*scratch;		// The set being built
+	int				scratch_count;
+};
+
+typedef struct globset_t globset_t;
+
+#pragma mark Functions
+
+// Sets up an empty set.
+void init_globset(globset_t *set);
+
+// Adds a pattern.  Returns 0, or -1 if it's empty.
+int globset_add(globset_t *set, const char *pattern);
+
+// Returns 1 if any pattern matches all len characters of str, 0 otherwise.
+int globset_matches(globset_t *set, const char *str, size_t len);
+
+// Returns 1 if the string has any glob special characters.
+int is_glob_pattern(const char *str);
+
+// Bytes the set holds, the DFA built so far included.
+size_t globset_memory(globset_t *set);
+
+// Frees everything in the set.
+void free_globset(globset_t *set);
@@ -0,0 +1,356 @@
+/*
+ *  hash.c
+ *  snapper
+ *
+ *  Content hashing primitives.  XXH64 follows the reference description by
+ *  Yann Collet; SHA-256 follows FIPS 180-4.  Both are written against plain
+ *  byte buffers so they behave the same on any endianness.
+ *
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "hash.h"
+
+#pragma mark XXH64
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t read64_le(const unsigned char *p)
+{
+	return ((uint64_t)p[0]) | ((uint64_t)p[1] << 8) |
+		((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+		((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint32_t read32_le(const unsigned char *p)
+{
+	return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void xxh64_init(struct xxh64_state_t *state, uint64_t seed)
+{
+	memset(state, 0, sizeof(*state));
+	state->seed = seed;
+	state->v[0] = seed + PRIME64_1 + PRIME64_2;
+	state->v[1] = seed + PRIME64_2;
+	state->v[2] = seed;
+	state->v[3] = seed - PRIME64_1;
+}
+
+static void xxh64_stripe(struct xxh64_state_t *state, const unsigned char *p)
+{
+	state->v[0] = xxh64_round(state->v[0], read64_le(p));
+	state->v[1] = xxh64_round(state->v[1], read64_le(p + 8));
+	state->v[2] = xxh64_round(state->v[2], read64_le(p + 16));
+	state->v[3] = xxh64_round(state->v[3], read64_le(p + 24));
+}
+
+static void xxh64_update(struct xxh64_state_t *state,
+						 const unsigned char *p, size_t len)
+{
+	state->total_len += len;
+
+	// Top up a partial stripe from the last call first.
+	if (state->memsize + len < 32)
+	{
+		memcpy(state->mem + state->memsize, p, len);
+		state->memsize += len;
+		return;
+	}
+
+	if (state->memsize)
+	{
+		size_t fill = 32 - state->memsize;
+		memcpy(state->mem + state->memsize, p, fill);
+		xxh64_stripe(state, state->mem);
+		p += fill;
+		len -= fill;
+		state->memsize = 0;
+	}
+
+	// Whole stripes straight from the caller's buffer.
+	for (; len >= 32; p += 32, len -= 32)
+	{
+		xxh64_stripe(state, p);
+	}
+
+	memcpy(state->mem, p, len);
+	state->memsize = len;
+}
+
+static uint64_t xxh64_digest(const struct xxh64_state_t *state)
+{
+	const unsigned char *p = state->mem;
+	size_t len = state->memsize;
+	uint64_t h;
+
+	if (state->total_len >= 32)
+	{
+		h = ROTL64(state->v[0], 1) + ROTL64(state->v[1], 7) +
+			ROTL64(state->v[2], 12) + ROTL64(state->v[3], 18);
+		h = xxh64_merge_round(h, state->v[0]);
+		h = xxh64_merge_round(h, state->v[1]);
+		h = xxh64_merge_round(h, state->v[2]);
+		h = xxh64_merge_round(h, state->v[3]);
+	}
+	else
+	{
+		h = state->seed + PRIME64_5;
+	}
+
+	h += state->total_len;
+
+	for (; len >= 8; p += 8, len -= 8)
+	{
+		h ^= xxh64_round(0, read64_le(p));
+		h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+
+	if (len >= 4)
+	{
+		h ^= (uint64_t)read32_le(p) * PRIME64_1;
+		h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+		len -= 4;
+	}
+
+	for (; len > 0; p++, len--)
+	{
+		h ^= (*p) * PRIME64_5;
+		h = ROTL64(h, 11) * PRIME64_1;
+	}
+
+	// Final avalanche.
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+	struct xxh64_state_t state;
+
+	xxh64_init(&state, seed);
+	xxh64_update(&state, data, len);
+	return xxh64_digest(&state);
+}
+
+#pragma mark SHA-256
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, r)	(((x) >> (r)) | ((x) << (32 - (r))))
+
+static void sha256_init(struct sha256_state_t *state)
+{
+	memset(state, 0, sizeof(*state));
+	state->h[0] = 0x6a09e667;
+	state->h[1] = 0xbb67ae85;
+	state->h[2] = 0x3c6ef372;
+	state->h[3] = 0xa54ff53a;
+	state->h[4] = 0x510e527f;
+	state->h[5] = 0x9b05688c;
+	state->h[6] = 0x1f83d9ab;
+	state->h[7] = 0x5be0cd19;
+}
+
+static void sha256_block(struct sha256_state_t *state, const unsigned char *p)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+	{
+		w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+			((uint32_t)p[i * 4 + 2] << 8) | ((uint32_t)p[i * 4 + 3]);
+	}
+	for (i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^
+			(w[i-15] >> 3);
+		uint32_t s1 = ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^
+			(w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	a = state->h[0]; b = state->h[1]; c = state->h[2]; d = state->h[3];
+	e = state->h[4]; f = state->h[5]; g = state->h[6]; h = state->h[7];
+
+	for (i = 0; i < 64; i++)
+	{
+		t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+			((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+			((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state->h[0] += a; state->h[1] += b; state->h[2] += c; state->h[3] += d;
+	state->h[4] += e; state->h[5] += f; state->h[6] += g; state->h[7] += h;
+}
+
+static void sha256_update(struct sha256_state_t *state,
+						  const unsigned char *p, size_t len)
+{
+	state->total_len += len;
+
+	if (state->memsize)
+	{
+		size_t fill = 64 - state->memsize;
+		if (fill > len)
+			fill = len;
+		memcpy(state->mem + state->memsize, p, fill);
+		state->memsize += fill;
+		p += fill;
+		len -= fill;
+		if (state->memsize < 64)
+			return;
+		sha256_block(state, state->mem);
+		state->memsize = 0;
+	}
+
+	for (; len >= 64; p += 64, len -= 64)
+	{
+		sha256_block(state, p);
+	}
+
+	memcpy(state->mem, p, len);
+	state->memsize = len;
+}
+
+static void sha256_digest(struct sha256_state_t *state, unsigned char *out)
+{
+	uint64_t bits = state->total_len * 8;
+	unsigned char pad[72];
+	size_t padlen;
+	int i;
+
+	// 0x80, then zeros up to 56 mod 64, then the big endian bit length.
+	padlen = (state->memsize < 56) ? 56 - state->memsize :
+		120 - state->memsize;
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	for (i = 0; i < 8; i++)
+	{
+		pad[padlen + i] = (unsigned char)(bits >> (56 - i * 8));
+	}
+	sha256_update(state, pad, padlen + 8);
+
+	for (i = 0; i < 8; i++)
+	{
+		out[i * 4]		= (unsigned char)(state->h[i] >> 24);
+		out[i * 4 + 1]	= (unsigned char)(state->h[i] >> 16);
+		out[i * 4 + 2]	= (unsigned char)(state->h[i] >> 8);
+		out[i * 4 + 3]	= (unsigned char)(state->h[i]);
+	}
+}
+
+#pragma mark Generic interface
+void hash_init(hash_state *state, int algorithm)
+{
+	state->algorithm = algorithm;
+
+	switch (algorithm) {
+		case HASH_SHA256:
+			sha256_init(&(state->u.sha256));
+			break;
+		case HASH_XXH64:
+		default:
+			state->algorithm = HASH_XXH64;
+			xxh64_init(&(state->u.xxh64), 0);
+			break;
+	}
+}
+
+void hash_update(hash_state *state, const void *data, size_t len)
+{
+	if (state->algorithm == HASH_SHA256)
+		sha256_update(&(state->u.sha256), data, len);
+	else
+		xxh64_update(&(state->u.xxh64), data, len);
+}
+
+size_t hash_final(hash_state *state, unsigned char *digest)
+{
+	uint64_t h;
+	int i;
+
+	if (state->algorithm == HASH_SHA256)
+	{
+		sha256_digest(&(state->u.sha256), digest);
+		return 32;
+	}
+
+	// XXH64 uses the canonical (big endian) representation.
+	h = xxh64_digest(&(state->u.xxh64));
+	for (i = 0; i < 8; i++)
+	{
+		digest[i] = (unsigned char)(h >> (56 - i * 8));
+	}
+	return 8;
+}
+
+void hash_to_hex(const unsigned char *digest, size_t len, char *out)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		*out++ = hexdigits[digest[i] >> 4];
+		*out++ = hexdigits[digest[i] & 0x0f];
+	}
+	*out = '\0';
+}
+
+int hash_algorithm_from_name(const char *name)
+{
+	if (!strcmp(name, "xxh64"))
+		return HASH_XXH64;
+	if (!strcmp(name, "sha256"))
+		return HASH_SHA256;
+	return -1;
+}
+
+const char *hash_algorithm_name(int algorithm)
+{
+	return (algorithm == HASH_SHA256) ? "sha256" : "xxh64";
+}
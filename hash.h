@@ -0,0 +1,70 @@
+/*
+ *  hash.h
+ *  snapper
+ *
+ *  Content hashing primitives.  A fast non-cryptographic hash (XXH64) is the
+ *  default; SHA-256 is available when a cryptographic digest is wanted.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#pragma mark Algorithms
+#define HASH_XXH64			0
+#define HASH_SHA256			1
+
+// Largest digest any algorithm produces, in bytes (SHA-256).
+#define HASH_MAX_DIGEST		32
+// Room for a hex encoded digest, plus the null terminator.
+#define HASH_MAX_HEX		(HASH_MAX_DIGEST * 2 + 1)
+
+#pragma mark Data Types
+struct xxh64_state_t {
+	uint64_t	total_len;			// Bytes fed in so far
+	uint64_t	v[4];				// Accumulator lanes
+	unsigned char mem[32];			// Partial stripe
+	size_t		memsize;			// Bytes in the partial stripe
+	uint64_t	seed;
+};
+
+struct sha256_state_t {
+	uint64_t	total_len;			// Bytes fed in so far
+	uint32_t	h[8];				// Chaining value
+	unsigned char mem[64];			// Partial block
+	size_t		memsize;			// Bytes in the partial block
+};
+
+struct hash_state_t {
+	int			algorithm;			// One of the HASH_* values above
+	union {
+		struct xxh64_state_t	xxh64;
+		struct sha256_state_t	sha256;
+	} u;
+};
+
+typedef struct hash_state_t hash_state;
+
+#pragma mark Functions
+
+// Starts a new digest with the given algorithm.
+void hash_init(hash_state *state, int algorithm);
+
+// Feeds len bytes into the digest.
+void hash_update(hash_state *state, const void *data, size_t len);
+
+// Finishes the digest into digest (at least HASH_MAX_DIGEST bytes).  Returns
+// the number of bytes written.
+size_t hash_final(hash_state *state, unsigned char *digest);
+
+// One-shot XXH64 of a buffer.
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+// Writes the hex representation of digest into out (at least len * 2 + 1).
+void hash_to_hex(const unsigned char *digest, size_t len, char *out);
+
+// Maps "xxh64"/"sha256" to an algorithm.  Returns -1 if unknown.
+int hash_algorithm_from_name(const char *name);
+
+// The short name of an algorithm, as used in headers and options.
+const char *hash_algorithm_name(int algorithm);
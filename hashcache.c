@@ -0,0 +1,362 @@
+/*
+ *  hashcache.c
+ *  snapper
+ *
+ *  Persistent content hash cache.  See hashcache.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "hash.h"
+#include "hashcache.h"
+#include "util_macros.h"
+
+#pragma mark Local Prototypes
+static uint64_t slot_for_key(const struct hashcache_key_t *key, int algorithm,
+							 uint64_t capacity);
+static int key_matches(const struct hashcache_entry_t *entry,
+					   const struct hashcache_key_t *key, int algorithm);
+static int insert_entry(struct hashcache_entry_t *entries, uint64_t capacity,
+						const struct hashcache_entry_t *entry);
+static int has_entry(const struct hashcache_entry_t *entries,
+					 uint64_t capacity, const struct hashcache_entry_t *entry);
+static void grow_new_table(hashcache_t *cache);
+static void keep_unseen(hashcache_t *cache);
+
+#pragma mark Function Implementations
+int init_hashcache(hashcache_t *cache, const char *path)
+{
+	struct hashcache_header_t *header;
+	struct stat info;
+	int fd;
+
+	cache->path = strdup(path);
+	cache->started = time(0);
+	cache->map = NULL;
+	cache->map_len = 0;
+	cache->old_entries = NULL;
+	cache->old_capacity = 0;
+	cache->new_count = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	pthread_mutex_init(&(cache->lock), NULL);
+
+	fd = open(path, O_RDONLY);
+	if (fd != -1 && fstat(fd, &info) == 0 &&
+		info.st_size >= (off_t)sizeof(struct hashcache_header_t))
+	{
+		cache->map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (cache->map == MAP_FAILED)
+		{
+			LogError("Couldn't map hash cache %s: %s\n", path, strerror(errno));
+			cache->map = NULL;
+		}
+		else
+		{
+			cache->map_len = info.st_size;
+		}
+	}
+	else if (fd == -1 && errno != ENOENT)
+	{
+		LogError("Couldn't open hash cache %s: %s\n", path, strerror(errno));
+	}
+
+	if (fd != -1)
+	{
+		close(fd);
+	}
+
+	// Make sure it's something we wrote, on this kind of machine.
+	if (cache->map)
+	{
+		header = cache->map;
+		if (memcmp(header->magic, HASHCACHE_MAGIC, 8) != 0 ||
+			header->byteorder != HASHCACHE_BYTEORDER ||
+			header->entry_size != sizeof(struct hashcache_entry_t) ||
+			header->capacity == 0 ||
+			(header->capacity & (header->capacity - 1)) != 0 ||
+			cache->map_len != sizeof(struct hashcache_header_t) +
+			header->capacity * sizeof(struct hashcache_entry_t))
+		{
+			LogError("Ignoring unusable hash cache %s\n", path);
+			munmap(cache->map, cache->map_len);
+			cache->map = NULL;
+			cache->map_len = 0;
+		}
+		else
+		{
+			cache->old_entries = (struct hashcache_entry_t *)(header + 1);
+			cache->old_capacity = header->capacity;
+		}
+	}
+
+	// Start this run's table around the size of the last one.
+	cache->new_capacity = MAX(cache->old_capacity, HASHCACHE_MIN_SLOTS);
+	CREATE(cache->new_entries,
+		   cache->new_capacity * sizeof(struct hashcache_entry_t));
+
+	return 0;
+}
+
+size_t hashcache_lookup(hashcache_t *cache, const struct hashcache_key_t *key,
+						int algorithm, unsigned char *digest)
+{
+	const struct hashcache_entry_t *entry = NULL;
+	uint64_t slot, probes;
+
+	if (cache->old_entries)
+	{
+		slot = slot_for_key(key, algorithm, cache->old_capacity);
+		for (probes = 0; probes < cache->old_capacity; probes++)
+		{
+			const struct hashcache_entry_t *candidate =
+				&(cache->old_entries[slot]);
+
+			if (!candidate->used)
+				break;
+
+			if (key_matches(candidate, key, algorithm))
+			{
+				entry = candidate;
+				break;
+			}
+
+			slot = (slot + 1) & (cache->old_capacity - 1);
+		}
+	}
+
+	if (entry == NULL || entry->digest_len > HASH_MAX_DIGEST)
+	{
+		__atomic_add_fetch(&(cache->misses), 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	__atomic_add_fetch(&(cache->hits), 1, __ATOMIC_RELAXED);
+	memcpy(digest, entry->digest, entry->digest_len);
+
+	// Carry it over, so it survives into the next run's cache.
+	hashcache_store(cache, key, algorithm, entry->digest, entry->digest_len);
+
+	return entry->digest_len;
+}
+
+void hashcache_store(hashcache_t *cache, const struct hashcache_key_t *key,
+					 int algorithm, const unsigned char *digest, size_t len)
+{
+	struct hashcache_entry_t entry;
+
+	// A file changed in the same second as this run could change again
+	// without moving its times, so don't trust its hash on the next run.
+	if (key->ctime >= cache->started - 1 || key->mtime >= cache->started - 1)
+	{
+		return;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	entry.key = *key;
+	entry.used = 1;
+	entry.algorithm = algorithm;
+	entry.digest_len = MIN(len, sizeof(entry.digest));
+	memcpy(entry.digest, digest, entry.digest_len);
+
+	pthread_mutex_lock(&(cache->lock));
+
+	// Keep the load factor at or under one half.
+	if ((cache->new_count + 1) * 2 > cache->new_capacity)
+	{
+		grow_new_table(cache);
+	}
+
+	cache->new_count += insert_entry(cache->new_entries, cache->new_capacity,
+									 &entry);
+
+	pthread_mutex_unlock(&(cache->lock));
+}
+
+int hashcache_save(hashcache_t *cache, int unseen)
+{
+	struct hashcache_header_t header;
+	char tmp_path[PATH_MAX];
+	FILE *file;
+
+	if (unseen == HASHCACHE_KEEP_UNSEEN)
+	{
+		keep_unseen(cache);
+	}
+
+	snprintf(tmp_path, PATH_MAX, "%s.tmp.%ld", cache->path, (long) getpid());
+
+	file = fopen(tmp_path, "w");
+	if (file == NULL)
+	{
+		LogError("Couldn't write hash cache %s: %s\n",
+				 tmp_path, strerror(errno));
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HASHCACHE_MAGIC, 8);
+	header.byteorder = HASHCACHE_BYTEORDER;
+	header.entry_size = sizeof(struct hashcache_entry_t);
+	header.capacity = cache->new_capacity;
+	header.count = cache->new_count;
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		fwrite(cache->new_entries, sizeof(struct hashcache_entry_t),
+			   cache->new_capacity, file) != cache->new_capacity ||
+		fflush(file) == EOF || fsync(fileno(file)) == -1)
+	{
+		LogError("Couldn't write hash cache %s: %s\n",
+				 tmp_path, strerror(errno));
+		fclose(file);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	fclose(file);
+
+	// The rename is what makes the new cache visible, all at once.
+	if (rename(tmp_path, cache->path) == -1)
+	{
+		LogError("Couldn't replace hash cache %s: %s\n",
+				 cache->path, strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+void free_hashcache(hashcache_t *cache)
+{
+	if (cache->map)
+	{
+		munmap(cache->map, cache->map_len);
+	}
+
+	free(cache->new_entries);
+	free(cache->path);
+	pthread_mutex_destroy(&(cache->lock));
+
+	cache->map = NULL;
+	cache->old_entries = NULL;
+	cache->new_entries = NULL;
+	cache->path = NULL;
+}
+
+#pragma mark Table helpers
+static uint64_t slot_for_key(const struct hashcache_key_t *key, int algorithm,
+							 uint64_t capacity)
+{
+	return xxh64(key, sizeof(*key), (uint64_t) algorithm) & (capacity - 1);
+}
+
+static int key_matches(const struct hashcache_entry_t *entry,
+					   const struct hashcache_key_t *key, int algorithm)
+{
+	return (entry->algorithm == algorithm &&
+			entry->key.ino == key->ino &&
+			entry->key.dev == key->dev &&
+			entry->key.size == key->size &&
+			entry->key.mtime == key->mtime &&
+			entry->key.ctime == key->ctime);
+}
+
+// Puts entry in the first free slot at or after its home slot, or over an
+// existing entry for the same key.  Returns 1 if a free slot was used up.
+static int insert_entry(struct hashcache_entry_t *entries, uint64_t capacity,
+						const struct hashcache_entry_t *entry)
+{
+	uint64_t slot = slot_for_key(&(entry->key), entry->algorithm, capacity);
+	int was_free;
+
+	while (entries[slot].used &&
+		   !key_matches(&(entries[slot]), &(entry->key), entry->algorithm))
+	{
+		slot = (slot + 1) & (capacity - 1);
+	}
+
+	was_free = !entries[slot].used;
+	entries[slot] = *entry;
+
+	return was_free;
+}
+
+// Is there an entry for entry's key in entries?
+static int has_entry(const struct hashcache_entry_t *entries,
+					 uint64_t capacity, const struct hashcache_entry_t *entry)
+{
+	uint64_t slot = slot_for_key(&(entry->key), entry->algorithm, capacity);
+
+	while (entries[slot].used)
+	{
+		if (key_matches(&(entries[slot]), &(entry->key), entry->algorithm))
+		{
+			return 1;
+		}
+		slot = (slot + 1) & (capacity - 1);
+	}
+
+	return 0;
+}
+
+// Doubles the new table.  Called with the lock held.
+static void grow_new_table(hashcache_t *cache)
+{
+	struct hashcache_entry_t *old = cache->new_entries;
+	uint64_t old_capacity = cache->new_capacity, i;
+
+	cache->new_capacity *= 2;
+	CREATE(cache->new_entries,
+		   cache->new_capacity * sizeof(struct hashcache_entry_t));
+
+	for (i = 0; i < old_capacity; i++)
+	{
+		if (old[i].used)
+		{
+			insert_entry(cache->new_entries, cache->new_capacity, &(old[i]));
+		}
+	}
+
+	free(old);
+}
+
+// Copies the last run's entries that this run didn't look up (or store a
+// fresher digest for) into the new table.
+static void keep_unseen(hashcache_t *cache)
+{
+	uint64_t i;
+
+	pthread_mutex_lock(&(cache->lock));
+
+	for (i = 0; cache->old_entries && i < cache->old_capacity; i++)
+	{
+		if (!cache->old_entries[i].used ||
+			has_entry(cache->new_entries, cache->new_capacity,
+					  &(cache->old_entries[i])))
+		{
+			continue;
+		}
+
+		if ((cache->new_count + 1) * 2 > cache->new_capacity)
+		{
+			grow_new_table(cache);
+		}
+		cache->new_count += insert_entry(cache->new_entries,
+										 cache->new_capacity,
+										 &(cache->old_entries[i]));
+	}
+
+	pthread_mutex_unlock(&(cache->lock));
+}
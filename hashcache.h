@@ -0,0 +1,105 @@
+/*
+ *  hashcache.h
+ *  snapper
+ *
+ *  Persistent content hash cache.  Maps a file's identity (device, inode,
+ *  size, mtime and ctime) to the hash computed for it on an earlier run, so
+ *  unchanged files don't have to be read again.
+ *
+ *  The cache file is an open-addressed (linear probing) table that is
+ *  memory-mapped read-only for lookups.  Entries seen during the run go into
+ *  a fresh table, which replaces the file atomically (write, then rename)
+ *  when the run is done.  Files that have gone away drop out that way.  A
+ *  run that only looks at some of the files (snapdupes) keeps the last
+ *  run's other entries instead.
+ *
+ *  The file is in host byte order; it's a cache, not an interchange format.
+ *
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#pragma mark Defines
+#define HASHCACHE_MAGIC		"SNAPHC01"
+#define HASHCACHE_BYTEORDER	0x01020304
+// Smallest table we'll write out.  Always a power of two.
+#define HASHCACHE_MIN_SLOTS	1024
+
+// What hashcache_save() does with the last run's entries that weren't looked
+// up this run.
+#define HASHCACHE_DROP_UNSEEN	0	// Drop them; the run saw every file
+#define HASHCACHE_KEEP_UNSEEN	1	// Keep them; it only saw some
+
+#pragma mark Data Types
+// The identity of a file's contents, as far as we can tell from stat.
+struct hashcache_key_t {
+	uint64_t	dev;
+	uint64_t	ino;
+	int64_t		size;
+	int64_t		mtime;
+	int64_t		ctime;
+};
+
+// One slot, as laid out in the file.
+struct hashcache_entry_t {
+	struct hashcache_key_t key;
+	uint8_t		used;				// Slot holds an entry
+	uint8_t		algorithm;			// HASH_* the digest was made with
+	uint8_t		digest_len;			// Bytes of digest that are valid
+	uint8_t		pad[5];
+	unsigned char digest[32];
+};
+
+struct hashcache_header_t {
+	char		magic[8];			// HASHCACHE_MAGIC
+	uint32_t	byteorder;			// HASHCACHE_BYTEORDER
+	uint32_t	entry_size;			// sizeof(struct hashcache_entry_t)
+	uint64_t	capacity;			// Slots following the header
+	uint64_t	count;				// Slots in use
+};
+
+struct hashcache_t {
+	char		*path;				// Where the cache lives.
+	time_t		started;			// When this run started.
+
+	// Last run's table, mapped read-only.  Safe to read from any thread.
+	void		*map;
+	size_t		map_len;
+	struct hashcache_entry_t *old_entries;
+	uint64_t	old_capacity;
+
+	// This run's table.  Guarded by lock.
+	pthread_mutex_t lock;
+	struct hashcache_entry_t *new_entries;
+	uint64_t	new_capacity;
+	uint64_t	new_count;
+
+	long long	hits;				// Lookups answered from the cache
+	long long	misses;				// Lookups that had to read the file
+};
+
+typedef struct hashcache_t hashcache_t;
+
+#pragma mark Functions
+
+// Opens (and maps) the cache at path.  A missing or unusable cache file just
+// means an empty cache.
+int init_hashcache(hashcache_t *cache, const char *path);
+
+// Looks up a digest for key made with algorithm.  Returns the digest length
+// and copies the digest out on a hit, or 0 on a miss.  Thread safe.
+size_t hashcache_lookup(hashcache_t *cache, const struct hashcache_key_t *key,
+						int algorithm, unsigned char *digest);
+
+// Remembers a digest for key, to be written out by hashcache_save().  Thread
+// safe.
+void hashcache_store(hashcache_t *cache, const struct hashcache_key_t *key,
+					 int algorithm, const unsigned char *digest, size_t len);
+
+// Atomically replaces the cache file with this run's entries, and, with
+// HASHCACHE_KEEP_UNSEEN, the last run's that weren't looked up.
+int hashcache_save(hashcache_t *cache, int unseen);
+
+// Unmaps and frees everything.
+void free_hashcache(hashcache_t *cache);
@@ -0,0 +1,476 @@
+/*
+ *  hasher.c
+ *  snapper
+ *
+ *  A small pool of reader/hasher threads.  See hasher.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "snap_record.h"
+#include "hash.h"
+#include "hashcache.h"
+#include "stats.h"
+#include "latency.h"
+#include "trace.h"
+#include "hasher.h"
+#include "util_macros.h"
+
+#pragma mark Local Prototypes
+static void *hasher_thread(void *arg);
+static void hash_file(hasher_t *hasher, file_record *record,
+					  unsigned char *buffer, latency_set_t *latency);
+static size_t hash_contents(hasher_t *hasher, int fd, file_record *record,
+							unsigned char *buffer, unsigned char *digest,
+							long long *total, latency_set_t *latency);
+static size_t fingerprint_file(hasher_t *hasher, int fd, file_record *record,
+							   unsigned char *buffer, unsigned char *digest,
+							   long long *total, latency_set_t *latency);
+
+#pragma mark Function Implementations
+int init_hasher(hasher_t *hasher, int thread_count, int what, int algorithm,
+				int fingerprint_blocks, hashcache_t *cache, int timed)
+{
+	int i;
+
+	hasher->what = what;
+	hasher->algorithm = algorithm;
+	hasher->fingerprint_blocks = MAX(fingerprint_blocks, 0);
+	hasher->cache = cache;
+	hasher->thread_count = MAX(thread_count, 1);
+	hasher->head = 0;
+	hasher->count = 0;
+	hasher->busy = 0;
+	hasher->started = 0;
+	hasher->shutting_down = false;
+	hasher->files_hashed = 0;
+	hasher->bytes_hashed = 0;
+
+	pthread_mutex_init(&(hasher->lock), NULL);
+	pthread_cond_init(&(hasher->not_empty), NULL);
+	pthread_cond_init(&(hasher->not_full), NULL);
+	pthread_cond_init(&(hasher->idle), NULL);
+
+	CREATE(hasher->queue, HASHER_QUEUE_SIZE * sizeof(file_record *));
+	CREATE(hasher->threads, hasher->thread_count * sizeof(pthread_t));
+	hasher->latencies = NULL;
+	if (timed)
+	{
+		// Zeroed, which is empty.
+		CREATE(hasher->latencies,
+			   hasher->thread_count * sizeof(latency_set_t));
+	}
+
+	for (i = 0; i < hasher->thread_count; i++)
+	{
+		if (pthread_create(&(hasher->threads[i]), NULL, hasher_thread,
+						   hasher) != 0)
+		{
+			LogError("Couldn't start hasher thread: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+
+	return 0;
+}
+
+void hasher_submit(hasher_t *hasher, file_record *record)
+{
+	uint64_t start = 0;
+
+	pthread_mutex_lock(&(hasher->lock));
+
+	// The hashers can't keep up, so the walk waits (which the trace shows).
+	if (hasher->count >= HASHER_QUEUE_SIZE)
+	{
+		start = TRACE_START();
+	}
+	while (hasher->count >= HASHER_QUEUE_SIZE)
+	{
+		pthread_cond_wait(&(hasher->not_full), &(hasher->lock));
+	}
+
+	hasher->queue[(hasher->head + hasher->count) % HASHER_QUEUE_SIZE] = record;
+	hasher->count++;
+
+	pthread_cond_signal(&(hasher->not_empty));
+	pthread_mutex_unlock(&(hasher->lock));
+
+	if (start)
+	{
+		TRACE_END("queue full", NULL, start);
+	}
+}
+
+void hasher_wait(hasher_t *hasher)
+{
+	uint64_t start = TRACE_START();
+
+	pthread_mutex_lock(&(hasher->lock));
+
+	while (hasher->count > 0 || hasher->busy > 0)
+	{
+		pthread_cond_wait(&(hasher->idle), &(hasher->lock));
+	}
+
+	pthread_mutex_unlock(&(hasher->lock));
+
+	TRACE_END("wait for hashes", NULL, start);
+}
+
+void hasher_latency(hasher_t *hasher, latency_set_t *set)
+{
+	int i;
+
+	if (hasher->latencies == NULL)
+	{
+		return;
+	}
+
+	for (i = 0; i < hasher->thread_count; i++)
+	{
+		latency_merge(set, &(hasher->latencies[i]));
+	}
+}
+
+void free_hasher(hasher_t *hasher)
+{
+	int i;
+
+	// Let the workers drain the queue and exit.
+	pthread_mutex_lock(&(hasher->lock));
+	hasher->shutting_down = true;
+	pthread_cond_broadcast(&(hasher->not_empty));
+	pthread_mutex_unlock(&(hasher->lock));
+
+	for (i = 0; i < hasher->thread_count; i++)
+	{
+		pthread_join(hasher->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&(hasher->lock));
+	pthread_cond_destroy(&(hasher->not_empty));
+	pthread_cond_destroy(&(hasher->not_full));
+	pthread_cond_destroy(&(hasher->idle));
+
+	free(hasher->threads);
+	free(hasher->queue);
+	if (hasher->latencies)
+	{
+		free(hasher->latencies);
+	}
+	hasher->threads = NULL;
+	hasher->queue = NULL;
+	hasher->latencies = NULL;
+}
+
+static void *hasher_thread(void *arg)
+{
+	hasher_t *hasher = arg;
+	unsigned char *buffer = NULL;
+	latency_set_t *latency = NULL;
+	file_record *record;
+	uint64_t start;
+
+	// Aligned so that the reads are friendly to the page cache (and to
+	// direct I/O, should anyone ever turn that on).
+	if (posix_memalign((void **)&buffer, HASHER_READ_ALIGN,
+					   HASHER_READ_SIZE) != 0)
+	{
+		LogError("Couldn't allocate hasher buffer.\n");
+		exit(1);
+	}
+
+	// Each worker times into a set of its own, so there's nothing to lock.
+	pthread_mutex_lock(&(hasher->lock));
+	if (hasher->latencies)
+	{
+		latency = &(hasher->latencies[hasher->started]);
+	}
+	hasher->started++;
+	pthread_mutex_unlock(&(hasher->lock));
+
+	trace_thread("hasher");
+
+	for (;;)
+	{
+		pthread_mutex_lock(&(hasher->lock));
+
+		// Starved: the walk isn't finding files as fast as they're hashed.
+		start = (hasher->count == 0 && !hasher->shutting_down) ?
+			TRACE_START() : 0;
+		while (hasher->count == 0 && !hasher->shutting_down)
+		{
+			pthread_cond_wait(&(hasher->not_empty), &(hasher->lock));
+		}
+		if (start)
+		{
+			TRACE_END("idle", NULL, start);
+		}
+
+		if (hasher->count == 0)
+		{
+			// Shutting down, and nothing left to do.
+			pthread_mutex_unlock(&(hasher->lock));
+			break;
+		}
+
+		record = hasher->queue[hasher->head];
+		hasher->head = (hasher->head + 1) % HASHER_QUEUE_SIZE;
+		hasher->count--;
+		hasher->busy++;
+
+		pthread_cond_signal(&(hasher->not_full));
+		pthread_mutex_unlock(&(hasher->lock));
+
+		start = TRACE_START();
+		hash_file(hasher, record, buffer, latency);
+		TRACE_END("hash", record->re_path, start);
+
+		pthread_mutex_lock(&(hasher->lock));
+		hasher->busy--;
+		if (hasher->count == 0 && hasher->busy == 0)
+		{
+			pthread_cond_broadcast(&(hasher->idle));
+		}
+		pthread_mutex_unlock(&(hasher->lock));
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+// Reads the record's file and fills in re_hash and/or re_fingerprint, as
+// asked for.  Errors are reported, and leave the field NULL.
+static void hash_file(hasher_t *hasher, file_record *record,
+					  unsigned char *buffer, latency_set_t *latency)
+{
+	struct hashcache_key_t key;
+	unsigned char digest[HASH_MAX_DIGEST];
+	char hex[HASH_MAX_HEX];
+	int fingerprint_id = HASHER_FINGERPRINT_ID(hasher->fingerprint_blocks);
+	Boolean need_content = IS_SET(hasher->what, HASHER_CONTENT);
+	Boolean need_fingerprint = IS_SET(hasher->what, HASHER_FINGERPRINT);
+	long long total = 0;
+	uint64_t start;
+	size_t len;
+	int fd = -1;
+
+	// If the cache has seen this exact file before, we may be done.
+	if (hasher->cache)
+	{
+		key.dev = record->re_dev;
+		key.ino = record->re_ino;
+		key.size = record->re_size;
+		key.mtime = record->re_mtime;
+		key.ctime = record->re_ctime;
+
+		if (need_content &&
+			(len = hashcache_lookup(hasher->cache, &key, hasher->algorithm,
+									digest)) > 0)
+		{
+			hash_to_hex(digest, len, hex);
+			record->re_hash = strdup(hex);
+			need_content = false;
+		}
+
+		if (need_fingerprint &&
+			(len = hashcache_lookup(hasher->cache, &key, fingerprint_id,
+									digest)) > 0)
+		{
+			hash_to_hex(digest, len, hex);
+			record->re_fingerprint = strdup(hex);
+			need_fingerprint = false;
+		}
+	}
+
+	if (!need_content && !need_fingerprint)
+	{
+		return;
+	}
+
+	start = LATENCY_START(latency);
+#ifdef O_NOATIME
+	// Don't let hashing show up in the next snapshot's access times.  Only
+	// allowed for the owner (or root), so fall back quietly.
+	fd = open(record->re_path, O_RDONLY | O_NOATIME);
+#endif
+	if (fd == -1)
+	{
+		fd = open(record->re_path, O_RDONLY);
+	}
+	LATENCY_END(latency, LATENCY_OPEN, start);
+	if (fd == -1)
+	{
+		LogError("%s: %s\n", record->re_path, strerror(errno));
+		return;
+	}
+
+	// The fingerprint only uses pread, so it leaves the offset alone for the
+	// full read below.
+	if (need_fingerprint)
+	{
+		len = fingerprint_file(hasher, fd, record, buffer, digest, &total,
+							   latency);
+		if (len > 0)
+		{
+			hash_to_hex(digest, len, hex);
+			record->re_fingerprint = strdup(hex);
+
+			if (hasher->cache)
+			{
+				hashcache_store(hasher->cache, &key, fingerprint_id,
+								digest, len);
+			}
+		}
+	}
+
+	if (need_content)
+	{
+		len = hash_contents(hasher, fd, record, buffer, digest, &total,
+							latency);
+		if (len > 0)
+		{
+			hash_to_hex(digest, len, hex);
+			record->re_hash = strdup(hex);
+
+			if (hasher->cache)
+			{
+				hashcache_store(hasher->cache, &key, hasher->algorithm,
+								digest, len);
+			}
+		}
+	}
+
+	close(fd);
+
+	pthread_mutex_lock(&(hasher->lock));
+	hasher->files_hashed++;
+	hasher->bytes_hashed += total;
+	pthread_mutex_unlock(&(hasher->lock));
+}
+
+// Hashes all of fd with the pool's algorithm.  Returns the digest length, or
+// 0 on error.  Adds the bytes read to *total.
+static size_t hash_contents(hasher_t *hasher, int fd, file_record *record,
+							unsigned char *buffer, unsigned char *digest,
+							long long *total, latency_set_t *latency)
+{
+	hash_state state;
+	uint64_t start;
+	ssize_t got;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	hash_init(&state, hasher->algorithm);
+
+	for (;;)
+	{
+		start = LATENCY_START(latency);
+		got = read(fd, buffer, HASHER_READ_SIZE);
+		LATENCY_END(latency, LATENCY_READ, start);
+		if (got == 0)
+			break;
+
+		if (got == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			LogError("%s: %s\n", record->re_path, strerror(errno));
+			return 0;
+		}
+
+		hash_update(&state, buffer, got);
+		*total += got;
+	}
+
+	return hash_final(&state, digest);
+}
+
+// Samples the head, the tail and fingerprint_blocks evenly spaced blocks in
+// between, and hashes them (XXH64) along with the size.  Files too small to
+// be worth sampling are hashed whole.  Returns the digest length, or 0 on
+// error.  Adds the bytes read to *total.
+static size_t fingerprint_file(hasher_t *hasher, int fd, file_record *record,
+							   unsigned char *buffer, unsigned char *digest,
+							   long long *total, latency_set_t *latency)
+{
+	hash_state state;
+	unsigned char size_bytes[8];
+	off_t size = record->re_size, span, offset;
+	int blocks = hasher->fingerprint_blocks, i;
+	uint64_t start;
+	ssize_t got = 0;
+
+	hash_init(&state, HASH_XXH64);
+
+	// The size goes in first, so a truncated or extended file always differs.
+	for (i = 0; i < 8; i++)
+	{
+		size_bytes[i] = (unsigned char)((uint64_t) size >> (i * 8));
+	}
+	hash_update(&state, size_bytes, 8);
+
+	if (size <= (off_t) HASHER_FINGERPRINT_BLOCK * (blocks + 2))
+	{
+		// Small enough that sampling wouldn't save anything.
+		for (offset = 0; offset < size; offset += got)
+		{
+			start = LATENCY_START(latency);
+			got = pread(fd, buffer, HASHER_READ_SIZE, offset);
+			LATENCY_END(latency, LATENCY_READ, start);
+			if (got == -1 && errno == EINTR)
+			{
+				got = 0;
+				continue;
+			}
+			if (got <= 0)
+				break;
+			hash_update(&state, buffer, got);
+			*total += got;
+		}
+	}
+	else
+	{
+		// Head, the evenly spaced interior blocks, then the tail.
+		span = size - HASHER_FINGERPRINT_BLOCK;
+		for (i = 0; i <= blocks + 1; i++)
+		{
+			offset = (span / (blocks + 1)) * i;
+			if (i == blocks + 1)
+				offset = span;
+
+			start = LATENCY_START(latency);
+			got = pread(fd, buffer, HASHER_FINGERPRINT_BLOCK, offset);
+			LATENCY_END(latency, LATENCY_READ, start);
+			if (got == -1 && errno == EINTR)
+			{
+				i--;
+				continue;
+			}
+			if (got <= 0)
+				break;
+			hash_update(&state, buffer, got);
+			*total += got;
+		}
+	}
+
+	if (got == -1)
+	{
+		LogError("%s: %s\n", record->re_path, strerror(errno));
+		return 0;
+	}
+
+	return hash_final(&state, digest);
+}
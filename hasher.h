@@ -0,0 +1,87 @@
+/*
+ *  hasher.h
+ *  snapper
+ *
+ *  A small pool of reader/hasher threads.  The walker hands regular file
+ *  records to the pool as it finds them, and the workers fill in the
+ *  record's content hash and/or sampled fingerprint while the walk carries
+ *  on.
+ *
+ *  Requires snap_record.h, hashcache.h, stats.h and latency.h.
+ *
+ */
+
+#include <pthread.h>
+
+#pragma mark Tunables
+// Jobs that can be waiting before hasher_submit() blocks the walker.
+#define HASHER_QUEUE_SIZE	4096
+// Size and alignment of each worker's read buffer.
+#define HASHER_READ_SIZE	(1024 * 1024)
+#define HASHER_READ_ALIGN	4096
+// Size of each block sampled for a fingerprint.
+#define HASHER_FINGERPRINT_BLOCK	(64 * 1024)
+// Most interior blocks a fingerprint can sample, so each count gets its own
+// cache id.
+#define HASHER_MAX_FINGERPRINT_BLOCKS	127
+
+#pragma mark What to compute
+#define HASHER_CONTENT			0x01	// Full content hash (re_hash)
+#define HASHER_FINGERPRINT		0x02	// Sampled fingerprint (re_fingerprint)
+
+// The algorithm id fingerprints are cached under.  Kept apart from the real
+// hash algorithms, and from fingerprints sampled with another block count.
+#define HASHER_FINGERPRINT_ID(blocks)	(128 + (blocks))
+
+#pragma mark Data Types
+struct hasher_t {
+	int				what;				// HASHER_* bits
+	int				algorithm;			// HASH_* algorithm for re_hash
+	int				fingerprint_blocks;	// Interior blocks per fingerprint
+	hashcache_t		*cache;				// Consulted before reading, or NULL
+	int				thread_count;		// Number of worker threads
+	pthread_t		*threads;			// The workers
+	latency_set_t	*latencies;			// Each worker's call times, or NULL
+										// when they aren't timed
+
+	pthread_mutex_t	lock;				// Protects everything below
+	pthread_cond_t	not_empty;			// Signaled when a job is queued
+	pthread_cond_t	not_full;			// Signaled when a job is taken
+	pthread_cond_t	idle;				// Signaled when all work is done
+
+	file_record		**queue;			// Ring of pending records
+	int				head;				// Next job to hand out
+	int				count;				// Jobs in the ring
+	int				busy;				// Jobs being hashed right now
+	int				started;			// Workers that have started
+	char			shutting_down;		// Workers exit once the ring drains
+
+	long long		files_hashed;		// Records that got a hash
+	long long		bytes_hashed;		// Bytes read to get them
+};
+
+typedef struct hasher_t hasher_t;
+
+#pragma mark Functions
+
+// Starts thread_count workers (at least one).  what says whether to compute
+// the content hash (with algorithm), the fingerprint (sampling
+// fingerprint_blocks blocks), or both.  If cache isn't NULL, files it knows
+// about aren't read at all.  If timed, each worker times its open()s and
+// read()s; see hasher_latency().
+int init_hasher(hasher_t *hasher, int thread_count, int what, int algorithm,
+				int fingerprint_blocks, hashcache_t *cache, int timed);
+
+// Queues a record to have its contents hashed.  Blocks while the queue is
+// full.  The record must stay allocated until hasher_wait() returns.
+void hasher_submit(hasher_t *hasher, file_record *record);
+
+// Waits until every submitted record has been hashed.
+void hasher_wait(hasher_t *hasher);
+
+// Adds the workers' call times to set.  Only after hasher_wait(), when
+// they're idle.
+void hasher_latency(hasher_t *hasher, latency_set_t *set);
+
+// Waits for outstanding work, stops the workers and frees the pool.
+void free_hasher(hasher_t *hasher);
@@ -0,0 +1,436 @@
+/*
+ *  ignore.c
+ *  snapper
+ *
+ *  The compiled ignore list.  See ignore.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include "comm.h"
+#include "hash.h"
+#include "globset.h"
+#include "ignore.h"
+#include "util_macros.h"
+
+#pragma mark Local Prototypes
+static void add_name(ignore_t *ignore, const char *name, size_t len);
+static void add_path(ignore_t *ignore, const char *path);
+static void grow_names(ignore_t *ignore);
+static int find_child(struct ignore_node_t *node, const char *name,
+					  size_t len, int *insert_at);
+static void free_node(struct ignore_node_t *node);
+static size_t node_memory(struct ignore_node_t *node);
+
+#pragma mark Function Implementations
+void init_ignore(ignore_t *ignore)
+{
+	ignore->name_capacity = IGNORE_MIN_SLOTS;
+	ignore->name_count = 0;
+	CREATE(ignore->names,
+		   ignore->name_capacity * sizeof(struct ignore_name_t));
+
+	memset(&(ignore->root), 0, sizeof(ignore->root));
+	ignore->path_count = 0;
+
+	init_globset(&(ignore->name_globs));
+	init_globset(&(ignore->path_globs));
+}
+
+int ignore_add(ignore_t *ignore, const char *rule)
+{
+	char *anywhere;
+
+	if (rule == NULL || *rule == '\0')
+	{
+		return -1;
+	}
+
+	if (*rule != '/' && strchr(rule, '/'))
+	{
+		// A relative path: the same thing, under any directory at all.
+		CREATE(anywhere, strlen(rule) + 5);
+		sprintf(anywhere, "/**/%s", rule);
+		globset_add(&(ignore->path_globs), anywhere);
+		free(anywhere);
+	}
+	else if (is_glob_pattern(rule))
+	{
+		globset_add((*rule == '/') ? &(ignore->path_globs) :
+					&(ignore->name_globs), rule);
+	}
+	else if (*rule == '/')
+	{
+		add_path(ignore, rule);
+	}
+	else
+	{
+		add_name(ignore, rule, strlen(rule));
+	}
+
+	return 0;
+}
+
+int ignore_matches(ignore_t *ignore, const char *path, size_t pathlen,
+				   const char *name, size_t namelen)
+{
+	struct ignore_node_t *node;
+	const char *component, *end = path + pathlen;
+	uint64_t slot;
+	int child;
+
+	if (ignore->name_count > 0)
+	{
+		slot = xxh64(name, namelen, 0) & (ignore->name_capacity - 1);
+		while (ignore->names[slot].name)
+		{
+			if (ignore->names[slot].len == namelen &&
+				!memcmp(ignore->names[slot].name, name, namelen))
+			{
+				return 1;
+			}
+			slot = (slot + 1) & (ignore->name_capacity - 1);
+		}
+	}
+
+	if (globset_matches(&(ignore->name_globs), name, namelen))
+	{
+		return 1;
+	}
+
+	// Relative walks never matched path rules, and still don't.
+	if (pathlen == 0 || *path != '/')
+	{
+		return 0;
+	}
+
+	if (globset_matches(&(ignore->path_globs), path, pathlen))
+	{
+		return 1;
+	}
+
+	if (ignore->path_count == 0)
+	{
+		return 0;
+	}
+
+	node = &(ignore->root);
+	while (path < end)
+	{
+		// Step over the slashes to the next component.
+		while (path < end && *path == '/')
+			path++;
+		if (path == end)
+			break;
+
+		for (component = path; path < end && *path != '/'; path++)
+			;
+
+		child = find_child(node, component, path - component, NULL);
+		if (child == -1)
+		{
+			// Nothing is ignored anywhere under here.
+			return 0;
+		}
+		node = node->children[child];
+	}
+
+	return node->ignored;
+}
+
+size_t ignore_memory(ignore_t *ignore)
+{
+	size_t bytes;
+	uint64_t i;
+
+	bytes = ignore->name_capacity * sizeof(struct ignore_name_t);
+	for (i = 0; i < ignore->name_capacity; i++)
+	{
+		if (ignore->names[i].name)
+		{
+			bytes += ignore->names[i].len + 1;
+		}
+	}
+
+	return bytes + node_memory(&(ignore->root)) +
+		globset_memory(&(ignore->name_globs)) +
+		globset_memory(&(ignore->path_globs));
+}
+
+void free_ignore(ignore_t *ignore)
+{
+	uint64_t i;
+
+	for (i = 0; i < ignore->name_capacity; i++)
+	{
+		free(ignore->names[i].name);
+	}
+	free(ignore->names);
+	ignore->names = NULL;
+	ignore->name_capacity = 0;
+	ignore->name_count = 0;
+
+	free_node(&(ignore->root));
+	memset(&(ignore->root), 0, sizeof(ignore->root));
+	ignore->path_count = 0;
+
+	free_globset(&(ignore->name_globs));
+	free_globset(&(ignore->path_globs));
+}
+
+#pragma mark Scopes
+ignore_scope_t *load_ignore_scope(const char *file_path, size_t dir_len,
+								  ignore_scope_t *parent, const void *owner)
+{
+	ignore_scope_t *scope;
+	char line[PATH_MAX + 2];
+	size_t len;
+	FILE *file;
+
+	if ((file = fopen(file_path, "r")) == NULL)
+	{
+		LogError("%s: %s\n", file_path, strerror(errno));
+		return NULL;
+	}
+
+	CREATE(scope, sizeof(ignore_scope_t));
+	init_ignore(&(scope->rules));
+	scope->owner = owner;
+	scope->parent = parent;
+
+	// Paths below the directory are matched from its trailing '/' on.
+	scope->prefix_len = dir_len;
+	if (dir_len > 0 && file_path[dir_len - 1] == '/')
+	{
+		scope->prefix_len--;
+	}
+
+	while (fgets(line, sizeof(line), file))
+	{
+		len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+		{
+			line[--len] = '\0';
+		}
+
+		if (len == 0 || line[0] == '#')
+		{
+			continue;
+		}
+
+		ignore_add(&(scope->rules), line);
+	}
+
+	fclose(file);
+
+	scope->memory = sizeof(ignore_scope_t) + ignore_memory(&(scope->rules));
+
+	return scope;
+}
+
+int ignore_scope_matches(ignore_scope_t *scope, const char *path,
+						 size_t pathlen, const char *name, size_t namelen)
+{
+	for (; scope; scope = scope->parent)
+	{
+		if (pathlen > scope->prefix_len &&
+			ignore_matches(&(scope->rules), path + scope->prefix_len,
+						   pathlen - scope->prefix_len, name, namelen))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void free_ignore_scope(ignore_scope_t *scope)
+{
+	free_ignore(&(scope->rules));
+	free(scope);
+}
+
+#pragma mark Name set
+static void add_name(ignore_t *ignore, const char *name, size_t len)
+{
+	uint64_t hash = xxh64(name, len, 0), slot;
+
+	// Keep the load factor at or under one half.
+	if ((uint64_t)(ignore->name_count + 1) * 2 > ignore->name_capacity)
+	{
+		grow_names(ignore);
+	}
+
+	slot = hash & (ignore->name_capacity - 1);
+	while (ignore->names[slot].name)
+	{
+		if (ignore->names[slot].len == len &&
+			!memcmp(ignore->names[slot].name, name, len))
+		{
+			return; // Already have it.
+		}
+		slot = (slot + 1) & (ignore->name_capacity - 1);
+	}
+
+	ignore->names[slot].name = strndup(name, len);
+	ignore->names[slot].len = len;
+	ignore->names[slot].hash = hash;
+	ignore->name_count++;
+}
+
+// Doubles the name set.
+static void grow_names(ignore_t *ignore)
+{
+	struct ignore_name_t *old = ignore->names;
+	uint64_t old_capacity = ignore->name_capacity, i, slot;
+
+	ignore->name_capacity *= 2;
+	CREATE(ignore->names,
+		   ignore->name_capacity * sizeof(struct ignore_name_t));
+
+	for (i = 0; i < old_capacity; i++)
+	{
+		if (old[i].name)
+		{
+			slot = old[i].hash & (ignore->name_capacity - 1);
+			while (ignore->names[slot].name)
+			{
+				slot = (slot + 1) & (ignore->name_capacity - 1);
+			}
+			ignore->names[slot] = old[i];
+		}
+	}
+
+	free(old);
+}
+
+#pragma mark Path trie
+static void add_path(ignore_t *ignore, const char *path)
+{
+	struct ignore_node_t *node = &(ignore->root), *new_node;
+	const char *component;
+	int child, insert_at;
+
+	while (*path)
+	{
+		while (*path == '/')
+			path++;
+		if (*path == '\0')
+			break;
+
+		for (component = path; *path && *path != '/'; path++)
+			;
+
+		child = find_child(node, component, path - component, &insert_at);
+		if (child != -1)
+		{
+			node = node->children[child];
+			continue;
+		}
+
+		// Grow by doubling, then slide the later children over.
+		if (node->child_count >= node->child_capacity)
+		{
+			node->child_capacity = MAX(node->child_capacity * 2, 4);
+			if (node->children)
+			{
+				RECREATE(node->children, node->child_capacity *
+						 sizeof(struct ignore_node_t *));
+			}
+			else
+			{
+				CREATE(node->children, node->child_capacity *
+					   sizeof(struct ignore_node_t *));
+			}
+		}
+
+		memmove(&(node->children[insert_at + 1]), &(node->children[insert_at]),
+				(node->child_count - insert_at) *
+				sizeof(struct ignore_node_t *));
+
+		CREATE(new_node, sizeof(struct ignore_node_t));
+		new_node->name = strndup(component, path - component);
+		new_node->len = path - component;
+
+		node->children[insert_at] = new_node;
+		node->child_count++;
+		node = new_node;
+	}
+
+	if (!node->ignored)
+	{
+		node->ignored = true;
+		ignore->path_count++;
+	}
+}
+
+// Binary searches node's children for a component.  Returns its index, or -1
+// if there isn't one, in which case *insert_at (if not NULL) is set to where
+// it would go.
+static int find_child(struct ignore_node_t *node, const char *name,
+					  size_t len, int *insert_at)
+{
+	int low = 0, high = node->child_count, mid, cmp;
+	struct ignore_node_t *child;
+
+	while (low < high)
+	{
+		mid = low + (high - low) / 2;
+		child = node->children[mid];
+
+		cmp = memcmp(child->name, name, MIN(child->len, len));
+		if (cmp == 0)
+		{
+			cmp = (child->len < len) ? -1 : (child->len > len);
+		}
+
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (insert_at)
+	{
+		*insert_at = low;
+	}
+
+	return -1;
+}
+
+static void free_node(struct ignore_node_t *node)
+{
+	int i;
+
+	for (i = 0; i < node->child_count; i++)
+	{
+		free_node(node->children[i]);
+		free(node->children[i]);
+	}
+
+	free(node->children);
+	free(node->name);
+}
+
+// What's under a node (not the node itself, which its parent holds).
+static size_t node_memory(struct ignore_node_t *node)
+{
+	size_t bytes;
+	int i;
+
+	bytes = node->child_capacity * sizeof(struct ignore_node_t *);
+	for (i = 0; i < node->child_count; i++)
+	{
+		bytes += sizeof(struct ignore_node_t) + node->children[i]->len + 1 +
+			node_memory(node->children[i]);
+	}
+
+	return bytes;
+}
@@ -0,0 +1,116 @@
+/*
+ *  ignore.h
+ *  snapper
+ *
+ *  The compiled ignore list.  Rules are sorted into two structures as they
+ *  are added, so that checking an entry costs the same no matter how many
+ *  rules there are:
+ *
+ *		o Name rules (no leading '/') go into a hash set, and an entry is
+ *		  checked with one lookup of its name.
+ *		o Path rules (leading '/') go into a trie of path components, and an
+ *		  entry is checked by walking its path down the trie, one component
+ *		  at a time, giving up at the first component no rule has.
+ *
+ *  Both kinds still match exactly, as the old list did: "/dev" ignores /dev
+ *  only, and ".svn" ignores entries named exactly .svn.  (Extra slashes in a
+ *  path rule no longer matter, so "/dev/" is the same as "/dev".)
+ *
+ *  Rules with wildcards ("*.o", "*~", "/var/log/syslog.?") go into one of two
+ *  glob sets instead, one matched against the name and one against the whole
+ *  path.  Each is a single automaton, so an entry is checked against all the
+ *  wildcard rules of a kind in one pass over its name or path.  A rule that
+ *  doesn't start with '/' but has one in it ("build/core.[0-9]") is matched
+ *  against the end of the path, at any depth.
+ *
+ *  Per-directory ignore files load into scopes.  A scope holds one file's
+ *  rules, matched against paths relative to its directory (so a leading '/'
+ *  means the top of that directory), and points at the scope above it, so a
+ *  directory inherits its parents' rules without copying them.
+ *
+ *  Requires globset.h.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#pragma mark Defines
+// Starting size of the name set.  Always a power of two.
+#define IGNORE_MIN_SLOTS	64
+
+#pragma mark Data Types
+// One slot of the name set.
+struct ignore_name_t {
+	char		*name;				// The name, or NULL for an empty slot
+	size_t		len;				// Its length
+	uint64_t	hash;				// Its hash, so growing needn't rehash
+};
+
+// One path component in the trie.  Children are kept sorted, so they can be
+// binary searched.
+struct ignore_node_t {
+	char		*name;				// This component (NULL at the root)
+	size_t		len;				// Its length
+	char		ignored;			// A rule ends here
+	int			child_count;		// Children in use
+	int			child_capacity;		// Children allocated
+	struct ignore_node_t **children;	// Sorted by (memcmp, then length)
+};
+
+struct ignore_t {
+	struct ignore_name_t *names;	// Open addressed set of name rules
+	uint64_t	name_capacity;		// Slots in names
+	int			name_count;			// Name rules
+	struct ignore_node_t root;		// "/", the top of the path trie
+	int			path_count;			// Path rules
+	globset_t	name_globs;			// Name rules with wildcards
+	globset_t	path_globs;			// Path rules with wildcards
+};
+
+typedef struct ignore_t ignore_t;
+
+// The rules from one directory's ignore file.
+struct ignore_scope_t {
+	ignore_t	rules;				// This file's rules
+	size_t		prefix_len;			// Length of the directory's path
+	const void	*owner;				// What loaded it (e.g. its FTSENT)
+	struct ignore_scope_t *parent;	// The scope above, or NULL
+	size_t		memory;				// Bytes it held once loaded
+};
+
+typedef struct ignore_scope_t ignore_scope_t;
+
+#pragma mark Functions
+
+// Sets up an empty ignore list.
+void init_ignore(ignore_t *ignore);
+
+// Adds a rule: an absolute path if it starts with a '/', otherwise a name.
+// Either may have wildcards.  Returns 0, or -1 if the rule is empty.
+int ignore_add(ignore_t *ignore, const char *rule);
+
+// Returns 1 if an entry with this path and name (its last component) should
+// be ignored, 0 otherwise.
+int ignore_matches(ignore_t *ignore, const char *path, size_t pathlen,
+				   const char *name, size_t namelen);
+
+// Bytes the ignore list holds (not counting the ignore_t itself).
+size_t ignore_memory(ignore_t *ignore);
+
+// Frees everything in the ignore list.
+void free_ignore(ignore_t *ignore);
+
+// Reads an ignore file (one rule per line; blank lines and lines starting
+// with '#' are skipped) into a new scope under parent.  file_path has to
+// start with the path of its directory, which is dir_len characters long.
+// Returns NULL if the file can't be read.
+ignore_scope_t *load_ignore_scope(const char *file_path, size_t dir_len,
+								  ignore_scope_t *parent, const void *owner);
+
+// Returns 1 if scope, or any scope above it, ignores the entry.
+int ignore_scope_matches(ignore_scope_t *scope, const char *path,
+						 size_t pathlen, const char *name, size_t namelen);
+
+// Frees a scope (but not the ones above it).
+void free_ignore_scope(ignore_scope_t *scope);
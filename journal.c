@@ -0,0 +1,299 @@
+/*
+ *  journal.c
+ *  snapper
+ *
+ *  Checkpoints and resuming.  See journal.h.
+ *
+ *  The checkpoint file is text:
+ *
+ *		SNAPJ01
+ *		options <hash of the options, in hex>
+ *		runs <count>
+ *		<records in run 0>
+ *		...
+ *		frontier <path>
+ *
+ *  Run n is the file run.<n> (six digits) in the journal directory.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "snap_record.h"
+#include "extsort.h"
+#include "journal.h"
+#include "util_macros.h"
+
+#pragma mark Local Prototypes
+static void run_path(journal_t *journal, int run, char *path, size_t len);
+static void add_run_records(journal_t *journal, long long records);
+static int write_checkpoint(journal_t *journal);
+
+#pragma mark Function Implementations
+void init_journal(journal_t *journal, const char *output_path,
+				  unsigned long long options, int interval)
+{
+	size_t len = strlen(output_path) + sizeof(".journal/checkpoint");
+
+	memset(journal, 0, sizeof(journal_t));
+
+	CREATE(journal->dir, len);
+	snprintf(journal->dir, len, "%s.journal", output_path);
+	CREATE(journal->checkpoint_path, len);
+	snprintf(journal->checkpoint_path, len, "%s/checkpoint", journal->dir);
+
+	journal->options = options;
+	journal->interval = (interval > 0) ? interval : JOURNAL_INTERVAL;
+	journal->last = time(0);
+}
+
+int journal_resume(journal_t *journal, extsort_t *sort)
+{
+	char line[PATH_MAX + 32], path[PATH_MAX];
+	unsigned long long options;
+	long long records;
+	size_t len;
+	FILE *file;
+	int runs, i;
+
+	if ((file = fopen(journal->checkpoint_path, "r")) == NULL)
+	{
+		if (errno == ENOENT)
+		{
+			return 0;
+		}
+		LogError("Couldn't read checkpoint %s: %s\n",
+				 journal->checkpoint_path, strerror(errno));
+		return -1;
+	}
+
+	if (fgets(line, sizeof(line), file) == NULL ||
+		strncmp(line, JOURNAL_MAGIC "\n", sizeof(JOURNAL_MAGIC)) != 0 ||
+		fscanf(file, "options %llx\n", &options) != 1 ||
+		fscanf(file, "runs %d\n", &runs) != 1 || runs < 0)
+	{
+		LogError("%s isn't a snapper checkpoint\n", journal->checkpoint_path);
+		fclose(file);
+		return -1;
+	}
+
+	if (options != journal->options)
+	{
+		LogError("%s is from a scan with different options; run without "
+				 "--resume to start over\n", journal->checkpoint_path);
+		fclose(file);
+		return -1;
+	}
+
+	for (i = 0; i < runs; i++)
+	{
+		if (fscanf(file, "%lld\n", &records) != 1)
+		{
+			LogError("Checkpoint %s is truncated\n", journal->checkpoint_path);
+			fclose(file);
+			return -1;
+		}
+		add_run_records(journal, records);
+	}
+
+	if (fgets(line, sizeof(line), file) == NULL ||
+		strncmp(line, "frontier ", 9) != 0)
+	{
+		LogError("Checkpoint %s is truncated\n", journal->checkpoint_path);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	len = strlen(line);
+	if (len > 0 && line[len - 1] == '\n')
+	{
+		line[len - 1] = '\0';
+	}
+	journal->frontier = strdup(line + 9);
+
+	for (i = 0; i < journal->run_count; i++)
+	{
+		run_path(journal, i, path, sizeof(path));
+		if (extsort_add_run(sort, path, journal->run_records[i]) == -1)
+		{
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+int journal_due(journal_t *journal)
+{
+	return (time(0) - journal->last >= journal->interval);
+}
+
+int journal_checkpoint(journal_t *journal, extsort_t *sort, snap_t *snap)
+{
+	char path[PATH_MAX];
+	char *frontier;
+	long long records = snap->currentArraySize;
+
+	journal->last = time(0);
+
+	if (records == 0)
+	{
+		return 0;
+	}
+
+	// The last record walked, before the spill sorts (and frees) them.
+	frontier = strdup(snap->master_array[records - 1]->re_path);
+
+	if (mkdir(journal->dir, 0700) == -1 && errno != EEXIST)
+	{
+		LogError("Couldn't create journal %s: %s\n", journal->dir,
+				 strerror(errno));
+		free(frontier);
+		return -1;
+	}
+
+	run_path(journal, journal->run_count, path, sizeof(path));
+	if (extsort_spill_to(sort, snap, path) == -1)
+	{
+		free(frontier);
+		return -1;
+	}
+
+	add_run_records(journal, records);
+	if (journal->frontier)
+	{
+		free(journal->frontier);
+	}
+	journal->frontier = frontier;
+
+	return write_checkpoint(journal);
+}
+
+void journal_remove(journal_t *journal)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	if ((dir = opendir(journal->dir)) == NULL)
+	{
+		return;
+	}
+
+	// Runs past the checkpoint's (left by a crash) go, too.
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strncmp(entry->d_name, "run.", 4) == 0 ||
+			strncmp(entry->d_name, "checkpoint", 10) == 0)
+		{
+			snprintf(path, sizeof(path), "%s/%s", journal->dir,
+					 entry->d_name);
+			unlink(path);
+		}
+	}
+	closedir(dir);
+
+	if (rmdir(journal->dir) == -1)
+	{
+		LogError("Couldn't remove journal %s: %s\n", journal->dir,
+				 strerror(errno));
+	}
+}
+
+void free_journal(journal_t *journal)
+{
+	free(journal->dir);
+	free(journal->checkpoint_path);
+	if (journal->frontier)
+	{
+		free(journal->frontier);
+	}
+	if (journal->run_records)
+	{
+		free(journal->run_records);
+	}
+
+	memset(journal, 0, sizeof(journal_t));
+}
+
+#pragma mark Local Functions
+static void run_path(journal_t *journal, int run, char *path, size_t len)
+{
+	snprintf(path, len, "%s/run.%06d", journal->dir, run);
+}
+
+static void add_run_records(journal_t *journal, long long records)
+{
+	if (journal->run_count >= journal->run_capacity)
+	{
+		journal->run_capacity = MAX(journal->run_capacity * 2, 16);
+		if (journal->run_records)
+		{
+			RECREATE(journal->run_records,
+					 journal->run_capacity * sizeof(long long));
+		}
+		else
+		{
+			CREATE(journal->run_records,
+				   journal->run_capacity * sizeof(long long));
+		}
+	}
+
+	journal->run_records[journal->run_count++] = records;
+}
+
+// Replaces the checkpoint file, all at once.
+static int write_checkpoint(journal_t *journal)
+{
+	char tmp_path[PATH_MAX];
+	FILE *file;
+	int i, failed;
+
+	snprintf(tmp_path, PATH_MAX, "%s.tmp", journal->checkpoint_path);
+
+	if ((file = fopen(tmp_path, "w")) == NULL)
+	{
+		LogError("Couldn't write checkpoint %s: %s\n", tmp_path,
+				 strerror(errno));
+		return -1;
+	}
+
+	failed = (fprintf(file, "%s\noptions %016llx\nruns %d\n", JOURNAL_MAGIC,
+					  journal->options, journal->run_count) < 0);
+	for (i = 0; i < journal->run_count && !failed; i++)
+	{
+		failed = (fprintf(file, "%lld\n", journal->run_records[i]) < 0);
+	}
+
+	if (failed || fprintf(file, "frontier %s\n", journal->frontier) < 0 ||
+		fflush(file) == EOF || fsync(fileno(file)) == -1)
+	{
+		LogError("Couldn't write checkpoint %s: %s\n", tmp_path,
+				 strerror(errno));
+		fclose(file);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	fclose(file);
+
+	if (rename(tmp_path, journal->checkpoint_path) == -1)
+	{
+		LogError("Couldn't replace checkpoint %s: %s\n",
+				 journal->checkpoint_path, strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
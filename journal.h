@@ -0,0 +1,72 @@
+/*
+ *  journal.h
+ *  snapper
+ *
+ *  Checkpoints, so a long scan that dies part way through can be resumed
+ *  instead of started over.  The journal is a directory next to the output
+ *  (<output>.journal).  At each checkpoint, the records made since the last
+ *  one are written there as a sorted run (see extsort.h), and then the
+ *  checkpoint file is replaced (write, sync, rename) with the list of runs
+ *  and the path of the last record in them: the frontier.
+ *
+ *  A resume adds the listed runs back to the sort, and walks the tree again
+ *  from the frontier on.  The walk has to visit entries in the same order
+ *  both times, so with a journal, fts sorts every directory by name.
+ *
+ *  A crash can leave a run the checkpoint doesn't list yet; it's just
+ *  written over.  The journal is removed once the output has been written.
+ *
+ *  Requires snap_record.h and extsort.h.
+ *
+ */
+
+#include <time.h>
+
+#pragma mark Defines
+#define JOURNAL_MAGIC		"SNAPJ01"
+// Seconds between checkpoints, unless told otherwise.
+#define JOURNAL_INTERVAL	300
+
+#pragma mark Data Types
+struct journal_t {
+	char		*dir;				// <output>.journal
+	char		*checkpoint_path;	// Its checkpoint file
+	unsigned long long options;		// Hash of the options that shape the
+									// output; a resume has to match.
+	int			interval;			// Seconds between checkpoints
+	time_t		last;				// When the last one was made
+
+	char		*frontier;			// Last path in the runs, or NULL
+	long long	*run_records;		// Records in each run, oldest first
+	int			run_count;
+	int			run_capacity;
+};
+
+typedef struct journal_t journal_t;
+
+#pragma mark Functions
+
+// Sets up a journal for the output at output_path.  options identifies
+// everything about the scan that the output depends on.  Nothing is
+// written yet.
+void init_journal(journal_t *journal, const char *output_path,
+				  unsigned long long options, int interval);
+
+// Reads the checkpoint, and adds its runs to the sort.  Returns 1 if there
+// was one to resume from (the frontier is set), 0 if there wasn't, or -1
+// if it can't be used (it's from a different scan, say).
+int journal_resume(journal_t *journal, extsort_t *sort);
+
+// Whether it's time for a checkpoint.
+int journal_due(journal_t *journal);
+
+// Writes the snap's records (which must be in walk order, and finished) out
+// as a new run, and records it, and the frontier, in the checkpoint.
+// Returns 0, or -1 if the checkpoint couldn't be written.
+int journal_checkpoint(journal_t *journal, extsort_t *sort, snap_t *snap);
+
+// Deletes the journal, once the output is safely written.
+void journal_remove(journal_t *journal);
+
+// Frees everything (but leaves the files).
+void free_journal(journal_t *journal);
@@ -0,0 +1,168 @@
+/*
+ *  latency.c
+ *  snapper
+ *
+ *  Latency histograms.  See latency.h.
+ *
+ *  A time v of at least 2^LATENCY_SUB_BITS, with its top bit at m, goes in
+ *  bucket (m - LATENCY_SUB_BITS) * LATENCY_SUB_COUNT + (v >> (m -
+ *  LATENCY_SUB_BITS)): its power of two, and its next LATENCY_SUB_BITS bits.
+ *  Smaller ones get a bucket each.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "stats.h"
+#include "latency.h"
+
+#pragma mark Local Prototypes
+static int bucket_of(uint64_t ns);
+static uint64_t bucket_top(int bucket);
+
+static const char *op_names[LATENCY_OPS] = {
+	"opendir",
+	"readdir",
+	"stat",
+	"dirread",
+	"open",
+	"read"
+};
+
+#pragma mark Function Implementations
+void init_latency_set(latency_set_t *set)
+{
+	memset(set, 0, sizeof(latency_set_t));
+}
+
+void latency_record(latency_t *latency, uint64_t ns)
+{
+	if (latency->count == 0 || ns < latency->min)
+	{
+		latency->min = ns;
+	}
+	if (ns > latency->max)
+	{
+		latency->max = ns;
+	}
+	latency->count++;
+	latency->sum += ns;
+	latency->buckets[bucket_of(ns)]++;
+}
+
+void latency_merge(latency_set_t *into, const latency_set_t *from)
+{
+	const latency_t *src;
+	latency_t *dest;
+	int op, i;
+
+	for (op = 0; op < LATENCY_OPS; op++)
+	{
+		src = &(from->ops[op]);
+		dest = &(into->ops[op]);
+
+		if (src->count == 0)
+		{
+			continue;
+		}
+
+		if (dest->count == 0 || src->min < dest->min)
+		{
+			dest->min = src->min;
+		}
+		if (src->max > dest->max)
+		{
+			dest->max = src->max;
+		}
+		dest->count += src->count;
+		dest->sum += src->sum;
+
+		for (i = 0; i < LATENCY_BUCKETS; i++)
+		{
+			dest->buckets[i] += src->buckets[i];
+		}
+	}
+}
+
+uint64_t latency_quantile(const latency_t *latency, double q)
+{
+	uint64_t wanted, seen = 0;
+	int i;
+
+	if (latency->count == 0)
+	{
+		return 0;
+	}
+
+	wanted = (uint64_t)(q * latency->count + 0.5);
+	if (wanted < 1)
+	{
+		wanted = 1;
+	}
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += latency->buckets[i];
+		if (seen >= wanted)
+		{
+			// Anything in the bucket could be it; don't claim worse than
+			// anything actually took.
+			return (bucket_top(i) < latency->max) ? bucket_top(i) :
+				latency->max;
+		}
+	}
+
+	return latency->max;
+}
+
+const char *latency_op_name(int op)
+{
+	return (op >= 0 && op < LATENCY_OPS) ? op_names[op] : "unknown";
+}
+
+void latency_summarize(const latency_t *latency, const char *name,
+					   struct stats_latency_t *summary)
+{
+	summary->name = name;
+	summary->count = latency->count;
+	summary->sum = latency->sum;
+	summary->min = latency->min;
+	summary->max = latency->max;
+	summary->p50 = latency_quantile(latency, 0.5);
+	summary->p90 = latency_quantile(latency, 0.9);
+	summary->p99 = latency_quantile(latency, 0.99);
+	summary->p999 = latency_quantile(latency, 0.999);
+}
+
+#pragma mark Local Functions
+static int bucket_of(uint64_t ns)
+{
+	int shift;
+
+	if (ns < LATENCY_SUB_COUNT)
+	{
+		return (int) ns;
+	}
+
+	shift = (63 - __builtin_clzll(ns)) - LATENCY_SUB_BITS;
+
+	return shift * LATENCY_SUB_COUNT + (int)(ns >> shift);
+}
+
+// The largest time that goes in a bucket.
+static uint64_t bucket_top(int bucket)
+{
+	int shift;
+
+	if (bucket < LATENCY_SUB_COUNT)
+	{
+		return (uint64_t) bucket;
+	}
+
+	shift = bucket / LATENCY_SUB_COUNT - 1;
+
+	return (((uint64_t)(bucket - shift * LATENCY_SUB_COUNT)) << shift) +
+		(((uint64_t) 1 << shift) - 1);
+}
@@ -0,0 +1,89 @@
+/*
+ *  latency.h
+ *  snapper
+ *
+ *  Latency histograms for the filesystem calls a scan makes, to tell a few
+ *  slow directories from a uniformly slow filesystem.  The buckets are
+ *  HDR-style: exact below 16ns, and above that 16 to each power of two, so
+ *  any time is recorded to within about 6% in a fixed 8K per histogram, and
+ *  recording one is a couple of shifts and adds.
+ *
+ *  Each thread keeps its own set, with no locks; the sets are merged once
+ *  the threads are done.  Timing is off unless a set was handed out, and
+ *  then costs a NULL check per call.
+ *
+ *  Requires stats.h.
+ *
+ */
+
+#include <stdint.h>
+
+#pragma mark Defines
+// Sub-buckets per power of two, as bits.
+#define LATENCY_SUB_BITS	4
+#define LATENCY_SUB_COUNT	(1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS		((65 - LATENCY_SUB_BITS) * LATENCY_SUB_COUNT)
+
+// The calls that are timed.
+enum {
+	LATENCY_OPENDIR,			// opendir(), of a streamed directory
+	LATENCY_READDIR,			// readdir() (a getdents() now and then)
+	LATENCY_STAT,				// stat() of one entry, outside of fts
+	LATENCY_DIRREAD,			// fts reading a whole directory: opendir(),
+								// getdents() and a stat() of every entry
+	LATENCY_OPEN,				// open() of a file to hash
+	LATENCY_READ,				// read() or pread() of it
+	LATENCY_OPS
+};
+
+#pragma mark Data Types
+struct latency_t {
+	uint64_t	count;
+	uint64_t	sum;				// All in ns
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[LATENCY_BUCKETS];
+};
+
+typedef struct latency_t latency_t;
+
+// One histogram per call, for one thread.
+struct latency_set_t {
+	latency_t	ops[LATENCY_OPS];
+};
+
+typedef struct latency_set_t latency_set_t;
+
+#pragma mark Timing
+// For timing a call into a set that may be NULL (not timing):
+//
+//		uint64_t start = LATENCY_START(set);
+//		dir = opendir(path);
+//		LATENCY_END(set, LATENCY_OPENDIR, start);
+#define LATENCY_START(set)		((set) ? monotonic_ns() : 0)
+#define LATENCY_END(set, op, start)										\
+	do {																\
+		if (set)														\
+			latency_record(&((set)->ops[(op)]), monotonic_ns() - (start));	\
+	} while (0)
+
+#pragma mark Functions
+
+// Empties a set.
+void init_latency_set(latency_set_t *set);
+
+// Adds one call that took ns.
+void latency_record(latency_t *latency, uint64_t ns);
+
+// Adds everything in from to into.
+void latency_merge(latency_set_t *into, const latency_set_t *from);
+
+// The time (ns) below which fraction q (0 to 1) of the calls finished.
+uint64_t latency_quantile(const latency_t *latency, double q);
+
+// The name of a LATENCY_* call, for reports.
+const char *latency_op_name(int op);
+
+// Fills in a summary of the histogram for the stats report.
+void latency_summarize(const latency_t *latency, const char *name,
+					   struct stats_latency_t *summary);
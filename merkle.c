@@ -0,0 +1,179 @@
+/*
+ *  merkle.c
+ *  snapper
+ *
+ *  Directory rollup ("Merkle") hashes.  See merkle.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "comm.h"
+#include "snap_record.h"
+#include "hash.h"
+#include "merkle.h"
+#include "util_macros.h"
+
+#pragma mark Local data types
+// A directory whose children we're still hashing.
+struct merkle_frame_t {
+	file_record	*record;			// The directory
+	hash_state	state;				// Its own fields, then its children's
+};
+
+#pragma mark Local Prototypes
+static int compare_paths(const void *left, const void *right);
+static void hash_own_fields(hash_state *state, file_record *record);
+static void hash_u64(hash_state *state, uint64_t value);
+static void finish_record(file_record *record, hash_state *state,
+						  struct merkle_frame_t *parent);
+
+#pragma mark Function Implementations
+int compute_tree_hashes(snap_t *snap)
+{
+	file_record **sorted = NULL, *record;
+	struct merkle_frame_t *stack = NULL;
+	int depth = 0, capacity = 64, i;
+	hash_state leaf;
+
+	if (snap->currentArraySize == 0)
+	{
+		return 0;
+	}
+
+	// Path order puts each directory right before its children, and the
+	// children in name order, so one pass with a stack of open directories
+	// is enough: a directory is done as soon as we see a path outside it.
+	CREATE(sorted, snap->currentArraySize * sizeof(file_record *));
+	memcpy(sorted, snap->master_array,
+		   snap->currentArraySize * sizeof(file_record *));
+	qsort(sorted, snap->currentArraySize, sizeof(file_record *),
+		  compare_paths);
+
+	CREATE(stack, capacity * sizeof(struct merkle_frame_t));
+
+	for (i = 0; i < snap->currentArraySize; i++)
+	{
+		record = sorted[i];
+
+		// Close the directories this record isn't in.
+		while (depth > 0 &&
+			   !path_is_under(record->re_path, stack[depth-1].record->re_path))
+		{
+			depth--;
+			finish_record(stack[depth].record, &(stack[depth].state),
+						  (depth > 0) ? &(stack[depth-1]) : NULL);
+		}
+
+		if (record->re_type == 'D')
+		{
+			if (depth >= capacity)
+			{
+				capacity *= 2;
+				RECREATE(stack, capacity * sizeof(struct merkle_frame_t));
+			}
+
+			stack[depth].record = record;
+			hash_init(&(stack[depth].state), HASH_XXH64);
+			hash_own_fields(&(stack[depth].state), record);
+			depth++;
+		}
+		else
+		{
+			hash_init(&leaf, HASH_XXH64);
+			hash_own_fields(&leaf, record);
+			finish_record(record, &leaf,
+						  (depth > 0) ? &(stack[depth-1]) : NULL);
+		}
+	}
+
+	// Whatever is left open is complete now.
+	while (depth > 0)
+	{
+		depth--;
+		finish_record(stack[depth].record, &(stack[depth].state),
+					  (depth > 0) ? &(stack[depth-1]) : NULL);
+	}
+
+	free(stack);
+	free(sorted);
+
+	return 0;
+}
+
+static int compare_paths(const void *left, const void *right)
+{
+	return pathcmp((*(file_record **) left)->re_path,
+				   (*(file_record **) right)->re_path);
+}
+
+// Feeds the fields that identify a record (besides its children) into state.
+static void hash_own_fields(hash_state *state, file_record *record)
+{
+	const char *name = strrchr(record->re_path, '/');
+
+	name = (name && name[1]) ? name + 1 : record->re_path;
+
+	// The name, null terminated so "ab"+"c" can't look like "a"+"bc".
+	hash_update(state, name, strlen(name) + 1);
+	hash_update(state, &(record->re_type), 1);
+	hash_u64(state, (uint64_t) record->re_mode);
+	hash_u64(state, (uint64_t) record->re_uid);
+	hash_u64(state, (uint64_t) record->re_gid);
+
+	if (record->re_type != 'D')
+	{
+		hash_u64(state, (uint64_t) record->re_size);
+		hash_u64(state, (uint64_t) record->re_mtime);
+	}
+
+	if (record->re_hash)
+	{
+		hash_update(state, record->re_hash, strlen(record->re_hash) + 1);
+	}
+	else if (record->re_fingerprint)
+	{
+		hash_update(state, record->re_fingerprint,
+					strlen(record->re_fingerprint) + 1);
+	}
+}
+
+// Fixed width and byte order, so tree hashes compare across machines.
+static void hash_u64(hash_state *state, uint64_t value)
+{
+	unsigned char bytes[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		bytes[i] = (unsigned char)(value >> (i * 8));
+	}
+	hash_update(state, bytes, 8);
+}
+
+// Stores the finished digest in the record, and rolls it into the parent.
+static void finish_record(file_record *record, hash_state *state,
+						  struct merkle_frame_t *parent)
+{
+	unsigned char digest[HASH_MAX_DIGEST];
+	char hex[HASH_MAX_HEX];
+	size_t len;
+
+	len = hash_final(state, digest);
+	hash_to_hex(digest, len, hex);
+
+	if (record->re_tree_hash)
+	{
+		free(record->re_tree_hash);
+	}
+	record->re_tree_hash = strdup(hex);
+
+	if (parent)
+	{
+		hash_update(&(parent->state), digest, len);
+	}
+}
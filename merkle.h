@@ -0,0 +1,24 @@
+/*
+ *  merkle.h
+ *  snapper
+ *
+ *  Directory rollup ("Merkle") hashes.  Every record gets a tree hash: for
+ *  files it covers the name, metadata and content hash (if there is one);
+ *  for directories it covers the directory's own name and metadata plus the
+ *  tree hashes of all of its children, in path order.  Two directories with
+ *  the same tree hash have identical subtrees, so a diff can skip them
+ *  without looking inside.
+ *
+ *  Access and change times aren't part of the hash (reading or hashing a
+ *  file moves them), and neither are a directory's size and mtime (they
+ *  only change when the children do, and vary by filesystem).
+ *
+ *  Requires snap_record.h.
+ *
+ */
+
+#pragma mark Functions
+
+// Fills in re_tree_hash for every record in the snap.  Works on a walk in any
+// order; parents that aren't in the snap (-D) are simply left out.
+int compute_tree_hashes(snap_t *snap);
@@ -0,0 +1,335 @@
+/*
+ *  mounts.c
+ *  snapper
+ *
+ *  The mount table.  See mounts.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <sys/types.h>
+#ifdef __APPLE__
+#include <sys/param.h>
+#include <sys/ucred.h>
+#include <sys/mount.h>
+#else
+#include <sys/sysmacros.h>
+#endif
+
+#include "comm.h"
+#include "mounts.h"
+#include "util_macros.h"
+
+// Mounts we stay out of unless told otherwise.  Pseudo filesystems have
+// nothing on disk (and some, like /proc, are huge), overlay layers repeat
+// what's underneath them, and remote filesystems are slow, or hang outright
+// when the server has gone away.
+static const char *default_excluded_fstypes[] = {
+	// Pseudo
+	"proc", "sysfs", "cgroup", "cgroup2", "devpts", "devtmpfs", "devfs",
+	"securityfs", "debugfs", "tracefs", "pstore", "bpf", "configfs",
+	"fusectl", "mqueue", "hugetlbfs", "binfmt_misc", "efivarfs",
+	"selinuxfs", "rpc_pipefs", "nsfs", "autofs",
+	// Layered
+	"overlay", "aufs",
+	// Remote
+	"nfs", "nfs4", "cifs", "smb3", "smbfs", "afpfs", "webdav", "afs",
+	"9p", "ceph", "glusterfs", "lustre", "davfs", "fuse.sshfs",
+	"fuse.glusterfs", "fuse.s3fs", "fuse.rclone",
+	NULL
+};
+
+#pragma mark Local Prototypes
+static void add_entry(mount_table_t *table, const char *mount_point,
+					  const char *fstype, const char *source, dev_t dev);
+static int read_system_mounts(mount_table_t *table);
+static int fstype_matches(const char *rule, const char *fstype);
+static int point_matches(const char *rule, const char *mount_point);
+static int is_excluded(mount_table_t *table, struct mount_entry_t *entry);
+
+#pragma mark Function Implementations
+void init_mount_table(mount_table_t *table)
+{
+	memset(table, 0, sizeof(mount_table_t));
+}
+
+void mount_rule_add(mount_table_t *table, int kind, const char *value)
+{
+	if (kind < MOUNT_EXCLUDE_FSTYPE || kind > MOUNT_INCLUDE_POINT ||
+		value == NULL || *value == '\0')
+	{
+		return;
+	}
+
+	if (table->rules[kind])
+	{
+		RECREATE(table->rules[kind],
+				 (table->rule_counts[kind] + 1) * sizeof(char *));
+	}
+	else
+	{
+		CREATE(table->rules[kind], sizeof(char *));
+	}
+
+	table->rules[kind][table->rule_counts[kind]++] = strdup(value);
+}
+
+int load_mount_table(mount_table_t *table)
+{
+	int i;
+
+	if (read_system_mounts(table) == -1)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < table->count; i++)
+	{
+		table->entries[i].excluded = is_excluded(table, &(table->entries[i]));
+	}
+
+	return table->count;
+}
+
+struct mount_entry_t *mount_for_dev(mount_table_t *table, dev_t dev,
+									const char *path)
+{
+	struct mount_entry_t *found = NULL;
+	int i;
+
+	for (i = 0; i < table->count; i++)
+	{
+		if (table->entries[i].dev != dev)
+			continue;
+
+		if (path == NULL || point_matches(table->entries[i].mount_point, path))
+		{
+			return &(table->entries[i]);
+		}
+
+		// Last one wins, like the mounts themselves.
+		found = &(table->entries[i]);
+	}
+
+	return found;
+}
+
+void free_mount_table(mount_table_t *table)
+{
+	int i, kind;
+
+	for (i = 0; i < table->count; i++)
+	{
+		free(table->entries[i].mount_point);
+		free(table->entries[i].fstype);
+		free(table->entries[i].source);
+	}
+	free(table->entries);
+
+	for (kind = 0; kind < 4; kind++)
+	{
+		for (i = 0; i < table->rule_counts[kind]; i++)
+		{
+			free(table->rules[kind][i]);
+		}
+		free(table->rules[kind]);
+	}
+
+	init_mount_table(table);
+}
+
+#pragma mark Reading the mounts
+static void add_entry(mount_table_t *table, const char *mount_point,
+					  const char *fstype, const char *source, dev_t dev)
+{
+	struct mount_entry_t *entry;
+
+	if (table->count >= table->capacity)
+	{
+		table->capacity = MAX(table->capacity * 2, 32);
+		if (table->entries)
+		{
+			RECREATE(table->entries,
+					 table->capacity * sizeof(struct mount_entry_t));
+		}
+		else
+		{
+			CREATE(table->entries,
+				   table->capacity * sizeof(struct mount_entry_t));
+		}
+	}
+
+	entry = &(table->entries[table->count++]);
+	entry->mount_point = strdup(mount_point);
+	entry->fstype = strdup(fstype);
+	entry->source = strdup(source);
+	entry->dev = dev;
+	entry->excluded = false;
+}
+
+#ifdef __APPLE__
+static int read_system_mounts(mount_table_t *table)
+{
+	struct statfs *mounts;
+	int count, i;
+
+	// MNT_NOWAIT: use what the kernel already knows, rather than asking
+	// every filesystem (and waiting on the dead NFS server).
+	if ((count = getmntinfo(&mounts, MNT_NOWAIT)) == 0)
+	{
+		LogError("getmntinfo: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		add_entry(table, mounts[i].f_mntonname, mounts[i].f_fstypename,
+				  mounts[i].f_mntfromname, (dev_t) mounts[i].f_fsid.val[0]);
+	}
+
+	return 0;
+}
+#else
+// Undoes the octal escapes (\040 for a space, and so on) mountinfo uses for
+// awkward characters, in place.
+static void unescape_mountinfo(char *field)
+{
+	char *in = field, *out = field;
+
+	while (*in)
+	{
+		if (in[0] == '\\' && in[1] >= '0' && in[1] <= '3' &&
+			in[2] >= '0' && in[2] <= '7' && in[3] >= '0' && in[3] <= '7')
+		{
+			*out++ = (char)(((in[1] - '0') << 6) | ((in[2] - '0') << 3) |
+							(in[3] - '0'));
+			in += 4;
+		}
+		else
+		{
+			*out++ = *in++;
+		}
+	}
+	*out = '\0';
+}
+
+// Each line is:
+//	id parent major:minor root mount_point options [optional...] - fstype
+//	source super_options
+static int read_system_mounts(mount_table_t *table)
+{
+	char line[PATH_MAX * 2 + 256], *fields[64], *saveptr, *field;
+	unsigned int major, minor;
+	int count, separator, i;
+	FILE *file;
+
+	if ((file = fopen("/proc/self/mountinfo", "r")) == NULL)
+	{
+		LogError("/proc/self/mountinfo: %s\n", strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file))
+	{
+		count = 0;
+		for (field = strtok_r(line, " \n", &saveptr); field && count < 64;
+			 field = strtok_r(NULL, " \n", &saveptr))
+		{
+			fields[count++] = field;
+		}
+
+		// The optional fields end at a lone "-".
+		for (separator = 6; separator < count; separator++)
+		{
+			if (!strcmp(fields[separator], "-"))
+				break;
+		}
+
+		if (count < 5 || separator + 2 >= count ||
+			sscanf(fields[2], "%u:%u", &major, &minor) != 2)
+		{
+			continue;
+		}
+
+		for (i = 0; i < count; i++)
+		{
+			unescape_mountinfo(fields[i]);
+		}
+
+		add_entry(table, fields[4], fields[separator + 1],
+				  fields[separator + 2], makedev(major, minor));
+	}
+
+	fclose(file);
+
+	return 0;
+}
+#endif
+
+#pragma mark Rules
+// "fuse" matches "fuse" and "fuse.anything".
+static int fstype_matches(const char *rule, const char *fstype)
+{
+	size_t len = strlen(rule);
+
+	return (!strncmp(rule, fstype, len) &&
+			(fstype[len] == '\0' || fstype[len] == '.'));
+}
+
+// Mount points match exactly, give or take a trailing slash.
+static int point_matches(const char *rule, const char *mount_point)
+{
+	size_t rule_len = strlen(rule), point_len = strlen(mount_point);
+
+	while (rule_len > 1 && rule[rule_len - 1] == '/')
+		rule_len--;
+	while (point_len > 1 && mount_point[point_len - 1] == '/')
+		point_len--;
+
+	return (rule_len == point_len && !strncmp(rule, mount_point, rule_len));
+}
+
+static int is_excluded(mount_table_t *table, struct mount_entry_t *entry)
+{
+	int i;
+
+	for (i = 0; i < table->rule_counts[MOUNT_INCLUDE_POINT]; i++)
+	{
+		if (point_matches(table->rules[MOUNT_INCLUDE_POINT][i],
+						  entry->mount_point))
+			return false;
+	}
+
+	for (i = 0; i < table->rule_counts[MOUNT_EXCLUDE_POINT]; i++)
+	{
+		if (point_matches(table->rules[MOUNT_EXCLUDE_POINT][i],
+						  entry->mount_point))
+			return true;
+	}
+
+	for (i = 0; i < table->rule_counts[MOUNT_INCLUDE_FSTYPE]; i++)
+	{
+		if (fstype_matches(table->rules[MOUNT_INCLUDE_FSTYPE][i],
+						   entry->fstype))
+			return false;
+	}
+
+	for (i = 0; i < table->rule_counts[MOUNT_EXCLUDE_FSTYPE]; i++)
+	{
+		if (fstype_matches(table->rules[MOUNT_EXCLUDE_FSTYPE][i],
+						   entry->fstype))
+			return true;
+	}
+
+	for (i = 0; default_excluded_fstypes[i]; i++)
+	{
+		if (fstype_matches(default_excluded_fstypes[i], entry->fstype))
+			return true;
+	}
+
+	return false;
+}
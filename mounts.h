@@ -0,0 +1,66 @@
+/*
+ *  mounts.h
+ *  snapper
+ *
+ *  The mount table, read once at startup (from /proc/self/mountinfo on
+ *  Linux, getmntinfo() on Mac OS X), so that a scan across disks (-a) can
+ *  tell what kind of filesystem it's about to descend into, and stay out of
+ *  the ones that aren't worth it.
+ *
+ *  By default, pseudo filesystems (proc, sysfs, cgroup and friends), overlay
+ *  layers and remote filesystems (NFS, SMB and the like) are excluded.
+ *  Rules can exclude or include more, by filesystem type or mount point.  A
+ *  mount point rule beats a type rule, and an include beats an exclude.  A
+ *  type rule of "fuse" also covers "fuse.sshfs" and other subtypes.
+ *
+ */
+
+#include <sys/types.h>
+
+#pragma mark Rule kinds
+#define MOUNT_EXCLUDE_FSTYPE	0
+#define MOUNT_INCLUDE_FSTYPE	1
+#define MOUNT_EXCLUDE_POINT		2
+#define MOUNT_INCLUDE_POINT		3
+
+#pragma mark Data Types
+struct mount_entry_t {
+	char		*mount_point;		// Where it's mounted
+	char		*fstype;			// What kind of filesystem
+	char		*source;			// What's mounted (device, server:/path)
+	dev_t		dev;				// st_dev of everything on it
+	char		excluded;			// Don't descend into it
+};
+
+struct mount_table_t {
+	struct mount_entry_t *entries;	// The mounts, in mount order
+	int			count;
+	int			capacity;
+
+	char		**rules[4];			// Rule values, by MOUNT_* kind
+	int			rule_counts[4];
+};
+
+typedef struct mount_table_t mount_table_t;
+
+#pragma mark Functions
+
+// Sets up an empty table, with no rules beyond the defaults.
+void init_mount_table(mount_table_t *table);
+
+// Adds a rule of one of the MOUNT_* kinds.  Has to come before
+// load_mount_table().
+void mount_rule_add(mount_table_t *table, int kind, const char *value);
+
+// Reads the system's mount table, and decides which mounts are excluded.
+// Returns the number of mounts, or -1 if the table couldn't be read.
+int load_mount_table(mount_table_t *table);
+
+// Finds the mount a directory on device dev is the root of.  Bind mounts
+// can share a device, so path breaks ties (and can be NULL).  Returns NULL
+// if there's no such mount.
+struct mount_entry_t *mount_for_dev(mount_table_t *table, dev_t dev,
+									const char *path);
+
+// Frees everything in the table.
+void free_mount_table(mount_table_t *table);
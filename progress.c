@@ -0,0 +1,254 @@
+/*
+ *  progress.c
+ *  snapper
+ *
+ *  Progress reports from a thread of their own.  See progress.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "comm.h"
+#include "stats.h"
+#include "progress.h"
+#include "snap_record.h"
+#include "util_macros.h"
+
+#pragma mark Local Prototypes
+static void *progress_thread(void *arg);
+static int format_report(progress_t *progress, char *line, size_t size);
+static void format_bytes(double bytes, char *buffer, size_t size);
+static long long count_records(const char *path);
+
+#pragma mark Function Implementations
+void init_progress(progress_t *progress, const char *previous,
+				   void (*report)(const char *line))
+{
+	memset(progress, 0, sizeof(progress_t));
+	progress->previous = previous ? strdup(previous) : NULL;
+	progress->expected = -1;
+	progress->report = report;
+	pthread_mutex_init(&(progress->lock), NULL);
+	pthread_cond_init(&(progress->wake), NULL);
+}
+
+int start_progress(progress_t *progress)
+{
+	progress->started = monotonic_ns();
+	progress->stopping = 0;
+
+	if (pthread_create(&(progress->thread), NULL, progress_thread,
+					   progress) != 0)
+	{
+		LogError("Couldn't start the progress thread: %s\n", strerror(errno));
+		return -1;
+	}
+	progress->running = 1;
+
+	return 0;
+}
+
+void stop_progress(progress_t *progress)
+{
+	if (!progress->running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&(progress->lock));
+	progress->stopping = 1;
+	pthread_cond_signal(&(progress->wake));
+	pthread_mutex_unlock(&(progress->lock));
+
+	pthread_join(progress->thread, NULL);
+	progress->running = 0;
+}
+
+void free_progress(progress_t *progress)
+{
+	stop_progress(progress);
+
+	if (progress->previous)
+	{
+		free(progress->previous);
+	}
+	progress->previous = NULL;
+	pthread_mutex_destroy(&(progress->lock));
+	pthread_cond_destroy(&(progress->wake));
+}
+
+#pragma mark Local Functions
+static void *progress_thread(void *arg)
+{
+	progress_t *progress = arg;
+	char line[PROGRESS_LINE_SIZE];
+	struct timespec deadline;
+	struct timeval now;
+	int len, last_len = 0;
+	long long expected = -1;
+
+	// Counted here, so the walk can get going meanwhile.
+	if (progress->previous)
+	{
+		expected = count_records(progress->previous);
+	}
+
+	pthread_mutex_lock(&(progress->lock));
+	progress->expected = expected;
+
+	while (!progress->stopping)
+	{
+		// (Condition variables wait on the wall clock.)
+		gettimeofday(&now, NULL);
+		deadline.tv_sec = now.tv_sec + PROGRESS_INTERVAL_MS / 1000;
+		deadline.tv_nsec = now.tv_usec * 1000L +
+			(PROGRESS_INTERVAL_MS % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		pthread_cond_timedwait(&(progress->wake), &(progress->lock),
+							   &deadline);
+		if (progress->stopping)
+		{
+			break;
+		}
+
+		pthread_mutex_unlock(&(progress->lock));
+
+		// Padded out over what the last one left on the screen.
+		len = format_report(progress, line, sizeof(line));
+		while (len < last_len && len < (int) sizeof(line) - 1)
+		{
+			line[len++] = ' ';
+		}
+		line[len] = '\0';
+		last_len = len;
+		progress->report(line);
+
+		pthread_mutex_lock(&(progress->lock));
+	}
+
+	pthread_mutex_unlock(&(progress->lock));
+
+	return NULL;
+}
+
+// Formats a report, returning its length.
+static int format_report(progress_t *progress, char *line, size_t size)
+{
+	uint64_t files, records, bytes;
+	double elapsed, rate, left;
+	char byte_rate[32];
+	int depth, len, percent;
+	long long expected;
+
+	files = __atomic_load_n(&(progress->files), __ATOMIC_RELAXED);
+	records = __atomic_load_n(&(progress->records), __ATOMIC_RELAXED);
+	bytes = __atomic_load_n(&(progress->bytes), __ATOMIC_RELAXED);
+	depth = __atomic_load_n(&(progress->depth), __ATOMIC_RELAXED);
+	expected = progress->expected;
+
+	elapsed = (monotonic_ns() - progress->started) / 1e9;
+	rate = (elapsed > 0) ? records / elapsed : 0;
+	format_bytes((elapsed > 0) ? bytes / elapsed : 0, byte_rate,
+				 sizeof(byte_rate));
+
+	len = snprintf(line, size, "%llu files, %llu records (%.0f/s, %s/s), "
+				   "depth %d", (unsigned long long) files,
+				   (unsigned long long) records, rate, byte_rate, depth);
+
+	// How far along, if the last scan's size says.
+	if (expected > 0 && len < (int) size)
+	{
+		if (records < (uint64_t) expected)
+		{
+			percent = (int) (records * 100 / expected);
+			left = (rate > 0) ? (expected - records) / rate : 0;
+			len += snprintf(line + len, size - len, ", %d%%, "
+							"%d:%02d:%02d left", percent, (int) left / 3600,
+							((int) left / 60) % 60, (int) left % 60);
+		}
+		else
+		{
+			len += snprintf(line + len, size - len, ", past the last "
+							"scan's %lld", expected);
+		}
+	}
+
+	return (len < (int) size) ? len : (int) size - 1;
+}
+
+static void format_bytes(double bytes, char *buffer, size_t size)
+{
+	static const char *units[] = {"bytes", "KB", "MB", "GB", "TB", NULL};
+	int i;
+
+	for (i = 0; bytes >= 1024.0 && units[i + 1]; i++)
+	{
+		bytes /= 1024.0;
+	}
+	snprintf(buffer, size, (i == 0) ? "%.0f %s" : "%.1f %s", bytes, units[i]);
+}
+
+// A snapshot's records, going by how each one ends: a newline, or, with a
+// header to tell, the field and record delimiters it was written with (and
+// not counting the header).  Returns -1 if it can't be read.
+static long long count_records(const char *path)
+{
+	char buffer[64 * 1024], ending[32], *c, *end;
+	long long records = 0;
+	size_t got, kept = 0;
+	int ending_len;
+	FILE *file;
+
+	if ((file = fopen(path, "r")) == NULL)
+	{
+		LogError("Couldn't read the previous snapshot %s: %s\n", path,
+				 strerror(errno));
+		return -1;
+	}
+
+	got = fread(buffer, 1, sizeof(buffer), file);
+	if ((ending_len = snap_record_ending(buffer, got, ending,
+										sizeof(ending))) > 0)
+	{
+		records = -1;
+	}
+	else
+	{
+		ending[0] = '\n';
+		ending_len = 1;
+	}
+
+	// An ending can straddle two reads, so the last few bytes of each are
+	// kept for the next.
+	while (got > kept)
+	{
+		for (c = buffer, end = buffer + got;
+			 (c = memchr(c, ending[0], end - c)) != NULL; c++)
+		{
+			if (end - c < ending_len)
+			{
+				break;
+			}
+			if (memcmp(c, ending, ending_len) == 0)
+			{
+				records++;
+			}
+		}
+
+		kept = MIN(got, (size_t) ending_len - 1);
+		memmove(buffer, buffer + got - kept, kept);
+		got = kept + fread(buffer + kept, 1, sizeof(buffer) - kept, file);
+	}
+	fclose(file);
+
+	return MAX(records, 0);
+}
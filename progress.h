@@ -0,0 +1,83 @@
+/*
+ *  progress.h
+ *  snapper
+ *
+ *  Progress reports while the walk runs, from a thread of their own.  The
+ *  walk only bumps a few counters (relaxed atomic stores, as it's the only
+ *  writer), and the thread reads them a few times a second and reports the
+ *  rates, and how deep the walk is.
+ *
+ *  Given an earlier snapshot of the same tree, its record count is taken as
+ *  what this scan will come to, for a percentage and an estimate of the
+ *  time left.  It's counted by the thread, so the walk doesn't wait on it.
+ *
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#pragma mark Tunables
+// Time between reports.
+#define PROGRESS_INTERVAL_MS	250
+// Longest report.
+#define PROGRESS_LINE_SIZE		160
+
+#pragma mark Data Types
+struct progress_t {
+	// Bumped by the walk, and only the walk.
+	uint64_t	files;				// Entries visited
+	uint64_t	records;			// Records made of them
+	uint64_t	bytes;				// Their sizes, all told
+	int			depth;				// Level of the last one visited
+
+	// The earlier snapshot:
+	char		*previous;			// Its path, or NULL
+	long long	expected;			// Its records, once counted, or -1
+
+	void		(*report)(const char *line);	// Prints a report
+	uint64_t	started;			// When the walk began (ns)
+
+	pthread_t	thread;
+	pthread_mutex_t lock;			// For the stopping condition
+	pthread_cond_t wake;
+	int			running;
+	int			stopping;
+};
+
+typedef struct progress_t progress_t;
+
+#pragma mark Counting
+// An entry at level was visited.
+#define PROGRESS_VISIT(progress, level)									\
+	do {																\
+		__atomic_store_n(&((progress)->files), (progress)->files + 1,	\
+						 __ATOMIC_RELAXED);								\
+		__atomic_store_n(&((progress)->depth), (level),				\
+						 __ATOMIC_RELAXED);								\
+	} while (0)
+
+// A record of size bytes was made.
+#define PROGRESS_RECORD(progress, size)									\
+	do {																\
+		__atomic_store_n(&((progress)->records),						\
+						 (progress)->records + 1, __ATOMIC_RELAXED);	\
+		__atomic_store_n(&((progress)->bytes),							\
+						 (progress)->bytes + (size), __ATOMIC_RELAXED);	\
+	} while (0)
+
+#pragma mark Functions
+
+// Sets up the counters.  previous (which may be NULL) is an earlier
+// snapshot of the tree, and report prints a report.  Copies previous.
+void init_progress(progress_t *progress, const char *previous,
+				   void (*report)(const char *line));
+
+// Starts the reports.  Returns 0, or -1 if the thread couldn't be started
+// (and there won't be any).
+int start_progress(progress_t *progress);
+
+// Stops them, once the walk is done.
+void stop_progress(progress_t *progress);
+
+// Frees the counters' copy of the snapshot's path.
+void free_progress(progress_t *progress);
@@ -17,23 +17,35 @@
 
 #include "comm.h"
 #include "snap_record.h"
+#include "hash.h"
+#include "stats.h"
+#include "trace.h"
 #include "util_macros.h"
 
 #pragma mark Forward Declarations
-// Prints the header string to the provided buffer.
-int hprintbuf(snap_t *snap, char **buf, size_t maxlen);
+// Turns a human readable size ("12 bytes", "1.5 KB") back into bytes, as
+// near as the text allows.  Returns -1 if it isn't one.
+static off_t parse_human_size(const char *str);
 
-// Print a record description to a buffer
-int rprintbuf(snap_t *snap, file_record *record, char **buf, size_t maxlen);
+// Does rprintbuf()'s formatting, untimed.
+static int format_record(snap_t *snap, file_record *record, char **buf, 
+						 size_t maxlen);
 
-// Simple function to return the next line of a file stream.  Returns negative
-// upon failure, or size of line (including a possibilty of 0), upon success.
-// Originally called getline(), but now that's part of the C standard library.
-int _getline(FILE *file, char *buffer, size_t buflen);
+// Reads a snapper file's header line into the column tracker and the snap.
+static int read_snap_header(snap_t *snap, FILE *snapper_file, char *path,
+							int column_tracker[]);
 
-int parse_snapper_file_line(int column_tracker[], 
-							char *line, 
-							file_record *record);
+// Counts a record's bytes into (sign 1) or out of (-1) the snap's memory.
+static void account_record(snap_t *snap, file_record *record, int sign);
+
+// The length of the column name (as hprintbuf() writes them) that text
+// starts with, or 0 if it doesn't start with one.
+static size_t header_name_length(const char *text, size_t len);
+
+// How many names, each followed by the field delimiter field, the header
+// at the start of text has.  Puts where they end in *end.
+static int header_names_with(const char *text, size_t len, const char *field,
+							 size_t field_len, size_t *end);
 
 int _getline(FILE *file, char *buffer, size_t buflen)
 {
@@ -147,7 +159,15 @@ int init_snap_record(snap_t *snap)
 	CREATE(snap->master_array, 
 		   snap->currentArrayCapacity * sizeof(file_record *));
 	
+	memset(&(snap->memory), 0, sizeof(struct snap_memory_t));
+	snap->memory.spine = snap->currentArrayCapacity * sizeof(file_record *);
+	snap->memory.total = snap->memory.peak = snap->memory.spine;
+	
 	snap->column_string = strdup("%p %m %c");
+	snap->hash_algorithm = HASH_XXH64;
+	snap->fingerprint_blocks = FINGERPRINT_BLOCKS;
+	snap->format_ns = 0;
+	snap->bytes_written = 0;
 	set_snap_field_delimiter(snap, "%t");
 	set_snap_record_delimiter(snap, "%n");
 	
@@ -175,6 +195,74 @@ int set_snap_record_delimiter(snap_t *snap, char *record_delimiter)
 	return 0;
 }
 
+// Returns true if the snap's column string contains the given column code.
+int snap_has_column(snap_t *snap, char code)
+{
+	char *source_char;
+	
+	for (source_char = snap->column_string; *source_char; source_char++)
+	{
+		if (*source_char != '%')
+		{
+			continue;
+		}
+		
+		// Look at the code (a "%%" is an escaped '%', not a code).
+		source_char++;
+		if (*source_char == '\0')
+		{
+			break;
+		}
+		if (*source_char == code && code != '%')
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+// Compares paths in walk order.  The same as strcmp, except that '/' sorts
+// before every other character, which makes "/a/b" come before "/a-b", just
+// like a name-sorted walk would visit them.
+int pathcmp(const char *left, const char *right)
+{
+	const unsigned char *l = (const unsigned char *) left;
+	const unsigned char *r = (const unsigned char *) right;
+	int lc, rc;
+	
+	while (*l && *l == *r)
+	{
+		l++;
+		r++;
+	}
+	
+	// '\0' < '/' < everything else.
+	lc = (*l == '/') ? 1 : ((*l) ? *l + 1 : 0);
+	rc = (*r == '/') ? 1 : ((*r) ? *r + 1 : 0);
+	
+	return lc - rc;
+}
+
+// Returns true if path is inside (not equal to) the directory dir.
+int path_is_under(const char *path, const char *dir)
+{
+	size_t dirlen = strlen(dir);
+	
+	if (strncmp(path, dir, dirlen) != 0)
+	{
+		return false;
+	}
+	
+	// "/" is the one directory that already ends with a slash.
+	if (dirlen > 0 && dir[dirlen-1] == '/')
+	{
+		return path[dirlen] != '\0';
+	}
+	
+	return path[dirlen] == '/';
+}
+
 int add_record_to_snap(snap_t *snap, file_record *file)
 {
 	// Self-growing array.  We keep track of the capacity, and reallocate
@@ -189,6 +277,8 @@ int add_record_to_snap(snap_t *snap, file_record *file)
 		
 		// Keep track of the capacity.
 		snap->currentArrayCapacity += ARRAY_CHUNK_SIZE;
+		snap->memory.spine += ARRAY_CHUNK_SIZE * sizeof(file_record *);
+		snap->memory.total += ARRAY_CHUNK_SIZE * sizeof(file_record *);
 	}
 	
 	snap->master_array[snap->currentArraySize] = file;
@@ -196,9 +286,58 @@ int add_record_to_snap(snap_t *snap, file_record *file)
 	// Keep track of our size.
 	snap->currentArraySize++;
 	
+	account_record(snap, file, 1);
+	if (snap->memory.total > snap->memory.peak)
+	{
+		snap->memory.peak = snap->memory.total;
+		snap->memory.peak_records = snap->currentArraySize;
+	}
+	
 	return 0;
 }
 
+void empty_snap(snap_t *snap)
+{
+	int i;
+	
+	for (i = 0; i < snap->currentArraySize; i++)
+	{
+		account_record(snap, snap->master_array[i], -1);
+		free_file_record(snap->master_array[i]);
+		snap->master_array[i] = NULL;
+	}
+	
+	snap->currentArraySize = 0;
+}
+
+static void account_record(snap_t *snap, file_record *record, int sign)
+{
+	long long paths = 0, time_strings = 0;
+	
+	if (record->re_path)
+	{
+		paths = strlen(record->re_path) + 1;
+	}
+	if (record->re_atime_str)
+	{
+		time_strings += strlen(record->re_atime_str) + 1;
+	}
+	if (record->re_mtime_str)
+	{
+		time_strings += strlen(record->re_mtime_str) + 1;
+	}
+	if (record->re_ctime_str)
+	{
+		time_strings += strlen(record->re_ctime_str) + 1;
+	}
+	
+	snap->memory.records += sign * (long long) sizeof(file_record);
+	snap->memory.paths += sign * paths;
+	snap->memory.time_strings += sign * time_strings;
+	snap->memory.total += sign * ((long long) sizeof(file_record) + paths +
+								  time_strings);
+}
+
 // Prints the header string to the provided buffer.
 #define MAX_HEADER	256
 int hprintbuf(snap_t *snap, char **buf, size_t maxlen)
@@ -274,6 +413,9 @@ int hprintbuf(snap_t *snap, char **buf, size_t maxlen)
 			case 'i':
 				snprintf(local_buffer, MAX_HEADER, "%s", "inode");
 				break;
+			case 'd':
+				snprintf(local_buffer, MAX_HEADER, "%s", "Device");
+				break;
 			case 'o':
 				snprintf(local_buffer, MAX_HEADER, "%s", "Owner");
 				break;
@@ -292,6 +434,17 @@ int hprintbuf(snap_t *snap, char **buf, size_t maxlen)
 			case 'e':
 				snprintf(local_buffer, MAX_HEADER, "%s", "Selected");
 				break;
+			case 'h':
+				snprintf(local_buffer, MAX_HEADER, "Hash (%s)", 
+						 hash_algorithm_name(snap->hash_algorithm));
+				break;
+			case 'f':
+				snprintf(local_buffer, MAX_HEADER, "Fingerprint (%d blocks)", 
+						 snap->fingerprint_blocks);
+				break;
+			case 'r':
+				snprintf(local_buffer, MAX_HEADER, "%s", "Tree Hash");
+				break;
 			case '%':
 			case '\0':
 			case ' ':
@@ -347,6 +500,17 @@ int hprintbuf(snap_t *snap, char **buf, size_t maxlen)
 #undef MAX_HEADER
 
 int rprintbuf(snap_t *snap, file_record *record, char **buf, size_t maxlen)
+{
+	uint64_t start = monotonic_ns();
+	int len = format_record(snap, record, buf, maxlen);
+	
+	snap->format_ns += monotonic_ns() - start;
+	
+	return len;
+}
+
+static int format_record(snap_t *snap, file_record *record, char **buf, 
+						 size_t maxlen)
 {
 	char *source_char, *dest_char, *save_pos, *buffer_pointer;
 	char local_buffer[PATH_MAX+1];
@@ -399,21 +563,27 @@ int rprintbuf(snap_t *snap, file_record *record, char **buf, size_t maxlen)
 				snprintf(local_buffer, PATH_MAX, "%s", record->re_path);
 				break;
 			case 'a':
+				// A record read from a file keeps the text it was read with.
 				snprintf(local_buffer, PATH_MAX, "%s", 
+						 (record->re_atime_str) ? record->re_atime_str :
 						 ctime(&(record->re_atime)));
 				break;
 			case 'A':
 				snprintf(local_buffer, PATH_MAX, "%ld", record->re_atime);
 				break;
 			case 'm':
+				// A record read from a file keeps the text it was read with.
 				snprintf(local_buffer, PATH_MAX, "%s", 
+						 (record->re_mtime_str) ? record->re_mtime_str :
 						 ctime(&(record->re_mtime)));
 				break;
 			case 'M':
 				snprintf(local_buffer, PATH_MAX, "%ld", record->re_mtime);
 				break;
 			case 'c':
+				// A record read from a file keeps the text it was read with.
 				snprintf(local_buffer, PATH_MAX, "%s", 
+						 (record->re_ctime_str) ? record->re_ctime_str :
 						 ctime(&(record->re_ctime)));
 				break;
 			case 'C':
@@ -454,6 +624,10 @@ int rprintbuf(snap_t *snap, file_record *record, char **buf, size_t maxlen)
 				snprintf(local_buffer, PATH_MAX, "%lu", 
 						 (long unsigned int)record->re_ino);
 				break;
+			case 'd':
+				snprintf(local_buffer, PATH_MAX, "%llu", 
+						 (long long unsigned int)record->re_dev);
+				break;
 			case 'o':
 				snprintf(local_buffer, PATH_MAX, "%lu", 
 						 (long unsigned int)record->re_uid);
@@ -471,6 +645,20 @@ int rprintbuf(snap_t *snap, file_record *record, char **buf, size_t maxlen)
 			case 'e': // Special "enabled"
 				snprintf(local_buffer, PATH_MAX, "%c", record->re_selected);
 				break;
+			case 'h':
+				// Only regular files that could be read have a hash.
+				snprintf(local_buffer, PATH_MAX, "%s", 
+						 (record->re_hash) ? record->re_hash : "");
+				break;
+			case 'f':
+				// Same goes for the fingerprint.
+				snprintf(local_buffer, PATH_MAX, "%s", 
+						 (record->re_fingerprint) ? record->re_fingerprint : "");
+				break;
+			case 'r':
+				snprintf(local_buffer, PATH_MAX, "%s", 
+						 (record->re_tree_hash) ? record->re_tree_hash : "");
+				break;
 			case 'P': 
 				// P now comes out to the octal mode, as described in the
 				// chmod manual page
@@ -572,11 +760,50 @@ int write_snap_record_to_file(snap_t *snap, char *path)
 {
 	int i;
 	FILE *myFile;
-	struct file_record_t *current_record;
-	char *buffer;
+	char *buffer, *insert;
+	size_t used = 0;
+	uint64_t start, write_start;
 	
-	// Create a buffer to hold the current record.
-	CREATE(buffer, MAX_RECORD_LENGTH+1);
+	// Records are formatted one after another into a chunk, with room past
+	// it for the one that fills it.
+	CREATE(buffer, WRITE_CHUNK_SIZE + MAX_RECORD_LENGTH + 1);
+	
+	// Open the file, and print the headers to it.
+	myFile = open_snap_output(snap, path);
+	
+	// For all the records in the array:
+	start = TRACE_START();
+	for (i = 0; i < snap->currentArraySize; i++)
+	{
+		// Print the current record to the end of the chunk, according to
+		// the columnString
+		insert = buffer + used;
+		used += rprintbuf(snap, snap->master_array[i], &insert,
+						  MAX_RECORD_LENGTH);
+		
+		// Write the chunk out once it's full (and at the end).
+		if (used >= WRITE_CHUNK_SIZE || i == snap->currentArraySize - 1)
+		{
+			TRACE_END("format", NULL, start);
+			write_start = TRACE_START();
+			
+			snap->bytes_written += fwrite(buffer, 1, used, myFile);
+			used = 0;
+			
+			TRACE_END("write", NULL, write_start);
+			start = TRACE_START();
+		}
+	}
+	
+	free(buffer);
+	
+	return close_snap_output(myFile, path);
+}
+
+FILE *open_snap_output(snap_t *snap, char *path)
+{
+	FILE *myFile;
+	char *buffer;
 	
 	// If we have a specified outputPath, attempt to open it.
 	if (path)
@@ -598,30 +825,24 @@ int write_snap_record_to_file(snap_t *snap, char *path)
 	// Now, myFile either points to a specified file, or stdout.  Either way,
 	// we're going to write to it.
 	
-	// Print the header string to the buffer.
+	// Print the header string to a buffer, and from there to the file.
+	CREATE(buffer, MAX_RECORD_LENGTH+1);
 	hprintbuf(snap, &buffer, MAX_RECORD_LENGTH);
 	
 	// Ensure null-termination
 	buffer[MAX_RECORD_LENGTH] = '\0';
 	
-	// Print to file.
-	fprintf(myFile, "%s", buffer);
-	
-	// For all the records in the array:
-	for (i = 0; i < snap->currentArraySize; i++)
+	if (fputs(buffer, myFile) != EOF)
 	{
-		current_record = snap->master_array[i];
-		
-		// Print the current record to our buffer, according to the columnString
-		rprintbuf(snap, current_record, &buffer, MAX_RECORD_LENGTH);
-		
-		// Make sure it's null-terminated (probably already is)
-		buffer[MAX_RECORD_LENGTH] = '\0';
-		
-		// Print it out.
-		fprintf(myFile, "%s", buffer);
+		snap->bytes_written += strlen(buffer);
 	}
+	free(buffer);
 	
+	return myFile;
+}
+
+int close_snap_output(FILE *myFile, char *path)
+{
 	// If we have an actual file, fclose it (which calls it's on fflush),
 	// otherwise, call fflush.  Just to make sure all the output gets written.
 	if (myFile != stdout)
@@ -655,7 +876,7 @@ int write_snap_record_to_file(snap_t *snap, char *path)
 }
 
 // Some defines to keep track of column indicies.
-#define MAX_COLUMNS		16
+#define MAX_COLUMNS		20
 #define PATH_COLUMN		0
 #define OWNER_COLUMN	1
 #define GROUP_COLUMN	2
@@ -672,11 +893,42 @@ int write_snap_record_to_file(snap_t *snap, char *path)
 #define SIZE_COLUMN		13
 #define BYTES_COLUMN	14
 #define SELECT_COLUMN	15
+#define HASH_COLUMN		16
+#define FPRINT_COLUMN	17
+#define TREE_COLUMN		18
+#define DEVICE_COLUMN	19
 
 int read_snap_record_from_file(snap_t *snap, char *path)
-{	
-	int column_tracker[MAX_COLUMNS];
+{
+	snap_reader_t reader;
+	file_record *new_rec;
+	
+	if (open_snap_reader(&reader, snap, path) != 0)
+	{
+		return -1;
+	}
+	
+	while ((new_rec = snap_reader_next(&reader)) != NULL)
+	{
+		add_record_to_snap(snap, new_rec);
+	}
+	
+	close_snap_reader(&reader);
+	
+	/* Sort by path here!  This will enable binary searches */
+	
+	return 0;
+}
 
+int open_snap_reader(snap_reader_t *reader, snap_t *snap, char *path)
+{
+	int *column_tracker;
+	
+	CREATE(reader->column_tracker, MAX_COLUMNS * sizeof(int));
+	CREATE(reader->buffer, PATH_MAX + 128);
+	reader->path = path;
+	
+	column_tracker = reader->column_tracker;
 	column_tracker[PATH_COLUMN] = -1;
 	column_tracker[OWNER_COLUMN] = -1;
 	column_tracker[GROUP_COLUMN] = -1;
@@ -693,20 +945,201 @@ int read_snap_record_from_file(snap_t *snap, char *path)
 	column_tracker[BYTES_COLUMN] = -1;
 	column_tracker[MODE_T_COLUMN] = -1;
 	column_tracker[SELECT_COLUMN] = -1;
+	column_tracker[HASH_COLUMN] = -1;
+	column_tracker[FPRINT_COLUMN] = -1;
+	column_tracker[TREE_COLUMN] = -1;
+	column_tracker[DEVICE_COLUMN] = -1;
 	
-	FILE *snapper_file = fopen(path, "r");
-	if (snapper_file == NULL)
+	reader->file = fopen(path, "r");
+	if (reader->file == NULL)
 	{
 		LogError("Couldn't open snapper file %s: %s\n",
 				 path, strerror(errno));
-		return(1);
+		free(reader->column_tracker);
+		free(reader->buffer);
+		return -1;
+	}
+	
+	if (read_snap_header(snap, reader->file, path, column_tracker) != 0 ||
+		column_tracker[PATH_COLUMN] == -1)
+	{
+		if (column_tracker[PATH_COLUMN] == -1)
+		{
+			LogError("No path column in %s.\n", path);
+		}
+		close_snap_reader(reader);
+		return -1;
+	}
+	
+	return 0;
+}
+
+file_record *snap_reader_next(snap_reader_t *reader)
+{
+	file_record *new_rec;
+	
+	if (_getline(reader->file, reader->buffer, PATH_MAX + 64) < 0)
+	{
+		return NULL;
+	}
+	
+	CREATE(new_rec, sizeof(file_record));
+	parse_snapper_file_line(reader->column_tracker, reader->buffer, new_rec);
+	
+	return new_rec;
+}
+
+void close_snap_reader(snap_reader_t *reader)
+{
+	if (reader->file)
+	{
+		fclose(reader->file);
+	}
+	free(reader->column_tracker);
+	free(reader->buffer);
+	
+	reader->file = NULL;
+	reader->column_tracker = NULL;
+	reader->buffer = NULL;
+}
+
+// Longest field delimiter snap_record_ending() looks for.
+#define MAX_DELIMITER	16
+int snap_record_ending(const char *text, size_t len, char *ending,
+					   size_t size)
+{
+	size_t first_len, field_len, best_len = 0, end, best_end = 0;
+	int names, best = 0;
+	
+	if ((first_len = header_name_length(text, len)) == 0)
+	{
+		return -1;
+	}
+	
+	// The field delimiter follows the first name.  However long it is, it
+	// has to follow every other one too, so it's the length that lines up
+	// the most names (the shortest, with only one column to go by).
+	for (field_len = 1; field_len <= MAX_DELIMITER; field_len++)
+	{
+		names = header_names_with(text, len, text + first_len, field_len,
+								  &end);
+		if (names > best)
+		{
+			best = names;
+			best_len = field_len;
+			best_end = end;
+		}
+	}
+	
+	if (best == 0 || best_end >= len || best_len + 1 > size)
+	{
+		return -1;
+	}
+	memcpy(ending, text + first_len, best_len);
+	ending[best_len] = text[best_end];
+	
+	return (int) best_len + 1;
+}
+
+static int header_names_with(const char *text, size_t len, const char *field,
+							 size_t field_len, size_t *end)
+{
+	size_t pos = 0, name_len;
+	int names = 0;
+	
+	if (field + field_len > text + len)
+	{
+		return 0;
+	}
+	
+	while ((name_len = header_name_length(text + pos, len - pos)) &&
+		   pos + name_len + field_len <= len &&
+		   memcmp(text + pos + name_len, field, field_len) == 0)
+	{
+		pos += name_len + field_len;
+		names++;
+	}
+	*end = pos;
+	
+	return names;
+}
+
+static size_t header_name_length(const char *text, size_t len)
+{
+	static const char *names[] = {"Path", "Last Accessed", "atime",
+		"Last Modified", "mtime", "Last Mode Change", "ctime", "Size (raw)",
+		"Size", "inode", "Device", "Owner", "Group", "Type (raw)", "Type",
+		"Mode", "Selected", "Tree Hash", NULL};
+	// These carry the algorithm or the block count, up to the ')'.
+	static const char *prefixes[] = {"Hash (", "Fingerprint (", NULL};
+	const char *close;
+	size_t name_len;
+	int i;
+	
+	// Longest first, where one starts with another.
+	for (i = 0; names[i]; i++)
+	{
+		name_len = strlen(names[i]);
+		if (name_len <= len && memcmp(text, names[i], name_len) == 0)
+		{
+			return name_len;
+		}
+	}
+	
+	for (i = 0; prefixes[i]; i++)
+	{
+		name_len = strlen(prefixes[i]);
+		if (name_len <= len && memcmp(text, prefixes[i], name_len) == 0 &&
+			(close = memchr(text + name_len, ')', len - name_len)) != NULL)
+		{
+			return close - text + 1;
+		}
+	}
+	
+	return 0;
+}
+
+static off_t parse_human_size(const char *str)
+{
+	static const char *units[] = {"bytes", "KB", "MB", "GB", "TB", NULL};
+	double size, scale = 1.0;
+	char *endptr;
+	int i;
+	
+	size = strtod(str, &endptr);
+	if (endptr == str)
+	{
+		return -1;
+	}
+	while (*endptr == ' ')
+	{
+		endptr++;
+	}
+	if (*endptr == '\0')
+	{
+		return (off_t) size;
+	}
+	
+	for (i = 0; units[i]; i++, scale *= 1024.0)
+	{
+		if (strcmp(endptr, units[i]) == 0)
+		{
+			return (off_t)(size * scale + 0.5);
+		}
 	}
+	
+	return -1;
+}
 
+// Reads the header line, noting which field holds which column, and builds
+// the snap's column string from it.
+static int read_snap_header(snap_t *snap, FILE *snapper_file, char *path,
+							int column_tracker[])
+{
 	// Our buffer for getting lines from the snapper file.
 	char buffer[PATH_MAX + 128]; // Basically, the longest path and 128 extra
 								 // spaces.  This should suffice.
-
-
+	
 	// Get the header.
 	bzero(buffer, PATH_MAX + 64);
 	int lines = 0;
@@ -874,6 +1307,48 @@ int read_snap_record_from_file(snap_t *snap, char *path)
 						column_tracker[MODE_T_COLUMN] = i;
 						strncat(column_string, "%T", 200-strlen(column_string));
 					}
+					else if (strncmp("Hash (", header_buf, 6) == 0)
+					{
+						// The algorithm is named in the parentheses.
+						char *close_paren = strchr(header_buf, ')');
+						if (close_paren)
+						{
+							*close_paren = '\0';
+						}
+						if (hash_algorithm_from_name(header_buf + 6) != -1)
+						{
+							snap->hash_algorithm = 
+								hash_algorithm_from_name(header_buf + 6);
+						}
+						column_tracker[HASH_COLUMN] = i;
+						strncat(column_string, "%h", 200-strlen(column_string));
+					}
+					else if (strncmp("Fingerprint (", header_buf, 13) == 0)
+					{
+						// The number of sampled blocks is in the parentheses.
+						if (atoi(header_buf + 13) > 0)
+						{
+							snap->fingerprint_blocks = atoi(header_buf + 13);
+						}
+						column_tracker[FPRINT_COLUMN] = i;
+						strncat(column_string, "%f", 200-strlen(column_string));
+					}
+					else if (strncmp("Tree Hash", 
+									 header_buf, 
+									 MAX(strlen("Tree Hash"), 
+										 strlen(header_buf))) == 0)
+					{
+						column_tracker[TREE_COLUMN] = i;
+						strncat(column_string, "%r", 200-strlen(column_string));
+					}
+					else if (strncmp("Device", 
+									 header_buf, 
+									 MAX(strlen("Device"), 
+										 strlen(header_buf))) == 0)
+					{
+						column_tracker[DEVICE_COLUMN] = i;
+						strncat(column_string, "%d", 200-strlen(column_string));
+					}
 					
 					
 					i++;  // Increment column counter.
@@ -895,20 +1370,7 @@ int read_snap_record_from_file(snap_t *snap, char *path)
 			
 			break;
 	}
-	
-	assert(column_tracker[PATH_COLUMN] != -1);
 
-	while ((_getline(snapper_file, buffer, PATH_MAX + 64) >= 0))
-	{
-		file_record *new_rec;
-		CREATE(new_rec, sizeof(file_record));
-		
-		parse_snapper_file_line(column_tracker, buffer, new_rec);
-		add_record_to_snap(snap, new_rec);
-	}
-	
-	/* Sort by path here!  This will enable binary searches */
-	
 	return 0;
 }
 
@@ -932,10 +1394,14 @@ int parse_snapper_file_line(int column_tracker[],
 	record->re_ctime_str	=	NULL;
 	record->re_size			=	-1;
 	record->re_ino			=	-1;
+	record->re_dev			=	-1;
 	record->re_uid			=	-1;
 	record->re_gid			=	-1;
 	record->re_mode			=	-1;
 	record->re_type			=	'\0';
+	record->re_hash			=	NULL;
+	record->re_fingerprint	=	NULL;
+	record->re_tree_hash	=	NULL;
 	record->re_selected		=	'u';
 
 	while (*curr_pos && curr_input - entry_buf < PATH_MAX)
@@ -949,8 +1415,10 @@ int parse_snapper_file_line(int column_tracker[],
 			{
 				record->re_path = strdup(entry_buf); // This must be freed.
 			}
-			else if (i == column_tracker[PERMS_COLUMN])
+			else if (i == column_tracker[PERMS_COLUMN] &&
+					 column_tracker[MODE_T_COLUMN] == -1)
 			{
+				// Only the permissions, so the raw type's mode wins.
 				record->re_mode = strtol(entry_buf, &endptr, 8);
 				
 				if (*endptr != '\0')
@@ -977,6 +1445,10 @@ int parse_snapper_file_line(int column_tracker[],
 					case 'n':
 						record->re_selected = *entry_buf;
 						break;
+					case '\0':
+						// As a scan leaves it.
+						record->re_selected = '\0';
+						break;
 					default:
 						record->re_selected = 'u';
 				}
@@ -1053,18 +1525,60 @@ int parse_snapper_file_line(int column_tracker[],
 			}
 			else if (i == column_tracker[SIZE_COLUMN])
 			{
-				record->re_size = strtol(entry_buf, &endptr, 10);
+				record->re_size = parse_human_size(entry_buf);
+			}
+			else if (i == column_tracker[TYPE_COLUMN])
+			{
+				// Get the first char in entry_buf
+				record->re_type = *entry_buf;
+			}
+			else if (i == column_tracker[MODE_T_COLUMN])
+			{
+				record->re_mode = strtol(entry_buf, &endptr, 10);
 				
 				if (*endptr != '\0')
 				{
-					record->re_size = -1;
+					record->re_mode = -1;
 				}
+			}
+			else if (i == column_tracker[HASH_COLUMN])
+			{
+				if (*entry_buf)
+				{
+					record->re_hash = strdup(entry_buf);
+				}
+			}
+			else if (i == column_tracker[FPRINT_COLUMN])
+			{
+				if (*entry_buf)
+				{
+					record->re_fingerprint = strdup(entry_buf);
+				}
+			}
+			else if (i == column_tracker[TREE_COLUMN])
+			{
+				if (*entry_buf)
+				{
+					record->re_tree_hash = strdup(entry_buf);
+				}
+			}
+			else if (i == column_tracker[DEVICE_COLUMN])
+			{
+				record->re_dev = strtoull(entry_buf, &endptr, 10);
 				
+				if (*endptr != '\0')
+				{
+					record->re_dev = -1;
+				}
 			}
-			else if (i == column_tracker[TYPE_COLUMN])
+			else if (i == column_tracker[BYTES_COLUMN])
 			{
-				// Get the first char in entry_buf
-				record->re_type = *entry_buf;
+				record->re_size = strtoll(entry_buf, &endptr, 10);
+				
+				if (*endptr != '\0')
+				{
+					record->re_size = -1;
+				}
 			}
 
 			
@@ -1078,42 +1592,99 @@ int parse_snapper_file_line(int column_tracker[],
 		}
 	}	
 	
+	// Without the type column, the raw type's mode says what it is.
+	if (record->re_type == '\0' && column_tracker[MODE_T_COLUMN] != -1 &&
+		record->re_mode != (mode_t) -1)
+	{
+		record->re_type = file_type_for_mode(record->re_mode);
+	}
+	
 	return 0;
 }
 
-
-int free_snap(snap_t *snap)
+char file_type_for_mode(mode_t mode)
 {
+	if (S_ISDIR(mode))
+	{
+		return 'D';
+	}
+	else if (S_ISLNK(mode))
+	{
+		return 'L';
+	}
+	else if (S_ISSOCK(mode))
+	{
+		return 'S';
+	}
+	else if (S_ISFIFO(mode))
+	{
+		return 'U';
+	}
+	else if (S_ISBLK(mode))
+	{
+		return 'B';
+	}
+	else if (S_ISCHR(mode))
+	{
+		return 'C';
+	}
+	else if (S_ISREG(mode))
+	{
+		return 'F';
+	}
 	
-	int i;
+	return 'X';
+}
+
+
+void free_file_record(file_record *record)
+{
+	if (record == NULL)
+	{
+		return;
+	}
 	
-	for (i = 0; i < snap->currentArraySize; i++)
+	if (record->re_path)
 	{
-		if (snap->master_array[i])
-		{
-			if (snap->master_array[i]->re_path)
-			{
-				free(snap->master_array[i]->re_path);
-			}
-			if (snap->master_array[i]->re_atime_str)
-			{
-				free(snap->master_array[i]->re_atime_str);
-			}
-			if (snap->master_array[i]->re_mtime_str)
-			{
-				free(snap->master_array[i]->re_mtime_str);
-			}
-			if (snap->master_array[i]->re_ctime_str)
-			{
-				free(snap->master_array[i]->re_ctime_str);
-			}
-			free(snap->master_array[i]);
-		}
+		free(record->re_path);
+	}
+	if (record->re_atime_str)
+	{
+		free(record->re_atime_str);
+	}
+	if (record->re_mtime_str)
+	{
+		free(record->re_mtime_str);
+	}
+	if (record->re_ctime_str)
+	{
+		free(record->re_ctime_str);
+	}
+	if (record->re_hash)
+	{
+		free(record->re_hash);
+	}
+	if (record->re_fingerprint)
+	{
+		free(record->re_fingerprint);
+	}
+	if (record->re_tree_hash)
+	{
+		free(record->re_tree_hash);
 	}
+	free(record);
+}
+
+int free_snap(snap_t *snap)
+{
+	
+	empty_snap(snap);
 	
 	free(snap->master_array);
 	
 	snap->master_array = NULL;
+	snap->memory.total -= snap->memory.spine;
+	snap->memory.spine = 0;
 	
 	free(snap->column_string);
 	free(snap->field_delimiter);
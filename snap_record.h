@@ -7,8 +7,10 @@
  *
  */
 
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <stdint.h>
 
 #pragma mark Reallocation defines
 // Initial size of the array.  A good number would be right around the number
@@ -19,7 +21,12 @@
 #define ARRAY_CHUNK_SIZE	50000
 
 #define COLUMN_STRING_MAX	64
+
+// Interior blocks sampled for the %f fingerprint, unless told otherwise.
+#define FINGERPRINT_BLOCKS	16
 #define MAX_RECORD_LENGTH	(PATH_MAX + 100)
+// Records are formatted into a buffer this big, which is written out whole.
+#define WRITE_CHUNK_SIZE	(256 * 1024)
 
 #pragma mark Data Types
 struct file_record_t {
@@ -32,10 +39,17 @@ struct file_record_t {
 	char		*re_ctime_str;		// Human readible string of above.
 	off_t		re_size;			// File size, in bytes
 	ino_t		re_ino;				// File inode
+	dev_t		re_dev;				// Device the file lives on
 	uid_t		re_uid;				// File's owner ID
 	gid_t		re_gid;				// File's group ID
 	mode_t		re_mode;			// File's mode (permissions)
 	char		re_type;			// File's type (F for file, D for dir, etc)
+	char		*re_hash;			// Hex digest of the file's contents, or
+									// NULL if it wasn't hashed.
+	char		*re_fingerprint;	// Hex digest of sampled blocks of the
+									// file's contents, or NULL.
+	char		*re_tree_hash;		// Hex rollup hash of this entry (and
+									// for directories, everything in them).
 	
 	/* Internal: */
 	char		re_selected;		// Indicates that this file is "selected"
@@ -46,21 +60,51 @@ struct file_record_t {
 
 typedef struct file_record_t file_record;
 
+// Bytes a snap holds, by what holds them.  They're the sizes asked of malloc
+// (its own overhead isn't counted), and only what's there when a record is
+// added: hashes and fingerprints, filled in later by the hashers, aren't.
+struct snap_memory_t {
+	long long	records;					// The file_records themselves.
+	long long	paths;						// Their paths.
+	long long	time_strings;				// Their time strings, if read.
+	long long	spine;						// The master array.
+	long long	total;						// All of the above.
+	long long	peak;						// The most total has been,
+	int			peak_records;				// and the records held then.
+};
+
 struct snap_record_t {
 	char		valid;
 	
 	char		*column_string;
 	char		*field_delimiter;
 	char		*record_delimiter;
+	int			hash_algorithm;				// Algorithm behind the %h column.
+	int			fingerprint_blocks;			// Blocks sampled for %f.
 	
 	// Our record array:
 	int			currentArraySize;			// Current size of the array.
 	int			currentArrayCapacity;		// Current max size of the array.
 	file_record **master_array;				// The master record array.
+	struct snap_memory_t memory;			// What it's all taking up.
+	
+	// What writing it out took:
+	uint64_t	format_ns;					// Time in rprintbuf().
+	long long	bytes_written;				// Headers and records written.
 };
 
 typedef struct snap_record_t snap_t;
 
+// Reads a snapper file a record at a time.
+struct snap_reader_t {
+	FILE		*file;
+	char		*path;
+	int			*column_tracker;			// Which field holds which column.
+	char		*buffer;					// The line being parsed.
+};
+
+typedef struct snap_reader_t snap_reader_t;
+
 #pragma mark Functions
 
 // Initializes the snap_t.  Does not allocate.
@@ -75,14 +119,80 @@ int set_snap_field_delimiter(snap_t *snap, char *field_delimiter);
 // Set the record delimiter for the snap
 int set_snap_record_delimiter(snap_t *snap, char *record_delimiter);
 
+// Returns true if the snap's column string contains the given column code.
+int snap_has_column(snap_t *snap, char code);
+
+// Compares paths in walk order: component by component, so a directory comes
+// right before everything in it.  Otherwise like strcmp.
+int pathcmp(const char *left, const char *right);
+
+// Returns true if path is inside (not equal to) the directory dir.
+int path_is_under(const char *path, const char *dir);
+
 // Writes what's in the snap record to a file at path.
 int write_snap_record_to_file(snap_t *snap, char *path);
 
+// Opens path for writing a snap (or stdout, if path is NULL or can't be
+// opened), and prints the headers.
+FILE *open_snap_output(snap_t *snap, char *path);
+
+// Flushes and closes a file from open_snap_output().
+int close_snap_output(FILE *file, char *path);
+
+// Prints a record to a buffer, according to the snap's column string.  The
+// time it takes is added to the snap's format_ns.
+int rprintbuf(snap_t *snap, file_record *record, char **buf, size_t maxlen);
+
+// Prints the header string to the provided buffer.
+int hprintbuf(snap_t *snap, char **buf, size_t maxlen);
+
+// Simple function to return the next line of a file stream.  Returns negative
+// upon failure, or size of line (including a possibilty of 0), upon success.
+// Originally called getline(), but now that's part of the C standard library.
+int _getline(FILE *file, char *buffer, size_t buflen);
+
+// Parses a line of a snapper file into record, with column_tracker (from the
+// header) saying which field holds which column.
+int parse_snapper_file_line(int column_tracker[], 
+							char *line, 
+							file_record *record);
+
+// The type letter (as in the t column) for a mode: D for a directory, F
+// for a regular file, and so on.
+char file_type_for_mode(mode_t mode);
+
 // Reads a snap file from given path into a snap record.
 int read_snap_record_from_file(snap_t *snap, char *path);
 
+// Opens a snapper file for reading, and reads its header into the snap (the
+// column string, the hash algorithm and so on).  Returns 0, or -1 if the
+// file can't be opened or has no path column.
+int open_snap_reader(snap_reader_t *reader, snap_t *snap, char *path);
+
+// Reads the next record from the file, or returns NULL at the end.  Free it
+// with free_file_record().
+file_record *snap_reader_next(snap_reader_t *reader);
+
+// Closes the file, and frees the reader's buffers.
+void close_snap_reader(snap_reader_t *reader);
+
+// Works out how the records of a snapshot written with a header (-H) end,
+// from the header, which is written with the snapshot's own delimiters:
+// the field delimiter, then the record delimiter's first character.  text
+// is the start of the snapshot, len bytes of it.  Copies the ending to
+// ending (size bytes) and returns its length, or returns -1 if text doesn't
+// start with a header.
+int snap_record_ending(const char *text, size_t len, char *ending,
+					   size_t size);
+
 // Add a file entry to an array
 int add_record_to_snap(snap_t *snap, file_record *record);
 
+// Frees the records in the array (but keeps the array).
+void empty_snap(snap_t *snap);
+
+// Frees a record and everything it holds.
+void free_file_record(file_record *record);
+
 // Free's all the memory (but not the snap record itself);
 int free_snap(snap_t *snap);
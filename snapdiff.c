@@ -0,0 +1,276 @@
+//
+// Written by Frank Fleschner
+//
+// Copyright (c) 2009, ACS
+// All rights reserved.
+//
+// Program that compares two snapper snapshots, and prints what was added,
+// removed or changed between them.
+//
+// Snapshots must have been written with headers (-H), and must include the
+// path column.  If both have the tree hash column (%r), whole subtrees whose
+// directory hashes match are skipped without comparing anything inside them,
+// so the comparison only costs as much as what actually changed.  Otherwise,
+// every record is compared on whatever columns both snapshots have.
+//
+// Output is one line per difference:
+//		+	path	Only in the new snapshot
+//		-	path	Only in the old snapshot
+//		M	path	In both, but different
+//
+// Usage:
+//		snapdiff [-v] <old snapshot> <new snapshot>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "comm.h"
+#include "snap_record.h"
+#include "util_macros.h"
+
+#ifdef __APPLE__
+#define PROGNAME getprogname()
+#else
+#define PROGNAME "snapdiff"
+#endif
+
+#define VERSION "0.1"
+
+/* Globals, in one (large(ish)) struct. */
+struct globals_t {
+	Boolean		verbose;			// Verbose output
+	Boolean		megaVerbose;		// Mega-verbose output (scary)
+
+	snap_t		old_snap;			// The snapshot we compare against
+	snap_t		new_snap;			// The snapshot we compare
+
+	long		recordsCompared;	// Pairs of records we looked at
+	long		recordsSkipped;		// Records inside identical subtrees
+} _globals;
+
+struct globals_t *globals = &_globals;
+
+// Sorts a snap's records by path, in walk order.
+void sort_by_path(snap_t *snap);
+
+// Returns the index just past the subtree rooted at array[index].
+int skip_subtree(file_record **array, int count, int index);
+
+// Returns true if two records for the same path differ.
+Boolean records_differ(file_record *old_rec, file_record *new_rec);
+
+// Prints the usage to stderr
+void usage(void);
+
+int main (int argc, char * argv[]) {
+	file_record **old_array, **new_array;
+	int old_count, new_count, i = 0, j = 0, cmp;
+	int c; opterr = 0;
+
+	/* DEFAULTS */
+	globals->verbose			= NO;
+	globals->megaVerbose		= NO;
+	globals->recordsCompared	= 0;
+	globals->recordsSkipped		= 0;
+
+	/* PARSE ARGUMENTS */
+	while ((c = getopt(argc, argv, "vVh")) != -1)
+	{
+		switch (c) {
+			case 'V':
+				globals->megaVerbose = YES;
+				/* FALLTHROUGH:	-V implies -v */
+			case 'v':
+				globals->verbose = YES;
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break; /* Not Reached */
+			case '?':
+			default:
+				LogError("Unknown option: %c\n",
+						 isprint(optopt) ? optopt: '?');
+				break;
+		}
+	}
+
+	if (argc - optind != 2)
+	{
+		LogError("Must supply an old and a new snapshot!\n");
+		usage();
+		exit(1);
+	}
+
+	init_snap_record(&(globals->old_snap));
+	init_snap_record(&(globals->new_snap));
+
+	if (read_snap_record_from_file(&(globals->old_snap), argv[optind]) != 0 ||
+		read_snap_record_from_file(&(globals->new_snap), argv[optind+1]) != 0)
+	{
+		exit(1);
+	}
+
+	LogV("Read %d records from %s, %d records from %s\n",
+		 globals->old_snap.currentArraySize, argv[optind],
+		 globals->new_snap.currentArraySize, argv[optind+1]);
+
+	// Both sides in walk order, so a subtree is one contiguous run.
+	sort_by_path(&(globals->old_snap));
+	sort_by_path(&(globals->new_snap));
+
+	old_array = globals->old_snap.master_array;
+	old_count = globals->old_snap.currentArraySize;
+	new_array = globals->new_snap.master_array;
+	new_count = globals->new_snap.currentArraySize;
+
+	while (i < old_count || j < new_count)
+	{
+		if (i >= old_count)
+			cmp = 1;
+		else if (j >= new_count)
+			cmp = -1;
+		else
+			cmp = pathcmp(old_array[i]->re_path, new_array[j]->re_path);
+
+		if (cmp < 0)
+		{
+			printf("-\t%s\n", old_array[i]->re_path);
+			i++;
+			continue;
+		}
+
+		if (cmp > 0)
+		{
+			printf("+\t%s\n", new_array[j]->re_path);
+			j++;
+			continue;
+		}
+
+		globals->recordsCompared++;
+
+		// Same directory, same tree hash: nothing in it changed.
+		if (old_array[i]->re_type == 'D' && new_array[j]->re_type == 'D' &&
+			old_array[i]->re_tree_hash && new_array[j]->re_tree_hash &&
+			!strcmp(old_array[i]->re_tree_hash, new_array[j]->re_tree_hash))
+		{
+			int old_end = skip_subtree(old_array, old_count, i);
+			int new_end = skip_subtree(new_array, new_count, j);
+
+			LogMV("Skipping identical subtree %s\n", old_array[i]->re_path);
+			globals->recordsSkipped += (old_end - i - 1) + (new_end - j - 1);
+			i = old_end;
+			j = new_end;
+			continue;
+		}
+
+		if (records_differ(old_array[i], new_array[j]))
+		{
+			printf("M\t%s\n", new_array[j]->re_path);
+		}
+
+		i++;
+		j++;
+	}
+
+	LogV("Compared %ld record%s, skipped %ld in identical subtrees.\n",
+		 globals->recordsCompared, (globals->recordsCompared != 1) ? "s" : "",
+		 globals->recordsSkipped);
+
+	free_snap(&(globals->old_snap));
+	free_snap(&(globals->new_snap));
+
+	return 0;
+}
+
+static int compare_paths(const void *left, const void *right)
+{
+	return pathcmp((*(file_record **) left)->re_path,
+				   (*(file_record **) right)->re_path);
+}
+
+// Sorts a snap's records by path, in walk order.
+void sort_by_path(snap_t *snap)
+{
+	qsort(snap->master_array, snap->currentArraySize, sizeof(file_record *),
+		  compare_paths);
+}
+
+// Returns the index just past the subtree rooted at array[index].  The
+// subtree is contiguous in a path sorted array, so we can binary search for
+// its end instead of walking it.
+int skip_subtree(file_record **array, int count, int index)
+{
+	const char *dir = array[index]->re_path;
+	int low = index + 1, high = count, mid;
+
+	while (low < high)
+	{
+		mid = low + (high - low) / 2;
+		if (path_is_under(array[mid]->re_path, dir))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+// Returns true if two records for the same path differ.  Tree hashes say it
+// all when both sides have them; otherwise compare the columns both have.
+Boolean records_differ(file_record *old_rec, file_record *new_rec)
+{
+#define DIFFERS(member, missing) \
+	(old_rec->member != (missing) && new_rec->member != (missing) && \
+	 old_rec->member != new_rec->member)
+#define STR_DIFFERS(member) \
+	(old_rec->member && new_rec->member && \
+	 strcmp(old_rec->member, new_rec->member) != 0)
+
+	if (DIFFERS(re_type, '\0'))
+	{
+		return true;
+	}
+
+	// A directory's tree hash also covers its children, which we're about
+	// to look at anyway, so only compare its own fields.
+	if (old_rec->re_type != 'D' && old_rec->re_tree_hash &&
+		new_rec->re_tree_hash)
+	{
+		return STR_DIFFERS(re_tree_hash);
+	}
+
+	if (DIFFERS(re_mode, (mode_t) -1) || DIFFERS(re_uid, (uid_t) -1) ||
+		DIFFERS(re_gid, (gid_t) -1))
+	{
+		return true;
+	}
+
+	if (old_rec->re_type == 'D')
+	{
+		return false;
+	}
+
+	return (DIFFERS(re_size, (off_t) -1) || DIFFERS(re_mtime, (time_t) -1) ||
+			STR_DIFFERS(re_hash) || STR_DIFFERS(re_fingerprint));
+#undef DIFFERS
+#undef STR_DIFFERS
+}
+
+// Prints the usage to stderr
+void usage(void)
+{
+	fprintf(stderr, "%s v%s\n"
+			"%s [-v -V -h] <old snapshot> <new snapshot>\n"
+			"Snapshots need headers (-H) and the path column (%%p).  With\n"
+			"the tree hash column (%%r), identical subtrees are skipped.\n"
+			"v = verbose\nV = mega-verbose\nh = print usage\n",
+			PROGNAME, VERSION, PROGNAME);
+}
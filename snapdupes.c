@@ -0,0 +1,501 @@
+//
+// Written by Frank Fleschner
+//
+// Copyright (c) 2009, ACS
+// All rights reserved.
+//
+// Program that finds files with duplicate contents in a snapper snapshot.
+//
+// The snapshot must have been written with headers (-H), and must include
+// the path and raw size (%S) columns.  Work is done in passes, each one only
+// on what survived the last, so most files are never opened at all:
+//
+//		1. Group regular files by size, and drop every size only seen once.
+//		2. lstat the rest; drop anything that changed since the snapshot, and
+//		   fold hardlinks (same device and inode) into one entry, since they
+//		   take no extra space and needn't be read twice.
+//		3. Hash the size, head and tail of each, in parallel; drop uniques.
+//		4. Hash the full contents of each, in parallel; drop uniques.
+//
+// Output is one block per group of identical files, largest first:
+//		# <copies> copies of <size> bytes, <bytes> reclaimable
+//		<path>
+//		...
+//
+// The hash cache (-c) can be the one snapper keeps with --hash-cache.  Only
+// the candidates are looked up in it, so the rest of its entries are kept
+// when it's saved.
+//
+// Usage:
+//		snapdupes [-v] [-a algorithm] [-t threads] [-c cache] <snapshot>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "snap_record.h"
+#include "hash.h"
+#include "hashcache.h"
+#include "stats.h"
+#include "latency.h"
+#include "hasher.h"
+#include "util_macros.h"
+
+#ifdef __APPLE__
+#define PROGNAME getprogname()
+#else
+#define PROGNAME "snapdupes"
+#endif
+
+#define VERSION "0.1"
+
+/* Globals, in one (large(ish)) struct. */
+struct globals_t {
+	Boolean		verbose;			// Verbose output
+	Boolean		megaVerbose;		// Mega-verbose output (scary)
+
+	int			hashAlgorithm;		// HASH_* used for the full pass
+	int			hashThreads;		// Number of hasher threads
+	char		*hashCachePath;		// Persistent hash cache, or NULL
+	hashcache_t	hashCache;			// The cache, if hashCachePath is set
+
+	snap_t		snap;				// The snapshot we search
+
+	long		hardlinksFolded;	// Extra links to an inode we've seen
+	long		filesChanged;		// Candidates that changed since the snap
+	long long	duplicateGroups;	// Groups printed
+	long long	duplicateFiles;		// Files in them
+	long long	reclaimableBytes;	// Bytes freed by keeping one of each
+} _globals;
+
+struct globals_t *globals = &_globals;
+
+// Which digest a pass groups by.
+#define BY_FINGERPRINT	0
+#define BY_HASH			1
+
+// Sets *count to the regular files that share a size with another one.
+file_record **size_candidates(snap_t *snap, int *count);
+
+// Refreshes the candidates from disk, and folds hardlinks.  Returns the new
+// count.
+int check_candidates(file_record **array, int count);
+
+// Hashes the candidates with one pass of the pool, then drops the ones with
+// no match.  Returns the new count.
+int hash_pass(file_record **array, int count, int what);
+
+// Drops the records whose (size, digest) appears only once.  Returns the new
+// count.
+int keep_collisions(file_record **array, int count, int by);
+
+// Prints the groups of identical files.
+void print_groups(file_record **array, int count);
+
+// Prints the usage to stderr
+void usage(void);
+
+int main (int argc, char * argv[]) {
+	file_record **candidates;
+	int count;
+	int c; opterr = 0;
+
+	/* DEFAULTS */
+	globals->verbose			= NO;
+	globals->megaVerbose		= NO;
+	// A collision here means advice to delete a file, so default to the
+	// cryptographic hash.
+	globals->hashAlgorithm		= HASH_SHA256;
+	globals->hashThreads		= (int) sysconf(_SC_NPROCESSORS_ONLN);
+	globals->hashCachePath		= NULL;
+	globals->hardlinksFolded	= 0;
+	globals->filesChanged		= 0;
+	globals->duplicateGroups	= 0;
+	globals->duplicateFiles		= 0;
+	globals->reclaimableBytes	= 0;
+
+	/* PARSE ARGUMENTS */
+	while ((c = getopt(argc, argv, "a:c:t:vVh")) != -1)
+	{
+		switch (c) {
+			case 'a':
+				if ((globals->hashAlgorithm =
+					 hash_algorithm_from_name(optarg)) == -1)
+				{
+					LogError("Unknown hash algorithm: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'c':
+				globals->hashCachePath = optarg;
+				break;
+			case 't':
+				globals->hashThreads = atoi(optarg);
+				break;
+			case 'V':
+				globals->megaVerbose = YES;
+				/* FALLTHROUGH:	-V implies -v */
+			case 'v':
+				globals->verbose = YES;
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break; /* Not Reached */
+			case '?':
+			default:
+				LogError("Unknown option: %c\n",
+						 isprint(optopt) ? optopt: '?');
+				break;
+		}
+	}
+
+	if (argc - optind != 1)
+	{
+		LogError("Must supply a snapshot!\n");
+		usage();
+		exit(1);
+	}
+
+	init_snap_record(&(globals->snap));
+
+	if (read_snap_record_from_file(&(globals->snap), argv[optind]) != 0)
+	{
+		exit(1);
+	}
+
+	if (!snap_has_column(&(globals->snap), 'S'))
+	{
+		LogError("%s has no raw size column (%%S).\n", argv[optind]);
+		exit(1);
+	}
+
+	if (globals->hashCachePath)
+	{
+		init_hashcache(&(globals->hashCache), globals->hashCachePath);
+	}
+
+	LogV("Read %d records from %s\n", globals->snap.currentArraySize,
+		 argv[optind]);
+
+	candidates = size_candidates(&(globals->snap), &count);
+	LogV("Pass 1: %d files share a size.\n", count);
+
+	count = check_candidates(candidates, count);
+	LogV("Pass 2: %d files left (%ld hardlinks folded, %ld changed).\n",
+		 count, globals->hardlinksFolded, globals->filesChanged);
+
+	count = hash_pass(candidates, count, HASHER_FINGERPRINT);
+	LogV("Pass 3: %d files share a partial hash.\n", count);
+
+	count = hash_pass(candidates, count, HASHER_CONTENT);
+	LogV("Pass 4: %d files share a %s hash.\n", count,
+		 hash_algorithm_name(globals->hashAlgorithm));
+
+	print_groups(candidates, count);
+
+	LogV("%lld duplicate group%s, %lld files, %lld bytes reclaimable.\n",
+		 globals->duplicateGroups,
+		 (globals->duplicateGroups != 1) ? "s" : "",
+		 globals->duplicateFiles, globals->reclaimableBytes);
+
+	if (globals->hashCachePath)
+	{
+		// Only the candidates were looked up, so keep what snapper (or
+		// an earlier run) cached for everything else.
+		hashcache_save(&(globals->hashCache), HASHCACHE_KEEP_UNSEEN);
+		free_hashcache(&(globals->hashCache));
+	}
+
+	free(candidates);
+	free_snap(&(globals->snap));
+
+	return 0;
+}
+
+// Biggest first, then by device and inode so hardlinks end up together.
+static int compare_size_inode(const void *left, const void *right)
+{
+	const file_record *l = *(file_record **) left;
+	const file_record *r = *(file_record **) right;
+
+	if (l->re_size != r->re_size)
+		return (l->re_size > r->re_size) ? -1 : 1;
+	if (l->re_dev != r->re_dev)
+		return (l->re_dev < r->re_dev) ? -1 : 1;
+	if (l->re_ino != r->re_ino)
+		return (l->re_ino < r->re_ino) ? -1 : 1;
+	return 0;
+}
+
+// Size, then the digest of the current pass, so groups are contiguous.
+static int compare_fingerprint(const void *left, const void *right)
+{
+	const file_record *l = *(file_record **) left;
+	const file_record *r = *(file_record **) right;
+
+	if (l->re_size != r->re_size)
+		return (l->re_size > r->re_size) ? -1 : 1;
+	return strcmp(l->re_fingerprint, r->re_fingerprint);
+}
+
+static int compare_hash(const void *left, const void *right)
+{
+	const file_record *l = *(file_record **) left;
+	const file_record *r = *(file_record **) right;
+
+	if (l->re_size != r->re_size)
+		return (l->re_size > r->re_size) ? -1 : 1;
+	return strcmp(l->re_hash, r->re_hash);
+}
+
+// Sets *count to the regular files that share a size with another one.  Empty
+// files are all alike, but there's nothing to reclaim, so they're left out.
+file_record **size_candidates(snap_t *snap, int *count)
+{
+	file_record **array;
+	int i, kept = 0, start, end;
+
+	CREATE(array, (snap->currentArraySize + 1) * sizeof(file_record *));
+
+	for (i = 0; i < snap->currentArraySize; i++)
+	{
+		file_record *record = snap->master_array[i];
+
+		// Without a type column, everything counts until pass 2 lstats it.
+		if ((record->re_type == 'F' || record->re_type == '\0') &&
+			record->re_size > 0 && record->re_path)
+		{
+			array[kept++] = record;
+		}
+	}
+
+	qsort(array, kept, sizeof(file_record *), compare_size_inode);
+
+	// Keep the runs of two or more.
+	*count = 0;
+	for (start = 0; start < kept; start = end)
+	{
+		for (end = start + 1;
+			 end < kept && array[end]->re_size == array[start]->re_size;
+			 end++)
+			;
+
+		if (end - start > 1)
+		{
+			for (i = start; i < end; i++)
+			{
+				array[(*count)++] = array[i];
+			}
+		}
+	}
+
+	return array;
+}
+
+// Refreshes the candidates from disk: anything that's gone, isn't a regular
+// file any more or changed size is dropped (it'd be hashed as something it
+// isn't).  Then every link to an inode after the first is dropped too, and
+// sizes that are left with one file go with them.  Returns the new count.
+int check_candidates(file_record **array, int count)
+{
+	struct stat info;
+	int i, kept = 0, start, end, unique;
+
+	for (i = 0; i < count; i++)
+	{
+		file_record *record = array[i];
+
+		if (lstat(record->re_path, &info) == -1)
+		{
+			LogMV("%s: %s\n", record->re_path, strerror(errno));
+			globals->filesChanged++;
+			continue;
+		}
+
+		if (!S_ISREG(info.st_mode) || info.st_size != record->re_size)
+		{
+			LogMV("%s changed since the snapshot, skipping.\n",
+				  record->re_path);
+			globals->filesChanged++;
+			continue;
+		}
+
+		// The snapshot doesn't record the device, and its other columns may
+		// be missing; the hasher and its cache want them all.
+		record->re_dev = info.st_dev;
+		record->re_ino = info.st_ino;
+		record->re_mtime = info.st_mtime;
+		record->re_ctime = info.st_ctime;
+
+		// Digests from the snapshot may be stale, or from another algorithm.
+		free(record->re_hash);
+		free(record->re_fingerprint);
+		record->re_hash = NULL;
+		record->re_fingerprint = NULL;
+
+		array[kept++] = record;
+	}
+
+	qsort(array, kept, sizeof(file_record *), compare_size_inode);
+
+	count = 0;
+	for (start = 0; start < kept; start = end)
+	{
+		for (end = start + 1;
+			 end < kept && array[end]->re_size == array[start]->re_size;
+			 end++)
+			;
+
+		// Count the distinct inodes of this size.
+		for (unique = 1, i = start + 1; i < end; i++)
+		{
+			if (compare_size_inode(&(array[i-1]), &(array[i])) != 0)
+				unique++;
+		}
+
+		if (unique < 2)
+		{
+			continue;
+		}
+
+		for (i = start; i < end; i++)
+		{
+			if (i > start && compare_size_inode(&(array[i-1]),
+												&(array[i])) == 0)
+			{
+				LogMV("%s is a hardlink to %s\n", array[i]->re_path,
+					  array[i-1]->re_path);
+				globals->hardlinksFolded++;
+				continue;
+			}
+
+			array[count++] = array[i];
+		}
+	}
+
+	return count;
+}
+
+// Hashes the candidates with one pass of the pool, then drops the ones with
+// no match.  The partial pass is a fingerprint sampling no interior blocks,
+// so it covers just the size, head and tail.  Returns the new count.
+int hash_pass(file_record **array, int count, int what)
+{
+	hasher_t hasher;
+	int i;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	init_hasher(&hasher, globals->hashThreads, what, globals->hashAlgorithm,
+				0, globals->hashCachePath ? &(globals->hashCache) : NULL,
+				false);
+
+	for (i = 0; i < count; i++)
+	{
+		hasher_submit(&hasher, array[i]);
+	}
+
+	hasher_wait(&hasher);
+	LogMV("Read %lld bytes from %lld files.\n", hasher.bytes_hashed,
+		  hasher.files_hashed);
+	free_hasher(&hasher);
+
+	return keep_collisions(array, count,
+						   (what == HASHER_CONTENT) ? BY_HASH : BY_FINGERPRINT);
+}
+
+// Drops the records whose (size, digest) appears only once, along with any
+// that couldn't be read.  Returns the new count.
+int keep_collisions(file_record **array, int count, int by)
+{
+	int (*compare)(const void *, const void *) =
+		(by == BY_HASH) ? compare_hash : compare_fingerprint;
+	int i, kept = 0, start, end;
+
+	for (i = 0; i < count; i++)
+	{
+		if ((by == BY_HASH) ? array[i]->re_hash != NULL :
+			array[i]->re_fingerprint != NULL)
+		{
+			array[kept++] = array[i];
+		}
+	}
+
+	qsort(array, kept, sizeof(file_record *), compare);
+
+	count = 0;
+	for (start = 0; start < kept; start = end)
+	{
+		for (end = start + 1;
+			 end < kept && compare(&(array[start]), &(array[end])) == 0;
+			 end++)
+			;
+
+		if (end - start > 1)
+		{
+			for (i = start; i < end; i++)
+			{
+				array[count++] = array[i];
+			}
+		}
+	}
+
+	return count;
+}
+
+// Prints the groups of identical files.  The array is already sorted by
+// size (largest first) and hash, with every group two or more long.
+void print_groups(file_record **array, int count)
+{
+	int i, start, end;
+
+	for (start = 0; start < count; start = end)
+	{
+		for (end = start + 1;
+			 end < count && compare_hash(&(array[start]), &(array[end])) == 0;
+			 end++)
+			;
+
+		printf("# %d copies of %lld bytes, %lld reclaimable\n", end - start,
+			   (long long) array[start]->re_size,
+			   (long long) array[start]->re_size * (end - start - 1));
+
+		for (i = start; i < end; i++)
+		{
+			printf("%s\n", array[i]->re_path);
+		}
+		printf("\n");
+
+		globals->duplicateGroups++;
+		globals->duplicateFiles += end - start;
+		globals->reclaimableBytes +=
+			(long long) array[start]->re_size * (end - start - 1);
+	}
+}
+
+// Prints the usage to stderr
+void usage(void)
+{
+	fprintf(stderr, "%s v%s\n"
+			"%s [-v -V -h] [-a algorithm] [-t threads] [-c cache] <snapshot>\n"
+			"The snapshot needs headers (-H), the path (%%p) and raw size\n"
+			"(%%S) columns.\n"
+			"a = hash algorithm for the full pass (xxh64 or sha256, default\n"
+			"    sha256)\nt = hasher threads (default: one per CPU)\n"
+			"c = persistent hash cache, shared with snapper's --hash-cache\n"
+			"    (entries for files not looked at here are kept)\n"
+			"v = verbose\nV = mega-verbose\nh = print usage\n",
+			PROGNAME, VERSION, PROGNAME);
+}
@@ -0,0 +1,350 @@
+//
+// Written by Frank Fleschner
+//
+// Copyright (c) 2009, ACS
+// All rights reserved.
+//
+// Program that merges snapper snapshots into one, in path order.
+//
+// Meant for scans split up across jobs, by top-level directory, say: each
+// input has to be in path order already (snapper -s p), and they're merged
+// a record at a time with a heap, so memory use doesn't depend on how big
+// the snapshots are.
+//
+// The output has the columns all of the inputs have, in the order of the
+// first input.  The hash (%h) and fingerprint (%f) columns only count as
+// common if they were made the same way everywhere.  A path in more than
+// one input (such as the top directory of each shard) is written once, from
+// the first input that has it.
+//
+// Snapshots must have been written with headers (-H), and must include the
+// path column.
+//
+// Usage:
+//		snapmerge [-v] [-o output] <snapshot> <snapshot> ...
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "comm.h"
+#include "snap_record.h"
+#include "hash.h"
+#include "util_macros.h"
+
+#ifdef __APPLE__
+#define PROGNAME getprogname()
+#else
+#define PROGNAME "snapmerge"
+#endif
+
+#define VERSION "0.1"
+
+/* Globals, in one (large(ish)) struct. */
+struct globals_t {
+	Boolean		verbose;			// Verbose output
+	Boolean		megaVerbose;		// Mega-verbose output (scary)
+
+	char		*outputPath;		// Where to write (stdout if NULL)
+
+	long		recordsWritten;		// Records in the merged snapshot
+	long		duplicatesDropped;	// Paths found in more than one input
+} _globals;
+
+struct globals_t *globals = &_globals;
+
+// One input, and where the merge is in it.
+struct input_t {
+	char		*path;				// The snapshot's file
+	snap_t		snap;				// Its header (columns, hash algorithm)
+	snap_reader_t reader;
+	file_record	*current;			// Its next record, NULL at the end
+	int			order;				// Breaks ties: earlier inputs first
+};
+
+// Works out the columns every input has, into snap's column string.
+void common_columns(struct input_t *inputs, int count, snap_t *snap);
+
+// Moves an input to its next record, checking it's still in path order.
+void advance(struct input_t *input);
+
+// Restores the heap below index i.
+void sift_down(struct input_t **heap, int count, int i);
+
+// Prints the usage to stderr
+void usage(void);
+
+int main (int argc, char * argv[]) {
+	struct input_t *inputs, **heap, *top;
+	file_record *last = NULL, *record;
+	snap_t merged;
+	FILE *out;
+	char *buffer;
+	int count, heap_count = 0, i;
+	int c; opterr = 0;
+
+	/* DEFAULTS */
+	globals->verbose			= NO;
+	globals->megaVerbose		= NO;
+	globals->outputPath			= NULL;
+	globals->recordsWritten		= 0;
+	globals->duplicatesDropped	= 0;
+
+	/* PARSE ARGUMENTS */
+	while ((c = getopt(argc, argv, "vVho:")) != -1)
+	{
+		switch (c) {
+			case 'V':
+				globals->megaVerbose = YES;
+				/* FALLTHROUGH:	-V implies -v */
+			case 'v':
+				globals->verbose = YES;
+				break;
+			case 'o':
+				globals->outputPath = strdup(optarg);
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break; /* Not Reached */
+			case '?':
+			default:
+				if (optopt == 'o')
+				{
+					LogError("Option %c requires an argument.\n", optopt);
+				}
+				else
+				{
+					LogError("Unknown option: %c\n",
+							 isprint(optopt) ? optopt: '?');
+				}
+				break;
+		}
+	}
+
+	count = argc - optind;
+	if (count < 1)
+	{
+		LogError("Must supply at least one snapshot!\n");
+		usage();
+		exit(1);
+	}
+
+	CREATE(inputs, count * sizeof(struct input_t));
+	CREATE(heap, count * sizeof(struct input_t *));
+
+	for (i = 0; i < count; i++)
+	{
+		inputs[i].path = argv[optind + i];
+		inputs[i].order = i;
+		init_snap_record(&(inputs[i].snap));
+
+		if (open_snap_reader(&(inputs[i].reader), &(inputs[i].snap),
+							 inputs[i].path) != 0)
+		{
+			exit(1);
+		}
+	}
+
+	init_snap_record(&merged);
+	common_columns(inputs, count, &merged);
+	LogV("Merging %d snapshot%s with columns %s\n", count,
+		 (count != 1) ? "s" : "", merged.column_string);
+
+	for (i = 0; i < count; i++)
+	{
+		advance(&(inputs[i]));
+		if (inputs[i].current)
+		{
+			heap[heap_count++] = &(inputs[i]);
+		}
+	}
+	for (i = heap_count / 2 - 1; i >= 0; i--)
+	{
+		sift_down(heap, heap_count, i);
+	}
+
+	CREATE(buffer, MAX_RECORD_LENGTH+1);
+	out = open_snap_output(&merged, globals->outputPath);
+
+	while (heap_count > 0)
+	{
+		top = heap[0];
+		record = top->current;
+
+		advance(top);
+		if (top->current == NULL)
+		{
+			heap[0] = heap[--heap_count];
+		}
+		sift_down(heap, heap_count, 0);
+
+		// The same path from a later input (ties go to the earlier one).
+		if (last && pathcmp(last->re_path, record->re_path) == 0)
+		{
+			LogMV("Dropping %s from %s, already merged\n",
+				  record->re_path, top->path);
+			globals->duplicatesDropped++;
+			free_file_record(record);
+			continue;
+		}
+
+		rprintbuf(&merged, record, &buffer, MAX_RECORD_LENGTH);
+		buffer[MAX_RECORD_LENGTH] = '\0';
+		fprintf(out, "%s", buffer);
+		globals->recordsWritten++;
+
+		// Kept until the next one, to spot duplicates.
+		free_file_record(last);
+		last = record;
+	}
+
+	close_snap_output(out, globals->outputPath);
+
+	LogV("Wrote %ld record%s, dropped %ld duplicate%s.\n",
+		 globals->recordsWritten, (globals->recordsWritten != 1) ? "s" : "",
+		 globals->duplicatesDropped,
+		 (globals->duplicatesDropped != 1) ? "s" : "");
+
+	free_file_record(last);
+	for (i = 0; i < count; i++)
+	{
+		close_snap_reader(&(inputs[i].reader));
+		free_snap(&(inputs[i].snap));
+	}
+	free_snap(&merged);
+	free(inputs);
+	free(heap);
+	free(buffer);
+	if (globals->outputPath)
+		free(globals->outputPath);
+
+	return 0;
+}
+
+// Works out the columns every input has, into snap's column string.
+void common_columns(struct input_t *inputs, int count, snap_t *snap)
+{
+	char columns[COLUMN_STRING_MAX * 2 + 1], code[3];
+	char *pos;
+	int i, everywhere;
+
+	snap->hash_algorithm = inputs[0].snap.hash_algorithm;
+	snap->fingerprint_blocks = inputs[0].snap.fingerprint_blocks;
+
+	*columns = '\0';
+	for (pos = inputs[0].snap.column_string; *pos; pos++)
+	{
+		if (*pos != '%' || pos[1] == '\0')
+			continue;
+
+		pos++;
+		snprintf(code, sizeof(code), "%%%c", *pos);
+
+		everywhere = YES;
+		for (i = 1; i < count && everywhere; i++)
+		{
+			if (!snap_has_column(&(inputs[i].snap), *pos))
+			{
+				LogV("%s has no %s column, so it's dropped\n",
+					 inputs[i].path, code);
+				everywhere = NO;
+			}
+			else if (*pos == 'h' &&
+					 inputs[i].snap.hash_algorithm != snap->hash_algorithm)
+			{
+				LogError("%s was hashed with %s, not %s, so %%h is dropped\n",
+						 inputs[i].path,
+						 hash_algorithm_name(inputs[i].snap.hash_algorithm),
+						 hash_algorithm_name(snap->hash_algorithm));
+				everywhere = NO;
+			}
+			else if (*pos == 'f' && inputs[i].snap.fingerprint_blocks !=
+					 snap->fingerprint_blocks)
+			{
+				LogError("%s was fingerprinted with %d blocks, not %d, so %%f "
+						 "is dropped\n", inputs[i].path,
+						 inputs[i].snap.fingerprint_blocks,
+						 snap->fingerprint_blocks);
+				everywhere = NO;
+			}
+		}
+
+		if (everywhere)
+		{
+			strncat(columns, code, sizeof(columns) - strlen(columns) - 1);
+		}
+	}
+
+	free(snap->column_string);
+	set_snap_column_string(snap, columns);
+}
+
+// Moves an input to its next record, checking it's still in path order.
+void advance(struct input_t *input)
+{
+	file_record *next = snap_reader_next(&(input->reader));
+
+	if (next && input->current &&
+		pathcmp(input->current->re_path, next->re_path) > 0)
+	{
+		LogError("%s isn't in path order (%s comes after %s).  Snapshots to "
+				 "merge need snapper -s p.\n", input->path,
+				 next->re_path, input->current->re_path);
+		exit(1);
+	}
+
+	// The old record is main's to free.
+	input->current = next;
+}
+
+static int input_less(struct input_t *left, struct input_t *right)
+{
+	int cmp = pathcmp(left->current->re_path, right->current->re_path);
+
+	return (cmp != 0) ? (cmp < 0) : (left->order < right->order);
+}
+
+// Restores the heap below index i.
+void sift_down(struct input_t **heap, int count, int i)
+{
+	struct input_t *swap;
+	int smallest, child;
+
+	for (;;)
+	{
+		smallest = i;
+		child = 2 * i + 1;
+
+		if (child < count && input_less(heap[child], heap[smallest]))
+			smallest = child;
+		if (child + 1 < count && input_less(heap[child + 1], heap[smallest]))
+			smallest = child + 1;
+
+		if (smallest == i)
+			return;
+
+		swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+void usage(void)
+{
+	fprintf(stderr, "%s v%s\n"
+			"%s [-v -V -h] [-o output] <snapshot> <snapshot> ...\n"
+			"Snapshots need headers (-H), the path column (%%p), and must be\n"
+			"in path order (snapper -s p).  The output has the columns all\n"
+			"of them have.\n"
+			"o = output file (defaults to stdout)\n"
+			"v = verbose\nV = mega-verbose\nh = print usage\n",
+			PROGNAME, VERSION, PROGNAME);
+}
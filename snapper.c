@@ -26,12 +26,20 @@
 //			  last path component) of scanned files.
 //			o If the matched (ignored) file is a folder, any children will also
 //			  be ignored.
+//			o Wildcards are supported: * and ? (not matching '/'), [...]
+//			  classes, and ** for any number of directories.  A string with a
+//			  '/' that doesn't begin with one matches at any depth.
 //			o You can specify as many of these as you like.
 //			EXAMPLES:
 //			-i /dev  # This will ignore ONLY /dev, but not a folder such as 
 //					 # /Users/dev or /Applications/develeper_tool.
 //			-i .svn	 # This will ignore any files or folders named .svn, but
 //					 # only if they're named EXACTLY .svn
+//			-i '*.o' # This will ignore any files or folders ending in .o
+//		-I Name of per-directory ignore files (e.g. .snapperignore).  A
+//		   directory with a file of that name has its rules (one per line, as
+//		   for -i) applied to everything under it.  A leading '/' in them
+//		   means the top of that directory.  Off unless given.
 //		-p Path to scan ("/" is used if none is provided).
 //		-a Scan accross devices (ie, external HDs, server volumes, etc)
 //		-H Print headers for the columns
@@ -53,6 +61,7 @@
 //			- C/c	The time of last status change
 //			- S/s	The size of the file (in bytes or KB/MB/GB)
 //			- i		The files inode
+//			- d		The file's device (st_dev)
 //			- o		The file's owner (UID)
 //			- g		The file's group (GID)
 //			- P		The file's permissions (octal format)
@@ -65,25 +74,110 @@
 //					C - Character special
 //					F - Regular file
 //					X - Something unexpected this way comes.
+//			- h		A hash of the file's contents (regular files only).  The
+//					hashing is done by a pool of threads while the scan runs.
+//			- f		A fingerprint of the file's contents: the size, plus the
+//					head, the tail and evenly spaced blocks in between.  Much
+//					cheaper than h for big files, but only samples them.
+//			- r		The tree hash: a rollup of the name, metadata and content
+//					hash (if any) of the entry, and for directories, of
+//					everything in them.  snapdiff uses it to skip identical
+//					subtrees.
 //		-s Sort token, takes one of the column codes above to sort by (just the
 //		   character, not the preceding '%') (defaults to default FTS sorting,
 //		   which is path based).  Capital case is descending and lower case is 
 //		   ascending.  (Big letter signifies big values first, and vise versa.)
+//		   p sorts each directory by name as it's walked, so the output is
+//		   in path order (as snapdiff and snapmerge expect) at no extra cost.
 //		-f Field delimiter, one or more characters (defaults to \t)
 //		-r Record delimiter, one or more characters (defaults to \n)
 //		-C Path to configuration file.  Options configured in configuration file
 //		   override anything specified in arguments.  But items specified in
 //		   arguments and not in the configuration file are still honored.
+//		--hash-algorithm
+//		   Algorithm for the %h column: xxh64 (fast, the default) or sha256.
+//		--hash-threads
+//		   Number of reader/hasher threads (defaults to the number of CPUs).
+//		--hash-cache
+//		   Path to a persistent hash cache.  Files whose device, inode, size,
+//		   mtime and ctime match the cache aren't read again.
+//		--fingerprint-blocks
+//		   Number of blocks sampled between the head and tail for the %f
+//		   column, up to 127 (defaults to 16).
+//		--exclude-fstype, --include-fstype
+//		   With -a, don't (or do) descend into mounts of this filesystem
+//		   type.  Pseudo (proc, sysfs, ...), overlay and remote (nfs, cifs,
+//		   ...) filesystems are excluded by default.
+//		--exclude-mount, --include-mount
+//		   With -a, don't (or do) descend into the filesystem mounted here.
+//		   Beats the filesystem type rules.
+//		--where
+//		   Only record files matching a filter expression, such as
+//		   'size>100M && mtime>-1d && type==F'.  Fields are size, mtime,
+//		   atime, ctime, type, owner, group, perm, inode, dev and name.
+//		   Directories are still descended into either way.
+//		--mem-limit
+//		   Most memory to hold records in (with a K, M or G suffix).  Past
+//		   it, records are sorted into runs in the temp directory, and
+//		   merged into the output at the end.  Unlimited unless given.
+//		--temp-dir
+//		   Where --mem-limit's runs go (defaults to $TMPDIR, or /tmp).
+//		--shard i/N
+//		   Only scan shard i (counting from 0) of N.  Entries shard-depth
+//		   levels below the scan path are dealt out by a hash of their
+//		   path from there; shard 0 also gets everything above them.  The
+//		   shards' snapshots (with -s p) snapmerge into a full one.
+//		--shard-depth
+//		   Level the tree is split at: 1 for the scan path's entries (the
+//		   default), 2 for theirs, and so on.
+//		--checkpoint
+//		   Seconds between checkpoints (defaults to 300 with --resume).
+//		   Records are written to a journal next to the output file as the
+//		   scan goes, so it can be resumed if it dies.  Needs -o.
+//		--resume
+//		   Pick up from the journal's last checkpoint, if there is one.
+//		--stream-dirs
+//		   Directories at least this big (their own size, as stat gives it,
+//		   with a K, M or G suffix) are read an entry at a time instead of
+//		   all at once by fts.  Their entries are sorted with the rest of
+//		   the records, so -s p still works.  Off unless given.
+//		--stats-file
+//		   Write how long each phase took, and what the walk counted, to
+//		   this file at the end (replacing it all at once).
+//		--stats-format
+//		   json (the default) or prometheus, for node_exporter's textfile
+//		   collector.
+//		--latency
+//		   Time the walk's filesystem calls (and the hashers' opens and
+//		   reads) into histograms, for -v and the stats report.
+//		--slow-dirs
+//		   How many of the directories the walk spent the most time in
+//		   -v lists at the end (defaults to 10; 0 for none).
+//		--trace
+//		   Write a timeline of what each thread did (directories walked,
+//		   files hashed, sorting, formatting and writing) to this file, in
+//		   Chrome's trace-event format, for Perfetto or chrome://tracing.
+//		--previous
+//		   An earlier snapshot of the same tree.  Its size is taken as what
+//		   this scan will come to, so the progress reports can say how far
+//		   along it is and how long is left.
+//		--estimate
+//		   Instead of a snapshot, print an estimate of what one would come
+//		   to (entries, records, bytes) and how long its walk would take,
+//		   from walking a random sample of the directories at each level
+//		   for a few seconds.  Nothing is hashed.
 //
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <ctype.h>
 #include <sys/errno.h>
 #include <string.h>
 #include <stdarg.h>
 #include <fts.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <fcntl.h>
@@ -94,6 +188,23 @@
 #include "configfile.h"
 #include "comm.h"
 #include "snap_record.h"
+#include "hash.h"
+#include "hashcache.h"
+#include "stats.h"
+#include "latency.h"
+#include "trace.h"
+#include "hasher.h"
+#include "merkle.h"
+#include "globset.h"
+#include "ignore.h"
+#include "mounts.h"
+#include "filter.h"
+#include "extsort.h"
+#include "journal.h"
+#include "dirstream.h"
+#include "dirprofile.h"
+#include "progress.h"
+#include "estimate.h"
 #include "util_macros.h"
 
 #define VERSION "0.9.6"
@@ -106,11 +217,6 @@
 
 #pragma mark Local data types
 
-struct ignore_record_t {
-	char		*ig_path;			// Ignored path
-	size_t		ig_len;				// Ignored path length (to avoid strlen's)
-};
-
 #pragma mark Globals
 struct globals_t {
 	/* Stuff related to options */
@@ -123,6 +229,7 @@ struct globals_t {
 	char		*sortToken;					// How to sort the records.
 
 	char		*pathToScan;				// Path to scan.
+	size_t		pathToScanLen;				// Its length, for paths below it.
 	char		*outputPath;				// Path to the output file.
 	char		*configurationFilePath;		// Path to the config file.
 	
@@ -131,11 +238,85 @@ struct globals_t {
 	
 	// Processing related stuff
 	int			fts_options;				// Options flags for fts_open()
+	Boolean		walkInOrder;				// fts sorts directories by name.
+	long long	streamDirs;					// Directory size (st_size) from
+											// which it's streamed, or 0.
+	
+	// What the walk did, for the summary:
+	int			filesVisited;
+	int			filesSkipped;				// Ignored, or on excluded mounts.
+	int			filesFiltered;				// Didn't match --where.
+	int			filesSharded;				// Left to other shards.
+	int			dirsStreamed;				// Read with a dirstream.
+	int			dirsVisited;
+	int			filesIgnored;				// On the ignore lists.
+	long long	statCalls;					// Entries stat()ed.
+	int			walkErrors;					// Unreadable, or unstat()able.
+	
+	// Timing and the stats report:
+	stats_t		stats;
+	char		*statsFile;					// Where the report goes, or NULL.
+	int			statsFormat;				// STATS_JSON or STATS_PROMETHEUS.
+	latency_set_t *latency;					// The walk's call times, or NULL
+											// when they aren't timed.
+	int			slowDirs;					// Slowest directories -v lists.
+	Boolean		profiling;					// Timing directories for them?
+	dirprofile_t dirProfile;				// The slowest so far.
+	char		*traceFile;					// Where the trace goes, or NULL.
+	
+	// Progress reports:
+	progress_t	progress;					// The walk's counters.
+	char		*previousPath;				// An earlier snapshot, or NULL.
+	
+	// Estimating instead of scanning:
+	Boolean		estimating;					// --estimate
+	estimate_t	estimate;					// The sample so far.
+	
+	// Content hashing
+	int			hashWhat;					// HASHER_* bits for %h and %f.
+	int			hashThreads;				// Number of hasher threads.
+	hasher_t	hasher;						// The hasher pool.
+	char		*hashCachePath;				// Path to the hash cache, or NULL.
+	hashcache_t	hashCache;					// The hash cache.
 		
-	// Our array of ignored paths/names:
-	struct ignore_record_t **ignore_array;	// The global ignored paths array.
-	int			currentIgnoreSize;			// Current size of the ignore_array
-	int			currentIgnoreCapacity;		// Current max size of the
+	// Our ignored paths/names:
+	ignore_t	ignores;					// The compiled ignore list.
+	char		**ignoreRules;				// The rules it was compiled from,
+	int			ignoreRuleCount;			// for scan_options_hash().
+	char		*ignoreFileName;			// Per-directory ignore file name.
+	size_t		ignoreFileNameLen;			// Its length.
+	int			ignoreFilesLoaded;			// How many of them we read.
+	long long	scopeMemory;				// Bytes their rules hold now,
+	long long	scopePeakMemory;			// and the most they have.
+	
+	// Mounts to stay out of when scanning across disks:
+	mount_table_t mounts;					// The mount table and its rules.
+	
+	// Which files get records:
+	char		*whereExpression;			// The --where filter, or NULL.
+	filter_t	filter;						// It, compiled.
+	
+	// Sorting bigger than memory:
+	long long	memLimit;					// Bytes of records, or 0 for no
+											// limit.
+	char		*tempDir;					// Where sorted runs go.
+	extsort_t	extsort;					// The runs.
+	
+	// Splitting the scan across processes:
+	int			shardIndex;					// Which shard we are.
+	int			shardCount;					// Out of how many (1 is all).
+	int			shardDepth;					// Level the tree is split at.
+	
+	// Checkpoints:
+	int			checkpointInterval;			// Seconds, or 0 for none.
+	Boolean		resume;						// Start from the last one?
+	journal_t	journal;					// The journal they go to.
+	char		*resumeFrom;				// Path the walk is resuming after,
+											// until it gets past it.
+	
+	// Memory, as it was once the output was written:
+	struct snap_memory_t memory;			// The snap's.
+	long long	ignoreMemory;				// The ignore list's.
 	
 	// OutPut niceness
 	int			OutPut_printed;				// How much OutPut last printed.
@@ -143,40 +324,185 @@ struct globals_t {
 
 struct globals_t *globals = &_globals;
 
+#pragma mark Mount rule keys
+// Configuration file keys for the mount rules, and the rules they make.
+static struct {
+	const char	*key;
+	int			kind;
+} mount_rule_keys[] = {
+	{"excludeFsType",	MOUNT_EXCLUDE_FSTYPE},
+	{"includeFsType",	MOUNT_INCLUDE_FSTYPE},
+	{"excludeMount",	MOUNT_EXCLUDE_POINT},
+	{"includeMount",	MOUNT_INCLUDE_POINT},
+	{NULL,				0}
+};
+
+#pragma mark Long options
+// Options that only have a long form.  Values start past any char, so they
+// can't collide with the short flags.
+enum {
+	OPT_HASH_ALGORITHM = 256,
+	OPT_HASH_THREADS,
+	OPT_HASH_CACHE,
+	OPT_FINGERPRINT_BLOCKS,
+	OPT_EXCLUDE_FSTYPE,
+	OPT_INCLUDE_FSTYPE,
+	OPT_EXCLUDE_MOUNT,
+	OPT_INCLUDE_MOUNT,
+	OPT_WHERE,
+	OPT_MEM_LIMIT,
+	OPT_TEMP_DIR,
+	OPT_SHARD,
+	OPT_SHARD_DEPTH,
+	OPT_CHECKPOINT,
+	OPT_RESUME,
+	OPT_STREAM_DIRS,
+	OPT_STATS_FILE,
+	OPT_STATS_FORMAT,
+	OPT_LATENCY,
+	OPT_SLOW_DIRS,
+	OPT_TRACE,
+	OPT_PREVIOUS,
+	OPT_ESTIMATE
+};
+
+static struct option long_options[] = {
+	{"hash-algorithm",	required_argument,	NULL,	OPT_HASH_ALGORITHM},
+	{"hash-threads",	required_argument,	NULL,	OPT_HASH_THREADS},
+	{"hash-cache",		required_argument,	NULL,	OPT_HASH_CACHE},
+	{"fingerprint-blocks", required_argument, NULL,	OPT_FINGERPRINT_BLOCKS},
+	{"exclude-fstype",	required_argument,	NULL,	OPT_EXCLUDE_FSTYPE},
+	{"include-fstype",	required_argument,	NULL,	OPT_INCLUDE_FSTYPE},
+	{"exclude-mount",	required_argument,	NULL,	OPT_EXCLUDE_MOUNT},
+	{"include-mount",	required_argument,	NULL,	OPT_INCLUDE_MOUNT},
+	{"where",			required_argument,	NULL,	OPT_WHERE},
+	{"mem-limit",		required_argument,	NULL,	OPT_MEM_LIMIT},
+	{"temp-dir",		required_argument,	NULL,	OPT_TEMP_DIR},
+	{"shard",			required_argument,	NULL,	OPT_SHARD},
+	{"shard-depth",		required_argument,	NULL,	OPT_SHARD_DEPTH},
+	{"checkpoint",		required_argument,	NULL,	OPT_CHECKPOINT},
+	{"resume",			no_argument,		NULL,	OPT_RESUME},
+	{"stream-dirs",		required_argument,	NULL,	OPT_STREAM_DIRS},
+	{"stats-file",		required_argument,	NULL,	OPT_STATS_FILE},
+	{"stats-format",	required_argument,	NULL,	OPT_STATS_FORMAT},
+	{"latency",			no_argument,		NULL,	OPT_LATENCY},
+	{"slow-dirs",		required_argument,	NULL,	OPT_SLOW_DIRS},
+	{"trace",			required_argument,	NULL,	OPT_TRACE},
+	{"previous",		required_argument,	NULL,	OPT_PREVIOUS},
+	{"estimate",		no_argument,		NULL,	OPT_ESTIMATE},
+	{NULL,				0,					NULL,	0}
+};
+
 #pragma mark function prototypes
 // Prints standard OutPut to stderr.  Use quiet mode to supress.  
 // is_status_update is for use of printing progress reports in the main loop.
 static void OutPut(Boolean is_status_update, const char *format, ...) 
 __attribute__((format(printf, 2, 3)));
 
-// Path to add to array of ignored paths.
-Boolean add_to_ignore_array(const char *path);
+// Prints a progress report (from the progress thread) as a status update.
+static void report_progress(const char *line);
+
+// Looks for an ignore file among a directory's children, and if there is
+// one, gives the directory a scope with its rules.
+void load_ignore_file(FTS *ftsp, FTSENT *dir);
+
+// Walks the tree at path, whose root is at level, below parent.
+static void walk_tree(char *path, int level, FTSENT *parent);
+
+// Handles (skips, or records) one entry of the walk.
+static int visit_entry(FTS *ftsp, FTSENT *p, int level, FTSENT *parent);
+
+// Walks a directory too big to hand to fts.
+static void stream_directory(FTSENT *dir, int level);
+
+// Keeps the walk out of a directory.
+static void skip_children(FTS *ftsp, FTSENT *p);
 
-// Returns true if the path should be ignored (and children skipped), false
-// otherwise.
-Boolean should_be_ignored(const char *path, size_t pathlen, 
-						  const char *name, size_t namelen);
+// Walks samples of the tree, and prints what the scan would come to.
+static void estimate_scan(void);
 
-// Deallocs all the allocated memory used in the ignore_array
-void free_ignore_array();
+// Gives a directory the scope loaded from its ignore file at path.
+static void adopt_scope(FTSENT *dir, ignore_scope_t *scope, const char *path);
+
+// Frees a directory's own ignore scope.
+static void release_scope(FTSENT *p);
 
 // Our qsort compare function.
 static int qsort_compare(const void * left, const void * right);
 
+// Our fts_open() compare function, for sorting by path: fts sorts each
+// directory's entries by name, so the whole walk comes out in path order.
+static int fts_compare(const FTSENT **left, const FTSENT **right);
+
+// Compares paths in the order the (fts_compare() sorted) walk finds them.
+static int walk_compare(const char *left, const char *right);
+
+// Whether path comes before the frontier in the sorted walk.
+static int walked_before(const char *path, const char *frontier);
+
+// Whether the walk itself finds records in sort token order (p or P), so
+// they don't have to be sorted after.  Streamed directories come in
+// whatever order the filesystem keeps them, so not with those.
+static int walk_gives_order(void);
+
+// Hashes the options that shape the output, to tie a journal to them.
+static unsigned long long scan_options_hash(void);
+
+// Hashes a set of rules into seed, the same whatever order they were given
+// in, or however many times.
+static uint64_t hash_rules(char **rules, int count, uint64_t seed);
+static int compare_strings(const void *left, const void *right);
+
+// Adds a rule to the ignore list, and keeps it for scan_options_hash().
+static void add_ignore_rule(const char *rule);
+
+// Frees the ignore rules' text.
+static void free_ignore_rules(void);
+
+// Puts the walk's counts in the stats, now that they're final.
+static void set_stats_counters(long long records);
+
+// Prints the phase times (with -v), and writes the stats file.
+static void report_stats(void);
+
+// Prints the call times with -v, and hands them to the stats report.
+static void report_latency(void);
+
+// Charges the time an entry of the walk took to its directory.
+static void profile_entry(FTSENT *p, int level, uint64_t ns);
+
+// Lists the slowest directories, with -v.
+static void report_slow_dirs(void);
+
+// Says where the memory went, with -v.
+static void report_memory(void);
+
+// STATS_* for a --stats-format name, or -1.
+static int parse_stats_format(const char *name);
+
+// Parses an i/N shard spec into the globals.  Returns -1 if it isn't one.
+static int parse_shard(const char *str);
+
+// Which shard an entry at the shard depth belongs to.
+static int shard_of(FTSENT *p);
+
+// Parses a byte count with an optional K, M, G or T suffix.  Returns -1 if
+// it isn't one.
+static long long parse_size(const char *str);
+
 // Print usage
 void usage(void);
 
 #pragma mark function definitions
 int main (int argc, char * argv[]) {
-	FTS *ftsp;
-	FTSENT *p;
-	int filesVisited = 0, filesSkipped = 0;
+	Boolean journalDone = true;
 	int c; opterr = 0;
-	struct file_record_t *current_record = NULL;
-	time_t start_time, end_time;
+	long long records;
+	uint64_t formatted, start;
 	config_file_t myConfigFile;
 
-	start_time = time(0);
+	init_stats(&(globals->stats));
+	stats_phase(&(globals->stats), "config");
 	
 	/* Set defaults: */
 	globals->fts_options			= FTS_PHYSICAL | FTS_XDEV;
@@ -189,18 +515,49 @@ int main (int argc, char * argv[]) {
 	globals->pathToScan				= strdup("/");
 	globals->outputPath				= NULL;
 	globals->configurationFilePath	= NULL;
+	globals->hashWhat				= 0;
+	globals->hashThreads			= (int) sysconf(_SC_NPROCESSORS_ONLN);
+	globals->hashCachePath			= NULL;
+	globals->ignoreRules			= NULL;
+	globals->ignoreRuleCount		= 0;
+	globals->ignoreFileName			= NULL;
+	globals->ignoreFilesLoaded		= 0;
+	globals->scopeMemory			= 0;
+	globals->scopePeakMemory		= 0;
+	globals->whereExpression		= NULL;
+	globals->memLimit				= 0;
+	globals->tempDir				= NULL;
+	globals->shardIndex				= 0;
+	globals->shardCount				= 1;
+	globals->shardDepth				= 1;
+	globals->checkpointInterval		= 0;
+	globals->resume					= false;
+	globals->resumeFrom				= NULL;
+	globals->streamDirs				= 0;
+	globals->statsFile				= NULL;
+	globals->statsFormat			= STATS_JSON;
+	globals->latency				= NULL;
+	globals->slowDirs				= DIRPROFILE_SIZE;
+	globals->profiling				= false;
+	globals->traceFile				= NULL;
+	globals->previousPath			= NULL;
+	globals->estimating				= false;
 	
 	/* Initialize the snap */
 	init_snap_record(&(globals->snap));
 
-	/* Initialize the ignored path's array */
-	globals->currentIgnoreCapacity = 10;
-	globals->currentIgnoreSize = 0;
-	CREATE(globals->ignore_array, 
-		   globals->currentIgnoreCapacity * sizeof(struct ignore_record_t *));
+	/* Initialize the ignore list */
+	init_ignore(&(globals->ignores));
+	
+	/* Initialize the mount table (it's only read if we cross disks) */
+	init_mount_table(&(globals->mounts));
+	
+	/* Initialize the filter (which matches everything until compiled) */
+	init_filter(&(globals->filter));
 	
 	/* Parse options/input */
-	while ((c = getopt(argc, argv, "vVDaqhHI:C:o:i:p:c:f:r:s:")) != -1)
+	while ((c = getopt_long(argc, argv, "vVDaqhHI:C:o:i:p:c:f:r:s:",
+							long_options, NULL)) != -1)
 	{
 		switch (c) {
 			case 'a':
@@ -238,7 +595,10 @@ int main (int argc, char * argv[]) {
 				globals->outputPath = strdup(optarg);
 				break;
 			case 'i':
-				add_to_ignore_array(optarg);
+				add_ignore_rule(optarg);
+				break;
+			case 'I':
+				globals->ignoreFileName = strdup(optarg);
 				break;
 			case 'p':
 				//TODO: Error checking.
@@ -251,9 +611,125 @@ int main (int argc, char * argv[]) {
 			case 'C':
 				globals->configurationFilePath = strdup(optarg);
 				break;
+			case OPT_HASH_ALGORITHM:
+				if (hash_algorithm_from_name(optarg) == -1)
+				{
+					LogError("Unknown hash algorithm: %s\n", optarg);
+					exit(1);
+				}
+				globals->snap.hash_algorithm = hash_algorithm_from_name(optarg);
+				break;
+			case OPT_HASH_THREADS:
+				globals->hashThreads = atoi(optarg);
+				break;
+			case OPT_HASH_CACHE:
+				globals->hashCachePath = strdup(optarg);
+				break;
+			case OPT_FINGERPRINT_BLOCKS:
+				globals->snap.fingerprint_blocks = MAX(atoi(optarg), 0);
+				if (globals->snap.fingerprint_blocks >
+					HASHER_MAX_FINGERPRINT_BLOCKS)
+				{
+					LogError("Bad fingerprint block count: %s (at most %d)\n",
+							 optarg, HASHER_MAX_FINGERPRINT_BLOCKS);
+					exit(1);
+				}
+				break;
+			case OPT_EXCLUDE_FSTYPE:
+				mount_rule_add(&(globals->mounts), MOUNT_EXCLUDE_FSTYPE, optarg);
+				break;
+			case OPT_INCLUDE_FSTYPE:
+				mount_rule_add(&(globals->mounts), MOUNT_INCLUDE_FSTYPE, optarg);
+				break;
+			case OPT_EXCLUDE_MOUNT:
+				mount_rule_add(&(globals->mounts), MOUNT_EXCLUDE_POINT, optarg);
+				break;
+			case OPT_INCLUDE_MOUNT:
+				mount_rule_add(&(globals->mounts), MOUNT_INCLUDE_POINT, optarg);
+				break;
+			case OPT_WHERE:
+				if (globals->whereExpression)
+					free(globals->whereExpression);
+				globals->whereExpression = strdup(optarg);
+				break;
+			case OPT_MEM_LIMIT:
+				if ((globals->memLimit = parse_size(optarg)) == -1)
+				{
+					LogError("Bad memory limit: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case OPT_TEMP_DIR:
+				if (globals->tempDir)
+					free(globals->tempDir);
+				globals->tempDir = strdup(optarg);
+				break;
+			case OPT_SHARD:
+				if (parse_shard(optarg) == -1)
+				{
+					LogError("Bad shard: %s (should be i/N, with i from 0 "
+							 "to N-1)\n", optarg);
+					exit(1);
+				}
+				break;
+			case OPT_SHARD_DEPTH:
+				globals->shardDepth = MAX(atoi(optarg), 1);
+				break;
+			case OPT_CHECKPOINT:
+				globals->checkpointInterval = MAX(atoi(optarg), 1);
+				break;
+			case OPT_RESUME:
+				globals->resume = true;
+				break;
+			case OPT_STATS_FILE:
+				if (globals->statsFile)
+					free(globals->statsFile);
+				globals->statsFile = strdup(optarg);
+				break;
+			case OPT_STATS_FORMAT:
+				if ((globals->statsFormat = parse_stats_format(optarg)) == -1)
+				{
+					LogError("Unknown stats format: %s (use json or "
+							 "prometheus)\n", optarg);
+					exit(1);
+				}
+				break;
+			case OPT_LATENCY:
+				if (globals->latency == NULL)
+				{
+					CREATE(globals->latency, sizeof(latency_set_t));
+				}
+				break;
+			case OPT_SLOW_DIRS:
+				globals->slowDirs = MAX(atoi(optarg), 0);
+				break;
+			case OPT_TRACE:
+				if (globals->traceFile)
+					free(globals->traceFile);
+				globals->traceFile = strdup(optarg);
+				break;
+			case OPT_PREVIOUS:
+				if (globals->previousPath)
+					free(globals->previousPath);
+				globals->previousPath = strdup(optarg);
+				break;
+			case OPT_ESTIMATE:
+				globals->estimating = true;
+				break;
+			case OPT_STREAM_DIRS:
+				if ((globals->streamDirs = parse_size(optarg)) == -1)
+				{
+					LogError("Bad directory size: %s\n", optarg);
+					exit(1);
+				}
+				break;
 			case '?':
 			default:
-				if (optopt == 'o' || optopt == 'i' || optopt == 'p' ||
+				if (optopt >= OPT_HASH_ALGORITHM) {
+					LogError("Option %s requires an argument.\n", 
+							 argv[optind - 1]);
+				}
+				else if (optopt == 'o' || optopt == 'i' || optopt == 'p' ||
 					optopt == 'c' || optopt == 'r' || optopt == 'f' ||
 					optopt == 'C' || optopt == 'I') {
 					LogError("Option %c requires an argument.\n", optopt);
@@ -286,18 +762,36 @@ int main (int argc, char * argv[]) {
 		// For debugging config file:
 		//debug_print_config_file_t(&myConfigFile);
 		
-		// Any Ignore files should be added to the ignore array.
+		// Any Ignore files should be added to the ignore list.
 		if (array_of_values_for_key(&myConfigFile, "ignore", 
 									&myValArray, &array_size) != -1)
 		{
 			for (i = 0; i < array_size; i++)
 			{
 				assert(myValArray[i]);
-				add_to_ignore_array(myValArray[i]);
+				add_ignore_rule(myValArray[i]);
 			}
 			free(myValArray);
 		}
 		
+		// So should the mount rules, all of which can be given many times.
+		for (i = 0; mount_rule_keys[i].key; i++)
+		{
+			size_t j;
+			
+			if (array_of_values_for_key(&myConfigFile, mount_rule_keys[i].key,
+										&myValArray, &array_size) != -1)
+			{
+				for (j = 0; j < array_size; j++)
+				{
+					assert(myValArray[j]);
+					mount_rule_add(&(globals->mounts), mount_rule_keys[i].kind,
+								   myValArray[j]);
+				}
+				free(myValArray);
+			}
+		}
+		
 		if (value_for_key(&myConfigFile, "verbose", &myValStr, NULL) != -1)
 		{
 			if (!strncmp(myValStr, "1", MAX(strlen(myValStr), (size_t) 1)) ||
@@ -445,179 +939,1173 @@ int main (int argc, char * argv[]) {
 			free(myValStr);
 		}
 		
-		// Get rid of all the crap!
-		done_with_config_file(&myConfigFile);
-	}
-	
-	
-	/* Print some verbose messages */
-	if (geteuid() != 0)
-	{
-		LogError("\nWARNING: %s should be run as ROOT for best results!\n",
-				 PROGNAME);
-	}
-	
-	LogV("Verbose mode is %s\n" "Mega Verbose mode is %s\n"
-		 "Scan accross disks is %s\n" "Skip directories is %s\n" 
-		 "Output path is %s\n" "Scan path is %s\n" "Column string is %s\n" 
-		 "MAX_RECORD_LENGTH is %d\n" "INITIAL_ARRAY_SIZE is %d\n" 
-		 "ARRAY_CHUNK_SIZE is %d\n",
-		 (globals->verbose) ? "ON" : "OFF",
-		 (globals->megaVerbose) ? "ON" : "OFF",
-		 (globals->fts_options & FTS_XDEV) ? "OFF" : "ON",
-		 (globals->skipDirs) ? "ON" : "OFF",
-		 globals->outputPath, globals->pathToScan, globals->snap.column_string,
-		 MAX_RECORD_LENGTH, INITIAL_ARRAY_SIZE, ARRAY_CHUNK_SIZE);
-	
-	/* Traverse the hierarchy (do the work) */
-	char *pathargv[] = {globals->pathToScan, NULL};
-	if ((ftsp = fts_open(pathargv, globals->fts_options, NULL)) == NULL) {
-		LogError("fts_open: %s\n", strerror(errno));
-		exit(1);
-	}
-
-	OutPut(false, "Beginning scan:\n");
-	
-	while ((p = fts_read(ftsp)) != NULL) {
+		if (value_for_key(&myConfigFile, "hashAlgorithm", 
+						  &myValStr, NULL) != -1)
+		{
+			if (hash_algorithm_from_name(myValStr) != -1)
+			{
+				globals->snap.hash_algorithm = 
+					hash_algorithm_from_name(myValStr);
+			}
+			else
+			{
+				LogError("Unknown hash algorithm: %s\n", myValStr);
+			}
+			free(myValStr);
+		}
 		
-		// Skip certain/special/error files, etc.
-		switch (p->fts_info) {
-			case FTS_D:
-				break;
-			case FTS_DNR:
-				LogError("%s: %s\n", p->fts_path, strerror(p->fts_errno));
-				break;
-			case FTS_DP:
-				continue;
-			case FTS_ERR:
-			case FTS_NS:
-				LogError("%s: %s\n", p->fts_path, strerror(p->fts_errno));
-				continue;
-			case FTS_SL:
-			case FTS_SLNONE:
-			default:
-				break;
+		if (value_for_key(&myConfigFile, "hashThreads", &myValStr, NULL) != -1)
+		{
+			if (myValStr && *myValStr)
+			{
+				globals->hashThreads = atoi(myValStr);
+			}
+			free(myValStr);
 		}
 		
-		filesVisited++;
-		if (!(filesVisited % 10000))
+		if (value_for_key(&myConfigFile, "fingerprintBlocks", 
+						  &myValStr, NULL) != -1)
 		{
-			OutPut(true, "%dk files scanned...", filesVisited/1000);
+			if (myValStr && *myValStr)
+			{
+				globals->snap.fingerprint_blocks = MAX(atoi(myValStr), 0);
+				if (globals->snap.fingerprint_blocks >
+					HASHER_MAX_FINGERPRINT_BLOCKS)
+				{
+					LogError("Bad fingerprint block count: %s (at most %d)\n",
+							 myValStr, HASHER_MAX_FINGERPRINT_BLOCKS);
+					exit(1);
+				}
+			}
+			free(myValStr);
 		}
 		
-		if (should_be_ignored(p->fts_path, p->fts_pathlen,
-							  p->fts_name, p->fts_namelen))
+		if (value_for_key(&myConfigFile, "hashCache", &myValStr, NULL) != -1)
 		{
-			LogV("Found %s, which is on the ignore list.  "
-				 "Ignoring it and its children.\n", p->fts_path);
-			filesSkipped++;
-			fts_set(ftsp, p, FTS_SKIP);
-			continue;
+			if (myValStr && *myValStr)
+			{
+				if (globals->hashCachePath)
+					free(globals->hashCachePath);
+				
+				globals->hashCachePath = myValStr;
+			}
 		}
 		
-		// If we're skipping directories, and this is a directory, continue
-		// to the next iteration.
-		if (globals->skipDirs && S_ISDIR(p->fts_statp->st_mode))
+		if (value_for_key(&myConfigFile, "ignoreFileName", 
+						  &myValStr, NULL) != -1)
 		{
-			filesSkipped++;
-			continue;
+			if (myValStr && *myValStr)
+			{
+				if (globals->ignoreFileName)
+					free(globals->ignoreFileName);
+				
+				globals->ignoreFileName = myValStr;
+			}
+		}
+		
+		if (value_for_key(&myConfigFile, "where", &myValStr, NULL) != -1)
+		{
+			if (myValStr && *myValStr)
+			{
+				if (globals->whereExpression)
+					free(globals->whereExpression);
+				
+				globals->whereExpression = myValStr;
+			}
 		}
 		
-		// Create our record, and add it to the array.
-		CREATE(current_record, sizeof(file_record));
-		current_record->re_path = strdup(p->fts_path);
-		current_record->re_atime = p->fts_statp->st_atime;
-		current_record->re_atime_str = NULL;
-		current_record->re_mtime = p->fts_statp->st_mtime;
-		current_record->re_mtime_str = NULL;
-		current_record->re_ctime = p->fts_statp->st_ctime;
-		current_record->re_ctime_str = NULL;
-		current_record->re_size = p->fts_statp->st_size;
-		current_record->re_ino = p->fts_statp->st_ino;
-		current_record->re_uid = p->fts_statp->st_uid;
-		current_record->re_gid = p->fts_statp->st_gid;
-		current_record->re_mode = p->fts_statp->st_mode;
+		if (value_for_key(&myConfigFile, "memLimit", &myValStr, NULL) != -1)
+		{
+			if ((globals->memLimit = parse_size(myValStr)) == -1)
+			{
+				LogError("Bad memory limit: %s\n", myValStr);
+				exit(1);
+			}
+			free(myValStr);
+		}
+		
+		if (value_for_key(&myConfigFile, "shard", &myValStr, NULL) != -1)
+		{
+			if (parse_shard(myValStr) == -1)
+			{
+				LogError("Bad shard: %s (should be i/N, with i from 0 "
+						 "to N-1)\n", myValStr);
+				exit(1);
+			}
+			free(myValStr);
+		}
+		
+		if (value_for_key(&myConfigFile, "shardDepth", 
+						  &myValStr, NULL) != -1)
+		{
+			globals->shardDepth = MAX(atoi(myValStr), 1);
+			free(myValStr);
+		}
 		
-		if (S_ISDIR(current_record->re_mode))
+		if (value_for_key(&myConfigFile, "checkpoint", 
+						  &myValStr, NULL) != -1)
+		{
+			globals->checkpointInterval = MAX(atoi(myValStr), 1);
+			free(myValStr);
+		}
+		
+		if (value_for_key(&myConfigFile, "statsFile", &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'D';
+			if (myValStr && *myValStr)
+			{
+				if (globals->statsFile)
+					free(globals->statsFile);
+				globals->statsFile = myValStr;
+			}
 		}
-		else if (S_ISLNK(current_record->re_mode))
+		
+		if (value_for_key(&myConfigFile, "statsFormat", 
+						  &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'L';
+			if ((globals->statsFormat = parse_stats_format(myValStr)) == -1)
+			{
+				LogError("Unknown stats format: %s (use json or "
+						 "prometheus)\n", myValStr);
+				exit(1);
+			}
+			free(myValStr);
 		}
-		else if (S_ISSOCK(current_record->re_mode))
+		
+		if (value_for_key(&myConfigFile, "latency", &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'S';
+			if (!strncmp(myValStr, "1", MAX(strlen(myValStr), (size_t) 1)) ||
+				!strncmp(myValStr, "yes", MAX(strlen(myValStr), (size_t) 3)) ||
+				!strncmp(myValStr, "true", MAX(strlen(myValStr), (size_t) 4)) ||
+				!strncmp(myValStr, "on", MAX(strlen(myValStr), (size_t) 2)))
+			{
+				if (globals->latency == NULL)
+				{
+					CREATE(globals->latency, sizeof(latency_set_t));
+				}
+			}
+			else if (globals->latency)
+			{
+				free(globals->latency);
+				globals->latency = NULL;
+			}
+			free(myValStr);
 		}
-		else if (S_ISFIFO(current_record->re_mode))
+		
+		if (value_for_key(&myConfigFile, "slowDirs", &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'U';
+			globals->slowDirs = MAX(atoi(myValStr), 0);
+			free(myValStr);
 		}
-		else if (S_ISBLK(current_record->re_mode))
+		
+		if (value_for_key(&myConfigFile, "streamDirs", 
+						  &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'B';
+			if ((globals->streamDirs = parse_size(myValStr)) == -1)
+			{
+				LogError("Bad directory size: %s\n", myValStr);
+				exit(1);
+			}
+			free(myValStr);
 		}
-		else if (S_ISCHR(current_record->re_mode))
+		
+		if (value_for_key(&myConfigFile, "tempDir", &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'C';
+			if (myValStr && *myValStr)
+			{
+				if (globals->tempDir)
+					free(globals->tempDir);
+				
+				globals->tempDir = myValStr;
+			}
 		}
-		else if (S_ISREG(current_record->re_mode))
+		
+		if (value_for_key(&myConfigFile, "previous", &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'F';
+			if (myValStr && *myValStr)
+			{
+				if (globals->previousPath)
+					free(globals->previousPath);
+				
+				globals->previousPath = myValStr;
+			}
 		}
-		else
+		
+		if (value_for_key(&myConfigFile, "estimate", &myValStr, NULL) != -1)
 		{
-			current_record->re_type = 'X';
+			if (!strncmp(myValStr, "1", MAX(strlen(myValStr), (size_t) 1)) ||
+				!strncmp(myValStr, "yes", MAX(strlen(myValStr), (size_t) 3)) ||
+				!strncmp(myValStr, "true", MAX(strlen(myValStr), (size_t) 4)) ||
+				!strncmp(myValStr, "on", MAX(strlen(myValStr), (size_t) 2)))
+			{
+				globals->estimating = true;
+			}
+			else
+				globals->estimating = false;
+			free(myValStr);
 		}
-
-		add_record_to_snap(&(globals->snap), current_record);
 		
-		LogMV("Visiting: %s\n", p->fts_path);
+		// Get rid of all the crap!
+		done_with_config_file(&myConfigFile);
 	}
 	
-	fts_close(ftsp);
 	
-	// Sort if we need to.
-	if (globals->sortToken &&
-		!(*globals->sortToken == 'p' || *globals->sortToken == 'P'))
+	// Mega-verbose logs every file, and waiting on stderr for each would
+	// slow the scan down several times over, so it's left to a thread.
+	if (globals->megaVerbose)
 	{
-		OutPut(false, "\nSorting...");
-		qsort(globals->snap.master_array, globals->snap.currentArraySize,
-			  sizeof(file_record *), qsort_compare);
-		OutPut(false, "Done!");
+		start_async_log();
 	}
-		
-	/* Hierarchy traversal complete, post process */
-	LogV("\nVisited %d file%s.\n", filesVisited, 
-		 (filesVisited != 1) ? "s" : "");
-	LogV("Skipped %d file%s.\n", filesSkipped, (filesSkipped != 1) ? "s" : "");
-	
-	OutPut(false, "\nWritting file...");
-
-	write_snap_record_to_file(&(globals->snap), globals->outputPath);
 	
-	OutPut(false, "Done.\n");
+	/* Print some verbose messages */
+	if (geteuid() != 0)
+	{
+		LogError("\nWARNING: %s should be run as ROOT for best results!\n",
+				 PROGNAME);
+	}
 	
-	// Free what we need to free.
-	free_snap(&(globals->snap));
-	free_ignore_array();
-	free(globals->pathToScan);
-	if (globals->outputPath)
-		free(globals->outputPath);
-	if (globals->sortToken)
-		free(globals->sortToken);
-	if (globals->configurationFilePath)
-		free(globals->configurationFilePath);
+	LogV("Verbose mode is %s\n" "Mega Verbose mode is %s\n"
+		 "Scan accross disks is %s\n" "Skip directories is %s\n" 
+		 "Output path is %s\n" "Scan path is %s\n" "Column string is %s\n" 
+		 "MAX_RECORD_LENGTH is %d\n" "INITIAL_ARRAY_SIZE is %d\n" 
+		 "ARRAY_CHUNK_SIZE is %d\n",
+		 (globals->verbose) ? "ON" : "OFF",
+		 (globals->megaVerbose) ? "ON" : "OFF",
+		 (globals->fts_options & FTS_XDEV) ? "OFF" : "ON",
+		 (globals->skipDirs) ? "ON" : "OFF",
+		 globals->outputPath, globals->pathToScan, globals->snap.column_string,
+		 MAX_RECORD_LENGTH, INITIAL_ARRAY_SIZE, ARRAY_CHUNK_SIZE);
+	
+	// Tracing has to be on before the hashers start, for them to be in it.
+	if (globals->traceFile)
+	{
+		LogV("Tracing to %s\n", globals->traceFile);
+		init_trace();
+		trace_thread("walker");
+	}
+	
+	// An estimate only walks samples of the tree, and writes nothing, so
+	// there's nothing to hash, sort out to disk or checkpoint.
+	if (globals->estimating)
+	{
+		LogV("Estimating the scan from samples of the tree\n");
+		globals->memLimit = 0;
+		globals->checkpointInterval = 0;
+		globals->resume = false;
+	}
+	
+	// Only pay for reading file contents if someone wants to see the hash
+	// or the fingerprint.
+	if (snap_has_column(&(globals->snap), 'h') && !globals->estimating)
+	{
+		globals->hashWhat |= HASHER_CONTENT;
+		LogV("Hashing contents with %s\n",
+			 hash_algorithm_name(globals->snap.hash_algorithm));
+	}
+	if (snap_has_column(&(globals->snap), 'f') && !globals->estimating)
+	{
+		globals->hashWhat |= HASHER_FINGERPRINT;
+		LogV("Fingerprinting contents with %d sampled blocks\n",
+			 globals->snap.fingerprint_blocks);
+	}
+	if (globals->hashWhat)
+	{
+		LogV("Reading files on %d thread%s\n",
+			 MAX(globals->hashThreads, 1), 
+			 (globals->hashThreads > 1) ? "s" : "");
+		
+		// The hashers open files by fts_path, which is only valid from our
+		// starting directory, so keep fts from changing directories.
+		globals->fts_options |= FTS_NOCHDIR;
+		
+		if (globals->hashCachePath)
+		{
+			LogV("Using hash cache %s\n", globals->hashCachePath);
+			init_hashcache(&(globals->hashCache), globals->hashCachePath);
+		}
+		
+		init_hasher(&(globals->hasher), globals->hashThreads, 
+					globals->hashWhat, globals->snap.hash_algorithm,
+					globals->snap.fingerprint_blocks,
+					(globals->hashCachePath) ? &(globals->hashCache) : NULL,
+					globals->latency != NULL);
+	}
+	
+	if (globals->ignoreFileName)
+	{
+		LogV("Reading ignore rules from %s files\n", globals->ignoreFileName);
+		globals->ignoreFileNameLen = strlen(globals->ignoreFileName);
+		
+		// The ignore files are opened by fts_path, too.
+		globals->fts_options |= FTS_NOCHDIR;
+	}
+	
+	// Compile the filter once, up front, so a typo fails before the walk.
+	if (globals->whereExpression)
+	{
+		if (filter_compile(&(globals->filter), globals->whereExpression) == -1)
+		{
+			exit(1);
+		}
+		LogV("Only recording files where %s\n", globals->whereExpression);
+	}
+	
+	// Each shard only has part of the tree, so a directory above the split
+	// can't have a tree hash covering all of it.
+	if (globals->shardCount > 1)
+	{
+		if (snap_has_column(&(globals->snap), 'r'))
+		{
+			LogError("Tree hashes (%%r) can't be computed with --shard.\n");
+			exit(1);
+		}
+		LogV("Scanning shard %d of %d, split %d level%s down\n",
+			 globals->shardIndex, globals->shardCount, globals->shardDepth,
+			 (globals->shardDepth != 1) ? "s" : "");
+	}
+	
+	// Streamed directories come in whatever order the filesystem keeps
+	// them, which a resume couldn't count on being the same.
+	if (globals->streamDirs && 
+		(globals->checkpointInterval || globals->resume))
+	{
+		LogError("\nWARNING: checkpoints need every directory walked in "
+				 "order, so --stream-dirs is ignored.\n");
+		globals->streamDirs = 0;
+	}
+	if (globals->streamDirs)
+	{
+		// Streamed entries are stat()ed by path from where we started.
+		globals->fts_options |= FTS_NOCHDIR;
+		LogV("Streaming directories of %lld bytes or more\n",
+			 globals->streamDirs);
+	}
+	globals->walkInOrder = ((globals->sortToken && 
+							 (*globals->sortToken == 'p' ||
+							  *globals->sortToken == 'P')) ||
+							globals->checkpointInterval || globals->resume);
+	
+	// Checkpoints go to a journal beside the output, as sorted runs.
+	if (globals->resume && globals->checkpointInterval == 0)
+	{
+		globals->checkpointInterval = JOURNAL_INTERVAL;
+	}
+	if (globals->checkpointInterval)
+	{
+		if (globals->outputPath == NULL)
+		{
+			LogError("Checkpoints need an output file (-o).\n");
+			exit(1);
+		}
+		if (snap_has_column(&(globals->snap), 'r'))
+		{
+			LogError("Tree hashes (%%r) can't be checkpointed.\n");
+			exit(1);
+		}
+		init_journal(&(globals->journal), globals->outputPath, 
+					 scan_options_hash(), globals->checkpointInterval);
+	}
+	
+	// With a memory limit, records get sorted out to disk in runs as the
+	// limit is reached.  Tree hashes need every record at once, though.
+	if (globals->memLimit && snap_has_column(&(globals->snap), 'r'))
+	{
+		LogError("\nWARNING: tree hashes need the whole snapshot in memory, "
+				 "so --mem-limit is ignored.\n");
+		globals->memLimit = 0;
+	}
+	if (globals->memLimit || globals->checkpointInterval)
+	{
+		init_extsort(&(globals->extsort), globals->tempDir, 
+					 (size_t) globals->memLimit,
+					 (globals->sortToken && !walk_gives_order()) ?
+					 qsort_compare : NULL);
+	}
+	if (globals->memLimit)
+	{
+		LogV("Holding at most %lld bytes of records, sorting the rest "
+			 "out to %s\n", globals->memLimit, globals->extsort.temp_dir);
+	}
+	if (globals->checkpointInterval)
+	{
+		LogV("Checkpointing every %d second%s to %s\n", 
+			 globals->checkpointInterval,
+			 (globals->checkpointInterval != 1) ? "s" : "",
+			 globals->journal.dir);
+		
+		if (globals->resume)
+		{
+			switch (journal_resume(&(globals->journal), &(globals->extsort))) {
+				case 1:
+					globals->resumeFrom = globals->journal.frontier;
+					OutPut(false, "Resuming after %s (%lld records "
+						   "journaled)\n", globals->resumeFrom,
+						   globals->extsort.records_spilled);
+					break;
+				case 0:
+					LogError("No checkpoint in %s, so starting from the "
+							 "beginning.\n", globals->journal.dir);
+					break;
+				default:
+					exit(1);
+			}
+		}
+	}
+	
+	// Crossing disks means we need to know what's mounted where, to stay out
+	// of /proc, NFS and the like.
+	if (!(globals->fts_options & FTS_XDEV))
+	{
+		int i;
+		
+		if (load_mount_table(&(globals->mounts)) == -1)
+		{
+			LogError("Couldn't read the mount table, so all mounts will "
+					 "be scanned.\n");
+		}
+		
+		for (i = 0; i < globals->mounts.count; i++)
+		{
+			if (globals->mounts.entries[i].excluded)
+			{
+				LogV("Excluding %s (%s)\n", 
+					 globals->mounts.entries[i].mount_point,
+					 globals->mounts.entries[i].fstype);
+			}
+		}
+	}
+	
+	// With -v, keep track of which directories the walk's time goes to.
+	if (globals->verbose && globals->slowDirs && !globals->estimating)
+	{
+		globals->profiling = true;
+		init_dirprofile(&(globals->dirProfile), globals->slowDirs);
+	}
+	
+	globals->pathToScanLen = strlen(globals->pathToScan);
+	
+	// The estimate is all that's wanted, so there's nothing to write.
+	if (globals->estimating)
+	{
+		estimate_scan();
+		
+		free_snap(&(globals->snap));
+		free_ignore(&(globals->ignores));
+		free_ignore_rules();
+		free_mount_table(&(globals->mounts));
+		free_filter(&(globals->filter));
+		free(globals->pathToScan);
+		if (globals->whereExpression)
+			free(globals->whereExpression);
+		if (globals->ignoreFileName)
+			free(globals->ignoreFileName);
+		if (globals->configurationFilePath)
+			free(globals->configurationFilePath);
+		if (globals->traceFile)
+		{
+			trace_write(globals->traceFile);
+			free_trace();
+			free(globals->traceFile);
+		}
+		
+		stop_async_log();
+		return 0;
+	}
+	
+	/* Traverse the hierarchy (do the work) */
+	stats_phase(&(globals->stats), "walk");
+	OutPut(false, "Beginning scan:\n");
+	
+	// The walk just counts; the reports are left to a thread.
+	init_progress(&(globals->progress), globals->previousPath,
+				  report_progress);
+	if (!globals->quietMode)
+	{
+		start_progress(&(globals->progress));
+	}
+	
+	start = TRACE_START();
+	walk_tree(globals->pathToScan, FTS_ROOTLEVEL, NULL);
+	TRACE_END("walk", NULL, start);
+	
+	free_progress(&(globals->progress));
+	if (globals->previousPath)
+	{
+		free(globals->previousPath);
+	}
+	
+	if (globals->ignoreFileName)
+	{
+		LogV("Read %d %s file%s\n", globals->ignoreFilesLoaded,
+			 globals->ignoreFileName,
+			 (globals->ignoreFilesLoaded != 1) ? "s" : "");
+	}
+	
+	// Wait for the hashers to catch up with the walk.
+	if (globals->hashWhat)
+	{
+		stats_phase(&(globals->stats), "hash");
+		OutPut(false, "\nFinishing hashes...");
+		hasher_wait(&(globals->hasher));
+		if (globals->latency)
+		{
+			hasher_latency(&(globals->hasher), globals->latency);
+		}
+		free_hasher(&(globals->hasher));
+		OutPut(false, "Done!");
+		LogV("\nHashed %lld file%s (%lld bytes).\n", 
+			 globals->hasher.files_hashed,
+			 (globals->hasher.files_hashed != 1) ? "s" : "",
+			 globals->hasher.bytes_hashed);
+		
+		// Replace the cache with what we saw this run, and say how it did.
+		if (globals->hashCachePath)
+		{
+			long long lookups = globals->hashCache.hits + 
+				globals->hashCache.misses;
+			
+			hashcache_save(&(globals->hashCache), HASHCACHE_DROP_UNSEEN);
+			OutPut(false, "\nHash cache: %lld hit%s, %lld miss%s "
+				   "(%.1f%% hit rate)", 
+				   globals->hashCache.hits,
+				   (globals->hashCache.hits != 1) ? "s" : "",
+				   globals->hashCache.misses,
+				   (globals->hashCache.misses != 1) ? "es" : "",
+				   (lookups > 0) ? 
+				   100.0 * globals->hashCache.hits / lookups : 0.0);
+			free_hashcache(&(globals->hashCache));
+		}
+	}
+	
+	// Roll up the tree hashes, now that every content hash is in.
+	if (snap_has_column(&(globals->snap), 'r'))
+	{
+		if (globals->skipDirs)
+		{
+			LogError("\nWARNING: tree hashes are stored on directory records, "
+					 "so -D leaves only the per-file hashes.\n");
+		}
+		
+		stats_phase(&(globals->stats), "tree");
+		OutPut(false, "\nComputing tree hashes...");
+		start = TRACE_START();
+		compute_tree_hashes(&(globals->snap));
+		TRACE_END("tree", NULL, start);
+		OutPut(false, "Done!");
+	}
+	
+	// Sort if we need to.  (Records that went out to disk get sorted as
+	// they're merged back in, instead.)
+	if (globals->sortToken && globals->extsort.run_count == 0 &&
+		!walk_gives_order())
+	{
+		stats_phase(&(globals->stats), "sort");
+		OutPut(false, "\nSorting...");
+		start = TRACE_START();
+		qsort(globals->snap.master_array, globals->snap.currentArraySize,
+			  sizeof(file_record *), qsort_compare);
+		TRACE_END("sort", NULL, start);
+		OutPut(false, "Done!");
+	}
+		
+	/* Hierarchy traversal complete, post process */
+	LogV("\nVisited %d file%s.\n", globals->filesVisited, 
+		 (globals->filesVisited != 1) ? "s" : "");
+	LogV("Skipped %d file%s.\n", globals->filesSkipped, (globals->filesSkipped != 1) ? "s" : "");
+	if (globals->whereExpression)
+	{
+		LogV("Filtered out %d file%s.\n", globals->filesFiltered,
+			 (globals->filesFiltered != 1) ? "s" : "");
+	}
+	if (globals->shardCount > 1)
+	{
+		LogV("Left %d entr%s to other shards.\n", globals->filesSharded,
+			 (globals->filesSharded != 1) ? "ies" : "y");
+	}
+	if (globals->streamDirs)
+	{
+		LogV("Streamed %d big director%s.\n", globals->dirsStreamed,
+			 (globals->dirsStreamed != 1) ? "ies" : "y");
+	}
+	
+	// Formatting happens as records are written, so it's timed apart (and
+	// moved out of the write time at the end).  Its phase goes first, to be
+	// listed in order.
+	stats_phase(&(globals->stats), "format");
+	stats_phase(&(globals->stats), "write");
+	formatted = globals->snap.format_ns;
+	records = globals->snap.currentArraySize + 
+		globals->extsort.records_spilled;
+	OutPut(false, "\nWritting file...");
+
+	if (globals->extsort.run_count > 0)
+	{
+		if (extsort_write(&(globals->extsort), &(globals->snap), 
+						  globals->outputPath) == -1)
+		{
+			LogError("\nCouldn't merge the sorted runs.\n");
+			journalDone = false;
+		}
+		LogV("\nMerged %d run%s (%lld records spilled, %d extra pass%s)\n",
+			 globals->extsort.run_count,
+			 (globals->extsort.run_count != 1) ? "s" : "",
+			 globals->extsort.records_spilled, globals->extsort.merge_passes,
+			 (globals->extsort.merge_passes != 1) ? "es" : "");
+	}
+	else
+	{
+		write_snap_record_to_file(&(globals->snap), globals->outputPath);
+	}
+	
+	OutPut(false, "Done.\n");
+	set_stats_counters(records);
+	
+	// The output's written, so the journal isn't needed any more.
+	if (globals->checkpointInterval)
+	{
+		if (journalDone)
+		{
+			journal_remove(&(globals->journal));
+		}
+		free_journal(&(globals->journal));
+	}
+	
+	// Free what we need to free.
+	stats_phase(&(globals->stats), "free");
+	stats_move(&(globals->stats), "write", "format",
+			   globals->snap.format_ns - formatted);
+	free_snap(&(globals->snap));
+	free_ignore(&(globals->ignores));
+	free_ignore_rules();
+	free_mount_table(&(globals->mounts));
+	free_filter(&(globals->filter));
+	if (globals->memLimit || globals->checkpointInterval)
+		free_extsort(&(globals->extsort));
+	if (globals->tempDir)
+		free(globals->tempDir);
+	if (globals->whereExpression)
+		free(globals->whereExpression);
+	free(globals->pathToScan);
+	if (globals->ignoreFileName)
+		free(globals->ignoreFileName);
+	if (globals->outputPath)
+		free(globals->outputPath);
+	if (globals->sortToken)
+		free(globals->sortToken);
+	if (globals->configurationFilePath)
+		free(globals->configurationFilePath);
+	if (globals->hashCachePath)
+		free(globals->hashCachePath);
+	
+	stats_finish(&(globals->stats));
+	report_stats();
+	if (globals->latency)
+		free(globals->latency);
+	
+	// Everything's done, so the trace can be written.
+	if (globals->traceFile)
+	{
+		long long dropped = trace_write(globals->traceFile);
+		
+		if (dropped > 0)
+		{
+			LogV("The trace filled up; its first %lld span%s were dropped\n",
+				 dropped, (dropped != 1) ? "s" : "");
+		}
+		free_trace();
+		free(globals->traceFile);
+	}
+	
+	OutPut(false, "Scanned %d files in %.3f seconds "
+		   "for an effective rate of %.1f files/s\n", 
+		   globals->filesVisited, stats_elapsed(&(globals->stats)),
+		   (stats_elapsed(&(globals->stats)) > 0) ?
+		   globals->filesVisited / stats_elapsed(&(globals->stats)) : 0.0);
+	
+	stop_async_log();
+	
+	return 0;
+}
+
+// Walks the tree at path with fts.  Its root is at the given level, under
+// parent (NULL for the scan path itself).
+static void walk_tree(char *path, int level, FTSENT *parent)
+{
+	char *pathargv[] = {path, NULL};
+	Boolean readsDir = false, stream;
+	uint64_t start;
+	FTS *ftsp;
+	FTSENT *p;
+	
+	if ((ftsp = fts_open(pathargv, globals->fts_options,
+						 globals->walkInOrder ? fts_compare : NULL)) == NULL)
+	{
+		LogError("fts_open: %s\n", strerror(errno));
+		exit(1);
+	}
+	
+	for (;;)
+	{
+		// fts reads a directory (and stats everything in it) on the
+		// fts_read() after the one that handed it out, so that's the one
+		// that's timed.  Only its total can be, since it's all in fts.
+		start = (readsDir || globals->profiling) ? monotonic_ns() : 0;
+		if ((p = fts_read(ftsp)) == NULL)
+		{
+			break;
+		}
+		if (readsDir)
+		{
+			LATENCY_END(globals->latency, LATENCY_DIRREAD, start);
+		}
+		
+		stream = visit_entry(ftsp, p, level + p->fts_level,
+							 (p->fts_level > FTS_ROOTLEVEL) ?
+							 p->fts_parent : parent);
+		
+		if (globals->profiling)
+		{
+			profile_entry(p, level + p->fts_level, monotonic_ns() - start);
+		}
+		
+		// A directory's span runs until fts hands it back when it's done
+		// (skipped or not).
+		if (trace_enabled && p->fts_info == FTS_D)
+		{
+			p->fts_number = (long) monotonic_ns();
+		}
+		else if (trace_enabled && p->fts_info == FTS_DP)
+		{
+			trace_span("dir", p->fts_path, (uint64_t) p->fts_number,
+					   monotonic_ns());
+		}
+		
+		if (stream)
+		{
+			stream_directory(p, level + p->fts_level);
+			
+			// Skipped by fts, so there's no FTS_DP to free its scope at.
+			release_scope(p);
+		}
+		
+		// Unless it's skipped, or load_ignore_file() read it already.
+		readsDir = (globals->latency && p->fts_info == FTS_D &&
+					p->fts_instr != FTS_SKIP && !globals->ignoreFileName);
+	}
+	
+	fts_close(ftsp);
+}
+
+// Handles one entry of the walk: decides whether it's skipped, sets up a
+// directory's ignore scope, and records it.  Returns true if it's a
+// directory big enough to be streamed, which is left to the caller.
+static int visit_entry(FTS *ftsp, FTSENT *p, int level, FTSENT *parent)
+{
+	struct file_record_t *current_record = NULL;
+	Boolean journaled = false, stream = false;
+	
+	// Skip certain/special/error files, etc.
+	if (p->fts_info != FTS_DP && p->fts_info != FTS_ERR)
+	{
+		globals->statCalls++;
+	}
+	
+	switch (p->fts_info) {
+		case FTS_D:
+			globals->dirsVisited++;
+			break;
+		case FTS_DNR:
+			LogError("%s: %s\n", p->fts_path, strerror(p->fts_errno));
+			globals->dirsVisited++;
+			globals->walkErrors++;
+			break;
+		case FTS_DP:
+			// Done with this directory, so done with its ignore file.
+			release_scope(p);
+			return false;
+		case FTS_ERR:
+		case FTS_NS:
+			LogError("%s: %s\n", p->fts_path, strerror(p->fts_errno));
+			globals->walkErrors++;
+			return false;
+		case FTS_SL:
+		case FTS_SLNONE:
+		default:
+			break;
+	}
+	
+	globals->filesVisited++;
+	PROGRESS_VISIT(&(globals->progress), level);
+	if (globals->estimating)
+	{
+		estimate_visit(&(globals->estimate), level);
+	}
+	
+	if (ignore_matches(&(globals->ignores), p->fts_path, p->fts_pathlen,
+					   p->fts_name, p->fts_namelen) ||
+		(parent &&
+		 ignore_scope_matches(parent->fts_pointer, p->fts_path,
+							  p->fts_pathlen, p->fts_name,
+							  p->fts_namelen)))
+	{
+		LogV("Found %s, which is on the ignore list.  "
+			 "Ignoring it and its children.\n", p->fts_path);
+		globals->filesSkipped++;
+		globals->filesIgnored++;
+		skip_children(ftsp, p);
+		return false;
+	}
+	
+	// A directory on a different device than its parent is a mount
+	// point.  Stay out of it if its filesystem is excluded.
+	if (p->fts_info == FTS_D && parent && globals->mounts.count &&
+		p->fts_statp->st_dev != parent->fts_statp->st_dev)
+	{
+		struct mount_entry_t *mount;
+		
+		mount = mount_for_dev(&(globals->mounts), p->fts_statp->st_dev,
+							  p->fts_path);
+		if (mount && mount->excluded)
+		{
+			LogV("Found %s, which is a %s mount.  Not descending into "
+				 "it.\n", p->fts_path, mount->fstype);
+			globals->filesSkipped++;
+			skip_children(ftsp, p);
+			return false;
+		}
+	}
+	
+	// Resuming: everything walked up to the frontier is in the journal
+	// already.  Directories above it are walked back into (for their
+	// ignore files and so on), but not recorded again.
+	if (globals->resumeFrom)
+	{
+		if (strcmp(p->fts_path, globals->resumeFrom) == 0 ||
+			path_is_under(globals->resumeFrom, p->fts_path))
+		{
+			journaled = true;
+		}
+		else if (walked_before(p->fts_path, globals->resumeFrom))
+		{
+			if (p->fts_info == FTS_D)
+			{
+				skip_children(ftsp, p);
+			}
+			return false;
+		}
+		else
+		{
+			// Past it, and the walk is in order, so that's that.
+			LogV("Resumed at %s\n", p->fts_path);
+			globals->resumeFrom = NULL;
+		}
+	}
+	
+	// Entries at the shard depth belong to one shard each; stay out of
+	// other shards' subtrees.
+	if (globals->shardCount > 1 && level == globals->shardDepth &&
+		shard_of(p) != globals->shardIndex)
+	{
+		LogMV("Leaving %s to another shard\n", p->fts_path);
+		globals->filesSharded++;
+		skip_children(ftsp, p);
+		return false;
+	}
+	
+	// A directory's children see its ignore file's rules (if it has one)
+	// and those of every directory above it.  Big ones are read a bit at a
+	// time, instead of by fts all at once.  (Estimating, only a sample of
+	// them are walked into at all.)
+	if (p->fts_info == FTS_D && globals->estimating &&
+		!estimate_walk_into(&(globals->estimate), level))
+	{
+		skip_children(ftsp, p);
+	}
+	else if (p->fts_info == FTS_D)
+	{
+		stream = (ftsp && globals->streamDirs &&
+				  p->fts_statp->st_size >= globals->streamDirs);
+		
+		p->fts_pointer = parent ? parent->fts_pointer : NULL;
+		
+		if (globals->ignoreFileName)
+		{
+			load_ignore_file(stream ? NULL : ftsp, p);
+		}
+		
+		if (stream)
+		{
+			fts_set(ftsp, p, FTS_SKIP);
+		}
+	}
+	
+	// Everything above the shard depth is walked by every shard, but
+	// only recorded by the first.
+	if (globals->shardCount > 1 && level < globals->shardDepth &&
+		globals->shardIndex != 0)
+	{
+		return stream;
+	}
+	
+	if (journaled)
+	{
+		return stream;
+	}
+	
+	// If we're skipping directories, and this is a directory, continue
+	// to the next iteration.
+	if (globals->skipDirs && S_ISDIR(p->fts_statp->st_mode))
+	{
+		globals->filesSkipped++;
+		return stream;
+	}
+	
+	// Files the filter doesn't want never become records.  (Directories
+	// that don't match are still descended into.)
+	if (!filter_matches(&(globals->filter), p->fts_name, p->fts_namelen,
+						p->fts_statp))
+	{
+		globals->filesFiltered++;
+		return stream;
+	}
+	
+	// Create our record, and add it to the array.  (fts_children() leaves
+	// a '/' after a directory's path, past fts_pathlen.)
+	CREATE(current_record, sizeof(file_record));
+	current_record->re_path = strndup(p->fts_path, p->fts_pathlen);
+	current_record->re_atime = p->fts_statp->st_atime;
+	current_record->re_atime_str = NULL;
+	current_record->re_mtime = p->fts_statp->st_mtime;
+	current_record->re_mtime_str = NULL;
+	current_record->re_ctime = p->fts_statp->st_ctime;
+	current_record->re_ctime_str = NULL;
+	current_record->re_size = p->fts_statp->st_size;
+	current_record->re_ino = p->fts_statp->st_ino;
+	current_record->re_dev = p->fts_statp->st_dev;
+	current_record->re_uid = p->fts_statp->st_uid;
+	current_record->re_gid = p->fts_statp->st_gid;
+	current_record->re_mode = p->fts_statp->st_mode;
+	current_record->re_hash = NULL;
+	current_record->re_fingerprint = NULL;
+	
+	current_record->re_type = file_type_for_mode(current_record->re_mode);
+
+	add_record_to_snap(&(globals->snap), current_record);
+	PROGRESS_RECORD(&(globals->progress), current_record->re_size);
+	if (globals->estimating)
+	{
+		estimate_record(&(globals->estimate), level,
+						current_record->re_size);
+	}
+	
+	// Hand regular files to the hasher pool; the hash shows up in the
+	// record by the time the walk is over.
+	if (globals->hashWhat && current_record->re_type == 'F')
+	{
+		hasher_submit(&(globals->hasher), current_record);
+	}
+	
+	// Out of room, or time for a checkpoint?  Sort what we have out to
+	// disk.  The hashes have to be in first, since the records are
+	// written out as they are.
+	if ((globals->memLimit &&
+		 extsort_account(&(globals->extsort), current_record)) ||
+		(globals->checkpointInterval && 
+		 journal_due(&(globals->journal))))
+	{
+		if (globals->hashWhat)
+		{
+			hasher_wait(&(globals->hasher));
+		}
+		if (globals->checkpointInterval)
+		{
+			if (journal_checkpoint(&(globals->journal), &(globals->extsort),
+								   &(globals->snap)) == -1)
+			{
+				exit(1);
+			}
+			LogV("Checkpointed %lld records\n",
+				 globals->extsort.records_spilled);
+		}
+		else if (extsort_spill(&(globals->extsort), 
+							   &(globals->snap)) == -1)
+		{
+			exit(1);
+		}
+		LogV("Sorted %lld records out to %d run%s\n",
+			 globals->extsort.records_spilled, globals->extsort.run_count,
+			 (globals->extsort.run_count != 1) ? "s" : "");
+	}
 	
-	end_time = time(0);
+	LogMV("Visiting: %s\n", p->fts_path);
 	
-	OutPut(false, "Scanned %d files in %ld seconds "
-		   "for an effective rate of %.1f files/s\n", 
-		   filesVisited, end_time - start_time,
-		   (float)filesVisited / ((float)end_time - (float)start_time));
+	return stream;
+}
+
+// Reads a big directory an entry at a time.  Its subdirectories get walks
+// of their own (unless they're on another disk, and we're not crossing
+// disks), so only this directory's read is streamed.
+static void stream_directory(FTSENT *dir, int level)
+{
+	dirstream_t stream;
+	uint64_t start, paused;
+	FTSENT *p;
 	
-	return 0;
+	start = globals->profiling ? monotonic_ns() : 0;
+	
+	if (open_dirstream(&stream, dir, globals->latency) == -1)
+	{
+		globals->walkErrors++;
+		return;
+	}
+	
+	LogV("Streaming %s (%lld bytes of directory)\n", dir->fts_path,
+		 (long long) dir->fts_statp->st_size);
+	globals->dirsStreamed++;
+	
+	while ((p = dirstream_next(&stream)) != NULL)
+	{
+		if (p->fts_info == FTS_D &&
+			!((globals->fts_options & FTS_XDEV) &&
+			  p->fts_statp->st_dev != dir->fts_statp->st_dev))
+		{
+			// Its walk is timed on its own, so leave it out of this
+			// directory's time.
+			paused = globals->profiling ? monotonic_ns() : 0;
+			walk_tree(p->fts_path, level + 1, dir);
+			if (globals->profiling)
+			{
+				start += monotonic_ns() - paused;
+			}
+			continue;
+		}
+		
+		visit_entry(NULL, p, level + 1, dir);
+		release_scope(p);
+		
+		if (globals->profiling)
+		{
+			uint64_t now = monotonic_ns();
+			
+			dirprofile_charge(&(globals->dirProfile), level + 1, now - start);
+			start = now;
+		}
+	}
+	
+	LogMV("Streamed %lld entries of %s\n", stream.entries, dir->fts_path);
+	close_dirstream(&stream);
+	
+	// fts hands the directory back as FTS_DP (skipped or not), and it's
+	// charged for this, and left, then.
+	if (globals->profiling)
+	{
+		dirprofile_charge_dir(&(globals->dirProfile), level,
+							  monotonic_ns() - start);
+	}
+}
+
+// Keeps the walk out of a directory.  (Streamed entries are never walked
+// into, so there's nothing to do for them.)
+static void skip_children(FTS *ftsp, FTSENT *p)
+{
+	if (ftsp)
+	{
+		fts_set(ftsp, p, FTS_SKIP);
+	}
+}
+
+// Walks the tree a pass at a time, each sampling more of it than the last,
+// until one's walked all of it or the time's up.  The walks are the scan's,
+// records and all (they're thrown away after each pass), so what an entry
+// costs is what it would in the scan.
+static void estimate_scan(void)
+{
+	static const char *units[] = {"bytes", "KB", "MB", "GB", "TB", "PB",
+		NULL};
+	estimate_t *estimate = &(globals->estimate);
+	double bytes;
+	uint64_t start;
+	int pass, unit;
+
+	OutPut(false, "Estimating:\n");
+	init_estimate(estimate, ESTIMATE_BUDGET_MS,
+				  monotonic_ns() ^ ((uint64_t) getpid() << 32));
+
+	for (pass = 1; estimate_next_pass(estimate); pass++)
+	{
+		start = TRACE_START();
+		walk_tree(globals->pathToScan, FTS_ROOTLEVEL, NULL);
+		TRACE_END("estimate", NULL, start);
+		estimate_end_pass(estimate);
+
+		LogV("Pass %d: %d director%s a level, %lld entries visited in "
+			 "%.3f s, for %.0f entries%s\n", pass, estimate->target,
+			 (estimate->target != 1) ? "ies" : "y", estimate->visited,
+			 (monotonic_ns() - estimate->pass_started) / 1e9,
+			 estimate->entries, estimate->expired ? " (cut short)" : "");
+
+		empty_snap(&(globals->snap));
+	}
+
+	finish_estimate(estimate);
+
+	for (bytes = estimate->est_bytes, unit = 0;
+		 bytes >= 1024.0 && units[unit + 1]; unit++)
+	{
+		bytes /= 1024.0;
+	}
+
+	printf("Estimate for %s, from %d pass%s (%lld entries visited in "
+		   "%.1f s):\n", globals->pathToScan, pass - 1,
+		   (pass - 1 != 1) ? "es" : "", estimate->total_visited,
+		   estimate->walk_ns / 1e9);
+	if (estimate->exact)
+	{
+		printf("  (exact: the tree was small enough to walk all of)\n");
+	}
+	else if (estimate->rough)
+	{
+		printf("  (rough, and low: the time was up before a pass could "
+			   "finish)\n");
+	}
+	printf("  entries     %14.0f", estimate->est_entries);
+	if (estimate->est_error > 0)
+	{
+		printf("  (give or take %.0f%%)", 100 * estimate->est_error);
+	}
+	printf("\n");
+	printf("  records     %14.0f\n", estimate->est_records);
+	printf("  directories %14.0f\n", estimate->est_dirs);
+	printf("  bytes       %14.0f  (%.1f %s)\n", estimate->est_bytes, bytes,
+		   units[unit]);
+	printf("  walk time   %8d:%02d:%02d  (%.1f us an entry)\n",
+		   (int) estimate->est_seconds / 3600,
+		   ((int) estimate->est_seconds / 60) % 60,
+		   (int) estimate->est_seconds % 60, estimate->entry_us);
+
+	free_estimate(estimate);
+}
+
+// Gives a directory the scope loaded from its ignore file at path.
+static void adopt_scope(FTSENT *dir, ignore_scope_t *scope, const char *path)
+{
+	LogMV("Loaded ignore rules from %s\n", path);
+	globals->ignoreFilesLoaded++;
+	dir->fts_pointer = scope;
+	
+	globals->scopeMemory += scope->memory;
+	globals->scopePeakMemory = MAX(globals->scopePeakMemory,
+								   globals->scopeMemory);
+}
+
+// Frees a directory's ignore scope, if it has one of its own.
+static void release_scope(FTSENT *p)
+{
+	if (p->fts_pointer && ((ignore_scope_t *) p->fts_pointer)->owner == p)
+	{
+		globals->scopeMemory -= ((ignore_scope_t *) p->fts_pointer)->memory;
+		free_ignore_scope(p->fts_pointer);
+	}
+	p->fts_pointer = NULL;
 }
 
 static int qsort_compare(const void * left, const void * right)
@@ -629,142 +2117,543 @@ static int qsort_compare(const void * left, const void * right)
 (((*left)->member) > ((*right)->member)) ? 1 : \
 ((((*left)->member) < ((*right)->member)) ? -1 : 0)
 	
+	int result;
+	
 	switch (*(globals->sortToken)) {
 		case 's':
-			return COMPARE(left_r, right_r, re_size);
+			result = COMPARE(left_r, right_r, re_size);
 			break;
 		case 'S':
-			return COMPARE(right_r, left_r, re_size);
+			result = COMPARE(right_r, left_r, re_size);
 			break;
 		case 'a':
-			return COMPARE(left_r, right_r, re_atime);
+			result = COMPARE(left_r, right_r, re_atime);
 			break;
 		case 'A':
-			return COMPARE(right_r, left_r, re_atime);
+			result = COMPARE(right_r, left_r, re_atime);
 			break;
 		case 'm':
-			return COMPARE(left_r, right_r, re_mtime);
+			result = COMPARE(left_r, right_r, re_mtime);
 			break;
 		case 'M':
-			return COMPARE(right_r, left_r, re_mtime);
+			result = COMPARE(right_r, left_r, re_mtime);
 			break;
 		case 'c':
-			return COMPARE(left_r, right_r, re_ctime);
+			result = COMPARE(left_r, right_r, re_ctime);
 			break;
 		case 'C':
-			return COMPARE(right_r, left_r, re_ctime);
+			result = COMPARE(right_r, left_r, re_ctime);
 			break;
 		case 'i':
-			return COMPARE(left_r, right_r, re_ino);
+			result = COMPARE(left_r, right_r, re_ino);
 			break;
 		case 'I':
-			return COMPARE(right_r, left_r, re_ino);
+			result = COMPARE(right_r, left_r, re_ino);
+			break;
+		case 'd':
+			result = COMPARE(left_r, right_r, re_dev);
+			break;
+		case 'D':
+			result = COMPARE(right_r, left_r, re_dev);
 			break;
 		case 'o':
-			return COMPARE(left_r, right_r, re_uid);
+			result = COMPARE(left_r, right_r, re_uid);
 			break;
 		case 'O':
-			return COMPARE(right_r, left_r, re_uid);
+			result = COMPARE(right_r, left_r, re_uid);
 			break;
 		case 'g':
-			return COMPARE(left_r, right_r, re_gid);
+			result = COMPARE(left_r, right_r, re_gid);
 			break;
 		case 'G':
-			return COMPARE(right_r, left_r, re_gid);
+			result = COMPARE(right_r, left_r, re_gid);
+			break;
+		case 'p':
+		case 'P':
+			result = walk_compare((*left_r)->re_path, (*right_r)->re_path);
 			break;
 		default:
-			return 0; // Could be conceivably reached....
+			result = 0; // Could be conceivably reached....
 			break;
 	}
-	return 0; // Shouldn't be reached.
+	
+	// Ties go in path order, so the order doesn't depend on where the
+	// records were split into runs.
+	if (result == 0)
+	{
+		result = pathcmp((*left_r)->re_path, (*right_r)->re_path);
+	}
+	
+	return result;
 }
 #undef COMPARE
 
-
-// Path to add to array of ignored paths.
-Boolean add_to_ignore_array(const char *path)
+static int fts_compare(const FTSENT **left, const FTSENT **right)
 {
-	// Create and initialize our new record.
-	struct ignore_record_t *newRecord;
-	CREATE(newRecord, sizeof(struct ignore_record_t));
+	int result = strcmp((*left)->fts_name, (*right)->fts_name);
 	
-	newRecord->ig_path = strdup(path);
-	newRecord->ig_len = strlen(path);
+	return (globals->sortToken && *(globals->sortToken) == 'P') ? 
+		-result : result;
+}
+
+// The first component the two differ in decides it, in the order
+// fts_compare() puts them.  (Unless one is inside the other, which comes
+// second either way.)
+static int walk_compare(const char *left, const char *right)
+{
+	int result = pathcmp(left, right);
 	
-	// Grow the array, if necessary.
-	if (globals->currentIgnoreSize >= globals->currentIgnoreCapacity)
+	if (globals->sortToken && *(globals->sortToken) == 'P' &&
+		!path_is_under(left, right) && !path_is_under(right, left))
 	{
-		LogMV("Growing Ignore array from %d to %d\n",
-			  globals->currentIgnoreCapacity,
-			  globals->currentIgnoreCapacity + 5);
-		
-		RECREATE(globals->ignore_array,
-				 (globals->currentIgnoreCapacity + 5) * 
-				 sizeof(struct ignore_record_t *));
-		
-		// Keep track of our capacity
-		globals->currentIgnoreCapacity += 5;
+		result = -result;
 	}
 	
-	// Assign.
-	globals->ignore_array[globals->currentIgnoreSize] = newRecord;
+	return result;
+}
+
+static int walked_before(const char *path, const char *frontier)
+{
+	return (walk_compare(path, frontier) < 0);
+}
+
+static int walk_gives_order(void)
+{
+	return (globals->sortToken && (*globals->sortToken == 'p' ||
+								   *globals->sortToken == 'P') &&
+			!globals->streamDirs);
+}
+
+// Everything a resumed scan has to agree with the journal on, for the
+// runs already written to still fit: what's scanned, which records there
+// are (so the ignore and mount rules, too), how they're printed and in what
+// order.
+static unsigned long long scan_options_hash(void)
+{
+	char options[PATH_MAX * 2];
+	uint64_t hash;
+	int kind;
+	
+	snprintf(options, sizeof(options), "%s\n%s\n%s\n%s\n%s\n%s\n%d\n%d/%d/%d\n"
+			 "%d\n%d\n%d\n%s",
+			 globals->pathToScan, globals->snap.column_string,
+			 globals->snap.field_delimiter, globals->snap.record_delimiter,
+			 globals->sortToken ? globals->sortToken : "",
+			 globals->whereExpression ? globals->whereExpression : "",
+			 globals->fts_options, globals->shardIndex, globals->shardCount,
+			 globals->shardDepth, globals->skipDirs, 
+			 globals->snap.hash_algorithm, globals->snap.fingerprint_blocks,
+			 globals->ignoreFileName ? globals->ignoreFileName : "");
 	
-	// Keep track of our size.
-	globals->currentIgnoreSize++;
+	hash = xxh64(options, strlen(options), 0);
+	hash = hash_rules(globals->ignoreRules, globals->ignoreRuleCount, hash);
+	for (kind = MOUNT_EXCLUDE_FSTYPE; kind <= MOUNT_INCLUDE_POINT; kind++)
+	{
+		hash = hash_rules(globals->mounts.rules[kind],
+						  globals->mounts.rule_counts[kind], hash);
+	}
 	
-	// Return successful.
-	return true;
+	return (unsigned long long) hash;
 }
 
-// Returns true if the path should be ignored (and children skipped), false
-// otherwise.
-Boolean should_be_ignored(const char *path, size_t pathlen, 
-						  const char *name, size_t namelen)
+static uint64_t hash_rules(char **rules, int count, uint64_t seed)
 {
-	// Iterate through our ignore_array.  If the first character is a '/', then
-	// we check against the (absolute) path.  Otherwise, we only check against
-	// the name.
-	int i;
-	for (i = 0; i < globals->currentIgnoreSize; i++) {
-		if (globals->ignore_array[i]->ig_path[0] == '/')
+	char **sorted = NULL;
+	int i, unique = 0;
+	
+	if (count > 0)
+	{
+		CREATE(sorted, count * sizeof(char *));
+		memcpy(sorted, rules, count * sizeof(char *));
+		qsort(sorted, count, sizeof(char *), compare_strings);
+	}
+	
+	// Each rule with its NUL, so they can't run together, and how many
+	// there were first, so one set can't run into the next.
+	for (i = 0; i < count; i++)
+	{
+		if (i == 0 || strcmp(sorted[i], sorted[i - 1]) != 0)
 		{
-			if (!strncmp(path, globals->ignore_array[i]->ig_path,
-						 MAX(pathlen, globals->ignore_array[i]->ig_len)))
-			{
-				return true;
-			}
+			sorted[unique++] = sorted[i];
 		}
-		else
+	}
+	seed = xxh64(&unique, sizeof(unique), seed);
+	for (i = 0; i < unique; i++)
+	{
+		seed = xxh64(sorted[i], strlen(sorted[i]) + 1, seed);
+	}
+	
+	if (sorted)
+		free(sorted);
+	
+	return seed;
+}
+
+static int compare_strings(const void *left, const void *right)
+{
+	return strcmp(*(char * const *) left, *(char * const *) right);
+}
+
+static void add_ignore_rule(const char *rule)
+{
+	if (ignore_add(&(globals->ignores), rule) == -1)
+	{
+		return;
+	}
+	
+	if (globals->ignoreRules)
+	{
+		RECREATE(globals->ignoreRules,
+				 (globals->ignoreRuleCount + 1) * sizeof(char *));
+	}
+	else
+	{
+		CREATE(globals->ignoreRules, sizeof(char *));
+	}
+	globals->ignoreRules[globals->ignoreRuleCount++] = strdup(rule);
+}
+
+static void free_ignore_rules(void)
+{
+	int i;
+	
+	for (i = 0; i < globals->ignoreRuleCount; i++)
+	{
+		free(globals->ignoreRules[i]);
+	}
+	if (globals->ignoreRules)
+		free(globals->ignoreRules);
+	globals->ignoreRules = NULL;
+	globals->ignoreRuleCount = 0;
+}
+
+static void set_stats_counters(long long records)
+{
+	stats_t *stats = &(globals->stats);
+	
+	stats_set(stats, "files_visited", "Entries the walk visited.",
+			  globals->filesVisited);
+	stats_set(stats, "directories", "Directories the walk visited.",
+			  globals->dirsVisited);
+	stats_set(stats, "stat_calls", "Entries stat()ed.", globals->statCalls);
+	stats_set(stats, "ignored", "Entries on the ignore lists (and not "
+			  "descended into).", globals->filesIgnored);
+	stats_set(stats, "skipped", "Entries not recorded: ignored, on excluded "
+			  "mounts, or directories with -D.", globals->filesSkipped);
+	stats_set(stats, "filtered", "Entries the --where filter left out.",
+			  globals->filesFiltered);
+	stats_set(stats, "sharded", "Entries left to other shards.",
+			  globals->filesSharded);
+	stats_set(stats, "errors", "Entries that couldn't be read or stat()ed.",
+			  globals->walkErrors);
+	stats_set(stats, "dirs_streamed", "Big directories read with "
+			  "--stream-dirs.", globals->dirsStreamed);
+	stats_set(stats, "records", "Records in the snapshot.", records);
+	stats_set(stats, "bytes_written", "Bytes of snapshot written.",
+			  globals->snap.bytes_written);
+	stats_set(stats, "files_hashed", "Files whose contents were hashed.",
+			  globals->hasher.files_hashed);
+	stats_set(stats, "bytes_hashed", "Bytes read to hash them.",
+			  globals->hasher.bytes_hashed);
+	stats_set(stats, "sort_runs", "Runs sorted out to disk.",
+			  globals->extsort.run_count);
+	
+	// The snap is about to be freed, so what it holds is noted now.
+	globals->memory = globals->snap.memory;
+	globals->ignoreMemory = ignore_memory(&(globals->ignores));
+	
+	stats_set(stats, "memory_peak_bytes", "Most bytes of records (with "
+			  "their paths and time strings) and the array of them held.",
+			  globals->memory.peak);
+	stats_set(stats, "memory_peak_records", "Records held at the peak.",
+			  globals->memory.peak_records);
+	stats_set(stats, "memory_bytes_per_record", "Bytes per record at the "
+			  "peak.", globals->memory.peak_records ?
+			  globals->memory.peak / globals->memory.peak_records : 0);
+	stats_set(stats, "memory_record_bytes", "Bytes of records held at the "
+			  "end.", globals->memory.records);
+	stats_set(stats, "memory_path_bytes", "Bytes of their paths.",
+			  globals->memory.paths);
+	stats_set(stats, "memory_time_string_bytes", "Bytes of their time "
+			  "strings.", globals->memory.time_strings);
+	stats_set(stats, "memory_array_bytes", "Bytes of the array of them.",
+			  globals->memory.spine);
+	stats_set(stats, "memory_ignore_bytes", "Bytes of ignore rules given "
+			  "with -i or in the config file.", globals->ignoreMemory);
+	stats_set(stats, "memory_ignore_file_peak_bytes", "Most bytes of rules "
+			  "from ignore files held at once.", globals->scopePeakMemory);
+}
+
+static void report_stats(void)
+{
+	stats_t *stats = &(globals->stats);
+	int i;
+	
+	LogV("\nTook %.3f seconds:\n", stats_elapsed(stats));
+	for (i = 0; i < stats->phase_count; i++)
+	{
+		LogV("  %-8s %10.3f s\n", stats->phases[i].name,
+			 stats->phases[i].ns / 1e9);
+	}
+	if (stats_phase_seconds(stats, "walk") > 0)
+	{
+		LogV("Walked %.1f files/s\n", globals->filesVisited / 
+			 stats_phase_seconds(stats, "walk"));
+	}
+	
+	if (globals->profiling)
+	{
+		report_slow_dirs();
+	}
+	
+	if (globals->latency)
+	{
+		report_latency();
+	}
+	
+	report_memory();
+	
+	if (globals->statsFile)
+	{
+		stats_write(stats, globals->statsFile, globals->statsFormat);
+		free(globals->statsFile);
+		globals->statsFile = NULL;
+	}
+}
+
+static void report_latency(void)
+{
+	struct stats_latency_t summary;
+	int op;
+	
+	LogV("\nCall latency (us):    calls       mean        p50        p90"
+		 "        p99      p99.9        max\n");
+	for (op = 0; op < LATENCY_OPS; op++)
+	{
+		if (globals->latency->ops[op].count == 0)
 		{
-			if (!strncmp(name, globals->ignore_array[i]->ig_path, 
-						 MAX(namelen, globals->ignore_array[i]->ig_len)))
-			{
-				return true;
-			}
+			continue;
 		}
+		
+		latency_summarize(&(globals->latency->ops[op]), latency_op_name(op),
+						  &summary);
+		stats_latency(&(globals->stats), &summary);
+		
+		LogV("  %-12s %12lld %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			 summary.name, summary.count,
+			 summary.sum / 1e3 / summary.count, summary.p50 / 1e3,
+			 summary.p90 / 1e3, summary.p99 / 1e3, summary.p999 / 1e3,
+			 summary.max / 1e3);
 	}
-	return false;
 }
 
-// Deallocs all the allocated memory used in the ignore_array
-void free_ignore_array()
+static void profile_entry(FTSENT *p, int level, uint64_t ns)
 {
-	// Walk through the ignore_array and free everything we strdup'ed, then
-	// free the array.
-	int i;
-	for (i = 0; i < globals->currentIgnoreSize; i++) {
-		free(globals->ignore_array[i]->ig_path);
+	switch (p->fts_info) {
+		case FTS_D:
+			dirprofile_enter(&(globals->dirProfile), level, ns);
+			break;
+		case FTS_DP:
+			dirprofile_leave(&(globals->dirProfile), level, p->fts_path, ns);
+			break;
+		default:
+			dirprofile_charge(&(globals->dirProfile), level, ns);
+			break;
+	}
+}
+
+static void report_memory(void)
+{
+	struct snap_memory_t *memory = &(globals->memory);
+	
+	LogV("\nMemory (bytes):\n");
+	LogV("  peak           %12lld  (%d record%s, %.1f each)\n", memory->peak,
+		 memory->peak_records, (memory->peak_records != 1) ? "s" : "",
+		 memory->peak_records ?
+		 (double) memory->peak / memory->peak_records : 0.0);
+	LogV("  at the end     %12lld\n", memory->total);
+	LogV("    records      %12lld\n", memory->records);
+	LogV("    paths        %12lld\n", memory->paths);
+	LogV("    time strings %12lld\n", memory->time_strings);
+	LogV("    array        %12lld\n", memory->spine);
+	LogV("  ignore rules   %12lld\n", globals->ignoreMemory);
+	if (globals->ignoreFileName)
+	{
+		LogV("  ignore files   %12lld  (at most)\n",
+			 globals->scopePeakMemory);
+	}
+}
+
+static void report_slow_dirs(void)
+{
+	dirprofile_t *profile = &(globals->dirProfile);
+	struct dirprofile_dir_t *dir;
+	int i, count = dirprofile_sort(profile);
+	
+	LogV("\nSlowest director%s:    seconds    entries   us/entry  path\n",
+		 (count != 1) ? "ies" : "y");
+	for (i = 0; i < count; i++)
+	{
+		dir = &(profile->heap[i]);
+		LogV("  %20.3f %10lld %10.1f  %s\n", dir->ns / 1e9, dir->entries,
+			 dir->entries ? dir->ns / 1e3 / dir->entries : 0.0, dir->path);
+	}
+	
+	free_dirprofile(profile);
+	globals->profiling = false;
+}
+
+static int parse_stats_format(const char *name)
+{
+	if (strcasecmp(name, "json") == 0)
+	{
+		return STATS_JSON;
+	}
+	if (strcasecmp(name, "prometheus") == 0 || strcasecmp(name, "prom") == 0)
+	{
+		return STATS_PROMETHEUS;
 	}
 	
-	free(globals->ignore_array);
-	globals->ignore_array = NULL;
+	return -1;
+}
+
+static int parse_shard(const char *str)
+{
+	int index, count;
+	char extra;
+	
+	if (sscanf(str, "%d/%d%c", &index, &count, &extra) != 2 ||
+		count < 1 || index < 0 || index >= count)
+	{
+		return -1;
+	}
+	
+	globals->shardIndex = index;
+	globals->shardCount = count;
+	
+	return 0;
+}
+
+// The hash is of the path from the scan path down, so the same tree shards
+// the same way wherever it's mounted.
+static int shard_of(FTSENT *p)
+{
+	const char *relative = p->fts_path + globals->pathToScanLen;
+	
+	while (*relative == '/')
+	{
+		relative++;
+	}
+	
+	return (int)(xxh64(relative, strlen(relative), 0) % 
+				 (uint64_t) globals->shardCount);
+}
+
+static long long parse_size(const char *str)
+{
+	long long size;
+	char *end;
+	
+	size = strtoll(str, &end, 10);
+	if (end == str || size < 0)
+	{
+		return -1;
+	}
+	
+	switch (toupper((unsigned char) *end))
+	{
+		case 'T': size *= 1024ll;	/* FALLTHROUGH */
+		case 'G': size *= 1024ll;	/* FALLTHROUGH */
+		case 'M': size *= 1024ll;	/* FALLTHROUGH */
+		case 'K': size *= 1024ll; end++; break;
+		default: break;
+	}
+	if (toupper((unsigned char) *end) == 'B')
+	{
+		end++;
+	}
+	
+	return (*end == '\0') ? size : -1;
+}
+
+
+// Looks for an ignore file among a directory's children, and if there is
+// one, gives the directory a scope with its rules.  fts_children() reads the
+// directory listing that fts_read() would have read next anyway (and
+// reuses it), so a directory without an ignore file costs nothing extra.
+// Without an fts (for a directory that's streamed, or was), it's looked
+// for by name instead.
+void load_ignore_file(FTS *ftsp, FTSENT *dir)
+{
+	ignore_scope_t *scope;
+	FTSENT *child;
+	char path[PATH_MAX];
+	struct stat st;
+	uint64_t start = LATENCY_START(globals->latency);
+	int found;
+	
+	if (ftsp == NULL)
+	{
+		snprintf(path, PATH_MAX, "%.*s%s%s", (int) dir->fts_pathlen,
+				 dir->fts_path,
+				 (dir->fts_pathlen > 0 &&
+				  dir->fts_path[dir->fts_pathlen - 1] == '/') ? "" : "/",
+				 globals->ignoreFileName);
+		
+		found = (lstat(path, &st) == 0);
+		LATENCY_END(globals->latency, LATENCY_STAT, start);
+		
+		if (found && S_ISREG(st.st_mode) &&
+			(scope = load_ignore_scope(path, dir->fts_pathlen,
+									   dir->fts_pointer, dir)))
+		{
+			adopt_scope(dir, scope, path);
+		}
+		return;
+	}
+	
+	child = fts_children(ftsp, 0);
+	LATENCY_END(globals->latency, LATENCY_DIRREAD, start);
+	
+	for (; child; child = child->fts_link)
+	{
+		if (child->fts_namelen != globals->ignoreFileNameLen ||
+			memcmp(child->fts_name, globals->ignoreFileName,
+				   child->fts_namelen) != 0)
+		{
+			continue;
+		}
+		
+		if (child->fts_info != FTS_F)
+		{
+			break;
+		}
+		
+		// The children's fts_path isn't filled in until fts_read() returns
+		// them, so build the path from the directory's.
+		snprintf(path, PATH_MAX, "%.*s%s%s", (int) dir->fts_pathlen,
+				 dir->fts_path,
+				 (dir->fts_pathlen > 0 &&
+				  dir->fts_path[dir->fts_pathlen - 1] == '/') ? "" : "/",
+				 child->fts_name);
+		
+		scope = load_ignore_scope(path, dir->fts_pathlen, dir->fts_pointer,
+								  dir);
+		if (scope)
+		{
+			adopt_scope(dir, scope, path);
+		}
+		break;
+	}
 }
 
 // For our regular output.  Set quiet mode to supress
 void OutPut(Boolean is_status_update, const char *format, ...)
 {	
-	char backspace_buffer[50], final_format[1024];
- 	int printed = 0, i = 0;
+	char backspace_buffer[PROGRESS_LINE_SIZE + 1], final_format[1024];
+	char buffer[LOG_SLOT_SIZE];
+	char *text = buffer;
+ 	int printed = 0, i = 0, dropped;
 	
 	// If quiet mode, we don't print anything.
 	if (globals->quietMode) {
@@ -776,7 +2665,8 @@ void OutPut(Boolean is_status_update, const char *format, ...)
 	{
 		// Construct a null-terminated string of backspaces to remove our
 		// last OutPut:
-		for (i = 0; i < globals->OutPut_printed && i < 50; i++)
+		for (i = 0; i < globals->OutPut_printed &&
+			 i < sizeof(backspace_buffer) - 1; i++)
 		{
 			backspace_buffer[i] = '\b';
 		}
@@ -792,8 +2682,29 @@ void OutPut(Boolean is_status_update, const char *format, ...)
 	
 	va_list ap;
     va_start(ap, format);
-    printed = vfprintf(stderr, final_format, ap);
+    printed = vsnprintf(buffer, sizeof(buffer), final_format, ap);
     va_end(ap);
+	if (printed >= (int) sizeof(buffer))
+	{
+		// Too big for the buffer (the usage statement, say).
+		CREATE(text, printed + 1);
+		va_start(ap, format);
+		vsnprintf(text, printed + 1, final_format, ap);
+		va_end(ap);
+	}
+	
+	// Status updates come often enough that one can be dropped, if the log
+	// is falling behind.
+	dropped = (printed > 0 && LogText(text, printed, is_status_update) < 0);
+	if (text != buffer)
+	{
+		free(text);
+	}
+	if (dropped)
+	{
+		// What's on screen is what was there before.
+		return;
+	}
 	
 	// If this is a status update, keep track of how much we printed, so we can
 	// overwrite it next time we have a status update.
@@ -807,6 +2718,11 @@ void OutPut(Boolean is_status_update, const char *format, ...)
 	}
 }
 
+static void report_progress(const char *line)
+{
+	OutPut(true, "%s", line);
+}
+
 void usage(void)
 {
 	OutPut(false, "%s v%s, %s2008 ACS, Inc.\n", PROGNAME, VERSION, "©");
@@ -825,12 +2741,20 @@ void usage(void)
 "		  last path component) of scanned files.\n"
 "		o If the matched (ignored) file is a folder, any children will also\n"
 "		  be ignored.\n"
+"		o Wildcards are supported: * and ? (not matching '/'), [...]\n"
+"		  classes, and ** for any number of directories.  A string with a\n"
+"		  '/' that doesn't begin with one matches at any depth.\n"
 "		o You can specify as many of these as you like.\n"
 "		EXAMPLES:\n"
 "		-i /dev	# This will ignore ONLY /dev, but not a folder such as\n"
 "					# /Users/dev or /Applications/develeper_tool.\n"
 "		-i .svn	# This will ignore any files or folders named .svn, but\n"
 "					# only if they're named EXACTLY .svn\n"
+"		-i '*.o'	# This will ignore any files or folders ending in .o\n"
+"	-I Name of per-directory ignore files (e.g. .snapperignore).  A\n"
+"	   directory with a file of that name has its rules (one per line, as\n"
+"	   for -i) applied to everything under it.  A leading '/' in them\n"
+"	   means the top of that directory.  Off unless given.\n"
 "	-p Path to scan (\"/\" is used if none is provided).\n"
 "	-a Scan accross devices (ie, external HDs, server volumes, etc)\n"
 "	-H Print headers for the columns\n"
@@ -852,6 +2776,7 @@ void usage(void)
 "		- C/c	The time of last status change\n"
 "		- S/s	The size of the file (in bytes or KB/MB/GB)\n"
 "		- i	The files inode\n"
+"		- d	The file's device (st_dev)\n"
 "		- o	The file's owner (UID)\n"
 "		- g	The file's group (GID)\n"
 "		- P	The file's permissions (octal format)\n"
@@ -864,14 +2789,92 @@ void usage(void)
 "				C - Character special\n"
 "				F - Regular file\n"
 "				X - Something unexpected this way comes.\n"
+"		- h	A hash of the file's contents (regular files only)\n"
+"		- f	A fingerprint of the file's contents (size, head, tail and\n"
+"			evenly spaced blocks; much cheaper than h for big files)\n"
+"		- r	The tree hash (rollup of the entry and, for directories,\n"
+"			everything in them; used by snapdiff to skip subtrees)\n"
 "	-s Sort token, takes one of the column codes above to sort by (just the\n"
 "	   character, not the preceding '%') (defaults to default FTS sorting,\n"
 "	   which is path based).  Capital case is descending and lower case is\n"
 "	   ascending.  (Big letter signifies big values first, and vise versa.)\n"
+"	   p sorts each directory by name as it's walked, so the output is\n"
+"	   in path order (as snapdiff and snapmerge expect) at no extra cost.\n"
 "	-f Field delimiter, one or more characters (defaults to \\t)\n"
 "	-r Record delimiter, one or more characters (defaults to \\n)\n"
 "	-C Path to configuration file.  Options configured in configuration file\n"
 "	   override anything specified in arguments.  But items specified in\n"
 "	   arguments and not in the configuration file are still honored.\n"
+"	--hash-algorithm\n"
+"	   Algorithm for the %h column: xxh64 (fast, the default) or sha256.\n"
+"	--hash-threads\n"
+"	   Number of reader/hasher threads (defaults to the number of CPUs).\n"
+"	--hash-cache\n"
+"	   Path to a persistent hash cache.  Files whose device, inode, size,\n"
+"	   mtime and ctime match the cache aren't read again.\n"
+"	--fingerprint-blocks\n"
+"	   Number of blocks sampled between the head and tail for the %f\n"
+"	   column, up to 127 (defaults to 16).\n"
+"	--exclude-fstype, --include-fstype\n"
+"	   With -a, don't (or do) descend into mounts of this filesystem\n"
+"	   type.  Pseudo (proc, sysfs, ...), overlay and remote (nfs, cifs,\n"
+"	   ...) filesystems are excluded by default.\n"
+"	--exclude-mount, --include-mount\n"
+"	   With -a, don't (or do) descend into the filesystem mounted here.\n"
+"	   Beats the filesystem type rules.\n"
+"	--where\n"
+"	   Only record files matching a filter expression, such as\n"
+"	   'size>100M && mtime>-1d && type==F'.  Fields are size, mtime,\n"
+"	   atime, ctime, type, owner, group, perm, inode, dev and name.\n"
+"	   Directories are still descended into either way.\n"
+"	--mem-limit\n"
+"	   Most memory to hold records in (with a K, M or G suffix).  Past\n"
+"	   it, records are sorted into runs in the temp directory, and\n"
+"	   merged into the output at the end.  Unlimited unless given.\n"
+"	--temp-dir\n"
+"	   Where --mem-limit's runs go (defaults to $TMPDIR, or /tmp).\n"
+"	--shard i/N\n"
+"	   Only scan shard i (counting from 0) of N.  Entries shard-depth\n"
+"	   levels below the scan path are dealt out by a hash of their\n"
+"	   path from there; shard 0 also gets everything above them.  The\n"
+"	   shards' snapshots (with -s p) snapmerge into a full one.\n"
+"	--shard-depth\n"
+"	   Level the tree is split at: 1 for the scan path's entries (the\n"
+"	   default), 2 for theirs, and so on.\n"
+"	--checkpoint\n"
+"	   Seconds between checkpoints (defaults to 300 with --resume).\n"
+"	   Records are written to a journal next to the output file as the\n"
+"	   scan goes, so it can be resumed if it dies.  Needs -o.\n"
+"	--resume\n"
+"	   Pick up from the journal's last checkpoint, if there is one.\n"
+"	--stream-dirs\n"
+"	   Directories at least this big (their own size, as stat gives it,\n"
+"	   with a K, M or G suffix) are read an entry at a time instead of\n"
+"	   all at once by fts.  Their entries are sorted with the rest of\n"
+"	   the records, so -s p still works.  Off unless given.\n"
+"	--stats-file\n"
+"	   Write how long each phase took, and what the walk counted, to\n"
+"	   this file at the end (replacing it all at once).\n"
+"	--stats-format\n"
+"	   json (the default) or prometheus, for node_exporter's textfile\n"
+"	   collector.\n"
+"	--latency\n"
+"	   Time the walk's filesystem calls (and the hashers' opens and\n"
+"	   reads) into histograms, for -v and the stats report.\n"
+"	--slow-dirs\n"
+"	   How many of the directories the walk spent the most time in\n"
+"	   -v lists at the end (defaults to 10; 0 for none).\n"
+"	--trace\n"
+"	   Write a timeline of what each thread did (directories walked,\n"
+"	   files hashed, sorting, formatting and writing) to this file, in\n"
+"	   Chrome's trace-event format, for Perfetto or chrome://tracing.\n"
+"	--previous\n"
+"	   An earlier snapshot of the same tree.  Its size is taken as what\n"
+"	   this scan will come to, so the progress reports can say how far\n"
+"	   along it is and how long is left.\n"
+"	--estimate\n"
+"	   Instead of a snapshot, print an estimate of what one would come\n"
+"	   to and how long its walk would take, from a random sample of\n"
+"	   the directories at each level, in a few seconds.\n"
 		   );
 }
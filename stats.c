@@ -0,0 +1,316 @@
+/*
+ *  stats.c
+ *  snapper
+ *
+ *  Run statistics.  See stats.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "comm.h"
+#include "stats.h"
+
+#pragma mark Local Prototypes
+static int find_phase(stats_t *stats, const char *name, int add);
+static void write_json(stats_t *stats, FILE *file);
+static void write_prometheus(stats_t *stats, FILE *file);
+
+#pragma mark Function Implementations
+uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+void init_stats(stats_t *stats)
+{
+	memset(stats, 0, sizeof(stats_t));
+
+	stats->started_at = time(0);
+	stats->started = monotonic_ns();
+	stats->current = -1;
+}
+
+void stats_phase(stats_t *stats, const char *name)
+{
+	uint64_t now = monotonic_ns();
+
+	if (stats->current >= 0)
+	{
+		stats->phases[stats->current].ns += now - stats->mark;
+	}
+
+	stats->current = find_phase(stats, name, 1);
+	stats->mark = now;
+}
+
+void stats_move(stats_t *stats, const char *from, const char *to,
+				uint64_t ns)
+{
+	int source = find_phase(stats, from, 1), dest = find_phase(stats, to, 1);
+
+	if (source < 0 || dest < 0)
+	{
+		return;
+	}
+
+	if (ns > stats->phases[source].ns)
+	{
+		ns = stats->phases[source].ns;
+	}
+	stats->phases[source].ns -= ns;
+	stats->phases[dest].ns += ns;
+}
+
+void stats_set(stats_t *stats, const char *name, const char *help,
+			   long long value)
+{
+	int i;
+
+	for (i = 0; i < stats->counter_count; i++)
+	{
+		if (strcmp(stats->counters[i].name, name) == 0)
+		{
+			stats->counters[i].value = value;
+			return;
+		}
+	}
+
+	if (stats->counter_count == STATS_MAX_COUNTERS)
+	{
+		LogError("Too many stats counters; dropping %s\n", name);
+		return;
+	}
+
+	stats->counters[i].name = name;
+	stats->counters[i].help = help;
+	stats->counters[i].value = value;
+	stats->counter_count++;
+}
+
+void stats_latency(stats_t *stats, const struct stats_latency_t *latency)
+{
+	int i;
+
+	for (i = 0; i < stats->latency_count; i++)
+	{
+		if (strcmp(stats->latencies[i].name, latency->name) == 0)
+		{
+			break;
+		}
+	}
+
+	if (i == STATS_MAX_LATENCIES)
+	{
+		LogError("Too many stats latencies; dropping %s\n", latency->name);
+		return;
+	}
+
+	stats->latencies[i] = *latency;
+	if (i == stats->latency_count)
+	{
+		stats->latency_count++;
+	}
+}
+
+void stats_finish(stats_t *stats)
+{
+	stats->finished = monotonic_ns();
+
+	if (stats->current >= 0)
+	{
+		stats->phases[stats->current].ns += stats->finished - stats->mark;
+		stats->current = -1;
+	}
+}
+
+double stats_elapsed(stats_t *stats)
+{
+	uint64_t end = stats->finished ? stats->finished : monotonic_ns();
+
+	return (end - stats->started) / 1e9;
+}
+
+double stats_phase_seconds(stats_t *stats, const char *name)
+{
+	int phase = find_phase(stats, name, 0);
+
+	return (phase < 0) ? 0.0 : stats->phases[phase].ns / 1e9;
+}
+
+int stats_write(stats_t *stats, const char *path, int format)
+{
+	char tmp_path[PATH_MAX];
+	FILE *file;
+
+	snprintf(tmp_path, PATH_MAX, "%s.tmp.%ld", path, (long) getpid());
+
+	if ((file = fopen(tmp_path, "w")) == NULL)
+	{
+		LogError("Couldn't write stats to %s: %s\n", tmp_path,
+				 strerror(errno));
+		return -1;
+	}
+
+	if (format == STATS_PROMETHEUS)
+	{
+		write_prometheus(stats, file);
+	}
+	else
+	{
+		write_json(stats, file);
+	}
+
+	if (ferror(file) || fclose(file) == EOF)
+	{
+		LogError("Couldn't write stats to %s: %s\n", tmp_path,
+				 strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+
+	if (rename(tmp_path, path) == -1)
+	{
+		LogError("Couldn't replace stats file %s: %s\n", path,
+				 strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+#pragma mark Local Functions
+// Finds a phase by name, adding it if add is set and there's room.
+static int find_phase(stats_t *stats, const char *name, int add)
+{
+	int i;
+
+	for (i = 0; i < stats->phase_count; i++)
+	{
+		if (strcmp(stats->phases[i].name, name) == 0)
+		{
+			return i;
+		}
+	}
+
+	if (!add || stats->phase_count == STATS_MAX_PHASES)
+	{
+		return -1;
+	}
+
+	stats->phases[i].name = name;
+	stats->phases[i].ns = 0;
+	stats->phase_count++;
+
+	return i;
+}
+
+static void write_json(stats_t *stats, FILE *file)
+{
+	struct stats_latency_t *latency;
+	int i;
+
+	fprintf(file, "{\n  \"start_time\": %ld,\n  \"elapsed_seconds\": %.9f,\n"
+			"  \"phases\": {", (long) stats->started_at,
+			stats_elapsed(stats));
+	for (i = 0; i < stats->phase_count; i++)
+	{
+		fprintf(file, "%s\n    \"%s\": %.9f", i ? "," : "",
+				stats->phases[i].name, stats->phases[i].ns / 1e9);
+	}
+
+	fprintf(file, "\n  },\n  \"counters\": {");
+	for (i = 0; i < stats->counter_count; i++)
+	{
+		fprintf(file, "%s\n    \"%s\": %lld", i ? "," : "",
+				stats->counters[i].name, stats->counters[i].value);
+	}
+
+	fprintf(file, "\n  },\n  \"latency_seconds\": {");
+	for (i = 0; i < stats->latency_count; i++)
+	{
+		latency = &(stats->latencies[i]);
+		fprintf(file, "%s\n    \"%s\": {\"count\": %lld, \"sum\": %.9f, "
+				"\"min\": %.9f, \"p50\": %.9f, \"p90\": %.9f, "
+				"\"p99\": %.9f, \"p999\": %.9f, \"max\": %.9f}",
+				i ? "," : "", latency->name, latency->count,
+				latency->sum / 1e9, latency->min / 1e9, latency->p50 / 1e9,
+				latency->p90 / 1e9, latency->p99 / 1e9, latency->p999 / 1e9,
+				latency->max / 1e9);
+	}
+	fprintf(file, "\n  }\n}\n");
+}
+
+static void write_prometheus(stats_t *stats, FILE *file)
+{
+	struct stats_latency_t *latency;
+	int i;
+
+	fprintf(file, "# HELP snapper_last_run_timestamp_seconds When the last "
+			"run started.\n# TYPE snapper_last_run_timestamp_seconds gauge\n"
+			"snapper_last_run_timestamp_seconds %ld\n",
+			(long) stats->started_at);
+	fprintf(file, "# HELP snapper_elapsed_seconds How long the last run "
+			"took.\n# TYPE snapper_elapsed_seconds gauge\n"
+			"snapper_elapsed_seconds %.9f\n", stats_elapsed(stats));
+
+	fprintf(file, "# HELP snapper_phase_seconds Time the last run spent in "
+			"each phase.\n# TYPE snapper_phase_seconds gauge\n");
+	for (i = 0; i < stats->phase_count; i++)
+	{
+		fprintf(file, "snapper_phase_seconds{phase=\"%s\"} %.9f\n",
+				stats->phases[i].name, stats->phases[i].ns / 1e9);
+	}
+
+	for (i = 0; i < stats->counter_count; i++)
+	{
+		fprintf(file, "# HELP snapper_%s %s\n# TYPE snapper_%s gauge\n"
+				"snapper_%s %lld\n", stats->counters[i].name,
+				stats->counters[i].help, stats->counters[i].name,
+				stats->counters[i].name, stats->counters[i].value);
+	}
+
+	if (stats->latency_count == 0)
+	{
+		return;
+	}
+
+	fprintf(file, "# HELP snapper_call_seconds How long the last run's "
+			"filesystem calls took.\n# TYPE snapper_call_seconds summary\n");
+	for (i = 0; i < stats->latency_count; i++)
+	{
+		latency = &(stats->latencies[i]);
+		fprintf(file, "snapper_call_seconds{op=\"%s\",quantile=\"0.5\"} %.9f\n"
+				"snapper_call_seconds{op=\"%s\",quantile=\"0.9\"} %.9f\n"
+				"snapper_call_seconds{op=\"%s\",quantile=\"0.99\"} %.9f\n"
+				"snapper_call_seconds{op=\"%s\",quantile=\"0.999\"} %.9f\n"
+				"snapper_call_seconds_sum{op=\"%s\"} %.9f\n"
+				"snapper_call_seconds_count{op=\"%s\"} %lld\n",
+				latency->name, latency->p50 / 1e9,
+				latency->name, latency->p90 / 1e9,
+				latency->name, latency->p99 / 1e9,
+				latency->name, latency->p999 / 1e9,
+				latency->name, latency->sum / 1e9,
+				latency->name, latency->count);
+	}
+
+	fprintf(file, "# HELP snapper_call_max_seconds The slowest of the last "
+			"run's filesystem calls.\n"
+			"# TYPE snapper_call_max_seconds gauge\n");
+	for (i = 0; i < stats->latency_count; i++)
+	{
+		fprintf(file, "snapper_call_max_seconds{op=\"%s\"} %.9f\n",
+				stats->latencies[i].name, stats->latencies[i].max / 1e9);
+	}
+}
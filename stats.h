@@ -0,0 +1,112 @@
+/*
+ *  stats.h
+ *  snapper
+ *
+ *  Run statistics: how long each phase of a run took (on the monotonic
+ *  clock, in nanoseconds), and named counters, written out at the end as a
+ *  JSON document or a Prometheus textfile (for node_exporter's textfile
+ *  collector) for whatever scrapes them after a cron run.  The file is
+ *  replaced atomically (write, then rename), so a scrape never sees half of
+ *  one.
+ *
+ *  Phases are back to back: starting one ends the last.  Phases, counters
+ *  and latencies come out in the order they were first given.
+ *
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#pragma mark Defines
+#define STATS_MAX_PHASES	16
+#define STATS_MAX_COUNTERS	64
+#define STATS_MAX_LATENCIES	16
+
+// Report formats.
+#define STATS_JSON			0
+#define STATS_PROMETHEUS	1
+
+#pragma mark Data Types
+struct stats_phase_t {
+	const char	*name;
+	uint64_t	ns;					// Time spent in it, all told
+};
+
+struct stats_counter_t {
+	const char	*name;				// Also the metric name (after snapper_)
+	const char	*help;				// What it counts, for # HELP
+	long long	value;
+};
+
+// How long some call took, summed up (all in ns).
+struct stats_latency_t {
+	const char	*name;				// Also the metric's op label
+	long long	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	p50;
+	uint64_t	p90;
+	uint64_t	p99;
+	uint64_t	p999;
+};
+
+struct stats_t {
+	time_t		started_at;			// Wall clock, when the run started
+	uint64_t	started;			// Monotonic, when the run started
+	uint64_t	finished;			// Monotonic, when stats_finish() was called
+
+	struct stats_phase_t phases[STATS_MAX_PHASES];
+	int			phase_count;
+	int			current;			// Phase being timed, or -1
+	uint64_t	mark;				// When it (last) started
+
+	struct stats_counter_t counters[STATS_MAX_COUNTERS];
+	int			counter_count;
+
+	struct stats_latency_t latencies[STATS_MAX_LATENCIES];
+	int			latency_count;
+};
+
+typedef struct stats_t stats_t;
+
+#pragma mark Functions
+
+// Nanoseconds on a clock that only goes forward.  Only differences between
+// two readings mean anything.
+uint64_t monotonic_ns(void);
+
+// Starts the clock.
+void init_stats(stats_t *stats);
+
+// Ends the current phase (if any) and starts timing the named one.  A name
+// that's been used before adds to it.  name must outlive the stats.
+void stats_phase(stats_t *stats, const char *name);
+
+// Moves ns of one phase's time to another: for a phase (formatting, say)
+// that's measured in pieces inside another.  The phase it comes from has to
+// be over.
+void stats_move(stats_t *stats, const char *from, const char *to,
+				uint64_t ns);
+
+// Sets a counter (adding it, the first time).  name and help must outlive
+// the stats.
+void stats_set(stats_t *stats, const char *name, const char *help,
+			   long long value);
+
+// Sets a call's latency summary (adding it, the first time).  Its name must
+// outlive the stats.
+void stats_latency(stats_t *stats, const struct stats_latency_t *latency);
+
+// Ends the current phase, and stops the clock.
+void stats_finish(stats_t *stats);
+
+// Seconds from init_stats() to stats_finish() (or now, before that).
+double stats_elapsed(stats_t *stats);
+
+// Seconds spent in a phase.
+double stats_phase_seconds(stats_t *stats, const char *name);
+
+// Writes the report to path in format (STATS_*).  Returns 0, or -1 if it
+// couldn't be written.
+int stats_write(stats_t *stats, const char *path, int format);
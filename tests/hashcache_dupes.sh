@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# hashcache_dupes.sh
+# snapper
+#
+# snapdupes shares snapper's hash cache, but only looks up the files that
+# might be duplicates.  Checks that a snapdupes run keeps what snapper
+# cached for the rest, so the next snapper run still hits on every file.
+#
+# Usage:
+#		tests/hashcache_dupes.sh [directory with the programs]
+#
+
+BIN=${1:-.}
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/hashcache_dupes.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# Two pairs of duplicates, and files no other is the size of.
+mkdir -p "$TMP/tree/a" "$TMP/tree/b"
+for f in 1 2 3 4 5 6; do
+	printf "%${f}0d" $f > "$TMP/tree/a/unique$f"
+done
+echo same > "$TMP/tree/a/dup1"
+echo same > "$TMP/tree/b/dup1"
+echo other stuff > "$TMP/tree/a/dup2"
+echo other stuff > "$TMP/tree/b/dup2"
+
+# The cache won't keep files changed in the second a run starts.
+sleep 2
+
+"$BIN/snapper" -p "$TMP/tree" -s p -H -c '%p %S %h' --hash-cache "$TMP/cache" \
+	-o "$TMP/first.snap" > /dev/null 2>&1 || exit 1
+"$BIN/snapdupes" -c "$TMP/cache" "$TMP/first.snap" > /dev/null || exit 1
+"$BIN/snapper" -p "$TMP/tree" -s p -H -c '%p %S %h' --hash-cache "$TMP/cache" \
+	-o "$TMP/second.snap" > "$TMP/log" 2>&1 || exit 1
+
+if ! grep -q "Hash cache: 10 hits, 0 misses" "$TMP/log"; then
+	echo "snapper missed the cache after snapdupes used it:"
+	grep "Hash cache" "$TMP/log"
+	exit 1
+fi
+
+echo "hashcache_dupes: ok"
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# shard_merge.sh
+# snapper
+#
+# Scans a small tree whole, and again as shards, and checks that snapmerge
+# puts the shards back together into exactly the whole scan.  The columns
+# include the raw type (%T) and the selected flag (%e), which have to be
+# read back as they were written for that to work.
+#
+# Usage:
+#		tests/shard_merge.sh [directory with the programs]
+#
+
+BIN=${1:-.}
+COLUMNS='%p %S %M %o %g %P %T %e %i %d'
+SHARDS=3
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/shard_merge.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# Directories a few levels deep, files, a symlink and a FIFO.
+for d in a a/b a/b/c d d/e f g h; do
+	mkdir -p "$TMP/tree/$d"
+	echo "$d" > "$TMP/tree/$d/file"
+	echo "$d$d" > "$TMP/tree/$d/other"
+done
+ln -s a/file "$TMP/tree/link"
+mkfifo "$TMP/tree/fifo"
+
+"$BIN/snapper" -q -p "$TMP/tree" -s p -H -c "$COLUMNS" -o "$TMP/full.snap" ||
+	exit 1
+
+i=0
+while [ $i -lt $SHARDS ]; do
+	"$BIN/snapper" -q -p "$TMP/tree" -s p -H -c "$COLUMNS" \
+		--shard $i/$SHARDS -o "$TMP/shard$i.snap" || exit 1
+	i=$((i + 1))
+done
+
+"$BIN/snapmerge" -o "$TMP/merged.snap" "$TMP"/shard*.snap || exit 1
+
+if ! cmp -s "$TMP/full.snap" "$TMP/merged.snap"; then
+	echo "shard_merge: the merged shards differ from the whole scan:"
+	diff "$TMP/full.snap" "$TMP/merged.snap"
+	exit 1
+fi
+
+echo "shard_merge: ok"
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# snapdiff_type.sh
+# snapper
+#
+# Diffs two scans of a small tree that only have the raw type (%T), not the
+# type letter, with a file changed in between.  snapdiff has to tell the
+# directories from the mode for two things: only the changed file is
+# reported (not the directories above it, whose tree hashes changed too),
+# and the untouched directories' subtrees are skipped.
+#
+# Usage:
+#		tests/snapdiff_type.sh [directory with the programs]
+#
+
+BIN=${1:-.}
+COLUMNS='%p %S %T %o %g %r'
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/snapdiff_type.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+for d in a a/b a/b/c d d/e; do
+	mkdir -p "$TMP/tree/$d"
+	echo "$d" > "$TMP/tree/$d/file"
+done
+
+"$BIN/snapper" -q -p "$TMP/tree" -s p -H -c "$COLUMNS" -o "$TMP/old.snap" ||
+	exit 1
+echo changed > "$TMP/tree/a/b/c/file"
+"$BIN/snapper" -q -p "$TMP/tree" -s p -H -c "$COLUMNS" -o "$TMP/new.snap" ||
+	exit 1
+
+"$BIN/snapdiff" -v "$TMP/old.snap" "$TMP/new.snap" > "$TMP/diff" \
+	2> "$TMP/log" || exit 1
+
+if [ "$(cat "$TMP/diff")" != "$(printf 'M\t%s' "$TMP/tree/a/b/c/file")" ]; then
+	echo "snapdiff_type: expected only a/b/c/file to differ, got:"
+	cat "$TMP/diff"
+	exit 1
+fi
+
+# d holds d/file, d/e and d/e/file, on each side.
+if ! grep -q "skipped 6 in identical subtrees" "$TMP/log"; then
+	echo "snapdiff_type: expected d's subtree to be skipped:"
+	cat "$TMP/log"
+	exit 1
+fi
+
+echo "snapdiff_type: ok"
@@ -0,0 +1,256 @@
+/*
+ *  trace.c
+ *  snapper
+ *
+ *  Per-thread span tracing.  See trace.h.
+ *
+ *  The trace is a JSON object whose traceEvents are a thread_name metadata
+ *  event per thread, then a complete ("X") event per span, with times in
+ *  microseconds from when tracing started.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "stats.h"
+#include "trace.h"
+#include "util_macros.h"
+
+#pragma mark Globals
+int trace_enabled = 0;
+
+// Set up by init_trace().
+static uint64_t trace_origin;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_thread_t **trace_threads = NULL;	// Protected by the
+static int trace_thread_count = 0;						// lock
+static int trace_thread_capacity = 0;
+
+// The calling thread's buffer, once it has one.
+static __thread struct trace_thread_t *this_thread = NULL;
+
+#pragma mark Local Prototypes
+static struct trace_thread_t *add_thread(const char *name);
+static void write_string(FILE *file, const char *string);
+
+#pragma mark Function Implementations
+void init_trace(void)
+{
+	trace_origin = monotonic_ns();
+	trace_enabled = 1;
+}
+
+void trace_thread(const char *name)
+{
+	if (!trace_enabled)
+	{
+		return;
+	}
+
+	if (this_thread)
+	{
+		this_thread->name = name;
+	}
+	else
+	{
+		this_thread = add_thread(name);
+	}
+}
+
+void trace_span(const char *name, const char *detail, uint64_t start,
+				uint64_t end)
+{
+	struct trace_event_t *event;
+	size_t len, from;
+
+	if (!trace_enabled)
+	{
+		return;
+	}
+
+	if (this_thread == NULL)
+	{
+		this_thread = add_thread("thread");
+	}
+
+	event = &(this_thread->events[this_thread->recorded % TRACE_EVENTS]);
+	this_thread->recorded++;
+
+	event->name = name;
+	event->start = start;
+	event->duration = (end > start) ? end - start : 0;
+
+	// Paths differ at the end, so that's the part to keep.
+	if (detail == NULL)
+	{
+		event->detail[0] = '\0';
+	}
+	else if ((len = strlen(detail)) < TRACE_DETAIL)
+	{
+		memcpy(event->detail, detail, len + 1);
+	}
+	else
+	{
+		// Without starting in the middle of a UTF-8 character.
+		for (from = len - (TRACE_DETAIL - 1);
+			 (detail[from] & 0xC0) == 0x80; from++)
+			;
+		memcpy(event->detail, detail + from, len - from + 1);
+	}
+}
+
+long long trace_write(const char *path)
+{
+	struct trace_thread_t *thread;
+	struct trace_event_t *event;
+	uint64_t first, i;
+	long long dropped = 0;
+	long pid = (long) getpid();
+	FILE *file;
+	int t, failed;
+
+	if ((file = fopen(path, "w")) == NULL)
+	{
+		LogError("Couldn't write trace to %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %ld, "
+			"\"args\": {\"name\": \"snapper\"}}", pid);
+
+	for (t = 0; t < trace_thread_count; t++)
+	{
+		thread = trace_threads[t];
+		fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+				"\"pid\": %ld, \"tid\": %d, \"args\": {\"name\": ", pid,
+				thread->tid);
+		write_string(file, thread->name);
+		fprintf(file, "}}");
+
+		first = (thread->recorded > TRACE_EVENTS) ?
+			thread->recorded - TRACE_EVENTS : 0;
+		dropped += first;
+
+		for (i = first; i < thread->recorded; i++)
+		{
+			event = &(thread->events[i % TRACE_EVENTS]);
+			fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %ld, "
+					"\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f", event->name,
+					pid, thread->tid,
+					(event->start - trace_origin) / 1e3,
+					event->duration / 1e3);
+			if (event->detail[0])
+			{
+				fprintf(file, ", \"args\": {\"path\": ");
+				write_string(file, event->detail);
+				fprintf(file, "}");
+			}
+			fprintf(file, "}");
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+
+	pthread_mutex_unlock(&trace_lock);
+
+	failed = ferror(file);
+	if (fclose(file) == EOF || failed)
+	{
+		LogError("Couldn't write trace to %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return dropped;
+}
+
+void free_trace(void)
+{
+	int t;
+
+	pthread_mutex_lock(&trace_lock);
+
+	trace_enabled = 0;
+	for (t = 0; t < trace_thread_count; t++)
+	{
+		free(trace_threads[t]->events);
+		free(trace_threads[t]);
+	}
+	if (trace_threads)
+	{
+		free(trace_threads);
+	}
+	trace_threads = NULL;
+	trace_thread_count = trace_thread_capacity = 0;
+
+	pthread_mutex_unlock(&trace_lock);
+
+	// Only this thread's can be forgotten; the others are done.
+	this_thread = NULL;
+}
+
+#pragma mark Local Functions
+static struct trace_thread_t *add_thread(const char *name)
+{
+	struct trace_thread_t *thread;
+
+	CREATE(thread, sizeof(struct trace_thread_t));
+	CREATE(thread->events, TRACE_EVENTS * sizeof(struct trace_event_t));
+	thread->name = name;
+
+	pthread_mutex_lock(&trace_lock);
+
+	if (trace_thread_count == trace_thread_capacity)
+	{
+		trace_thread_capacity = MAX(trace_thread_capacity * 2, 8);
+		if (trace_threads)
+		{
+			RECREATE(trace_threads, trace_thread_capacity *
+					 sizeof(struct trace_thread_t *));
+		}
+		else
+		{
+			CREATE(trace_threads, trace_thread_capacity *
+				   sizeof(struct trace_thread_t *));
+		}
+	}
+	thread->tid = trace_thread_count + 1;
+	trace_threads[trace_thread_count++] = thread;
+
+	pthread_mutex_unlock(&trace_lock);
+
+	return thread;
+}
+
+// Writes a JSON string, quoted and escaped.
+static void write_string(FILE *file, const char *string)
+{
+	const unsigned char *c;
+
+	fputc('"', file);
+	for (c = (const unsigned char *) string; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			fprintf(file, "\\%c", *c);
+		}
+		else if (*c < 0x20)
+		{
+			fprintf(file, "\\u%04x", *c);
+		}
+		else
+		{
+			fputc(*c, file);
+		}
+	}
+	fputc('"', file);
+}
@@ -0,0 +1,77 @@
+/*
+ *  trace.h
+ *  snapper
+ *
+ *  Timelines of what each thread was doing: spans (a name, a start and a
+ *  duration, and maybe a path) recorded into a ring buffer per thread, and
+ *  written out at the end in Chrome's trace-event format, for
+ *  chrome://tracing or Perfetto.  A thread only ever writes to its own
+ *  buffer, so there's no locking past the first span.  A full buffer keeps
+ *  the latest spans.
+ *
+ *  Tracing is off until init_trace(), and until then each span costs a
+ *  check of trace_enabled.
+ *
+ *  Requires stats.h.
+ *
+ */
+
+#include <stdint.h>
+
+#pragma mark Tunables
+// Spans each thread keeps.
+#define TRACE_EVENTS		32768
+// Bytes of a span's path kept (the end of it, if it's longer).
+#define TRACE_DETAIL		48
+
+#pragma mark Data Types
+struct trace_event_t {
+	const char	*name;				// Static; what the span was
+	uint64_t	start;				// ns, on the monotonic clock
+	uint64_t	duration;			// ns
+	char		detail[TRACE_DETAIL];	// What it was done to, or ""
+};
+
+struct trace_thread_t {
+	const char	*name;				// What the thread is
+	int			tid;				// Its number in the trace
+	struct trace_event_t *events;	// TRACE_EVENTS of them, as a ring
+	uint64_t	recorded;			// Spans ever recorded
+};
+
+extern int trace_enabled;
+
+#pragma mark Timing
+// For timing a span:
+//
+//		uint64_t start = TRACE_START();
+//		qsort(...);
+//		TRACE_END("sort", NULL, start);
+#define TRACE_START()	(trace_enabled ? monotonic_ns() : 0)
+#define TRACE_END(name, detail, start)									\
+	do {																\
+		if (trace_enabled)												\
+			trace_span((name), (detail), (start), monotonic_ns());		\
+	} while (0)
+
+#pragma mark Functions
+
+// Turns tracing on.  Before any threads that are to be traced start.
+void init_trace(void);
+
+// Names the calling thread in the trace.  Threads that don't are named
+// "thread".
+void trace_thread(const char *name);
+
+// Records a span of the calling thread, from start to end (ns).  name must
+// be static; detail (which may be NULL) is copied.
+void trace_span(const char *name, const char *detail, uint64_t start,
+				uint64_t end);
+
+// Writes every thread's spans to path.  Only once the traced threads are
+// done, or idle.  Returns how many spans the full buffers had dropped, or -1
+// if it couldn't be written.
+long long trace_write(const char *path);
+
+// Frees the buffers, and turns tracing off.
+void free_trace(void);